@@ -45,12 +45,98 @@ void buffer_delete_callback(char *data, void *the_vector) {
   delete reinterpret_cast<vector<char> *>(the_vector);
 }
 
-Bundle::Bundle(const std::string& fileName,
-               BundleOpenMode     mode) {
+// open options from a js object: numeric fields named as in
+// BundleOpenOptions, lockMode is "Shared" or "Exclusive", pathsMode is
+// "Eager", "Lazy" or "Background"
+bool optionsFromArg(Local<Value>val, BundleOpenOptions& options) {
+  auto isolate = Isolate::GetCurrent();
+  auto context = isolate->GetCurrentContext();
+
+  if (!val->IsObject()) {
+    return false;
+  }
+  Local<Object> obj = To<Object>(val).ToLocalChecked();
+
+  auto number = [&](const char *name, double& dst) -> bool {
+                  Local<Value> item;
+
+                  if (!Nan::Get(obj, Nan::New(name).ToLocalChecked()).ToLocal(&item)
+                      || item->IsUndefined()) {
+                    return true;
+                  }
+
+                  if (!item->IsNumber() && !item->IsBoolean()) {
+                    return false;
+                  }
+                  dst = item->IsBoolean() ? (item->BooleanValue(isolate) ? 1 : 0)
+                        : item->NumberValue(context).FromJust();
+                  return true;
+                };
+
+  double pageCacheSize    = static_cast<double>(options.pageCacheSize);
+  double headersCount     = options.headersCount;
+  double cryptoBufferSize = static_cast<double>(options.cryptoBufferSize);
+  double blockCacheSize   = static_cast<double>(options.blockCacheSize);
+  double cryptoThreads    = options.cryptoThreads;
+  double cryptoThreshold  = static_cast<double>(options.cryptoThreshold);
+  double cryptoStreaming  = options.cryptoStreaming;
+
+  if (!number("pageCacheSize", pageCacheSize)
+      || !number("headersCount", headersCount)
+      || !number("cryptoBufferSize", cryptoBufferSize)
+      || !number("blockCacheSize", blockCacheSize)
+      || !number("cryptoThreads", cryptoThreads)
+      || !number("cryptoThreshold", cryptoThreshold)
+      || !number("cryptoStreaming", cryptoStreaming)) {
+    return false;
+  }
+
+  options.pageCacheSize    = static_cast<int64_t>(pageCacheSize);
+  options.headersCount     = static_cast<int>(headersCount);
+  options.cryptoBufferSize = static_cast<int64_t>(cryptoBufferSize);
+  options.blockCacheSize   = static_cast<int64_t>(blockCacheSize);
+  options.cryptoThreads    = static_cast<int>(cryptoThreads);
+  options.cryptoThreshold  = static_cast<int64_t>(cryptoThreshold);
+  options.cryptoStreaming  = static_cast<int>(cryptoStreaming);
+
+  Local<Value> lock;
+
+  if (Nan::Get(obj, Nan::New("lockMode").ToLocalChecked()).ToLocal(&lock) && lock->IsString()) {
+    string m = *String::Utf8Value(isolate, Local<String>::Cast(lock));
+
+    if (m.compare("Exclusive") == 0) {
+      options.lockMode = BUNDLE_LOCK_EXCLUSIVE;
+    } else if (m.compare("Shared") == 0) {
+      options.lockMode = BUNDLE_LOCK_SHARED;
+    } else {
+      return false;
+    }
+  }
+
+  Local<Value> paths;
+
+  if (Nan::Get(obj, Nan::New("pathsMode").ToLocalChecked()).ToLocal(&paths) && paths->IsString()) {
+    string m = *String::Utf8Value(isolate, Local<String>::Cast(paths));
+
+    if (m.compare("Eager") == 0) {
+      options.pathsMode = BUNDLE_PATHS_EAGER;
+    } else if (m.compare("Lazy") == 0) {
+      options.pathsMode = BUNDLE_PATHS_LAZY;
+    } else if (m.compare("Background") == 0) {
+      options.pathsMode = BUNDLE_PATHS_BACKGROUND;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+Bundle::Bundle(const std::string      & fileName,
+               const BundleOpenOptions& options) {
   unsigned char dirKey[] = { 0x5C, 0xE5, 0xA2, 0x83, 0x10, 0xDA, 0x4F, 0x8F,
                              0x82, 0xAF, 0x61, 0xDD, 0x64, 0x74, 0x50, 0x85 };
 
-  _bundle = BundleOpen(fileName.c_str(), mode);
+  _bundle = BundleOpenEx(fileName.c_str(), &options);
 
 
   BundleInitialize(_bundle, dirKey, sizeof(dirKey));
@@ -75,9 +161,16 @@ NAN_MODULE_INIT(Bundle::Init) {
   SetPrototypeMethod(tpl, "FileAttributeSet", FileAttributeSet);
   SetPrototypeMethod(tpl, "FileNames",        FileNames);
   SetPrototypeMethod(tpl, "FileOpen",         FileOpen);
+  SetPrototypeMethod(tpl, "FilesCreate",      FilesCreate);
+  SetPrototypeMethod(tpl, "ImportDirectory",  ImportDirectory);
+  SetPrototypeMethod(tpl, "Extract",          Extract);
+  SetPrototypeMethod(tpl, "Compact",          Compact);
+  SetPrototypeMethod(tpl, "SpaceStats",       SpaceStats);
+  SetPrototypeMethod(tpl, "AutoCompactSet",   AutoCompactSet);
   SetPrototypeMethod(tpl, "FileSeek",         FileSeek);
   SetPrototypeMethod(tpl, "FileLength",       FileLength);
   SetPrototypeMethod(tpl, "FileRead",         FileRead);
+  SetPrototypeMethod(tpl, "FileReadAt",       FileReadAt);
   SetPrototypeMethod(tpl, "FileWrite",        FileWrite);
   SetPrototypeMethod(tpl, "FileDelete",       FileDelete);
   SetPrototypeMethod(tpl, "Close",            Close);
@@ -87,12 +180,13 @@ NAN_MODULE_INIT(Bundle::Init) {
 }
 
 NAN_METHOD(Bundle::New) {
-  if (info.Length() != 2) {
+  if ((info.Length() != 2) && (info.Length() != 3)) {
     ThrowTypeError("Wrong number of arguments");
     return;
   }
 
-  if (!info[0]->IsString() || !info[1]->IsArray()) {
+  if (!info[0]->IsString() || !info[1]->IsArray()
+      || ((info.Length() == 3) && !info[2]->IsObject() && !info[2]->IsUndefined())) {
     ThrowTypeError("Wrong arguments type");
     return;
   }
@@ -121,10 +215,27 @@ NAN_METHOD(Bundle::New) {
       if (m.compare("OpenAlways") == 0) {
         bmode |= BMODE_OPEN_ALWAYS;
       }
+
+      if (m.compare("Mapped") == 0) {
+        bmode |= BMODE_MAPPED;
+      }
+
+      if (m.compare("Positional") == 0) {
+        bmode |= BMODE_POSITIONAL;
+      }
+    }
+
+    // open options
+    BundleOpenOptions options;
+    BundleOpenOptionsInit(&options, bmode);
+
+    if ((info.Length() == 3) && info[2]->IsObject() && !optionsFromArg(info[2], options)) {
+      ThrowTypeError("Wrong options");
+      return;
     }
 
     // Invoked as constructor: `new Bundle(...)`
-    Bundle *obj = new Bundle(fileName, static_cast<BundleOpenMode>(bmode));
+    Bundle *obj = new Bundle(fileName, options);
 
     if (obj->_bundle == nullptr) {
       ThrowReferenceError("Failed to create or open bundle");
@@ -133,12 +244,12 @@ NAN_METHOD(Bundle::New) {
     obj->Wrap(info.This());
     info.GetReturnValue().Set(info.This());
   } else {
-    const int       argc       = 2;
-    Local<Value>    argv[argc] = { info[0], info[1] };
+    const int       argc       = 3;
+    Local<Value>    argv[argc] = { info[0], info[1], info[2] };
     Local<Function> cons       = Nan::New(constructor());
 
     Local<Object> instance;
-    CHECKED(cons->NewInstance(context, argc, argv).ToLocal(&instance));
+    CHECKED(cons->NewInstance(context, info.Length(), argv).ToLocal(&instance));
     info.GetReturnValue().Set(instance);
   }
 }
@@ -148,9 +259,10 @@ BundleWorker::BundleWorker(Callback          *callback,
                            BundlePtr          bundlePtr,
                            int                fileIdx,
                            std::vector<char> *buffer,
-                           std::string        param)
+                           std::string        param,
+                           int64_t            position)
   : AsyncWorker(callback), _operation(operation), _bundle(bundlePtr),
-  _fileIdx(fileIdx), _buffer(buffer), _param(param) {}
+  _fileIdx(fileIdx), _buffer(buffer), _param(param), _position(position) {}
 
 void BundleWorker::Execute()
 {
@@ -185,6 +297,11 @@ void BundleWorker::Execute()
       write = false;
       break;
 
+    case OpFileReadAt:
+      total = BundleFileReadAt(_bundle, _fileIdx, _position, _buffer->data(), 0, &total, nullptr);
+      write = false;
+      break;
+
     case OpFileWrite:
       total = BundleFileWrite(_bundle, _fileIdx, _buffer->data(), 0,
                               static_cast<int64_t>(_buffer->size()), nullptr);
@@ -192,7 +309,10 @@ void BundleWorker::Execute()
     }
 
     if (!write) {
-      if ((total > 0) && (static_cast<size_t>(total) < _buffer->size())) {
+      // nothing read (e.g. past the end of file) gives an empty buffer
+      if (total < 0) {
+        SetErrorMessage("Failed to read content");
+      } else if (static_cast<size_t>(total) < _buffer->size()) {
         _buffer->resize(static_cast<size_t>(total));
       }
     } else {
@@ -212,7 +332,8 @@ void BundleWorker::HandleOKCallback()
 
   if ((_operation == OpAttributeGet) ||
       (_operation == OpFileAttributeGet) ||
-      (_operation == OpFileRead)) {
+      (_operation == OpFileRead) ||
+      (_operation == OpFileReadAt)) {
     auto result = NewBuffer(_buffer->data(), _buffer->size(), buffer_delete_callback, _buffer);
     argv[1] = result.ToLocalChecked();
     callback->Call(2, argv, async_resource);
@@ -221,6 +342,75 @@ void BundleWorker::HandleOKCallback()
   }
 }
 
+ImportWorker::ImportWorker(Callback                 *callback,
+                           BundlePtr                 bundlePtr,
+                           std::string               rootPath,
+                           std::string               prefix,
+                           const BundleImportOptions& options)
+  : AsyncWorker(callback), _bundle(bundlePtr), _rootPath(rootPath), _prefix(prefix),
+  _options(options) {}
+
+void ImportWorker::Execute()
+{
+  // the prefix lives in the worker, so the pointer is set on this thread
+  _options.prefix = _prefix.c_str();
+  _imported       = BundleImportDirectory(_bundle, _rootPath.c_str(), &_options);
+
+  if (_imported < 0) {
+    SetErrorMessage("Failed to import directory");
+  }
+}
+
+void ImportWorker::HandleOKCallback()
+{
+  Local<Value> argv[2] = { Undefined(), Nan::New<Number>(static_cast<double>(_imported)) };
+
+  callback->Call(2, argv, async_resource);
+}
+
+ExtractWorker::ExtractWorker(Callback                  *callback,
+                             BundlePtr                  bundlePtr,
+                             std::string                destDir,
+                             const BundleExtractOptions& options)
+  : AsyncWorker(callback), _bundle(bundlePtr), _destDir(destDir), _options(options) {}
+
+void ExtractWorker::Execute()
+{
+  _extracted = BundleExtract(_bundle, _destDir.c_str(), &_options);
+
+  if (_extracted < 0) {
+    SetErrorMessage("Failed to extract bundle");
+  }
+}
+
+void ExtractWorker::HandleOKCallback()
+{
+  Local<Value> argv[2] = { Undefined(), Nan::New<Number>(static_cast<double>(_extracted)) };
+
+  callback->Call(2, argv, async_resource);
+}
+
+CompactWorker::CompactWorker(Callback                   *callback,
+                             BundlePtr                   bundlePtr,
+                             const BundleCompactOptions& options)
+  : AsyncWorker(callback), _bundle(bundlePtr), _options(options) {}
+
+void CompactWorker::Execute()
+{
+  _reclaimed = BundleCompact(_bundle, &_options);
+
+  if (_reclaimed < 0) {
+    SetErrorMessage("Failed to compact bundle");
+  }
+}
+
+void CompactWorker::HandleOKCallback()
+{
+  Local<Value> argv[2] = { Undefined(), Nan::New<Number>(static_cast<double>(_reclaimed)) };
+
+  callback->Call(2, argv, async_resource);
+}
+
 NAN_METHOD(Bundle::AttributeGet) {
   if ((info.Length() != 2) || !info[0]->IsString() || !info[1]->IsFunction()) {
     ThrowTypeError("Wrong arguments");
@@ -354,6 +544,220 @@ NAN_METHOD(Bundle::FileOpen) {
   info.GetReturnValue().Set(Nan::New<Int32>(idx));
 }
 
+NAN_METHOD(Bundle::FilesCreate) {
+  if ((info.Length() != 1) || !info[0]->IsArray()) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  auto isolate = Isolate::GetCurrent();
+
+  Bundle       *obj   = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  Local<Array>  names = Local<Array>::Cast(info[0]);
+  uint32_t      count = names->Length();
+  vector<string>       files(count);
+  vector<const char *> ptrs(count);
+  vector<int>          indexes(count, -1);
+
+  for (uint32_t i = 0; i < count; i++) {
+    Local<Value> item;
+
+    if (!Nan::Get(names, i).ToLocal(&item) || !item->IsString()) {
+      ThrowTypeError("Wrong arguments");
+      return;
+    }
+    files[i] = *String::Utf8Value(isolate, To<String>(item).ToLocalChecked());
+    ptrs[i]  = files[i].c_str();
+  }
+
+  if (count > 0) {
+    BundleFilesCreate(obj->_bundle, &ptrs[0], static_cast<int>(count), &indexes[0]);
+  }
+
+  Local<Array> result = Nan::New<Array>(count);
+
+  for (uint32_t i = 0; i < count; i++) {
+    Nan::Set(result, i, Nan::New<Int32>(indexes[i]));
+  }
+  info.GetReturnValue().Set(result);
+}
+
+NAN_METHOD(Bundle::ImportDirectory) {
+  if ((info.Length() != 3) || !info[0]->IsString()
+      || (!info[1]->IsObject() && !info[1]->IsUndefined()) || !info[2]->IsFunction()) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  auto isolate = Isolate::GetCurrent();
+  auto context = isolate->GetCurrentContext();
+
+  Bundle *obj      = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  string  rootPath = *String::Utf8Value(isolate, To<String>(info[0]).ToLocalChecked());
+  string  prefix;
+  BundleImportOptions options;
+
+  BundleImportOptionsInit(&options);
+
+  if (info[1]->IsObject()) {
+    Local<Object> opts = To<Object>(info[1]).ToLocalChecked();
+    Local<Value>  item;
+
+    if (Nan::Get(opts, Nan::New("prefix").ToLocalChecked()).ToLocal(&item) && item->IsString()) {
+      prefix = *String::Utf8Value(isolate, Local<String>::Cast(item));
+    }
+
+    if (Nan::Get(opts, Nan::New("threads").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.threads = static_cast<int>(item->NumberValue(context).FromJust());
+    }
+
+    if (Nan::Get(opts, Nan::New("chunkSize").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.chunkSize = static_cast<int64_t>(item->NumberValue(context).FromJust());
+    }
+
+    if (Nan::Get(opts, Nan::New("queueSize").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.queueSize = static_cast<int64_t>(item->NumberValue(context).FromJust());
+    }
+  }
+
+  AsyncQueueWorker(new ImportWorker(new Callback(info[2].As<Function>()), obj->_bundle,
+                                    rootPath, prefix, options));
+}
+
+NAN_METHOD(Bundle::Extract) {
+  if ((info.Length() != 3) || !info[0]->IsString()
+      || (!info[1]->IsObject() && !info[1]->IsUndefined()) || !info[2]->IsFunction()) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  auto isolate = Isolate::GetCurrent();
+  auto context = isolate->GetCurrentContext();
+
+  Bundle *obj     = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  string  destDir = *String::Utf8Value(isolate, To<String>(info[0]).ToLocalChecked());
+  BundleExtractOptions options;
+
+  BundleExtractOptionsInit(&options);
+
+  if (info[1]->IsObject()) {
+    Local<Object> opts = To<Object>(info[1]).ToLocalChecked();
+    Local<Value>  item;
+
+    if (Nan::Get(opts, Nan::New("threads").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.threads = static_cast<int>(item->NumberValue(context).FromJust());
+    }
+
+    if (Nan::Get(opts, Nan::New("runSize").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.runSize = static_cast<int64_t>(item->NumberValue(context).FromJust());
+    }
+
+    if (Nan::Get(opts, Nan::New("queueSize").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+      options.queueSize = static_cast<int64_t>(item->NumberValue(context).FromJust());
+    }
+  }
+
+  AsyncQueueWorker(new ExtractWorker(new Callback(info[2].As<Function>()), obj->_bundle,
+                                     destDir, options));
+}
+
+// reads { stepSize, bytesPerSecond, maxBytes } into the compaction options
+static void CompactOptionsGet(Local<Value> value, BundleCompactOptions& options) {
+  auto isolate = Isolate::GetCurrent();
+  auto context = isolate->GetCurrentContext();
+
+  BundleCompactOptionsInit(&options);
+
+  if (!value->IsObject()) {
+    return;
+  }
+
+  Local<Object> opts = To<Object>(value).ToLocalChecked();
+  Local<Value>  item;
+
+  if (Nan::Get(opts, Nan::New("stepSize").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+    options.stepSize = static_cast<int64_t>(item->NumberValue(context).FromJust());
+  }
+
+  if (Nan::Get(opts, Nan::New("bytesPerSecond").ToLocalChecked()).ToLocal(&item)
+      && item->IsNumber()) {
+    options.bytesPerSecond = static_cast<int64_t>(item->NumberValue(context).FromJust());
+  }
+
+  if (Nan::Get(opts, Nan::New("maxBytes").ToLocalChecked()).ToLocal(&item) && item->IsNumber()) {
+    options.maxBytes = static_cast<int64_t>(item->NumberValue(context).FromJust());
+  }
+}
+
+NAN_METHOD(Bundle::Compact) {
+  if ((info.Length() != 2) || (!info[0]->IsObject() && !info[0]->IsUndefined())
+      || !info[1]->IsFunction()) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  Bundle *obj = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  BundleCompactOptions options;
+
+  CompactOptionsGet(info[0], options);
+
+  AsyncQueueWorker(new CompactWorker(new Callback(info[1].As<Function>()), obj->_bundle,
+                                     options));
+}
+
+NAN_METHOD(Bundle::SpaceStats) {
+  if (info.Length() != 0) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  Bundle *obj = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  int64_t size = 0;
+  int64_t live = 0;
+  int64_t dead = 0;
+  int64_t tail = 0;
+
+  if (!BundleSpaceStats(obj->_bundle, &size, &live, &dead, &tail)) {
+    ThrowError("Failed to get bundle stats");
+    return;
+  }
+
+  Local<Object> result = Nan::New<Object>();
+  Nan::Set(result, Nan::New("size").ToLocalChecked(), Nan::New<Number>(static_cast<double>(size)));
+  Nan::Set(result, Nan::New("liveBytes").ToLocalChecked(),
+           Nan::New<Number>(static_cast<double>(live)));
+  Nan::Set(result, Nan::New("deadBytes").ToLocalChecked(),
+           Nan::New<Number>(static_cast<double>(dead)));
+  Nan::Set(result, Nan::New("tailBytes").ToLocalChecked(),
+           Nan::New<Number>(static_cast<double>(tail)));
+  info.GetReturnValue().Set(result);
+}
+
+NAN_METHOD(Bundle::AutoCompactSet) {
+  if ((info.Length() != 3) || !info[0]->IsNumber() || !info[1]->IsNumber()
+      || (!info[2]->IsObject() && !info[2]->IsUndefined())) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  auto isolate = Isolate::GetCurrent();
+  auto context = isolate->GetCurrentContext();
+
+  Bundle *obj = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  BundleCompactOptions options;
+  double deadRatio    = 0;
+  double minDeadBytes = 0;
+
+  CHECKED(info[0]->NumberValue(context).To(&deadRatio));
+  CHECKED(info[1]->NumberValue(context).To(&minDeadBytes));
+  CompactOptionsGet(info[2], options);
+
+  if (!BundleAutoCompactSet(obj->_bundle, deadRatio, static_cast<int64_t>(minDeadBytes),
+                            &options)) {
+    ThrowError("Failed to set auto compaction");
+  }
+}
+
 NAN_METHOD(Bundle::FileSeek) {
   if ((info.Length() != 3) || !info[0]->IsInt32() || !info[1]->IsNumber() || !info[2]->IsString()) {
     ThrowTypeError("Wrong arguments");
@@ -432,6 +836,37 @@ NAN_METHOD(Bundle::FileRead) {
                                     BundleWorker::OpFileRead, obj->_bundle, fileIdx, dst));
 }
 
+NAN_METHOD(Bundle::FileReadAt) {
+  if ((info.Length() != 4) || !info[0]->IsInt32() || !info[1]->IsNumber() || !info[2]->IsNumber() ||
+      !info[3]->IsFunction()) {
+    ThrowTypeError("Wrong arguments");
+    return;
+  }
+
+  auto isolate = Isolate::GetCurrent();
+  auto context = Context::New(isolate);
+
+  Bundle *obj      = ObjectWrap::Unwrap<Bundle>(info.Holder());
+  int     fileIdx  = 0;
+  double  position = 0.0;
+  double  total    = 0.0;
+
+  CHECKED(info[0]->Int32Value(context).To(&fileIdx));
+  CHECKED(info[1]->NumberValue(context).To(&position));
+  CHECKED(info[2]->NumberValue(context).To(&total));
+
+  if ((position < 0) || (total < 0)) {
+    ThrowTypeError("Bad position or length");
+    return;
+  }
+
+  auto dst = new vector<char>(static_cast<size_t>(total));
+
+  AsyncQueueWorker(new BundleWorker(new Callback(info[3].As<Function>()),
+                                    BundleWorker::OpFileReadAt, obj->_bundle, fileIdx, dst, "",
+                                    static_cast<int64_t>(position)));
+}
+
 NAN_METHOD(Bundle::FileWrite) {
   if ((info.Length() != 3) || !info[0]->IsInt32() || !info[2]->IsFunction()) {
     ThrowTypeError("Wrong arguments");
@@ -14,6 +14,7 @@ public:
     OpFileAttributeGet,
     OpFileAttributeSet,
     OpFileRead,
+    OpFileReadAt,
     OpFileWrite
   };
 
@@ -22,7 +23,8 @@ public:
                         BundlePtr          bundlePtr,
                         int                fileIdx,
                         std::vector<char> *buffer,
-                        std::string        param = "");
+                        std::string        param    = "",
+                        int64_t            position = 0);
   virtual ~BundleWorker() {}
 
 private:
@@ -40,6 +42,73 @@ private:
   int _fileIdx;
   std::vector<char> *_buffer = nullptr;
   std::string _param;
+  int64_t _position = 0;
+};
+
+// imports a directory tree on the libuv pool, the result is the number of
+// imported files
+class ImportWorker : public AsyncWorker {
+public:
+
+  explicit ImportWorker(Callback                 *callback,
+                        BundlePtr                 bundlePtr,
+                        std::string               rootPath,
+                        std::string               prefix,
+                        const BundleImportOptions& options);
+  virtual ~ImportWorker() {}
+
+private:
+
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+  BundlePtr _bundle = nullptr;
+  std::string _rootPath;
+  std::string _prefix;
+  BundleImportOptions _options;
+  int64_t _imported = 0;
+};
+
+// extracts all files of the bundle into a directory on the libuv pool, the
+// result is the number of extracted files
+class ExtractWorker : public AsyncWorker {
+public:
+
+  explicit ExtractWorker(Callback                  *callback,
+                         BundlePtr                  bundlePtr,
+                         std::string                destDir,
+                         const BundleExtractOptions& options);
+  virtual ~ExtractWorker() {}
+
+private:
+
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+  BundlePtr _bundle = nullptr;
+  std::string _destDir;
+  BundleExtractOptions _options;
+  int64_t _extracted = 0;
+};
+
+// compacts the bundle on the libuv pool while it stays open, the result is
+// the number of bytes the bundle shrank by
+class CompactWorker : public AsyncWorker {
+public:
+
+  explicit CompactWorker(Callback                   *callback,
+                         BundlePtr                   bundlePtr,
+                         const BundleCompactOptions& options);
+  virtual ~CompactWorker() {}
+
+private:
+
+  virtual void Execute();
+  virtual void HandleOKCallback();
+
+  BundlePtr _bundle = nullptr;
+  BundleCompactOptions _options;
+  int64_t _reclaimed = 0;
 };
 
 class Bundle : public node::ObjectWrap {
@@ -49,10 +118,17 @@ public:
 
 private:
 
-  explicit Bundle(const std::string& fileName,
-                  BundleOpenMode     mode);
+  explicit Bundle(const std::string      & fileName,
+                  const BundleOpenOptions& options);
   virtual ~Bundle();
 
+  /**
+   * @param fileName
+   * @param modes {"Read", "Write", "OpenAlways", "Mapped", "Positional"}
+   * @param options optional BundleOpenOptions fields
+   * @example
+   *   var bundle = new Bundle("file.bundle", ["Read"], { pageCacheSize: 4194304 });
+   */
   static NAN_METHOD(New);
 
   /**
@@ -99,6 +175,60 @@ private:
    */
   static NAN_METHOD(FileOpen);
 
+  /**
+   * @param fileNames
+   * @example
+   *   var fileIndexes = bundle.FilesCreate(["a.dat", "b.dat"]);
+   */
+  static NAN_METHOD(FilesCreate);
+
+  /**
+   * Imports all files of a directory tree: files are read by a pool of
+   * threads and written one after another by a single writer
+   * @param rootPath
+   * @param options optional { prefix, threads, chunkSize, queueSize }
+   * @example
+   *   bundle.ImportDirectory("/data/assets", { prefix: "assets/" }, callback);
+   */
+  static NAN_METHOD(ImportDirectory);
+
+  /**
+   * Extracts all files into a directory: data is read in the order it lies
+   * in the bundle and written by a pool of threads
+   * @param destDir
+   * @param options optional { threads, runSize, queueSize }
+   * @example
+   *   bundle.Extract("/data/out", { threads: 4 }, callback);
+   */
+  static NAN_METHOD(Extract);
+
+  /**
+   * Compacts the bundle in small steps without closing it: blocks from the
+   * end of the bundle are moved into free space closer to the start and the
+   * free tail is cut off
+   * @param options optional { stepSize, bytesPerSecond, maxBytes }
+   * @example
+   *   bundle.Compact({ bytesPerSecond: 10 * 1024 * 1024 }, callback);
+   */
+  static NAN_METHOD(Compact);
+
+  /**
+   * Space accounting of the bundle
+   * @example
+   *   var stats = bundle.SpaceStats(); // { size, liveBytes, deadBytes, tailBytes }
+   */
+  static NAN_METHOD(SpaceStats);
+
+  /**
+   * Compacts the bundle in a background thread when dead space crosses a threshold
+   * @param deadRatio share of dead space to start at, 0 disables
+   * @param minDeadBytes growth of dead space since the last run, 0 for the default
+   * @param options optional { stepSize, bytesPerSecond, maxBytes }
+   * @example
+   *   bundle.AutoCompactSet(0.25, 0, { bytesPerSecond: 10 * 1024 * 1024 });
+   */
+  static NAN_METHOD(AutoCompactSet);
+
   /**
    * @param fileIndex
    * @param offset
@@ -123,6 +253,17 @@ private:
    */
   static NAN_METHOD(FileRead);
 
+  /**
+   * Reads from the given position without moving the file cursor, so several
+   * ranges of one file can be read in parallel
+   * @param fileIndex
+   * @param position
+   * @param length
+   * @example
+   *   bundle.FileReadAt(100, 1048576, 65536, callback);
+   */
+  static NAN_METHOD(FileReadAt);
+
   /**
    * @param fileIndex
    * @param buffer
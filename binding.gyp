@@ -8,8 +8,16 @@
             ],
             "sources":		[
         	"bundles/lib/BundleFile.cpp",
+                "bundles/lib/BundleFileHandle.cpp",
+                "bundles/lib/BundleCrypto.cpp",
+                "bundles/lib/BundleBlockCache.cpp",
+                "bundles/lib/BundlePathIndex.cpp",
+                "bundles/lib/BundleImport.cpp",
+                "bundles/lib/BundleExtract.cpp",
                 "bundles/lib/BundlesLibrary.cpp",
                 "bundles/lib/streams/BinaryFile.cpp",
+                "bundles/lib/streams/MappedFile.cpp",
+                "bundles/lib/streams/PositionalFile.cpp",
                 "bundles/mbedtls-2.4.0/library/aes.c",
                 "bundles/mbedtls-2.4.0/library/aesni.c",
                 "bundles/mbedtls-2.4.0/library/padlock.c"
@@ -4,6 +4,8 @@ DEFINES += QTFRAMEWORK
 
 SUBDIRS += \
     lib \
-    ut
+    ut \
+    bench
 
-ut.depends  = lib
+ut.depends    = lib
+bench.depends = lib
@@ -0,0 +1,636 @@
+#include "BundleBench.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <thread>
+#include <vector>
+#ifdef _MSC_VER
+# include <direct.h>
+#else // ifdef _MSC_VER
+# include <sys/stat.h>
+# include <unistd.h>
+#endif // ifdef _MSC_VER
+#include "../lib/BundlesLibrary.h"
+#include "../lib/BundleCrypto.h"
+#include "../lib/BundlePathIndex.h"
+#include "../lib/BundleFileHDRs.h"
+
+// число и размер файлов тестового бандла
+#define BENCH_FILES_COUNT 64
+#define BENCH_FILE_SIZE   (1024 * 1024)
+
+// размер буфера и файла для замеров шифрования
+#define BENCH_AES_SIZE (64 * 1024 * 1024)
+
+static unsigned char benchKey[] =
+{ 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+  0x11 };
+
+// имя тестового файла
+static std::string BenchFileName(int i) {
+  return "bench/file" + std::to_string(i) + ".dat";
+}
+
+// создание тестового бандла: четные файлы шифрованные, нечетные - нет
+static bool BenchCreate(const BundleBenchOptions& options) {
+  std::vector<char> data(BENCH_FILE_SIZE);
+  bool ok = true;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  remove(options.path.c_str());
+
+  void *bundle = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+
+  if ((bundle == nullptr) || !BundleInitialize(bundle, benchKey, sizeof(benchKey))) {
+    BundleClose(bundle);
+    return false;
+  }
+
+  CryptoCtx ctx = BundleCreateCryptoContext(benchKey, sizeof(benchKey));
+
+  for (int i = 0; ok && (i < BENCH_FILES_COUNT); i++) {
+    int idx = BundleFileOpen(bundle, BenchFileName(i).c_str(), true);
+
+    ok = (idx > 0)
+         && (BundleFileWrite(bundle, idx, &data[0], 0, data.size(),
+                             (i % 2) == 0 ? ctx : nullptr) == (int64_t)data.size());
+  }
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+
+  // вернем результат
+  return ok;
+}
+
+// один замер: threads потоков читают свои файлы заданное время. возвращает
+// число прочитанных байт в секунду
+static double BenchReadPass(void *bundle, const std::vector<int>& idx, CryptoCtx ctx,
+                            bool encrypted, int threadsCount, int seconds) {
+  std::atomic<bool>    stop(false);
+  std::atomic<int64_t> total(0);
+  std::vector<std::thread> threads;
+
+  auto start = std::chrono::steady_clock::now();
+
+  // файлы нужного вида (четные шифрованные, нечетные - нет)
+  std::vector<int> files;
+
+  for (int i = encrypted ? 0 : 1; i < (int)idx.size(); i += 2) {
+    files.push_back(idx[i]);
+  }
+
+  for (int t = 0; t < threadsCount; t++) {
+    threads.push_back(std::thread([&, t]() {
+      std::vector<char> buffer(BENCH_FILE_SIZE);
+      int64_t read = 0;
+
+      // каждый поток читает только свои файлы (курсор у файла общий)
+      for (size_t i = t % files.size(); !stop; ) {
+        int64_t len = BENCH_FILE_SIZE;
+
+        BundleFileSeek(bundle, files[i], 0, BUNDLE_FILE_ORIG_SET);
+        read += BundleFileRead(bundle, files[i], &buffer[0], 0, &len,
+                               encrypted ? ctx : nullptr);
+
+        i += threadsCount;
+
+        if (i >= files.size()) {
+          i = t % files.size();
+        }
+      }
+      total += read;
+    }));
+  }
+
+  std::this_thread::sleep_for(std::chrono::seconds(seconds));
+  stop = true;
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  // вернем результат
+  return total / elapsed.count();
+}
+
+// пропускная способность параллельного чтения
+void BenchConcurrentRead(const BundleBenchOptions& options) {
+  // подготовим бандл
+  if (!BenchCreate(options)) {
+    printf("failed to create bundle %s\n", options.path.c_str());
+    return;
+  }
+
+  void *bundle = BundleOpen(options.path.c_str(), BMODE_READ | options.mode);
+
+  if ((bundle == nullptr) || !BundleInitialize(bundle, benchKey, sizeof(benchKey))) {
+    printf("failed to open bundle %s\n", options.path.c_str());
+    BundleClose(bundle);
+    return;
+  }
+
+  CryptoCtx ctx = BundleCreateCryptoContext(benchKey, sizeof(benchKey));
+  std::vector<int> idx(BENCH_FILES_COUNT);
+
+  for (int i = 0; i < BENCH_FILES_COUNT; i++) {
+    idx[i] = BundleFileOpen(bundle, BenchFileName(i).c_str(), false);
+  }
+
+  // замеры для 1, 2, 4 ... потоков
+  printf("%-8s %14s %8s %14s %8s\n", "threads", "plain MB/s", "scale", "aes MB/s", "scale");
+
+  double plainBase = 0;
+  double aesBase   = 0;
+
+  // больше потоков, чем файлов одного вида, не берем - иначе потоки
+  // делили бы курсор файла
+  int maxThreads = std::min(options.maxThreads, BENCH_FILES_COUNT / 2);
+
+  for (int threads = 1; threads <= maxThreads; threads *= 2) {
+    double plain = BenchReadPass(bundle, idx, ctx, false, threads, options.seconds);
+    double aes   = BenchReadPass(bundle, idx, ctx, true, threads, options.seconds);
+
+    if (threads == 1) {
+      plainBase = plain;
+      aesBase   = aes;
+    }
+
+    printf("%-8d %14.1f %7.2fx %14.1f %7.2fx\n", threads,
+           plain / (1024 * 1024), plainBase > 0 ? plain / plainBase : 0,
+           aes / (1024 * 1024),   aesBase > 0 ? aes / aesBase : 0);
+  }
+
+  // кэш заголовков блоков
+  uint64_t hits   = 0;
+  uint64_t misses = 0;
+  int64_t  memory = 0;
+
+  if (BundleBlocksCacheStats(bundle, &hits, &misses, &memory) && (hits + misses > 0)) {
+    printf("block cache: %.1f%% hits, %.1f KB\n",
+           100.0 * hits / (hits + misses), memory / 1024.0);
+  }
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(options.path.c_str());
+}
+
+// скорость (байт в секунду) функции, многократно вызываемой заданное время
+template<typename F>
+static double BenchRate(int64_t bytes, int seconds, F func) {
+  int64_t total = 0;
+  auto    start = std::chrono::steady_clock::now();
+  std::chrono::duration<double> elapsed(0);
+
+  do {
+    func();
+    total  += bytes;
+    elapsed = std::chrono::steady_clock::now() - start;
+  } while (elapsed.count() < seconds);
+
+  // вернем результат
+  return total / elapsed.count();
+}
+
+// скорость шифрования AES-ECB
+void BenchAesThroughput(const BundleBenchOptions& options) {
+  std::vector<unsigned char> data(BENCH_AES_SIZE);
+  AesContext *ctx = (AesContext *)BundleCreateCryptoContext(benchKey, sizeof(benchKey));
+
+  if (ctx == nullptr) {
+    printf("failed to create crypto context\n");
+    return;
+  }
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  printf("AES-NI: %s\n", BundleAesNiSupported() ? "yes" : "no");
+  printf("%-28s %12s %12s %8s\n", "", "block GB/s", "bulk GB/s", "speedup");
+
+  const double gb = 1024.0 * 1024.0 * 1024.0;
+
+  // чистое шифрование в памяти
+  for (int mode = MBEDTLS_AES_DECRYPT; mode <= MBEDTLS_AES_ENCRYPT; mode++) {
+    mbedtls_aes_context *aes = mode == MBEDTLS_AES_ENCRYPT ? &ctx->ctxEnc : &ctx->ctxDec;
+    double block = BenchRate(data.size(), options.seconds, [&]() {
+      BundleAesEcbPerBlock(aes, mode, &data[0], data.size());
+    });
+    double bulk = BenchRate(data.size(), options.seconds, [&]() {
+      BundleAesEcb(aes, mode, &data[0], data.size());
+    });
+
+    printf("%-28s %12.2f %12.2f %7.2fx\n",
+           mode == MBEDTLS_AES_ENCRYPT ? "memory encrypt" : "memory decrypt",
+           block / gb, bulk / gb, block > 0 ? bulk / block : 0);
+  }
+
+  // большой зашифрованный файл в бандле
+  remove(options.path.c_str());
+
+  void *bundle = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS
+                            | options.mode);
+  int   idx    = -1;
+
+  if ((bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey))) {
+    idx = BundleFileOpen(bundle, "bench/large.dat", true);
+
+    if ((idx <= 0)
+        || (BundleFileWrite(bundle, idx, &data[0], 0, data.size(),
+                            ctx) != (int64_t)data.size())) {
+      idx = -1;
+    }
+  }
+
+  if (idx <= 0) {
+    printf("failed to create bundle %s\n", options.path.c_str());
+  } else {
+    // было: чтение шифротекста и поблочная расшифровка
+    double block = BenchRate(data.size(), options.seconds, [&]() {
+      int64_t len = data.size();
+
+      BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+      BundleFileRead(bundle, idx, &data[0], 0, &len, nullptr);
+      BundleAesEcbPerBlock(&ctx->ctxDec, MBEDTLS_AES_DECRYPT, &data[0], (size_t)len);
+    });
+
+    // стало: чтение библиотекой с пакетной расшифровкой
+    double bulk = BenchRate(data.size(), options.seconds, [&]() {
+      int64_t len = data.size();
+
+      BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+      BundleFileRead(bundle, idx, &data[0], 0, &len, ctx);
+    });
+
+    printf("%-28s %12.2f %12.2f %7.2fx\n", "encrypted file read",
+           block / gb, bulk / gb, block > 0 ? bulk / block : 0);
+
+    // потоковое чтение: расшифровка в фоне параллельно с чтением
+    BundleCryptoStreamingSet(bundle, 1);
+
+    double stream = BenchRate(data.size(), options.seconds, [&]() {
+      int64_t len = data.size();
+
+      BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+      BundleFileRead(bundle, idx, &data[0], 0, &len, ctx);
+    });
+
+    printf("%-28s %12.2f %12.2f %7.2fx\n", "encrypted file read, stream",
+           block / gb, stream / gb, block > 0 ? stream / block : 0);
+    BundleCryptoStreamingSet(bundle, 0);
+
+    // пакетная расшифровка в пуле потоков
+    for (int threads = 1; threads < options.maxThreads; threads *= 2) {
+      char name[64];
+      snprintf(name, sizeof(name), "encrypted file read, +%d thr", threads);
+      BundleCryptoThreadsSet(bundle, threads, 0);
+
+      double pool = BenchRate(data.size(), options.seconds, [&]() {
+        int64_t len = data.size();
+
+        BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+        BundleFileRead(bundle, idx, &data[0], 0, &len, ctx);
+      });
+
+      printf("%-28s %12.2f %12.2f %7.2fx\n", name,
+             block / gb, pool / gb, block > 0 ? pool / block : 0);
+    }
+  }
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(options.path.c_str());
+}
+
+// результат замеров, чтобы компилятор не выбросил поиск
+static volatile size_t benchSink;
+
+// путь с длинным общим префиксом, как у распакованных изданий
+static std::string BenchPath(int i) {
+  return "content/OEBPS/volumes/volume_" + std::to_string(i / 10000) + "/chapters/chapter_"
+         + std::to_string(i / 100 % 100) + "/page_" + std::to_string(i) + ".xhtml";
+}
+
+// поиск по пути
+void BenchPathIndex(const BundleBenchOptions& options) {
+  printf("%-10s %16s %16s %8s\n", "paths", "map lookups/s", "hash lookups/s", "speedup");
+
+  for (int count = 100000; count <= 1000000; count *= 10) {
+    std::vector<std::string> paths(count);
+    std::map<std::string, size_t> map;
+    CBundlePathIndex index;
+
+    for (int i = 0; i < count; i++) {
+      paths[i]      = BenchPath(i);
+      map[paths[i]] = i;
+      index.Set(paths[i].data(), paths[i].size(), i);
+    }
+
+    // пути в случайном порядке (как C-строки, как приходят в FileOpen)
+    std::vector<const char *> order(count);
+
+    for (int i = 0; i < count; i++) {
+      order[i] = paths[rand() % count].c_str();
+    }
+
+    size_t found = 0;
+    double mapRate = BenchRate(count, options.seconds, [&]() {
+      for (int i = 0; i < count; i++) {
+        found += map.find(order[i])->second;
+      }
+    });
+    double hashRate = BenchRate(count, options.seconds, [&]() {
+      for (int i = 0; i < count; i++) {
+        size_t value = 0;
+        index.Find(order[i], strlen(order[i]), value);
+        found += value;
+      }
+    });
+
+    benchSink = found;
+    printf("%-10d %16.0f %16.0f %7.2fx\n", count, mapRate, hashRate,
+           mapRate > 0 ? hashRate / mapRate : 0);
+  }
+
+  // FileOpen в бандле
+  const int files = 100000;
+  void *bundle    = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+
+  if ((bundle == nullptr) || !BundleInitialize(bundle, benchKey, sizeof(benchKey))) {
+    printf("failed to create bundle %s\n", options.path.c_str());
+    BundleClose(bundle);
+    return;
+  }
+
+  std::vector<std::string> paths(files);
+  std::vector<const char *> names(files);
+  std::vector<int> indices(files);
+
+  for (int i = 0; i < files; i++) {
+    paths[i] = BenchPath(i);
+    names[i] = paths[i].c_str();
+  }
+
+  // создание по одному и пачкой
+  auto start = std::chrono::steady_clock::now();
+
+  for (int i = 0; i < files; i++) {
+    BundleFileOpen(bundle, names[i], true);
+  }
+  BundleClose(bundle);
+  std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+
+  auto batchPath = options.path + ".batch";
+  remove(batchPath.c_str());
+  start  = std::chrono::steady_clock::now();
+  bundle = BundleOpen(batchPath.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  BundleInitialize(bundle, benchKey, sizeof(benchKey));
+  BundleFilesCreate(bundle, &names[0], files, &indices[0]);
+  BundleClose(bundle);
+  std::chrono::duration<double> batch = std::chrono::steady_clock::now() - start;
+  remove(batchPath.c_str());
+
+  printf("create %d files: FileOpen %.2f s, FilesCreate %.2f s\n", files, single.count(),
+         batch.count());
+
+  // открытие с расшифровкой путей и поиск
+  start  = std::chrono::steady_clock::now();
+  bundle = BundleOpen(options.path.c_str(), BMODE_READ | options.mode);
+  BundleInitialize(bundle, benchKey, sizeof(benchKey));
+  std::chrono::duration<double> opened = std::chrono::steady_clock::now() - start;
+
+  double rate = BenchRate(files, options.seconds, [&]() {
+    for (int i = 0; i < files; i++) {
+      BundleFileOpen(bundle, paths[rand() % files].c_str(), false);
+    }
+  });
+
+  printf("bundle with %d files: open %.2f s, FileOpen %.0f/s\n", files, opened.count(), rate);
+
+  BundleClose(bundle);
+
+  // отложенная расшифровка путей: время до первого найденного файла
+  BundleOpenOptions lazy;
+  int64_t resolved = 0;
+
+  BundleOpenOptionsInit(&lazy, BMODE_READ | options.mode);
+  lazy.pathsMode = BUNDLE_PATHS_LAZY;
+
+  start  = std::chrono::steady_clock::now();
+  bundle = BundleOpenEx(options.path.c_str(), &lazy);
+  BundleInitialize(bundle, benchKey, sizeof(benchKey));
+  BundleFileOpen(bundle, paths[files / 2].c_str(), false);
+  opened = std::chrono::steady_clock::now() - start;
+  BundlePathsStats(bundle, &resolved, nullptr);
+
+  printf("lazy paths: open and first FileOpen %.4f s, %lld paths decrypted\n", opened.count(),
+         (long long)resolved);
+
+  BundleClose(bundle);
+  remove(options.path.c_str());
+}
+
+// импорт каталога: по файлу (FileOpen, чтение, BundleFileWrite) против
+// BundleImportDirectory, данные шифруются AES-CTR
+void BenchImport(const BundleBenchOptions& options) {
+  const int files = 1000;
+  const int size  = 128 * 1024;
+  std::string root = options.path + ".src";
+  std::vector<char> data(size);
+  bool ok = true;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // исходный каталог
+#ifdef _MSC_VER
+  _mkdir(root.c_str());
+#else // ifdef _MSC_VER
+  mkdir(root.c_str(), 0755);
+#endif // ifdef _MSC_VER
+
+  for (int i = 0; ok && (i < files); i++) {
+    FILE *file = fopen((root + "/file" + std::to_string(i) + ".dat").c_str(), "wb");
+
+    ok = (file != nullptr) && (fwrite(&data[0], 1, data.size(), file) == data.size());
+
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+
+  CryptoCtx ctx = BundleCreateCryptoContext(benchKey, sizeof(benchKey));
+
+  // по одному файлу
+  remove(options.path.c_str());
+  auto  start  = std::chrono::steady_clock::now();
+  void *bundle = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  ok = ok && (bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey));
+
+  for (int i = 0; ok && (i < files); i++) {
+    std::string name = "file" + std::to_string(i) + ".dat";
+    FILE *file = fopen((root + "/" + name).c_str(), "rb");
+    int   idx  = BundleFileOpen(bundle, name.c_str(), true);
+
+    ok = (file != nullptr) && (idx > 0)
+         && (fread(&data[0], 1, data.size(), file) == data.size())
+         && BundleFileCipherSet(bundle, idx, BUNDLE_CIPHER_CTR)
+         && (BundleFileWrite(bundle, idx, &data[0], 0, data.size(), ctx) == (int64_t)data.size());
+
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+  BundleClose(bundle);
+  std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+
+  // конвейером
+  BundleImportOptions import;
+  BundleImportOptionsInit(&import);
+  import.threads   = options.maxThreads;
+  import.cryptoCtx = ctx;
+
+  remove(options.path.c_str());
+  start  = std::chrono::steady_clock::now();
+  bundle = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  ok     = ok && (bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey))
+           && (BundleImportDirectory(bundle, root.c_str(), &import) == files);
+  BundleClose(bundle);
+  std::chrono::duration<double> pipeline = std::chrono::steady_clock::now() - start;
+
+  BundleDestroyCryptoContext(ctx);
+
+  if (ok) {
+    double mb = (double)files * size / (1024 * 1024);
+    printf("import %d files, %.0f MB: per file %.2f s (%.0f MB/s), "
+           "BundleImportDirectory %.2f s (%.0f MB/s)\n", files, mb, single.count(),
+           mb / single.count(), pipeline.count(), mb / pipeline.count());
+  } else {
+    printf("failed to import into bundle %s\n", options.path.c_str());
+  }
+
+  // уберем за собой
+  for (int i = 0; i < files; i++) {
+    remove((root + "/file" + std::to_string(i) + ".dat").c_str());
+  }
+#ifdef _MSC_VER
+  _rmdir(root.c_str());
+#else // ifdef _MSC_VER
+  rmdir(root.c_str());
+#endif // ifdef _MSC_VER
+  remove(options.path.c_str());
+}
+
+// удаление выгруженных файлов и каталога
+static void BenchExtractClean(const std::string& dir, int files) {
+  for (int i = 0; i < files; i++) {
+    remove((dir + "/file" + std::to_string(i) + ".dat").c_str());
+  }
+#ifdef _MSC_VER
+  _rmdir(dir.c_str());
+#else // ifdef _MSC_VER
+  rmdir(dir.c_str());
+#endif // ifdef _MSC_VER
+}
+
+// выгрузка бандла: по файлу (FileOpen, BundleFileRead, запись) против
+// BundleExtract. файлы пишутся в бандл по кусочку по очереди, поэтому их
+// блоки лежат вперемешку, данные шифруются AES-CTR
+void BenchExtract(const BundleBenchOptions& options) {
+  const int files = 1000;
+  const int size  = 128 * 1024;
+  const int piece = 16 * 1024;
+  std::string dest = options.path + ".out";
+  std::vector<char> data(size);
+  std::vector<int>  indices(files);
+  bool ok = true;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  CryptoCtx ctx = BundleCreateCryptoContext(benchKey, sizeof(benchKey));
+
+  remove(options.path.c_str());
+  void *bundle = BundleOpen(options.path.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  ok = (bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey));
+
+  for (int i = 0; ok && (i < files); i++) {
+    indices[i] = BundleFileOpen(bundle, ("file" + std::to_string(i) + ".dat").c_str(), true);
+    ok = (indices[i] > 0) && BundleFileCipherSet(bundle, indices[i], BUNDLE_CIPHER_CTR);
+  }
+
+  for (int pos = 0; ok && (pos < size); pos += piece) {
+    for (int i = 0; ok && (i < files); i++) {
+      ok = BundleFileWrite(bundle, indices[i], &data[0], pos, piece, ctx) == piece;
+    }
+  }
+  BundleClose(bundle);
+
+  // по одному файлу
+  auto start = std::chrono::steady_clock::now();
+  bundle = BundleOpen(options.path.c_str(), BMODE_READ | options.mode);
+  ok     = ok && (bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey));
+#ifdef _MSC_VER
+  _mkdir(dest.c_str());
+#else // ifdef _MSC_VER
+  mkdir(dest.c_str(), 0755);
+#endif // ifdef _MSC_VER
+
+  for (int i = 0; ok && (i < files); i++) {
+    std::string name = "file" + std::to_string(i) + ".dat";
+    int     idx = BundleFileOpen(bundle, name.c_str(), false);
+    int64_t len = size;
+    FILE   *file;
+
+    ok = (idx > 0) && (BundleFileRead(bundle, idx, &data[0], 0, &len, ctx) == size);
+    file = ok ? fopen((dest + "/" + name).c_str(), "wb") : nullptr;
+    ok   = (file != nullptr) && (fwrite(&data[0], 1, data.size(), file) == data.size());
+
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+  BundleClose(bundle);
+  std::chrono::duration<double> single = std::chrono::steady_clock::now() - start;
+  BenchExtractClean(dest, files);
+
+  // по порядку блоков
+  BundleExtractOptions extract;
+  BundleExtractOptionsInit(&extract);
+  extract.threads   = options.maxThreads;
+  extract.cryptoCtx = ctx;
+
+  start  = std::chrono::steady_clock::now();
+  bundle = BundleOpen(options.path.c_str(), BMODE_READ | options.mode);
+  ok     = ok && (bundle != nullptr) && BundleInitialize(bundle, benchKey, sizeof(benchKey))
+           && (BundleExtract(bundle, dest.c_str(), &extract) == files);
+  BundleClose(bundle);
+  std::chrono::duration<double> ordered = std::chrono::steady_clock::now() - start;
+  BenchExtractClean(dest, files);
+
+  BundleDestroyCryptoContext(ctx);
+
+  if (ok) {
+    double mb = (double)files * size / (1024 * 1024);
+    printf("extract %d files, %.0f MB: per file %.2f s (%.0f MB/s), "
+           "BundleExtract %.2f s (%.0f MB/s)\n", files, mb, single.count(),
+           mb / single.count(), ordered.count(), mb / ordered.count());
+  } else {
+    printf("failed to extract bundle %s\n", options.path.c_str());
+  }
+
+  remove(options.path.c_str());
+}
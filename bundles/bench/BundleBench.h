@@ -0,0 +1,33 @@
+#ifndef BUNDLEBENCH_H
+#define BUNDLEBENCH_H
+#include <string>
+
+// параметры замеров
+struct BundleBenchOptions {
+  std::string path;            // путь к временному бандлу
+  int         mode       = 0;  // дополнительные флаги BundleOpen (поток)
+  int         maxThreads = 8;  // максимальное число потоков
+  int         seconds    = 2;  // длительность одного замера
+};
+
+// пропускная способность параллельного чтения бандла в зависимости от
+// числа потоков (открытых и зашифрованных файлов)
+void BenchConcurrentRead(const BundleBenchOptions& options);
+
+// скорость шифрования AES-ECB: поблочный цикл mbedtls против пакетного
+// (AES-NI) на буфере и на чтении большого зашифрованного файла
+void BenchAesThroughput(const BundleBenchOptions& options);
+
+// поиск файла по пути: std::map против хэш-индекса на 10^5 и 10^6 путей и
+// FileOpen в бандле с 10^5 файлов
+void BenchPathIndex(const BundleBenchOptions& options);
+
+// импорт каталога: запись по файлу против конвейера BundleImportDirectory
+// (читающие потоки - maxThreads)
+void BenchImport(const BundleBenchOptions& options);
+
+// выгрузка бандла с файлами, записанными вперемешку: чтение по файлу
+// против BundleExtract (пишущие потоки - maxThreads)
+void BenchExtract(const BundleBenchOptions& options);
+
+#endif // BUNDLEBENCH_H
@@ -0,0 +1,74 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include "BundleBench.h"
+#include "../lib/BundlesLibrary.h"
+
+using namespace std;
+
+// вывод справки
+static void Usage()
+{
+  printf("usage: BundleBench [read|aes|index|import|extract] [-t threads] [-s seconds] "
+         "[-m stdio|positional|mapped] [-p bundle]\n");
+}
+
+int main(int argc, char *argv[])
+{
+  BundleBenchOptions options;
+  string bench = "read";
+
+  options.path = "bench.bundle";
+
+  // разберем параметры
+  for (int i = 1; i < argc; i++) {
+    string arg = argv[i];
+
+    if ((arg == "-t") && (i + 1 < argc)) {
+      options.maxThreads = atoi(argv[++i]);
+    } else if ((arg == "-s") && (i + 1 < argc)) {
+      options.seconds = atoi(argv[++i]);
+    } else if ((arg == "-p") && (i + 1 < argc)) {
+      options.path = argv[++i];
+    } else if ((arg == "-m") && (i + 1 < argc)) {
+      string mode = argv[++i];
+
+      if (mode == "positional") {
+        options.mode = BMODE_POSITIONAL;
+      } else if (mode == "mapped") {
+        options.mode = BMODE_MAPPED;
+      } else if (mode != "stdio") {
+        Usage();
+        return 1;
+      }
+    } else if (arg[0] != '-') {
+      bench = arg;
+    } else {
+      Usage();
+      return 1;
+    }
+  }
+
+  if ((options.maxThreads <= 0) || (options.seconds <= 0)) {
+    Usage();
+    return 1;
+  }
+
+  // запустим замер
+  if (bench == "read") {
+    BenchConcurrentRead(options);
+  } else if (bench == "aes") {
+    BenchAesThroughput(options);
+  } else if (bench == "index") {
+    BenchPathIndex(options);
+  } else if (bench == "import") {
+    BenchImport(options);
+  } else if (bench == "extract") {
+    BenchExtract(options);
+  } else {
+    Usage();
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,190 @@
+#include "BundleBlockCache.h"
+
+#define BUNDLE_BLOCKS_MIN_SLOTS 16 // минимальный размер таблицы
+
+// конструктор
+CBundleBlockCache::CBundleBlockCache(int64_t budget)
+  : m_count(0), m_limit(0), m_hand(0), m_budget(0), m_hits(0), m_misses(0) {
+  BudgetSet(budget);
+}
+
+// смена объема
+void CBundleBlockCache::BudgetSet(int64_t budget) {
+  size_t size = BUNDLE_BLOCKS_MIN_SLOTS;
+
+  m_budget = budget > 0 ? budget : 0;
+
+  // наибольшая таблица, укладывающаяся в объем. заполнение не больше 3/4,
+  // чтобы цепочки пробирования оставались короткими
+  if (m_budget > 0) {
+    while ((int64_t)(size * 2 * (sizeof(Entry) + 1)) <= m_budget) {
+      size *= 2;
+    }
+    m_limit = size / 4 * 3;
+  } else {
+    m_limit = 0;
+  }
+
+  Resize(size);
+}
+
+// поиск
+bool CBundleBlockCache::Find(int64_t pos, BundleBlock& block) {
+  size_t slot = 0;
+
+  if (!Lookup(pos, slot)) {
+    m_misses++;
+    return false;
+  }
+
+  m_hits++;
+  m_referenced[slot] = 1;
+  block              = m_entries[slot].block;
+  return true;
+}
+
+// добавление или замена
+void CBundleBlockCache::Put(int64_t pos, const BundleBlock& block) {
+  size_t slot = 0;
+
+  if (pos <= 0) {
+    return;
+  }
+
+  // замена
+  if (Lookup(pos, slot)) {
+    m_entries[slot].block = block;
+    m_referenced[slot]    = 1;
+    return;
+  }
+
+  // освободим место
+  if (m_limit > 0) {
+    if (m_count >= m_limit) {
+      Evict();
+    }
+  } else if ((m_count + 1) * 4 > m_entries.size() * 3) {
+    Resize(m_entries.size() * 2);
+  }
+
+  // вставим в первую свободную ячейку цепочки
+  for (slot = Home(pos); m_entries[slot].pos != 0; slot = (slot + 1) & (m_entries.size() - 1)) {}
+
+  m_entries[slot].pos   = pos;
+  m_entries[slot].block = block;
+  m_referenced[slot]    = 1;
+  m_count++;
+}
+
+// удаление
+void CBundleBlockCache::Erase(int64_t pos) {
+  size_t slot = 0;
+
+  if (Lookup(pos, slot)) {
+    EraseSlot(slot);
+  }
+}
+
+// очистка
+void CBundleBlockCache::Clear() {
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    m_entries[i].pos = 0;
+    m_referenced[i]  = 0;
+  }
+  m_count = 0;
+  m_hand  = 0;
+}
+
+// начальная ячейка цепочки для смещения
+size_t CBundleBlockCache::Home(int64_t pos) const {
+  uint64_t h = (uint64_t)pos * 0x9E3779B97F4A7C15ULL;
+
+  return (size_t)(h ^ (h >> 32)) & (m_entries.size() - 1);
+}
+
+// поиск ячейки со смещением
+bool CBundleBlockCache::Lookup(int64_t pos, size_t& slot) const {
+  if (pos <= 0) {
+    return false;
+  }
+
+  for (slot = Home(pos); m_entries[slot].pos != 0; slot = (slot + 1) & (m_entries.size() - 1)) {
+    if (m_entries[slot].pos == pos) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// перестроение таблицы заданного размера (записи сохраняются, если
+// помещаются)
+void CBundleBlockCache::Resize(size_t size) {
+  std::vector<Entry> entries(size);
+
+  m_entries.swap(entries);
+  std::vector<uint8_t>(size, 0).swap(m_referenced);
+  m_count = 0;
+  m_hand  = 0;
+
+  for (size_t i = 0; i < entries.size(); i++) {
+    if ((entries[i].pos != 0) && ((m_limit == 0) || (m_count < m_limit))) {
+      Put(entries[i].pos, entries[i].block);
+    }
+  }
+}
+
+// удаление записи со сдвигом следующих записей цепочки назад (без пометок
+// удаления)
+void CBundleBlockCache::EraseSlot(size_t slot) {
+  size_t mask = m_entries.size() - 1;
+  size_t i    = slot;
+  size_t j    = slot;
+
+  for (;;) {
+    j = (j + 1) & mask;
+
+    if (m_entries[j].pos == 0) {
+      break;
+    }
+
+    // запись j можно перенести в i, только если ее начальная ячейка не
+    // лежит между i и j
+    size_t home = Home(m_entries[j].pos);
+
+    if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) {
+      continue;
+    }
+
+    m_entries[i]    = m_entries[j];
+    m_referenced[i] = m_referenced[j];
+    i               = j;
+  }
+
+  m_entries[i].pos = 0;
+  m_referenced[i]  = 0;
+  m_count--;
+}
+
+// вытеснение одной записи: пропускаем записи с флагом обращения, сбрасывая
+// его
+void CBundleBlockCache::Evict() {
+  size_t mask = m_entries.size() - 1;
+
+  if (m_count == 0) {
+    return;
+  }
+
+  for (;; m_hand = (m_hand + 1) & mask) {
+    if (m_entries[m_hand].pos == 0) {
+      continue;
+    }
+
+    if (m_referenced[m_hand] != 0) {
+      m_referenced[m_hand] = 0;
+      continue;
+    }
+
+    EraseSlot(m_hand);
+    return;
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "mbedtls/aes.h"
+#include "BundleFileHDRs.h"
+
+// кэш заголовков блоков: хэш-таблица с открытой адресацией (линейное
+// пробирование), записи хранятся подряд без отдельных узлов. при заданном
+// объеме таблица не растет, вытеснение по алгоритму CLOCK. при нулевом
+// объеме таблица растет без ограничения. класс не потокобезопасный
+class CBundleBlockCache {
+private:
+
+  // запись таблицы (pos = 0 - свободна, блоков по нулевому смещению нет)
+  struct Entry {
+    int64_t     pos = 0;
+    BundleBlock block;
+  };
+
+  std::vector<Entry> m_entries;      // таблица (размер - степень двойки)
+  std::vector<uint8_t> m_referenced; // флаги обращения (для CLOCK)
+  size_t   m_count;                  // число записей
+  size_t   m_limit;                  // максимум записей (0 - без ограничения)
+  size_t   m_hand;                   // стрелка CLOCK
+  int64_t  m_budget;                 // объем памяти (0 - без ограничения)
+  uint64_t m_hits;                   // статистика
+  uint64_t m_misses;
+
+public:
+
+  explicit CBundleBlockCache(int64_t budget = 0);
+
+  // смена объема (кэш очищается)
+  void     BudgetSet(int64_t budget);
+  int64_t  Budget() const {
+    return m_budget;
+  }
+
+  // поиск (учитывается в статистике), добавление/замена и удаление
+  bool     Find(int64_t      pos,
+                BundleBlock& block);
+  void     Put(int64_t            pos,
+               const BundleBlock& block);
+  void     Erase(int64_t pos);
+  void     Clear();
+
+  // число записей, занятая память и статистика попаданий
+  size_t   Count() const {
+    return m_count;
+  }
+
+  size_t   Memory() const {
+    return m_entries.capacity() * sizeof(Entry) + m_referenced.capacity();
+  }
+
+  uint64_t Hits() const {
+    return m_hits;
+  }
+
+  uint64_t Misses() const {
+    return m_misses;
+  }
+
+private:
+
+  size_t   Home(int64_t pos) const;
+  bool     Lookup(int64_t pos,
+                  size_t& slot) const;
+  void     Resize(size_t size);
+  void     EraseSlot(size_t slot);
+  void     Evict();
+};
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <random>
+#include <string.h>
+#include "BundleCrypto.h"
+#include "mbedtls/aesni.h"
+
+// ускоренная ветка возможна только там, где mbedtls сам хранит ключи
+// в формате AES-NI (иначе раундовые ключи расшифрования другие)
+#if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+# define BUNDLE_AESNI
+# include <wmmintrin.h>
+#endif // if defined(MBEDTLS_AESNI_C) && defined(MBEDTLS_HAVE_X86_64)
+
+#define BUNDLE_AES_BLOCK 16 // размер блока AES
+#define BUNDLE_AES_LANES 8  // число блоков за проход
+#define BUNDLE_AES_CTR_BATCH 64 // блоков гаммы за раз для CTR
+
+#ifdef BUNDLE_AESNI
+
+// раунды для 8 блоков: загрузка ключа раунда один раз на все блоки,
+// независимые aesenc/aesdec идут в конвейере процессора
+# define BUNDLE_AES_ROUND8(op, b, k) \
+  b[0] = op(b[0], k); b[1] = op(b[1], k); b[2] = op(b[2], k); b[3] = op(b[3], k); \
+  b[4] = op(b[4], k); b[5] = op(b[5], k); b[6] = op(b[6], k); b[7] = op(b[7], k);
+
+__attribute__((target("aes,sse2")))
+static void AesNiEncrypt(const __m128i *rk, int nr, const unsigned char *src,
+                         unsigned char *dst, size_t blocks) {
+  __m128i b[BUNDLE_AES_LANES];
+  const __m128i *p = (const __m128i *)src;
+  __m128i *q       = (__m128i *)dst;
+
+  // по 8 блоков
+  for (; blocks >= BUNDLE_AES_LANES;
+       blocks -= BUNDLE_AES_LANES, p += BUNDLE_AES_LANES, q += BUNDLE_AES_LANES) {
+    __m128i k = _mm_loadu_si128(rk);
+
+    for (int i = 0; i < BUNDLE_AES_LANES; i++) {
+      b[i] = _mm_xor_si128(_mm_loadu_si128(p + i), k);
+    }
+
+    for (int r = 1; r < nr; r++) {
+      k = _mm_loadu_si128(rk + r);
+      BUNDLE_AES_ROUND8(_mm_aesenc_si128, b, k)
+    }
+    k = _mm_loadu_si128(rk + nr);
+    BUNDLE_AES_ROUND8(_mm_aesenclast_si128, b, k)
+
+    for (int i = 0; i < BUNDLE_AES_LANES; i++) {
+      _mm_storeu_si128(q + i, b[i]);
+    }
+  }
+
+  // остаток по одному
+  for (; blocks > 0; blocks--, p++, q++) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(p), _mm_loadu_si128(rk));
+
+    for (int r = 1; r < nr; r++) {
+      v = _mm_aesenc_si128(v, _mm_loadu_si128(rk + r));
+    }
+    _mm_storeu_si128(q, _mm_aesenclast_si128(v, _mm_loadu_si128(rk + nr)));
+  }
+}
+
+__attribute__((target("aes,sse2")))
+static void AesNiDecrypt(const __m128i *rk, int nr, const unsigned char *src,
+                         unsigned char *dst, size_t blocks) {
+  __m128i b[BUNDLE_AES_LANES];
+  const __m128i *p = (const __m128i *)src;
+  __m128i *q       = (__m128i *)dst;
+
+  // по 8 блоков
+  for (; blocks >= BUNDLE_AES_LANES;
+       blocks -= BUNDLE_AES_LANES, p += BUNDLE_AES_LANES, q += BUNDLE_AES_LANES) {
+    __m128i k = _mm_loadu_si128(rk);
+
+    for (int i = 0; i < BUNDLE_AES_LANES; i++) {
+      b[i] = _mm_xor_si128(_mm_loadu_si128(p + i), k);
+    }
+
+    for (int r = 1; r < nr; r++) {
+      k = _mm_loadu_si128(rk + r);
+      BUNDLE_AES_ROUND8(_mm_aesdec_si128, b, k)
+    }
+    k = _mm_loadu_si128(rk + nr);
+    BUNDLE_AES_ROUND8(_mm_aesdeclast_si128, b, k)
+
+    for (int i = 0; i < BUNDLE_AES_LANES; i++) {
+      _mm_storeu_si128(q + i, b[i]);
+    }
+  }
+
+  // остаток по одному
+  for (; blocks > 0; blocks--, p++, q++) {
+    __m128i v = _mm_xor_si128(_mm_loadu_si128(p), _mm_loadu_si128(rk));
+
+    for (int r = 1; r < nr; r++) {
+      v = _mm_aesdec_si128(v, _mm_loadu_si128(rk + r));
+    }
+    _mm_storeu_si128(q, _mm_aesdeclast_si128(v, _mm_loadu_si128(rk + nr)));
+  }
+}
+
+# undef BUNDLE_AES_ROUND8
+#endif // ifdef BUNDLE_AESNI
+
+// используется ли ускоренная ветка AES-NI
+bool BundleAesNiSupported() {
+#ifdef BUNDLE_AESNI
+  // проверка процессора один раз
+  static const bool supported = mbedtls_aesni_has_support(MBEDTLS_AESNI_AES) != 0;
+
+  return supported;
+#else // ifdef BUNDLE_AESNI
+  return false;
+#endif // ifdef BUNDLE_AESNI
+}
+
+// поблочно через mbedtls
+void BundleAesEcbPerBlock(mbedtls_aes_context *ctx, int mode, unsigned char *data,
+                          size_t size) {
+  for (size_t pos = 0; pos + BUNDLE_AES_BLOCK <= size; pos += BUNDLE_AES_BLOCK) {
+    mbedtls_aes_crypt_ecb(ctx, mode, data + pos, data + pos);
+  }
+}
+
+// шифрование/расшифровка многих блоков из src в dst
+void BundleAesEcb(mbedtls_aes_context *ctx, int mode, const unsigned char *src,
+                  unsigned char *dst, size_t size) {
+  if ((ctx == nullptr) || (src == nullptr) || (dst == nullptr)) {
+    return;
+  }
+
+#ifdef BUNDLE_AESNI
+
+  if (BundleAesNiSupported()) {
+    const __m128i *rk = (const __m128i *)ctx->rk;
+
+    if (mode == MBEDTLS_AES_ENCRYPT) {
+      AesNiEncrypt(rk, ctx->nr, src, dst, size / BUNDLE_AES_BLOCK);
+    } else {
+      AesNiDecrypt(rk, ctx->nr, src, dst, size / BUNDLE_AES_BLOCK);
+    }
+    return;
+  }
+#endif // ifdef BUNDLE_AESNI
+
+  // запасной вариант
+  for (size_t pos = 0; pos + BUNDLE_AES_BLOCK <= size; pos += BUNDLE_AES_BLOCK) {
+    mbedtls_aes_crypt_ecb(ctx, mode, src + pos, dst + pos);
+  }
+}
+
+// шифрование/расшифровка многих блоков на месте
+void BundleAesEcb(mbedtls_aes_context *ctx, int mode, unsigned char *data, size_t size) {
+  BundleAesEcb(ctx, mode, data, data, size);
+}
+
+// запись 64-битного значения в big-endian
+static void CtrPut64(unsigned char *dst, uint64_t value) {
+  for (int i = 7; i >= 0; i--) {
+    dst[i] = (unsigned char)(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+// AES-CTR от логического смещения
+void BundleAesCtr(mbedtls_aes_context *ctx, uint64_t nonce, int64_t offset,
+                  const unsigned char *src, unsigned char *dst, size_t size) {
+  unsigned char stream[BUNDLE_AES_CTR_BATCH * BUNDLE_AES_BLOCK];
+  uint64_t      counter = (uint64_t)offset / BUNDLE_AES_BLOCK;
+  size_t        skip    = (size_t)(offset % BUNDLE_AES_BLOCK);
+  size_t        done    = 0;
+
+  if ((ctx == nullptr) || (src == nullptr) || (dst == nullptr) || (offset < 0)) {
+    return;
+  }
+
+  while (done < size) {
+    size_t blocks = std::min((size_t)BUNDLE_AES_CTR_BATCH,
+                             (skip + size - done + BUNDLE_AES_BLOCK - 1) / BUNDLE_AES_BLOCK);
+
+    // блоки счетчика и гамма из них
+    for (size_t i = 0; i < blocks; i++) {
+      CtrPut64(stream + i * BUNDLE_AES_BLOCK,     nonce);
+      CtrPut64(stream + i * BUNDLE_AES_BLOCK + 8, counter + i);
+    }
+    BundleAesEcb(ctx, MBEDTLS_AES_ENCRYPT, stream, blocks * BUNDLE_AES_BLOCK);
+
+    // наложим гамму (первый блок - с середины)
+    size_t n = std::min(blocks * BUNDLE_AES_BLOCK - skip, size - done);
+    size_t i = 0;
+
+    for (; i + sizeof(uint64_t) <= n; i += sizeof(uint64_t)) {
+      uint64_t a, b;
+      memcpy(&a, src + done + i,  sizeof(a));
+      memcpy(&b, stream + skip + i, sizeof(b));
+      a ^= b;
+      memcpy(dst + done + i, &a, sizeof(a));
+    }
+
+    for (; i < n; i++) {
+      dst[done + i] = src[done + i] ^ stream[skip + i];
+    }
+
+    // сдвинем счетчики
+    done    += n;
+    counter += blocks;
+    skip     = 0;
+  }
+}
+
+// случайный nonce файла для AES-CTR
+uint64_t BundleCtrNonce() {
+  std::random_device random;
+
+  // вернем результат
+  return ((uint64_t)random() << 32) | (uint64_t)random();
+}
+
+// ключевой хэш пути (CBC-MAC). длина в первом блоке делает MAC стойким для
+// сообщений разной длины
+uint16_t BundleNameTag(mbedtls_aes_context *ctx, const char *path, size_t len) {
+  unsigned char state[BUNDLE_AES_BLOCK] = { 'N', 'A', 'M', 'E', 'T', 'A', 'G', 0 };
+  uint64_t size = len;
+
+  for (int i = 0; i < 8; i++) {
+    state[8 + i] = (unsigned char)(size >> (i * 8));
+  }
+  mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, state, state);
+
+  // путь поблочно, последний блок дополнен нулями
+  for (size_t pos = 0; pos < len; pos += BUNDLE_AES_BLOCK) {
+    for (size_t i = 0; (i < BUNDLE_AES_BLOCK) && (pos + i < len); i++) {
+      state[i] ^= (unsigned char)path[pos + i];
+    }
+    mbedtls_aes_crypt_ecb(ctx, MBEDTLS_AES_ENCRYPT, state, state);
+  }
+
+  // вернем результат
+  return (uint16_t)(state[0] | (state[1] << 8));
+}
+
+// конструктор
+CBundleCryptoPool::CBundleCryptoPool(int threads, size_t threshold)
+  : m_threshold(std::max(threshold, (size_t)BUNDLE_CRYPTO_MT_MIN_PART)), m_stop(false) {
+  for (int i = 0; i < threads; i++) {
+    m_threads.push_back(std::thread(&CBundleCryptoPool::Worker, this));
+  }
+}
+
+// деструктор
+CBundleCryptoPool::~CBundleCryptoPool() {
+  {
+    std::lock_guard<std::mutex> locker(m_locker);
+    m_stop = true;
+  }
+  m_queued.notify_all();
+
+  for (size_t i = 0; i < m_threads.size(); i++) {
+    m_threads[i].join();
+  }
+}
+
+// рабочий поток
+void CBundleCryptoPool::Worker() {
+  std::unique_lock<std::mutex> locker(m_locker);
+
+  while (true) {
+    m_queued.wait(locker, [this]() {
+      return m_stop || !m_tasks.empty();
+    });
+
+    if (m_tasks.empty()) {
+      return;
+    }
+
+    // возьмем часть и обработаем без лока
+    Task task = m_tasks.front();
+    m_tasks.pop_front();
+    locker.unlock();
+
+    BundleAesEcb(task.ctx, task.mode, task.src, task.dst, task.size);
+
+    locker.lock();
+
+    if (--*task.remain == 0) {
+      m_done.notify_all();
+    }
+  }
+}
+
+// шифрование/расшифровка на месте
+void CBundleCryptoPool::Process(mbedtls_aes_context *ctx, int mode, unsigned char *data,
+                                size_t size) {
+  Process(ctx, mode, data, data, size);
+}
+
+// шифрование/расшифровка из src в dst
+void CBundleCryptoPool::Process(mbedtls_aes_context *ctx, int mode, const unsigned char *src,
+                                unsigned char *dst, size_t size) {
+  size_t blocks = size / BUNDLE_AES_BLOCK;
+
+  // число частей: по одной на поток и на вызывающего, но не мельче минимума
+  size_t parts = std::min(m_threads.size() + 1,
+                          size / BUNDLE_CRYPTO_MT_MIN_PART);
+
+  if ((size < m_threshold) || (parts < 2)) {
+    BundleAesEcb(ctx, mode, src, dst, size);
+    return;
+  }
+
+  // части кратны блоку AES, последняя - вызывающему потоку
+  size_t partBlocks = (blocks + parts - 1) / parts;
+  size_t partSize   = partBlocks * BUNDLE_AES_BLOCK;
+  size_t pos        = 0;
+  Batch  batch;
+
+  for (; pos + partSize < blocks * BUNDLE_AES_BLOCK; pos += partSize) {
+    Submit(batch, ctx, mode, src + pos, dst + pos, partSize);
+  }
+
+  BundleAesEcb(ctx, mode, src + pos, dst + pos, blocks * BUNDLE_AES_BLOCK - pos);
+
+  // дождемся остальных частей
+  Wait(batch);
+}
+
+// постановка части в очередь
+void CBundleCryptoPool::Submit(Batch& batch, mbedtls_aes_context *ctx, int mode,
+                               const unsigned char *src, unsigned char *dst, size_t size) {
+  {
+    std::lock_guard<std::mutex> locker(m_locker);
+    Task task = { ctx, mode, src, dst, size, &batch.remain };
+
+    m_tasks.push_back(task);
+    batch.remain++;
+  }
+  m_queued.notify_one();
+}
+
+// ожидание завершения группы
+void CBundleCryptoPool::Wait(Batch& batch) {
+  std::unique_lock<std::mutex> locker(m_locker);
+
+  while (batch.remain > 0) {
+    // пока есть очередь - обрабатываем сами
+    if (!m_tasks.empty()) {
+      Task task = m_tasks.front();
+      m_tasks.pop_front();
+      locker.unlock();
+
+      BundleAesEcb(task.ctx, task.mode, task.src, task.dst, task.size);
+
+      locker.lock();
+
+      if (--*task.remain == 0) {
+        m_done.notify_all();
+      }
+      continue;
+    }
+    m_done.wait(locker);
+  }
+}
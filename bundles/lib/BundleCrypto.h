@@ -0,0 +1,140 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mbedtls/aes.h"
+
+#define BUNDLE_CRYPTO_MT_THRESHOLD (512 * 1024) // по умолчанию объем, начиная
+                                                // с которого данные делятся
+                                                // между потоками
+#define BUNDLE_CRYPTO_MT_MIN_PART  (64 * 1024)  // минимальная часть для
+                                                // одного потока
+
+// блочное шифрование AES-ECB сразу для многих блоков (на месте).
+// при наличии AES-NI блоки обрабатываются по 8 за проход, раунды соседних
+// блоков перекрываются. иначе - поблочно через mbedtls.
+// size должен быть кратен размеру блока AES (16), остаток не трогается
+void BundleAesEcb(mbedtls_aes_context *ctx,
+                  int                  mode,
+                  unsigned char       *data,
+                  size_t               size);
+
+// то же, но результат пишется в dst (src не меняется). буферы либо
+// совпадают, либо не пересекаются
+void BundleAesEcb(mbedtls_aes_context *ctx,
+                  int                  mode,
+                  const unsigned char *src,
+                  unsigned char       *dst,
+                  size_t               size);
+
+// то же, но всегда через mbedtls (по одному блоку за вызов)
+void BundleAesEcbPerBlock(mbedtls_aes_context *ctx,
+                          int                  mode,
+                          unsigned char       *data,
+                          size_t               size);
+
+// используется ли ускоренная ветка AES-NI
+bool BundleAesNiSupported();
+
+// AES-CTR с счетчиком от логического смещения: блок счетчика - nonce и номер
+// 16-байтного блока данных (big-endian). src/dst - данные с позиции offset,
+// выравнивание и кратность размера не нужны. шифрование и расшифровка
+// совпадают, используется ключ шифрования
+void BundleAesCtr(mbedtls_aes_context *ctx,
+                  uint64_t             nonce,
+                  int64_t              offset,
+                  const unsigned char *src,
+                  unsigned char       *dst,
+                  size_t               size);
+
+// случайный nonce файла для AES-CTR. выбирается заново при каждой записи
+// файла с нуля и хранится в атрибуте BUNDLE_FILE_NONCE, поэтому переносится
+// вместе с данными
+uint64_t BundleCtrNonce();
+
+// ключевой хэш пути для поиска без расшифровки имен: CBC-MAC на ключе
+// шифрования путей (первый блок - метка и длина пути), усеченный до 16 бит
+uint16_t BundleNameTag(mbedtls_aes_context *ctx,
+                       const char          *path,
+                       size_t               len);
+
+// пул потоков для шифрования больших объемов. ECB не связывает блоки между
+// собой, поэтому буфер делится на части, которые шифруются параллельно
+// (одну часть обрабатывает вызывающий поток). объемы меньше порога
+// шифруются в вызывающем потоке. пул можно использовать из нескольких
+// потоков одновременно
+class CBundleCryptoPool {
+public:
+
+  // группа частей, поставленных в очередь (Submit), для ожидания (Wait)
+  struct Batch {
+    int remain = 0; // число незавершенных частей
+  };
+
+private:
+
+  // часть буфера для одного потока
+  struct Task {
+    mbedtls_aes_context *ctx;
+    int                  mode;
+    const unsigned char *src;
+    unsigned char       *dst;
+    size_t               size;
+    int                 *remain; // счетчик незавершенных частей запроса
+  };
+
+  std::vector<std::thread> m_threads; // рабочие потоки
+  std::deque<Task> m_tasks;           // очередь частей
+  std::mutex m_locker;                // лок очереди и счетчиков
+  std::condition_variable m_queued;   // появилась часть
+  std::condition_variable m_done;     // часть завершена
+  size_t m_threshold;                 // порог распараллеливания
+  bool m_stop;                        // флаг остановки
+
+public:
+
+  CBundleCryptoPool(int    threads,
+                    size_t threshold = BUNDLE_CRYPTO_MT_THRESHOLD);
+  ~CBundleCryptoPool();
+
+  CBundleCryptoPool(const CBundleCryptoPool&)            = delete;
+  CBundleCryptoPool& operator=(const CBundleCryptoPool&) = delete;
+
+  int Threads() const {
+    return (int)m_threads.size();
+  }
+
+  size_t Threshold() const {
+    return m_threshold;
+  }
+
+  // шифрование/расшифровка на месте (как BundleAesEcb)
+  void Process(mbedtls_aes_context *ctx,
+               int                  mode,
+               unsigned char       *data,
+               size_t               size);
+  void Process(mbedtls_aes_context *ctx,
+               int                  mode,
+               const unsigned char *src,
+               unsigned char       *dst,
+               size_t               size);
+
+  // асинхронно: часть ставится в очередь целиком и обрабатывается одним
+  // потоком пула. Wait ждет завершения всех частей группы, помогая их
+  // обрабатывать
+  void Submit(Batch              & batch,
+              mbedtls_aes_context *ctx,
+              int                  mode,
+              const unsigned char *src,
+              unsigned char       *dst,
+              size_t               size);
+  void Wait(Batch& batch);
+
+private:
+
+  void Worker();
+};
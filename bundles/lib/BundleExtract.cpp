@@ -0,0 +1,479 @@
+#include <errno.h>
+#include <string.h>
+#include <algorithm>
+#include <thread>
+#ifdef _MSC_VER
+# include <direct.h>
+#else // ifdef _MSC_VER
+# include <sys/stat.h>
+# include <sys/types.h>
+#endif // ifdef _MSC_VER
+#include "BundlesLibrary.h"
+#include "BundleExtract.h"
+#include "BundleFile.h"
+#include "BundleCrypto.h"
+
+#define BUNDLE_EXTRACT_RUN_SIZE   (8 * 1024 * 1024)  // порция чтения по
+                                                      // умолчанию
+#define BUNDLE_EXTRACT_QUEUE_SIZE (64 * 1024 * 1024) // объем очереди по
+                                                      // умолчанию
+#define BUNDLE_EXTRACT_GAP        (64 * 1024)        // промежуток между
+                                                      // блоками, который
+                                                      // дешевле прочитать,
+                                                      // чем пропустить
+
+// блок данных файла на диске
+struct BundleExtractPiece {
+  size_t  file; // файл (индекс в раскладке)
+  int64_t disk; // смещение данных в бандле
+  int64_t pos;  // логическое смещение в файле
+  int64_t size; // размер
+};
+
+// позиционирование выходного файла (файлы могут быть больше 2 Гб)
+static bool OutputSeek(FILE *file, int64_t pos) {
+#ifdef _MSC_VER
+  return _fseeki64(file, pos, SEEK_SET) == 0;
+#else // ifdef _MSC_VER
+  return fseeko(file, (off_t)pos, SEEK_SET) == 0;
+#endif // ifdef _MSC_VER
+}
+
+// путь файла бандла можно выгрузить, только если он не выходит за каталог
+static bool PathSafe(const std::string& path) {
+  size_t start = 0;
+
+  if (path.empty() || (path[0] == '/')) {
+    return false;
+  }
+
+#ifdef _MSC_VER
+  if (path.find_first_of("\\:") != std::string::npos) {
+    return false;
+  }
+#endif // ifdef _MSC_VER
+
+  // пустые компоненты, "." и ".." не допускаются
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+
+    if (end == std::string::npos) {
+      end = path.size();
+    }
+
+    std::string part = path.substr(start, end - start);
+
+    if (part.empty() || (part == ".") || (part == "..")) {
+      return false;
+    }
+    start = end + 1;
+  }
+  return true;
+}
+
+// конструктор
+CBundleExtract::CBundleExtract(CBundleFile& bundle, AesContext *cryptoCtx, int threads,
+                               int64_t runSize, int64_t queueSize)
+  : m_bundle(bundle), m_cryptoCtx(cryptoCtx), m_threads(threads),
+  m_runSize(runSize > 0 ? (size_t)runSize : BUNDLE_EXTRACT_RUN_SIZE),
+  m_queueSize(queueSize > 0 ? (size_t)queueSize : BUNDLE_EXTRACT_QUEUE_SIZE),
+  m_gen(0), m_buffered(0), m_stop(false) {
+  if (m_threads <= 0) {
+    m_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  }
+
+  // части шифрованных данных должны оставаться кратными блоку AES
+  m_runSize = std::max(m_runSize / AES_BLOCK_SIZE * AES_BLOCK_SIZE, (size_t)AES_BLOCK_SIZE);
+}
+
+// выгрузка
+int64_t CBundleExtract::Run(const char *dest) {
+  std::vector<std::thread> workers;
+  int64_t extracted = 0;
+  bool    ok        = true;
+
+  if ((dest == nullptr) || !m_bundle.FilesLayout(m_files, m_gen)) {
+    return -1;
+  }
+  m_changed.assign(m_files.size(), false);
+
+  // каталоги, пустые файлы и способ выгрузки каждого файла
+  if (!Prepare(dest)) {
+    return -1;
+  }
+
+  // пишущие потоки
+  m_queues.resize((size_t)std::min(m_threads, std::max((int)m_files.size(), 1)));
+
+  for (size_t i = 0; i < m_queues.size(); i++) {
+    workers.emplace_back(&CBundleExtract::Worker, this, i);
+  }
+
+  // читаем по порядку расположения на диске
+  ok = ReadRuns();
+
+  {
+    std::lock_guard<std::mutex> lock(m_locker);
+    m_stop = true;
+  }
+  m_queued.notify_all();
+
+  for (size_t i = 0; i < workers.size(); i++) {
+    workers[i].join();
+  }
+
+  // изменившиеся файлы выгрузим заново по новой раскладке (удаленные - с
+  // ошибкой)
+  for (size_t i = 0; i < m_outputs.size(); i++) {
+    Output& out = m_outputs[i];
+
+    if (!m_changed[i] || out.failed) {
+      continue;
+    }
+
+    if (out.file != nullptr) {
+      fclose(out.file);
+      out.file = nullptr;
+    }
+
+    out.failed = !m_bundle.FileLayout(m_files[i].idx, m_files[i]);
+    out.remain = m_files[i].length;
+    out.slow   = true;
+  }
+
+  // файлы, которые нельзя расшифровать по блокам
+  for (size_t i = 0; i < m_outputs.size(); i++) {
+    if (m_outputs[i].slow && !m_outputs[i].failed) {
+      m_outputs[i].failed = !ExtractSlow(i);
+    }
+  }
+
+  // недописанные (при ошибке чтения) файлы
+  for (size_t i = 0; i < m_outputs.size(); i++) {
+    Output& out = m_outputs[i];
+
+    if (out.file != nullptr) {
+      fclose(out.file);
+      out.file = nullptr;
+    }
+
+    if (out.failed || (out.remain != 0)) {
+      ok = false;
+    } else {
+      extracted++;
+    }
+  }
+
+  return ok ? extracted : -1;
+}
+
+// подготовка: каталоги, пустые файлы, nonce и проверка выравнивания
+bool CBundleExtract::Prepare(const std::string& dest) {
+  std::string root = dest;
+
+  // каталог назначения
+  while ((root.size() > 1) && (root.back() == '/')) {
+    root.pop_back();
+  }
+
+  if (!MakeDirs(root + "/")) {
+    return false;
+  }
+
+  m_outputs.resize(m_files.size());
+
+  for (size_t i = 0; i < m_files.size(); i++) {
+    const BundleFileLayout& file = m_files[i];
+    Output& out = m_outputs[i];
+    bool    enc = (m_cryptoCtx != nullptr)
+                  && ((file.flags & (BUNDLE_FILE_FLAG_ENC_ATTR0 << BUNDLE_FILE_DATA)) != 0);
+
+    // небезопасные пути пропускаем
+    if (!PathSafe(file.path)) {
+      out.failed = true;
+      continue;
+    }
+
+    out.path   = root + "/" + file.path;
+    out.remain = file.length;
+
+    if (!MakeDirs(out.path)) {
+      out.failed = true;
+      continue;
+    }
+
+    // пустой файл создадим сразу
+    if (file.length == 0) {
+      FILE *empty = fopen(out.path.c_str(), "wb");
+
+      out.failed = empty == nullptr;
+
+      if (empty != nullptr) {
+        fclose(empty);
+      }
+      continue;
+    }
+
+    if (enc && ((file.flags & BUNDLE_FILE_FLAG_CTR) != 0)) {
+      out.nonce = file.nonce;
+    } else if (enc) {
+      // AES-ECB расшифровывается блоками по 16 байт: блок файла, не
+      // выровненный по ним, расшифровать отдельно нельзя
+      for (size_t j = 0; j < file.extents.size(); j++) {
+        if (((file.extents[j].offset % AES_BLOCK_SIZE) != 0)
+            || ((file.extents[j].size % AES_BLOCK_SIZE) != 0)) {
+          out.slow = true;
+          break;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// создание каталогов пути (последний компонент - имя файла)
+bool CBundleExtract::MakeDirs(const std::string& path) {
+  for (size_t end = path.find('/', 1); end != std::string::npos; end = path.find('/', end + 1)) {
+    std::string dir = path.substr(0, end);
+
+    if (m_dirs.count(dir) != 0) {
+      continue;
+    }
+
+#ifdef _MSC_VER
+    int res = _mkdir(dir.c_str());
+#else // ifdef _MSC_VER
+    int res = mkdir(dir.c_str(), 0755);
+#endif // ifdef _MSC_VER
+
+    if ((res != 0) && (errno != EEXIST)) {
+      return false;
+    }
+    m_dirs.insert(dir);
+  }
+  return true;
+}
+
+// чтение блоков всех файлов по возрастанию смещения. соседние блоки
+// читаются одной порцией, каждый блок порции уходит потоку своего файла
+bool CBundleExtract::ReadRuns() {
+  std::vector<BundleExtractPiece> pieces;
+
+  // блоки данных (большие делятся на части не больше порции)
+  for (size_t i = 0; i < m_files.size(); i++) {
+    if (m_outputs[i].failed || m_outputs[i].slow) {
+      continue;
+    }
+
+    for (const BundleExtent& ext : m_files[i].extents) {
+      for (int64_t done = 0; done < ext.size; done += (int64_t)m_runSize) {
+        BundleExtractPiece piece;
+        piece.file = i;
+        piece.disk = ext.block + (int64_t)sizeof(BundleBlock) + done;
+        piece.pos  = ext.offset + done;
+        piece.size = std::min(ext.size - done, (int64_t)m_runSize);
+        pieces.push_back(piece);
+      }
+    }
+  }
+
+  std::sort(pieces.begin(), pieces.end(),
+            [](const BundleExtractPiece& a, const BundleExtractPiece& b) {
+    return a.disk < b.disk;
+  });
+
+  for (size_t first = 0; first < pieces.size();) {
+    // блоки изменившихся файлов уже не их
+    if (m_changed[pieces[first].file]) {
+      first++;
+      continue;
+    }
+
+    int64_t start = pieces[first].disk;
+    int64_t end   = start + pieces[first].size;
+    size_t  last  = first + 1;
+
+    // добавим соседние блоки, пока порция не выросла
+    while ((last < pieces.size())
+           && (pieces[last].disk - end <= BUNDLE_EXTRACT_GAP)
+           && (pieces[last].disk + pieces[last].size - start <= (int64_t)m_runSize)) {
+      if (!m_changed[pieces[last].file]) {
+        end = std::max(end, pieces[last].disk + pieces[last].size);
+      }
+      last++;
+    }
+
+    size_t size = (size_t)(end - start);
+
+    // дождемся места в очереди
+    {
+      std::unique_lock<std::mutex> lock(m_locker);
+      m_space.wait(lock, [&] {
+        return (m_buffered == 0) || (m_buffered + size <= m_queueSize);
+      });
+      m_buffered += size;
+    }
+
+    // буферы порций переиспользуются: новый буфер в 8МБ - это обнуление и
+    // отказы страниц на каждом чтении
+    CBundleBuffer *data = nullptr;
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+
+      if (!m_spare.empty()) {
+        data = m_spare.back().release();
+        m_spare.pop_back();
+      }
+    }
+
+    if (data == nullptr) {
+      data = new CBundleBuffer();
+    }
+    data->resize(size);
+
+    // порция возвращает буфер и место в очереди, когда записана последняя
+    // ее часть
+    std::shared_ptr<CBundleBuffer> buffer(data, [this, size](CBundleBuffer *b) {
+      {
+        std::lock_guard<std::mutex> lock(m_locker);
+        m_spare.emplace_back(b);
+        m_buffered -= size;
+      }
+      m_space.notify_all();
+    });
+
+    size_t read = m_bundle.RawRead(start, buffer->data(), size, m_gen);
+
+    // цепочки изменились: отметим изменившиеся файлы и соберем порцию
+    // заново (без их блоков)
+    if (read == 0) {
+      uint64_t gen = m_gen;
+
+      m_bundle.LayoutChanged(m_files, m_changed, m_gen);
+
+      if (gen != m_gen) {
+        continue;
+      }
+    }
+
+    if (read != size) {
+      return false;
+    }
+
+    // раздадим части потокам
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+
+      for (size_t i = first; i < last; i++) {
+        if (m_changed[pieces[i].file]) {
+          continue;
+        }
+
+        Task task;
+        task.buffer = buffer;
+        task.offset = (size_t)(pieces[i].disk - start);
+        task.size   = (size_t)pieces[i].size;
+        task.file   = pieces[i].file;
+        task.pos    = pieces[i].pos;
+        m_queues[pieces[i].file % m_queues.size()].push_back(std::move(task));
+      }
+    }
+    m_queued.notify_all();
+
+    first = last;
+  }
+  return true;
+}
+
+// выгрузка файла через бандл (чтение по логическим позициям)
+bool CBundleExtract::ExtractSlow(size_t file) {
+  Output& out = m_outputs[file];
+  std::vector<unsigned char> buffer(m_runSize);
+  FILE   *dst = fopen(out.path.c_str(), "wb");
+  bool    ok  = dst != nullptr;
+
+  // открытые данные читаются как есть и при заданном ключе
+  AesContext *crypto =
+    ((m_files[file].flags & (BUNDLE_FILE_FLAG_ENC_ATTR0 << BUNDLE_FILE_DATA)) != 0)
+    ? m_cryptoCtx : nullptr;
+
+  while (ok && (out.remain > 0)) {
+    int64_t len  = (int64_t)buffer.size();
+    int64_t read = m_bundle.FileReadAt(m_files[file].idx, m_files[file].length - out.remain,
+                                       buffer.data(), &len, crypto);
+
+    ok = (read > 0) && (fwrite(buffer.data(), 1, (size_t)read, dst) == (size_t)read);
+
+    if (ok) {
+      out.remain -= std::min(read, out.remain);
+    }
+  }
+
+  if (dst != nullptr) {
+    ok = (fclose(dst) == 0) && ok;
+  }
+  return ok;
+}
+
+// пишущий поток: части файлов, закрепленных за ним
+void CBundleExtract::Worker(size_t worker) {
+  for (;;) {
+    Task task;
+
+    {
+      std::unique_lock<std::mutex> lock(m_locker);
+      m_queued.wait(lock, [&] {
+        return m_stop || !m_queues[worker].empty();
+      });
+
+      if (m_queues[worker].empty()) {
+        return;
+      }
+      task = std::move(m_queues[worker].front());
+      m_queues[worker].pop_front();
+    }
+
+    Process(task);
+
+    // порция освобождается вне лока (ее удаление берет лок)
+    task.buffer.reset();
+  }
+}
+
+// расшифровка и запись части
+void CBundleExtract::Process(Task& task) {
+  Output& out = m_outputs[task.file];
+  const BundleFileLayout& file = m_files[task.file];
+  unsigned char *data = task.buffer->data() + task.offset;
+
+  if (!out.failed) {
+    // расшифруем на месте (части одной порции не пересекаются)
+    if ((m_cryptoCtx != nullptr)
+        && ((file.flags & (BUNDLE_FILE_FLAG_ENC_ATTR0 << BUNDLE_FILE_DATA)) != 0)) {
+      if ((file.flags & BUNDLE_FILE_FLAG_CTR) != 0) {
+        BundleAesCtr(&m_cryptoCtx->ctxEnc, out.nonce, task.pos, data, data, task.size);
+      } else {
+        BundleAesEcb(&m_cryptoCtx->ctxDec, MBEDTLS_AES_DECRYPT, data, task.size);
+      }
+    }
+
+    // файл открывается первой частью и закрывается последней
+    if (out.file == nullptr) {
+      out.file = fopen(out.path.c_str(), "wb");
+    }
+
+    // части файла обычно идут подряд, тогда позиционирование (со сбросом
+    // буфера stdio) не нужно
+    out.failed = (out.file == nullptr)
+                 || ((task.pos != out.pos) && !OutputSeek(out.file, task.pos))
+                 || (fwrite(data, 1, task.size, out.file) != task.size);
+    out.pos = task.pos + (int64_t)task.size;
+  }
+
+  out.remain -= (int64_t)task.size;
+
+  if ((out.remain == 0) && (out.file != nullptr)) {
+    out.failed = (fclose(out.file) != 0) || out.failed;
+    out.file   = nullptr;
+  }
+}
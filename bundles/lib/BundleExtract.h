@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+#include "mbedtls/aes.h"
+#include "BundleFileHDRs.h"
+
+class CBundleFile;
+
+// выгрузка всех файлов бандла в каталог. блоки данных всех файлов
+// сортируются по смещению в бандле и читаются крупными последовательными
+// порциями (соседние блоки - одним чтением) в вызывающем потоке. порции
+// делятся на части по файлам, части расшифровываются и пишутся в выходные
+// файлы пулом потоков. каждый выходной файл обслуживает один поток, поэтому
+// файлы пишутся без блокировок. объем прочитанных, но не записанных данных
+// ограничен. порция читается под блокировкой бандла на чтение и только если
+// цепочки не менялись с раскладки; иначе файлы, цепочки которых изменились
+// (перенесены, обрезаны, дописаны, удалены), пропускаются и после чтения
+// порций выгружаются заново через бандл по новой раскладке
+class CBundleExtract {
+private:
+
+  // часть порции: данные одного блока файла
+  struct Task {
+    std::shared_ptr<CBundleBuffer> buffer; // порция
+    size_t  offset = 0;                    // смещение части в порции
+    size_t  size   = 0;                    // размер части
+    size_t  file   = 0;                    // файл (индекс в m_files)
+    int64_t pos    = 0;                    // логическое смещение в файле
+  };
+
+  // выходной файл (принадлежит одному потоку)
+  struct Output {
+    std::string path;         // путь на диске
+    FILE       *file = nullptr; // открытый файл
+    int64_t     remain = 0;   // сколько данных осталось записать
+    int64_t     pos    = 0;   // текущая позиция записи
+    uint64_t    nonce  = 0;   // nonce для AES-CTR
+    bool        failed = false; // ошибка записи
+    bool        slow   = false; // блоки не выровнены для AES-ECB: файл
+                                // читается через бандл целиком
+  };
+
+  CBundleFile& m_bundle;       // бандл
+  AesContext  *m_cryptoCtx;    // расшифровка данных (nullptr - как хранятся)
+  int          m_threads;      // число пишущих потоков
+  size_t       m_runSize;      // максимальная порция чтения
+  size_t       m_queueSize;    // максимум прочитанных, но не записанных данных
+  CFilesLayout m_files;        // файлы бандла
+  uint64_t     m_gen;          // счетчик изменений цепочек раскладки
+  std::vector<bool> m_changed; // файлы, изменившиеся во время чтения порций
+  std::vector<Output> m_outputs; // выходные файлы (по индексу в m_files)
+  std::set<std::string> m_dirs; // созданные каталоги
+  std::vector<std::deque<Task> > m_queues; // очереди частей по потокам
+  std::vector<std::unique_ptr<CBundleBuffer> > m_spare; // свободные буферы
+                                                       // порций
+  std::mutex m_locker;         // лок очередей
+  std::condition_variable m_queued; // появилась часть
+  std::condition_variable m_space;  // освободилось место
+  size_t m_buffered;           // объем порций в работе
+  bool   m_stop;               // чтение закончено
+
+public:
+
+  CBundleExtract(CBundleFile& bundle,
+                 AesContext  *cryptoCtx,
+                 int          threads,
+                 int64_t      runSize,
+                 int64_t      queueSize);
+
+  CBundleExtract(const CBundleExtract&)            = delete;
+  CBundleExtract& operator=(const CBundleExtract&) = delete;
+
+  // выгрузка в каталог dest (создается при необходимости). пути с ".." и
+  // абсолютные пути не выгружаются. возвращает число выгруженных файлов
+  // или -1 при ошибке (остальные файлы выгружаются)
+  int64_t Run(const char *dest);
+
+private:
+
+  bool    Prepare(const std::string& dest);
+  bool    MakeDirs(const std::string& path);
+  bool    ReadRuns();
+  bool    ExtractSlow(size_t file);
+  void    Worker(size_t worker);
+  void    Process(Task& task);
+};
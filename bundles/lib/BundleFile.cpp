@@ -4,31 +4,48 @@
 #include <map>
 #include <errno.h>
 #include <time.h>
+#include <stdint.h>
 #include <algorithm>
+#include <chrono>
+#include <set>
 
 #include "BundlesLibrary.h"
 #include "BundleFile.h"
+#include "BundleCrypto.h"
 
 // Конструктор
 CBundleFile::CBundleFile(std::shared_ptr<IBinaryStream>bundleStream,
                          int                           emptyHeadersCount)
   : m_bundle(bundleStream), m_initialized(false), m_created(false),
-  m_AesPathContext(nullptr), m_AesBuffer(nullptr),
-  m_emptyHeadersCount(emptyHeadersCount) {
-#ifdef __GNUC__
-  pthread_mutexattr_t attr;
-  pthread_mutexattr_init(&attr);
-  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
-  pthread_mutex_init(&m_locker, &attr);
-#endif // ifdef __GNUC__
+  m_AesPathContext(nullptr), m_AesBufferSize(0), m_AesWindowSize(BUNDLE_CRYPTO_WINDOW),
+  m_cryptoPool(nullptr), m_cryptoThreads(0), m_cryptoThreshold(0), m_cryptoStreaming(false),
+  m_cryptoBufferSize(BUNDLE_CACHE_SIZE),
+  m_freeValid(false), m_freeBytes(0), m_chainsGen(0), m_blocksStored(0),
+  m_emptyHeadersCount(emptyHeadersCount), m_infoNext(0), m_sealed(false),
+  m_pathsMode(BUNDLE_PATHS_EAGER), m_pathsNext(0), m_pathsBusy(0), m_pathsResolved(0),
+  m_pathsStop(false), m_compactRatio(0), m_compactMinDead(0), m_compactStep(0),
+  m_compactRate(0), m_compactMax(0), m_compactBaseline(0), m_compactPending(false),
+  m_compactStop(false) {
   m_filesDesc   = new CFilesDesc;
-  m_filesIdx    = new CFilesIndex;
-  m_blocksCache = new CBundleBlocks;
+  m_filesIdx    = new CBundlePathIndex;
+  m_blocksCache = new CBundleBlockCache(BUNDLE_BLOCKS_CACHE_SIZE);
+  m_freeExtents = new CFreeExtents;
+  m_freeBySize  = new CFreeBySize;
+  m_sealNames   = new CBundleBuffer;
+  m_tagsStart   = new CNameTags;
+  m_tagsItems   = new CNameTags;
+  m_AesBuffers  = new CCryptoBuffers;
 
   // проверим
   m_created = m_bundle != nullptr && m_filesDesc != nullptr
               && m_filesIdx != nullptr
-              && m_blocksCache != nullptr;
+              && m_blocksCache != nullptr
+              && m_freeExtents != nullptr
+              && m_freeBySize != nullptr
+              && m_sealNames != nullptr
+              && m_tagsStart != nullptr
+              && m_tagsItems != nullptr
+              && m_AesBuffers != nullptr;
 
   // обнулим данные
   memset(&m_info, 0, sizeof(m_info));
@@ -48,10 +65,16 @@ CBundleFile::~CBundleFile() {
     m_AesPathContext = nullptr;
   }
 
-  // удалим буфер
-  if (m_AesBuffer != nullptr) {
-    free(m_AesBuffer);
-    m_AesBuffer = nullptr;
+  // удалим буферы
+  if (m_AesBuffers != nullptr) {
+    AesBuffersFree();
+    delete m_AesBuffers;
+  }
+
+  // остановим потоки шифрования
+  if (m_cryptoPool != nullptr) {
+    delete m_cryptoPool;
+    m_cryptoPool = nullptr;
   }
 
   if (m_filesDesc != nullptr) {
@@ -65,9 +88,26 @@ CBundleFile::~CBundleFile() {
   if (m_blocksCache != nullptr) {
     delete m_blocksCache;
   }
-#ifdef __GNUC__
-  pthread_mutex_destroy(&m_locker);
-#endif // ifdef __GNUC__
+
+  if (m_freeExtents != nullptr) {
+    delete m_freeExtents;
+  }
+
+  if (m_freeBySize != nullptr) {
+    delete m_freeBySize;
+  }
+
+  if (m_sealNames != nullptr) {
+    delete m_sealNames;
+  }
+
+  if (m_tagsStart != nullptr) {
+    delete m_tagsStart;
+  }
+
+  if (m_tagsItems != nullptr) {
+    delete m_tagsItems;
+  }
 }
 
 // открытие бандла
@@ -77,26 +117,39 @@ errno_t CBundleFile::Open(bool openAlways) {
     return ENOMEM;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+
   errno_t err = EEXIST;
 
-  // читаем заголовок
-  if (m_bundle->Seek(0, SEEK_SET)) {
-    if ((m_bundle->Read(&m_info, sizeof(m_info), false) == sizeof(m_info))
-        && (memcmp(m_info.bundleSign, BUNDLE_SIGNATURE, sizeof(m_info.bundleSign)) == 0)) {
-      // читаем первый информационный блок
-      BundleBlock *block = BlockLoad(sizeof(m_info));
+  // карта свободного места будет построена при первой записи
+  m_freeExtents->clear();
+  m_freeBySize->clear();
+  m_freeValid = false;
+  m_freeBytes = 0;
 
-      if ((block != nullptr) && (block->size >= (int64_t)sizeof(BundleFileInfo))) {
-        // прочтем заголовки
-        if (ReadHeaders()) {
+  // признак запечатанности берется из заголовка нулевого файла
+  m_sealed = false;
+
+  // читаем заголовок
+  if ((m_bundle->ReadAt(0, &m_info, sizeof(m_info), false) == sizeof(m_info))
+      && (memcmp(m_info.bundleSign, BUNDLE_SIGNATURE, sizeof(m_info.bundleSign)) == 0)) {
+    // читаем первый информационный блок
+    BundleBlock    block;
+    BundleFileInfo mainInfo;
+
+    if (BlockLoad(sizeof(m_info), block) && (block.size >= (int64_t)sizeof(BundleFileInfo))
+        && (m_bundle->ReadAt(sizeof(m_info) + sizeof(block), &mainInfo, sizeof(mainInfo),
+                             false) == sizeof(mainInfo))) {
+      // запечатанный бандл читаем по каталогу в конце файла, окончание ищем
+      // только если это отмечено в заголовке нулевого файла
+      if ((m_info.version >= 2) && ((mainInfo.extFlags & BUNDLE_FILE_EXT_SEALED) != 0)) {
+        if (ReadSealed()) {
           err = 0;
         }
+      } else if (ReadHeaders()) {
+        // прочтем заголовки
+        err = 0;
       }
     }
   }
@@ -106,11 +159,6 @@ errno_t CBundleFile::Open(bool openAlways) {
     err = CreateNewBundle();
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
   return err;
 }
@@ -119,16 +167,11 @@ errno_t CBundleFile::Open(bool openAlways) {
 errno_t CBundleFile::CreateNewBundle() {
   errno_t err = 0;
 
-  // сместимся в начало
-  m_bundle->Seek(0, SEEK_SET);
-
   // основной хидер
   m_info.version = BUNDLE_VERSION;
   memcpy(m_info.bundleSign, BUNDLE_SIGNATURE, strlen(BUNDLE_SIGNATURE));
 
-  if (!m_bundle->Seek(0,
-                      SEEK_SET) ||
-      (m_bundle->Write(&m_info, sizeof(m_info), true) != sizeof(m_info))) {
+  if (m_bundle->WriteAt(0, &m_info, sizeof(m_info), true) != sizeof(m_info)) {
     err = errno;
   }
 
@@ -137,7 +180,7 @@ errno_t CBundleFile::CreateNewBundle() {
     BundleBlock nblock;
     nblock.size = sizeof(BundleFileInfo);
 
-    if (BlockStore(sizeof(m_info), nblock) == nullptr) {
+    if (!BlockStore(sizeof(m_info), nblock)) {
       err = errno;
     }
 
@@ -152,18 +195,19 @@ errno_t CBundleFile::CreateNewBundle() {
       descZero.curBlock = sizeof(m_info);
 
       // запишем первый элемент
-      if (m_bundle->Seek(sizeof(m_info) + sizeof(BundleBlock), SEEK_SET) &&
-          (m_bundle->Write(&descZero.info, sizeof(descZero.info), true) != sizeof(descZero.info))) {
+      if (m_bundle->WriteAt(sizeof(m_info) + sizeof(BundleBlock), &descZero.info,
+                            sizeof(descZero.info), true) != sizeof(descZero.info)) {
         err = errno;
       }
 
       // добавим в вектор
       if (err == 0) {
         m_filesDesc->push_back(descZero);
+        m_infoNext = sizeof(BundleFileInfo);
       }
 
       // запишем остальные элементы
-      AddEmptyHeaders();
+      AddEmptyHeaders(m_emptyHeadersCount);
     }
   }
 
@@ -172,8 +216,8 @@ errno_t CBundleFile::CreateNewBundle() {
 }
 
 // добавление блока пустых заголовков
-bool CBundleFile::AddEmptyHeaders() {
-  std::vector<BundleFileInfo> tmpInfos(m_emptyHeadersCount);
+bool CBundleFile::AddEmptyHeaders(int count) {
+  std::vector<BundleFileInfo> tmpInfos(count);
 
   // забьем мусором
 #ifndef __GNUC__
@@ -207,12 +251,13 @@ void CBundleFile::Close() {
     return;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // фоновая расшифровка путей и уплотнение ждут блокировку - остановим до
+  // захвата на запись
+  PathsStop();
+  AutoCompactStop();
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
   // закроем файл
   m_bundle->Close();
@@ -221,10 +266,6 @@ void CBundleFile::Close() {
   memset(&m_info, 0, sizeof(m_info));
   m_initialized = false;
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
 }
 
 // Инициализация
@@ -241,22 +282,20 @@ bool CBundleFile::Initialize(const void *pathKey, int keyLen,
     return false;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // прежняя фоновая расшифровка путей больше не нужна
+  PathsStop();
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
   // сбросим флаг
   m_initialized = false;
 
-  // создадим буфер
-  void *nbuffer = realloc(m_AesBuffer, cryptoBufferSize);
+  // окна шифрования выделяются при записи, чтение расшифровывает на месте
+  AesBuffersFree();
 
-  if (nbuffer != nullptr) {
-    m_AesBuffer     = nbuffer;
-    m_AesBufferSize = cryptoBufferSize;
+  if (cryptoBufferSize >= AES_BLOCK_SIZE) {
+    m_AesBufferSize = cryptoBufferSize - cryptoBufferSize % AES_BLOCK_SIZE;
 
     // инициализируем воркер
     m_AesPathContext = new AesContext;
@@ -270,23 +309,164 @@ bool CBundleFile::Initialize(const void *pathKey, int keyLen,
     }
 
     if (m_AesPathContext != nullptr) {
-      // прочтем заголовки
-      ReadPaths();
+      // пути будут расшифрованы заново
+      m_filesIdx->Clear();
+      m_pathsNext     = 1;
+      m_pathsBusy     = 0;
+      m_pathsResolved = 0;
+
+      for (size_t i = 0, j = m_filesDesc->size(); i < j; i++) {
+        (*m_filesDesc)[i].path.clear();
+        (*m_filesDesc)[i].pathValid = false;
+      }
+
+      // прочтем заголовки. в отложенном режиме пути расшифровываются при
+      // поиске (кандидаты - по ключевому хэшу пути из заголовков) и запросе
+      // имени, в фоновом - еще и отдельным потоком
+      m_tagsStart->clear();
+      m_tagsItems->clear();
+
+      if (m_sealed) {
+        ReadSealedPaths();
+      } else if (m_pathsMode == BUNDLE_PATHS_EAGER) {
+        ReadPaths();
+      } else {
+        TagsBuild();
+
+        if (m_pathsMode == BUNDLE_PATHS_BACKGROUND) {
+          try {
+            m_pathsThread = std::thread(&CBundleFile::PathsWorker, this);
+          } catch (...) {
+            // без потока пути расшифруются по требованию
+          }
+        }
+      }
 
       // выставим флаг
       m_initialized = ret = true;
     }
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
   return ret;
 }
 
+// параллельное шифрование данных файлов
+bool CBundleFile::CryptoThreadsSet(int threads, int64_t threshold) {
+  // проверки
+  if (!m_created || (threads < 0)) {
+    return false;
+  }
+
+  // лочимся на запись (читатели не используют пул во время замены)
+  CBundleWriteLock locker(m_locker);
+
+  m_cryptoThreads   = threads;
+  m_cryptoThreshold = threshold;
+
+  // вернем результат
+  return CryptoPoolRebuild();
+}
+
+// потоковое чтение шифрованных данных
+bool CBundleFile::CryptoStreamingSet(bool enabled) {
+  // проверки
+  if (!m_created) {
+    return false;
+  }
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+
+  m_cryptoStreaming = enabled;
+
+  // вернем результат
+  return CryptoPoolRebuild();
+}
+
+// размер порции шифрования для Initialize
+void CBundleFile::CryptoBufferSizeSet(size_t size) {
+  m_cryptoBufferSize = size;
+}
+
+size_t CBundleFile::CryptoBufferSize() const {
+  return m_cryptoBufferSize;
+}
+
+// объем кэша заголовков блоков
+void CBundleFile::BlocksCacheSet(int64_t budget) {
+  CBundleWriteLock locker(m_locker);
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  m_blocksCache->BudgetSet(budget);
+}
+
+// статистика кэша заголовков блоков
+void CBundleFile::BlocksCacheStats(uint64_t& hits, uint64_t& misses,
+                                   int64_t& memory) {
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  hits   = m_blocksCache->Hits();
+  misses = m_blocksCache->Misses();
+  memory = (int64_t)m_blocksCache->Memory();
+}
+
+// режим блокировки
+void CBundleFile::LockModeSet(int mode) {
+  m_locker.ExclusiveSet(mode == BUNDLE_LOCK_EXCLUSIVE);
+}
+
+// режим расшифровки путей
+void CBundleFile::PathsModeSet(int mode) {
+  m_pathsMode = mode;
+}
+
+// статистика расшифровки путей
+void CBundleFile::PathsStats(int64_t& resolved, int64_t& total) {
+  CBundleReadLock locker(m_locker);
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  resolved = m_pathsResolved;
+  total    = m_filesDesc->empty() ? 0 : (int64_t)m_filesDesc->size() - 1;
+}
+
+// пересоздание пула потоков шифрования по текущим настройкам
+bool CBundleFile::CryptoPoolRebuild() {
+  if (m_cryptoPool != nullptr) {
+    delete m_cryptoPool;
+    m_cryptoPool = nullptr;
+  }
+
+  // окна шифрования прежнего размера больше не нужны
+  AesBuffersFree();
+  m_AesWindowSize = BUNDLE_CRYPTO_WINDOW;
+
+  if (m_cryptoThreads > 0) {
+    try {
+      m_cryptoPool = new CBundleCryptoPool(m_cryptoThreads, m_cryptoThreshold > 0
+                                           ? (size_t)m_cryptoThreshold
+                                           : BUNDLE_CRYPTO_MT_THRESHOLD);
+    } catch (...) {
+      return false;
+    }
+
+    // окно записи должно быть не меньше порога, иначе потоки не включатся
+    m_AesWindowSize  = std::max(m_AesWindowSize, m_cryptoPool->Threshold());
+    m_AesWindowSize -= m_AesWindowSize % AES_BLOCK_SIZE;
+  } else if (m_cryptoStreaming) {
+    // для потокового чтения нужен один фоновый поток, деление буферов
+    // между потоками не включаем
+    try {
+      m_cryptoPool = new CBundleCryptoPool(1, SIZE_MAX);
+    } catch (...) {
+      return false;
+    }
+  }
+
+  // все ок
+  return true;
+}
+
 // получение атрибутов
 int64_t CBundleFile::BundleAttributeGet(int idx, int type, void *dst,
                                         int64_t  *dstLen, void *cryptoContext) {
@@ -301,12 +481,8 @@ int64_t CBundleFile::BundleAttributeGet(int idx, int type, void *dst,
     return 0;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
 
   // получим значения
   if ((idx >= 0) && (idx < (int)m_filesDesc->size())) {
@@ -322,12 +498,44 @@ int64_t CBundleFile::BundleAttributeGet(int idx, int type, void *dst,
           ret = ContentRead(tmp1, tmp2, dst, dstLen);
         }
       } else {
+        BundleFileDesc& desc = (*m_filesDesc)[idx];
+        int64_t curBlock     = 0;
+        int64_t curBlockPos  = 0;
+        int64_t curPos       = 0;
+
+        // курсор держим до конца чтения, иначе параллельное чтение или
+        // позиционирование того же файла потеряет сдвиг
+        std::lock_guard<std::mutex> cursor(desc.cursorLocker.locker);
+
+        // возьмем курсор (читаем уже без лока состояния)
+        {
+          std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+          curBlock    = desc.curBlock;
+          curBlockPos = desc.curBlockPos;
+          curPos      = desc.curPos;
+        }
+
         if ((cryptoContext != nullptr) && (dst != nullptr) && (dstLen != nullptr)) {
-          ret = CryptoContentRead((*m_filesDesc)[idx].curBlock,
-                                  (*m_filesDesc)[idx].curBlockPos, dst, dstLen, cryptoContext);
+          uint64_t nonce = 0;
+
+          if ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) == 0) {
+            ret = CryptoContentRead(curBlock, curBlockPos, dst, dstLen, cryptoContext);
+          } else if (NonceGet(idx, nonce)) {
+            ret = CtrContentRead(curBlock, curBlockPos, curPos, dst, dstLen,
+                                 (AesContext *)cryptoContext, nonce);
+          } else {
+            *dstLen = 0;
+          }
         } else {
-          ret = ContentRead((*m_filesDesc)[idx].curBlock, (*m_filesDesc)[idx].curBlockPos,
-                            dst, dstLen);
+          ret = ContentRead(curBlock, curBlockPos, dst, dstLen);
+        }
+
+        // сдвинем курсор и логическую позицию
+        {
+          std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+          desc.curBlock    = curBlock;
+          desc.curBlockPos = curBlockPos;
+          desc.curPos      = curPos + std::max(ret, (int64_t)0);
         }
       }
     } else {
@@ -337,11 +545,6 @@ int64_t CBundleFile::BundleAttributeGet(int idx, int type, void *dst,
     }
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
   return ret;
 }
@@ -354,7 +557,7 @@ int64_t CBundleFile::BundleAttributeSet(int idx, int type, const void *src,
   bool    infoChanged = false;
 
   // проверка
-  if (!m_created) {
+  if (!m_created || m_sealed) {
     return 0;
   }
 
@@ -362,12 +565,9 @@ int64_t CBundleFile::BundleAttributeSet(int idx, int type, const void *src,
     return 0;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+  uint64_t stored = m_blocksStored;
 
   // запишем значения
   if ((idx >= 0) && (idx < (int)m_filesDesc->size())
@@ -400,14 +600,27 @@ int64_t CBundleFile::BundleAttributeSet(int idx, int type, const void *src,
       // обрежем данные
       if (ret > 0) {
         BlockTrunk(tmp1, tmp2);
+        AutoCompactCheck();
       }
     } else {
+      BundleFileDesc& desc = (*m_filesDesc)[idx];
+      int64_t lastBlock    = 0;
+      int64_t length       = DataLengthGet(desc, lastBlock);
+
       // выставим текущий блок
       if ((*m_filesDesc)[idx].curBlock == 0) {
         (*m_filesDesc)[idx].curBlock = (*m_filesDesc)[idx].info.attrsBlocks[type];
       }
 
-      if ((cryptoContext != nullptr) && (src != nullptr)) {
+      uint64_t nonce = 0;
+
+      if ((cryptoContext != nullptr) && (src != nullptr)
+          && ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) != 0)) {
+        if (NonceGet(idx, nonce)) {
+          ret = CtrContentWrite(desc.curBlock, desc.curBlockPos, desc.curPos, src, srcLen,
+                                &firstBlock, (AesContext *)cryptoContext, nonce);
+        }
+      } else if ((cryptoContext != nullptr) && (src != nullptr)) {
         ret = CryptoContentWrite((*m_filesDesc)[idx].curBlock,
                                  (*m_filesDesc)[idx].curBlockPos,
                                  src,
@@ -419,12 +632,32 @@ int64_t CBundleFile::BundleAttributeSet(int idx, int type, const void *src,
         ret = ContentWrite((*m_filesDesc)[idx].curBlock, (*m_filesDesc)[idx].curBlockPos,
                            src, srcLen, &firstBlock);
       }
+
+      // сдвинем логическую позицию, индекс блоков достроится
+      (*m_filesDesc)[idx].curPos += ret;
+
+      // обновим длину в заголовке
+      if (ret != srcLen) {
+        // после ошибки записи длину придется пересчитать
+        desc.info.extFlags &= ~BUNDLE_FILE_EXT_LENGTH;
+        infoChanged         = true;
+      } else if (desc.curPos > length) {
+        // дописали в конец - курсор стоит на последнем блоке
+        infoChanged |= DataLengthSet(desc, desc.curPos, desc.curBlock);
+      }
     }
 
     // для первого блока запишем его значение
-    if (infoChanged) {
+    if (firstBlock > 0) {
       (*m_filesDesc)[idx].info.attrsBlocks[type] = firstBlock;
     }
+
+    // цепочка меняется, только если писались заголовки блоков (блок вырос,
+    // добавлен или отрезан), запись поверх данных ее не трогает
+    if ((firstBlock > 0) || (m_blocksStored != stored)) {
+      (*m_filesDesc)[idx].chainGen++;
+      m_chainsGen++;
+    }
   }
 
   // запишем инфо
@@ -433,17 +666,12 @@ int64_t CBundleFile::BundleAttributeSet(int idx, int type, const void *src,
     ret = 0;
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
   return ret;
 }
 
-// открытие файла
-int CBundleFile::FileOpen(const char *filename, bool openAlways) {
+// открытие файла. rewind - сбросить курсор файла в начало
+int CBundleFile::FileOpen(const char *filename, bool openAlways, bool rewind) {
   int res = -1;
 
   // проверки
@@ -454,92 +682,259 @@ int CBundleFile::FileOpen(const char *filename, bool openAlways) {
   if ((filename == nullptr) || !m_initialized) {
     return 0;
   }
-  std::string tmpStr(filename);
+  size_t   len  = strlen(filename);
+  uint64_t hash = CBundlePathIndex::Hash(filename, len);
+  size_t   found;
+
+  // ищем файл под блокировкой на чтение
+  {
+    CBundleReadLock locker(m_locker);
+
+    if (PathFind(hash, filename, len, found)) {
+      res = (int)found;
+
+      // выставим позицию (под локом курсора, как при позиционировании)
+      if (rewind) {
+        std::lock_guard<std::mutex> cursor((*m_filesDesc)[res].cursorLocker.locker);
+        std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+        (*m_filesDesc)[res].curBlock =
+          (*m_filesDesc)[res].info.attrsBlocks[BUNDLE_FILE_DATA];
+        (*m_filesDesc)[res].curBlockPos = 0;
+        (*m_filesDesc)[res].curPos      = 0;
+      }
+    }
+  }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // не нашли? добавим под блокировкой на запись
+  if ((res < 0) && openAlways && !m_sealed) {
+    CBundleWriteLock locker(m_locker);
 
-  // ищем файл
-  CFilesIndex::iterator it = m_filesIdx->find(tmpStr);
+    // пока ждали блокировку, файл могли создать
+    if (PathFind(hash, filename, len, found)) {
+      res = (int)found;
 
-  // не нашли? добавим
-  if ((it == m_filesIdx->end()) || (it->second >= m_filesDesc->size())) {
-    // проверим, можно ли создавать
-    if (openAlways) {
+      // выставим позицию
+      if (rewind) {
+        std::lock_guard<std::mutex> cursor((*m_filesDesc)[res].cursorLocker.locker);
+
+        (*m_filesDesc)[res].curBlock =
+          (*m_filesDesc)[res].info.attrsBlocks[BUNDLE_FILE_DATA];
+        (*m_filesDesc)[res].curBlockPos = 0;
+        (*m_filesDesc)[res].curPos      = 0;
+      }
+    } else {
       BundleFileDesc desc;
 
+      // ключевой хэш пути для поиска без расшифровки имен
+      BundleNameTagSet(desc.info, BundleNameTag(&m_AesPathContext->ctxEnc, filename, len));
+
       // запишем инфо
       if (InfoStore(desc.infoPos, desc.info, false)) {
         // добавим новый заголовок
         m_filesDesc->push_back(desc);
         res = (int)m_filesDesc->size() - 1;
 
-        // добавим имя
-        std::string cpy(filename);
-
-        // сохраним на диск
-        if (BundleAttributeSet(res, BUNDLE_FILE_NAME, cpy.data(), cpy.length() * sizeof(char),
-                               m_AesPathContext) != (int64_t)(cpy.length() * sizeof(char))) {
+        // сохраним имя на диск
+        if (BundleAttributeSet(res, BUNDLE_FILE_NAME, filename, len * sizeof(char),
+                               m_AesPathContext) != (int64_t)(len * sizeof(char))) {
           res = -1;
         } else {
-          (*m_filesIdx)[cpy.c_str()] = res;
-          (*m_filesDesc)[res].path   = cpy;
+          m_filesIdx->Set(filename, len, res);
+          (*m_filesDesc)[res].path.assign(filename, len);
+          (*m_filesDesc)[res].pathValid = true;
         }
       }
     }
-  } else {
-    res = (int)it->second;
+  }
+
+  // вернем результат
+  return res;
+}
+
+// создание файлов пачкой
+int CBundleFile::FilesCreate(const char *const *filenames, int count, int *indices) {
+  std::vector<int> created;                   // новые файлы (номер в пачке)
+  std::vector<std::pair<int, size_t> > dups; // повторы новых в пачке
+  std::vector<BundleFileInfo> infos;
+  std::vector<std::pair<int64_t, BundleBlock> > blocks; // блоки имен
+  CBundleBuffer    names;
+  CBundlePathIndex batch;
+  int     ret      = 0;
+  int64_t namesPos = 0;
+  int64_t size     = 0;
+  size_t  found    = 0;
+
+  // проверки
+  if (!m_created || m_sealed || !m_initialized || (filenames == nullptr)
+      || (indices == nullptr) || (count <= 0)) {
+    return 0;
+  }
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+
+  // существующие файлы откроем, остальные соберем
+  for (int i = 0; i < count; i++) {
+    indices[i] = -1;
+
+    if ((filenames[i] == nullptr) || (filenames[i][0] == '\0')) {
+      continue;
+    }
+    size_t   len  = strlen(filenames[i]);
+    uint64_t hash = CBundlePathIndex::Hash(filenames[i], len);
+
+    if (PathFind(hash, filenames[i], len, found)) {
+      (*m_filesDesc)[found].curBlock    = (*m_filesDesc)[found].info.attrsBlocks[BUNDLE_FILE_DATA];
+      (*m_filesDesc)[found].curBlockPos = 0;
+      (*m_filesDesc)[found].curPos      = 0;
+      indices[i]                        = (int)found;
+      ret++;
+    } else if (batch.Find(hash, filenames[i], len, found)) {
+      dups.push_back(std::make_pair(i, found));
+    } else {
+      batch.Set(filenames[i], len, created.size());
+      created.push_back(i);
+    }
+  }
+
+  if (created.empty()) {
+    return ret;
+  }
+
+  // заголовки новых файлов идут подряд после последнего использованного,
+  // недостающие пустые заголовки добавим одной записью
+  int64_t infoPos = std::max(m_infoNext, (int64_t)sizeof(BundleFileInfo));
+  int64_t infoEnd = infoPos + created.size() * sizeof(BundleFileInfo);
+  int64_t have    = FileSize(0);
+
+  if (have < infoEnd) {
+    int64_t add = (infoEnd - have + sizeof(BundleFileInfo) - 1) / sizeof(BundleFileInfo);
+
+    add = (add + m_emptyHeadersCount - 1) / m_emptyHeadersCount * m_emptyHeadersCount;
+
+    if (!AddEmptyHeaders((int)add)) {
+      return ret;
+    }
+  }
+
+  // имена: блок на каждое имя, блоки подряд одним участком
+  infos.resize(created.size());
+
+  for (size_t j = 0; j < created.size(); j++) {
+    size_t len = strlen(filenames[created[j]]);
+    size += sizeof(BundleBlock) + (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+  }
+
+  int64_t taken = 0;
+
+  if (!SpaceAllocate(size, namesPos, taken) || (taken != size)) {
+    if (taken > 0) {
+      SpaceRelease(namesPos, taken);
+    }
+    namesPos = m_bundle->Size();
+  }
+  names.resize((size_t)size, 0);
+
+  for (size_t j = 0, offset = 0; j < created.size(); j++) {
+    const char *filename = filenames[created[j]];
+    size_t      len      = strlen(filename);
+    BundleBlock bb;
+
+    bb.size = (len + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE;
+    memcpy(&names[offset], &bb, sizeof(bb));
+    memcpy(&names[offset + sizeof(bb)], filename, len);
+    BundleAesEcb(&m_AesPathContext->ctxEnc, MBEDTLS_AES_ENCRYPT, &names[offset + sizeof(bb)],
+                 (size_t)bb.size);
 
-    // выставим позицию
-    (*m_filesDesc)[res].curBlock =
-      (*m_filesDesc)[res].info.attrsBlocks[BUNDLE_FILE_DATA];
-    (*m_filesDesc)[res].curBlockPos = 0;
+    // заголовок файла
+    infos[j].attrsBlocks[BUNDLE_FILE_NAME] = namesPos + offset;
+    infos[j].flags                        |= BUNDLE_FILE_FLAG_ENC_ATTR0 << BUNDLE_FILE_NAME;
+    BundleNameTagSet(infos[j], BundleNameTag(&m_AesPathContext->ctxEnc, filename, len));
+
+    blocks.push_back(std::make_pair(namesPos + offset, bb));
+    offset += sizeof(bb) + (size_t)bb.size;
+  }
+
+  // запишем имена, затем заголовки. при ошибке место под имена вернем
+  if ((m_bundle->WriteAt(namesPos, &names[0], names.size(), false) != names.size())
+      || (FileSeek(0, infoPos, BUNDLE_FILE_ORIG_SET) != infoPos)
+      || (BundleAttributeSet(0, BUNDLE_FILE_DATA, &infos[0],
+                             infos.size() * sizeof(BundleFileInfo),
+                             nullptr) != (int64_t)(infos.size() * sizeof(BundleFileInfo)))) {
+    SpaceRelease(namesPos, size);
+    return ret;
+  }
+  m_infoNext = std::max(m_infoNext, infoEnd);
+
+  // заголовки блоков имен известны, кэшируем их только после записи
+  {
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+    for (size_t j = 0; j < blocks.size(); j++) {
+      m_blocksCache->Put(blocks[j].first, blocks[j].second);
+    }
+  }
+
+  // добавим заголовки
+  m_filesIdx->Reserve(created.size());
+
+  for (size_t j = 0; j < created.size(); j++) {
+    BundleFileDesc desc;
+    const char    *filename = filenames[created[j]];
+
+    desc.info      = infos[j];
+    desc.infoPos   = infoPos + j * sizeof(BundleFileInfo);
+    desc.path      = filename;
+    desc.pathValid = true;
+    m_filesDesc->push_back(desc);
+
+    indices[created[j]] = (int)m_filesDesc->size() - 1;
+    m_filesIdx->Set(desc.path.data(), desc.path.size(), indices[created[j]]);
+    ret++;
   }
+  m_chainsGen++;
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
+  // повторы получают индекс первого вхождения
+  for (size_t j = 0; j < dups.size(); j++) {
+    indices[dups[j].first] = indices[created[dups[j].second]];
+    ret++;
+  }
 
   // вернем результат
-  return res;
+  return ret;
 }
 
 void CBundleFile::FileDelete(int idx) {
-  if (!m_created) {
+  if (!m_created || m_sealed) {
     return;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
   if ((idx > 0) && (idx < (int)m_filesDesc->size())
       && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
     // выставим флаг
     (*m_filesDesc)[idx].info.flags |= BUNDLE_FILE_FLAG_EMPTY;
+    m_chainsGen++;
 
-    CFilesIndex::iterator it = m_filesIdx->find((*m_filesDesc)[idx].path.c_str());
-
-    if (it != m_filesIdx->end()) {
-      m_filesIdx->erase(it);
+    // нерасшифрованного пути в индексе нет, расшифровывать его уже не нужно
+    if ((*m_filesDesc)[idx].pathValid) {
+      m_filesIdx->Erase((*m_filesDesc)[idx].path.data(), (*m_filesDesc)[idx].path.size());
     }
+    (*m_filesDesc)[idx].pathValid = true;
 
     // запишем
-    InfoStore((*m_filesDesc)[idx].infoPos, (*m_filesDesc)[idx].info, false);
+    if (InfoStore((*m_filesDesc)[idx].infoPos, (*m_filesDesc)[idx].info, false)) {
+      // освободим место, занятое файлом
+      for (int i = 0; i < BUNDLE_ATTRS_COUNT; i++) {
+        SpaceReleaseChain((*m_filesDesc)[idx].info.attrsBlocks[i]);
+      }
+      AutoCompactCheck();
+    }
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
 }
 
 // получение следующего имени файла
@@ -550,12 +945,8 @@ int CBundleFile::FileName(int idx, char *filename, int len) {
     return 0;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
 
   // сразу сместимся
   idx++;
@@ -569,274 +960,728 @@ int CBundleFile::FileName(int idx, char *filename, int len) {
 
   // нашли что-нибудь?
   if ((idx >= 0) && (idx < (int)m_filesDesc->size()) && (filename != nullptr) && (len > 0)) {
-    // скопируем имя
+    // скопируем имя (при необходимости расшифруем)
 #ifndef _MSC_VER
-    strcpy(filename, (*m_filesDesc)[idx].path.c_str());
+    strcpy(filename, PathGet(idx).c_str());
 #else // ifndef _MSC_VER
-    strcpy_s(filename, len, (*m_filesDesc)[idx].path.c_str());
+    strcpy_s(filename, len, PathGet(idx).c_str());
 #endif // ifndef _MSC_VER
 
     // запомним результат
     ret = idx;
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
   return ret;
 }
 
-// получение размера файла
-int64_t CBundleFile::FileSize(int idx) {
-  int64_t res = 0;
+// чтение данных файла без копирования (если поток это поддерживает)
+const void * CBundleFile::FileBorrow(int idx, int64_t *dstLen) {
+  const void *res = nullptr;
 
-  if (!m_created) {
-    return 0;
+  // проверки
+  if (!m_created || (dstLen == nullptr)) {
+    return nullptr;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
 
   if ((idx >= 0) && (idx < (int)m_filesDesc->size())
-      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
-    // посчитаем размер
-    CalculateSize((*m_filesDesc)[idx].info.attrsBlocks[BUNDLE_FILE_DATA], 0, &res);
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0) && (*dstLen > 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    std::lock_guard<std::mutex> cursor(desc.cursorLocker.locker);
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+    BundleBlock     bb;
+    bool            loaded = BlockLoad(desc.curBlock, bb);
+
+    // в конце блока перейдем к следующему
+    while (loaded && (desc.curBlockPos >= bb.size) && (bb.nextBlock > 0)) {
+      desc.curBlock    = bb.nextBlock;
+      desc.curBlockPos = 0;
+      loaded           = BlockLoad(desc.curBlock, bb);
+    }
+
+    // отдадим непрерывный кусок текущего блока
+    if (loaded && (desc.curBlockPos < bb.size)) {
+      int64_t len = std::min(*dstLen, bb.size - desc.curBlockPos);
+      res = m_bundle->Borrow(desc.curBlock + sizeof(BundleBlock) + desc.curBlockPos,
+                             (size_t)len);
+
+      if (res != nullptr) {
+        desc.curBlockPos += len;
+        desc.curPos      += len;
+        *dstLen           = len;
+      }
+    }
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
+  if (res == nullptr) {
+    *dstLen = 0;
+  }
 
   // вернем результат
   return res;
 }
 
-// установка новой позиции в файле. возвращает полное смещение в бандле от начала
-int64_t CBundleFile::FileSeek(int idx, int64_t offset, BundleFileOrigin origin) {
-  std::vector<int64_t> blocks;
-  int64_t ret = 0;
+// режим шифрования данных файла
+bool CBundleFile::FileCipherSet(int idx, int cipher, const uint64_t *nonce) {
+  bool res = false;
 
   // проверки
-  if (!m_created) {
-    return 0;
-  }
-
-  if ((origin < BUNDLE_FILE_ORIG_SET) || (origin > BUNDLE_FILE_ORIG_END)) {
-    return -1;
+  if (!m_created || m_sealed
+      || ((cipher != BUNDLE_CIPHER_ECB) && (cipher != BUNDLE_CIPHER_CTR))) {
+    return false;
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
-  // запишем значения
-  if ((idx >= 0) && (idx < (int)m_filesDesc->size())
+  if ((idx > 0) && (idx < (int)m_filesDesc->size())
       && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
-    // скорректируем смещение
-    if (origin == BUNDLE_FILE_ORIG_END) {
-      (*m_filesDesc)[idx].curBlock    = 0;
-      (*m_filesDesc)[idx].curBlockPos = 0;
-
-      if (offset > 0) {
-        offset = 0;
-      }
-    }
-
-    // при необходимости соберем список блоков
-    if ((origin == BUNDLE_FILE_ORIG_END) || (origin == BUNDLE_FILE_ORIG_CUR)) {
-      ret = CollectBlocks((*m_filesDesc)[idx].info.attrsBlocks[BUNDLE_FILE_DATA],
-                          (*m_filesDesc)[idx].curBlock, blocks);
-    }
-
-    // определим метод прохода
-    if ((origin == BUNDLE_FILE_ORIG_END) || ((origin == BUNDLE_FILE_ORIG_CUR)
-                                             && (offset < 0))) {
-      // смещаемся
-      ret += FileSeekBackward((*m_filesDesc)[idx].curBlock,
-                              (*m_filesDesc)[idx].curBlockPos, offset, blocks);
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    int64_t lastBlock    = 0;
+    unsigned char flags  = cipher == BUNDLE_CIPHER_CTR
+                           ? desc.info.flags | BUNDLE_FILE_FLAG_CTR
+                           : desc.info.flags & ~BUNDLE_FILE_FLAG_CTR;
+
+    // уже записанные данные перешифровывать не будем
+    if (DataLengthGet(desc, lastBlock) > 0) {
+      res = (flags == desc.info.flags) && (nonce == nullptr);
     } else {
-      // выставим начало
-      if ((origin != BUNDLE_FILE_ORIG_CUR) || ((*m_filesDesc)[idx].curBlock <= 0)) {
-        (*m_filesDesc)[idx].curBlock =
-          (*m_filesDesc)[idx].info.attrsBlocks[BUNDLE_FILE_DATA];
-        (*m_filesDesc)[idx].curBlockPos = 0;
-        ret                             = 0;
+      if (flags == desc.info.flags) {
+        res = true;
+      } else {
+        desc.info.flags = flags;
+        res             = InfoStore(desc.infoPos, desc.info, false);
       }
 
-      // двигаемся вперед
-      if (offset > 0) {
-        ret += FileSeekForward((*m_filesDesc)[idx].curBlock,
-                               (*m_filesDesc)[idx].curBlockPos, offset);
+      // данные будут записаны заново - нужен новый nonce
+      if (res && (cipher == BUNDLE_CIPHER_CTR)) {
+        res = NonceSet(idx, nonce != nullptr ? *nonce : BundleCtrNonce());
       }
     }
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
-
   // вернем результат
-  return ret;
+  return res;
 }
 
-// сбор стэка блоков
-int64_t CBundleFile::CollectBlocks(int64_t start, int64_t end,
-                                   std::vector<int64_t>& dest) {
-  int64_t ret           = 0;
-  BundleBlock *tmpBlock = nullptr;
+int CBundleFile::FileCipherGet(int idx) {
+  int res = -1;
+
+  if (!m_created) {
+    return -1;
+  }
 
-  while (start != end && (tmpBlock = BlockLoad(start)) != nullptr) {
-    // добавим в стэк
-    dest.push_back(start);
-    ret += tmpBlock->size;
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
 
-    // сместимся
-    start = tmpBlock->nextBlock;
+  if ((idx >= 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    res = ((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_CTR) != 0
+          ? BUNDLE_CIPHER_CTR : BUNDLE_CIPHER_ECB;
   }
 
   // вернем результат
-  return ret;
+  return res;
 }
 
-// установка позиции в прямом порядке
-int64_t CBundleFile::FileSeekForward(int64_t& curBlock, int64_t& curBlockPos,
-                                     int64_t offset) {
-  int64_t pos = 0;
+// флаг шифрования данных (данные шифруются вне бандла)
+bool CBundleFile::FileDataEncryptedSet(int idx, bool encrypted) {
+  bool res = false;
 
-  // добавим смещения
-  offset     += curBlockPos;
-  curBlockPos = 0;
+  // проверки
+  if (!m_created || m_sealed) {
+    return false;
+  }
 
-  // пройдем в цикле
-  for (BundleBlock *bb = BlockLoad(curBlock); bb != nullptr;) {
-    if (offset >= bb->size) {
-      offset -= bb->size;
-      pos    += bb->size;
-    } else {
-      curBlockPos = offset;
-      pos        += offset;
-      break;
-    }
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
-    // сместимся к следующему блоку
-    if (bb->nextBlock > 0) {
-      curBlock = bb->nextBlock;
-      bb       = BlockLoad(curBlock);
-    } else {
-      break;
+  if ((idx > 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    unsigned char   flag = BUNDLE_FILE_FLAG_ENC_ATTR0 << BUNDLE_FILE_DATA;
+    int64_t lastBlock    = 0;
+    unsigned char flags  = encrypted ? desc.info.flags | flag : desc.info.flags & ~flag;
+
+    // у записанных данных флаг не меняется
+    if (flags == desc.info.flags) {
+      res = true;
+    } else if (DataLengthGet(desc, lastBlock) == 0) {
+      desc.info.flags = flags;
+      res             = InfoStore(desc.infoPos, desc.info, false);
     }
   }
 
   // вернем результат
-  return pos;
+  return res;
 }
 
-// установка позиции в обратном порядке
-int64_t CBundleFile::FileSeekBackward(int64_t& curBlock, int64_t& curBlockPos,
-                                      int64_t offset, std::vector<int64_t>& blocks) {
-  int64_t pos = 0;
-
-  // сменим знак на положительный
-  offset = -offset;
+// чтение данных файла с заданной позиции без курсора
+int64_t CBundleFile::FileReadAt(int idx, int64_t pos, void *dst, int64_t *dstLen,
+                                void *cryptoContext) {
+  int64_t ret = 0;
 
-  // обработаем текущий блок (если есть)
-  if (curBlock > 0) {
-    // укладывается ли смещение в текущий блок?
-    if (curBlockPos >= offset) {
-      curBlockPos -= offset;
-      return curBlockPos;
-    } else {
-      offset     -= curBlockPos;
-      curBlockPos = 0;
-    }
-  } else {
-    curBlockPos = 0;
+  // проверки
+  if (!m_created || (dstLen == nullptr) || (pos < 0)) {
+    return 0;
   }
 
-  // пройдем в цикле
-  for (size_t i = blocks.size(); i > 0; i--) {
-    BundleBlock *bb = BlockLoad(blocks[i - 1]);
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
 
-    if (bb == nullptr) {
-      break;
-    }
+  if ((idx >= 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    int64_t blockPos     = 0;
+    int64_t blockOffset  = 0;
 
-    // запомним блок
-    curBlock = blocks[i - 1];
+    // найдем блок по индексу блоков файла
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
 
-    // укладывается ли смещение в текущий блок?
-    if (bb->size >= offset) {
-      curBlockPos = bb->size - offset;
-      pos        -= offset;
-      break;
+      if ((pos < ExtentsUpdate(desc)) && !desc.extents.empty()) {
+        const BundleExtent& ext = desc.extents[ExtentsFind(desc.extents, pos)];
+
+        blockPos    = ext.block;
+        blockOffset = pos - ext.offset;
+      }
+    }
+
+    // ECB расшифровывает целыми блоками AES от начала файла, с невыровненной
+    // позиции получился бы мусор
+    bool unaligned = (cryptoContext != nullptr) && (dst != nullptr)
+                     && ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) == 0)
+                     && ((pos % AES_BLOCK_SIZE) != 0);
+
+    // читаем (за концом файла читать нечего)
+    if ((blockPos > 0) && !unaligned) {
+      uint64_t nonce = 0;
+
+      if ((cryptoContext != nullptr) && (dst != nullptr)
+          && ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) != 0)) {
+        if (NonceGet(idx, nonce)) {
+          ret = CtrContentRead(blockPos, blockOffset, pos, dst, dstLen,
+                               (AesContext *)cryptoContext, nonce);
+        } else {
+          *dstLen = 0;
+        }
+      } else if ((cryptoContext != nullptr) && (dst != nullptr)) {
+        ret = CryptoContentRead(blockPos, blockOffset, dst, dstLen, cryptoContext);
+      } else {
+        ret = ContentRead(blockPos, blockOffset, dst, dstLen);
+      }
     } else {
-      offset -= bb->size;
-      pos    -= bb->size;
+      *dstLen = 0;
     }
+  } else {
+    *dstLen = 0;
   }
 
   // вернем результат
-  return pos;
+  return ret;
 }
 
-// обрезание файла по заданному размеру
-void CBundleFile::FileTrunk(int idx, int64_t newSize) {
+// запись данных файла с заданной позиции (не дальше конца файла) без курсора
+int64_t CBundleFile::FileWriteAt(int idx, int64_t pos, const void *src, const int64_t srcLen,
+                                 void *cryptoContext) {
+  int64_t ret = 0;
+
   // проверки
-  if (!m_created) {
-    return;
+  if (!m_created || m_sealed || (pos < 0)) {
+    return 0;
   }
 
-  if (newSize < 0) {
-    return;
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+
+  if ((idx > 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+
+    // запомним курсор файла (блоки при записи не освобождаются, поэтому
+    // его можно будет вернуть)
+    int64_t curBlock    = desc.curBlock;
+    int64_t curBlockPos = desc.curBlockPos;
+    int64_t curPos      = desc.curPos;
+
+    // ECB шифрует целыми блоками AES от начала файла, с невыровненной
+    // позиции блоки легли бы мимо сетки и испортили файл
+    bool unaligned = (cryptoContext != nullptr) && (src != nullptr)
+                     && ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) == 0)
+                     && ((pos % AES_BLOCK_SIZE) != 0);
+
+    // пишем с нужной позиции
+    if (!unaligned && (FileSeek(idx, pos, BUNDLE_FILE_ORIG_SET) == pos)) {
+      ret = BundleAttributeSet(idx, BUNDLE_FILE_DATA, src, srcLen, cryptoContext);
+    }
+
+    // вернем курсор
+    desc.curBlock    = curBlock;
+    desc.curBlockPos = curBlockPos;
+    desc.curPos      = curPos;
+  }
+
+  // вернем результат
+  return ret;
+}
+
+// получение размера файла
+int64_t CBundleFile::FileSize(int idx) {
+  int64_t res = 0;
+
+  if (!m_created) {
+    return 0;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  if ((idx >= 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+    int64_t lastBlock = 0;
+
+    // размер хранится в заголовке (или считается и запоминается)
+    res = DataLengthGet((*m_filesDesc)[idx], lastBlock);
+  }
+
+  // вернем результат
+  return res;
+}
+
+// установка новой позиции в файле. возвращает новую позицию от начала файла
+int64_t CBundleFile::FileSeek(int idx, int64_t offset, BundleFileOrigin origin) {
+  int64_t ret = 0;
+
+  // проверки
+  if (!m_created) {
+    return 0;
+  }
+
+  if ((origin < BUNDLE_FILE_ORIG_SET) || (origin > BUNDLE_FILE_ORIG_END)) {
+    return -1;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  // запишем значения
+  if ((idx >= 0) && (idx < (int)m_filesDesc->size())
+      && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    std::lock_guard<std::mutex> cursor(desc.cursorLocker.locker);
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+    // конец файла известен из заголовка, индекс блоков не нужен
+    if ((origin == BUNDLE_FILE_ORIG_END) && (offset >= 0)) {
+      int64_t lastBlock = 0;
+      ret = DataLengthGet(desc, lastBlock);
+      BundleBlock bb;
+      bool        loaded = BlockLoad(lastBlock, bb);
+
+      desc.curBlock    = loaded ? lastBlock : desc.info.attrsBlocks[BUNDLE_FILE_DATA];
+      desc.curBlockPos = loaded ? bb.size : 0;
+      desc.curPos      = ret;
+    } else {
+      int64_t total = ExtentsUpdate(desc);
+
+      // вычислим целевую позицию
+      if (origin == BUNDLE_FILE_ORIG_END) {
+        ret = total + offset;
+      } else if (origin == BUNDLE_FILE_ORIG_CUR) {
+        ret = ExtentsPosition(desc) + offset;
+      } else {
+        ret = offset;
+      }
+
+      // не выходим за границы файла
+      ret = std::max((int64_t)0, std::min(ret, total));
+
+      // найдем блок двоичным поиском
+      if (desc.extents.empty()) {
+        desc.curBlock    = desc.info.attrsBlocks[BUNDLE_FILE_DATA];
+        desc.curBlockPos = 0;
+        ret              = 0;
+      } else {
+        const BundleExtent& ext = desc.extents[ExtentsFind(desc.extents, ret)];
+
+        desc.curBlock    = ext.block;
+        desc.curBlockPos = ret - ext.offset;
+      }
+      desc.curPos = ret;
+    }
+  }
+
+  // вернем результат
+  return ret;
+}
+
+// раскладка данных всех файлов
+bool CBundleFile::FilesLayout(CFilesLayout& files, uint64_t& gen) {
+  files.clear();
+
+  if (!m_created) {
+    return false;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  gen = m_chainsGen;
+
+  for (int idx = 1; idx < (int)m_filesDesc->size(); idx++) {
+    if (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0) {
+      continue;
+    }
+
+    files.emplace_back();
+
+    if (!FileLayout(idx, files.back())) {
+      return false;
+    }
+  }
+
+  // вернем результат
+  return true;
+}
+
+// раскладка данных файла
+bool CBundleFile::FileLayout(int idx, BundleFileLayout& file) {
+  if (!m_created) {
+    return false;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  if ((idx <= 0) || (idx >= (int)m_filesDesc->size())
+      || (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0)) {
+    return false;
+  }
+
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+  file.idx   = idx;
+  file.path  = PathGet(idx);
+  file.flags = desc.info.flags;
+  file.nonce = 0;
+
+  if (((desc.info.flags & BUNDLE_FILE_FLAG_CTR) != 0) && !NonceGet(idx, file.nonce)) {
+    return false;
+  }
+
+  // индекс блоков файла заодно пригодится для позиционирования
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+  file.length  = ExtentsUpdate(desc);
+  file.extents = desc.extents;
+  file.gen     = desc.chainGen;
+
+  // все ок
+  return true;
+}
+
+// чтение данных бандла с заданного смещения. под блокировкой на чтение
+// блоки не переносятся и не освобождаются, поэтому совпадение счетчика
+// гарантирует, что читаются блоки раскладки
+size_t CBundleFile::RawRead(int64_t pos, void *dst, size_t size, uint64_t gen) {
+  if (!m_created || (dst == nullptr) || (pos < (int64_t)sizeof(m_info))) {
+    return 0;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  if (gen != m_chainsGen) {
+    return 0;
+  }
+
+  const void *src = m_bundle->Borrow(pos, size);
+
+  if (src != nullptr) {
+    memcpy(dst, src, size);
+    return size;
+  }
+  return m_bundle->ReadAt(pos, dst, size, false);
+}
+
+// файлы раскладки, цепочки которых изменились
+void CBundleFile::LayoutChanged(const CFilesLayout& files, std::vector<bool>& changed,
+                                uint64_t& gen) {
+  changed.resize(files.size(), false);
+
+  if (!m_created) {
+    return;
+  }
+
+  // лочимся на чтение
+  CBundleReadLock locker(m_locker);
+
+  for (size_t i = 0; i < files.size(); i++) {
+    const BundleFileDesc& desc = (*m_filesDesc)[files[i].idx];
+
+    if (((desc.info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0) || (desc.chainGen != files[i].gen)) {
+      changed[i] = true;
+    }
+  }
+  gen = m_chainsGen;
+}
+
+// построение или достройка индекса блоков. возвращает размер файла
+int64_t CBundleFile::ExtentsUpdate(BundleFileDesc& desc) {
+  CFileExtents& extents = desc.extents;
+  int64_t blockPos      = desc.info.attrsBlocks[BUNDLE_FILE_DATA];
+  int64_t offset        = 0;
+  int64_t limit         = -1;
+  bool    sized         = false;
+
+  if (!desc.extentsValid) {
+    extents.clear();
+    desc.extentsValid = true;
+  } else if (desc.extentsGen == desc.chainGen) {
+    // цепочка не менялась - индекс актуален
+    return extents.empty() ? 0 : extents.back().offset + extents.back().size;
+  }
+  desc.extentsGen = desc.chainGen;
+
+  // запись меняет цепочку только с хвоста: последний блок мог вырасти,
+  // а за ним появиться новые. перечитаем начиная с него
+  if (!extents.empty()) {
+    blockPos = extents.back().block;
+    offset   = extents.back().offset;
+    extents.pop_back();
+  }
+
+  // защита от зацикливания: пустыми бывают только первый и последний блоки,
+  // поэтому блоков не больше начала последнего из заголовка. без него (или
+  // если цепочка оказалась длиннее) - не больше, чем помещается в бандл
+  if ((desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0) {
+    limit = BundleInt48Get(desc.info.dataLastStart) + 2;
+  }
+
+  // пройдем по цепочке
+  for (BundleBlock bb; BlockLoad(blockPos, bb);) {
+    if ((int64_t)extents.size() >= limit) {
+      if (sized) {
+        break;
+      }
+      limit = std::max(limit, m_bundle->Size() / (int64_t)sizeof(BundleBlock));
+      sized = true;
+
+      if ((int64_t)extents.size() >= limit) {
+        break;
+      }
+    }
+
+    BundleExtent ext;
+    ext.block  = blockPos;
+    ext.offset = offset;
+    ext.size   = bb.size;
+    extents.push_back(ext);
+
+    // сместимся к следующему блоку
+    offset  += bb.size;
+    blockPos = bb.nextBlock;
+  }
+
+  // вернем размер
+  return offset;
+}
+
+// получение логической позиции курсора файла
+int64_t CBundleFile::ExtentsPosition(BundleFileDesc& desc) {
+  const CFileExtents& extents = desc.extents;
+
+  if ((desc.curBlock <= 0) || extents.empty()) {
+    return 0;
+  }
+
+  // позиция курсора отслеживается при чтении/записи, сверим ее с блоком
+  size_t i = ExtentsFind(extents, desc.curPos);
+
+  if ((extents[i].block == desc.curBlock)
+      && (extents[i].offset + desc.curBlockPos == desc.curPos)) {
+    return desc.curPos;
+  }
+
+  // курсор в конце предыдущего блока
+  if ((i > 0) && (extents[i - 1].block == desc.curBlock)
+      && (extents[i - 1].offset + desc.curBlockPos == desc.curPos)) {
+    return desc.curPos;
+  }
+
+  // не сошлось (например, после ошибки чтения) - ищем блок перебором
+  for (i = 0; i < extents.size(); i++) {
+    if (extents[i].block == desc.curBlock) {
+      desc.curPos = extents[i].offset + desc.curBlockPos;
+      return desc.curPos;
+    }
+  }
+
+  // вернем результат
+  return 0;
+}
+
+// поиск блока, содержащего позицию (последний с началом не дальше позиции)
+size_t CBundleFile::ExtentsFind(const CFileExtents& extents, int64_t pos) {
+  size_t first = 0;
+  size_t count = extents.size();
+
+  while (count > 0) {
+    size_t step = count / 2;
+
+    if (extents[first + step].offset <= pos) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+
+  // вернем результат
+  return first > 0 ? first - 1 : 0;
+}
+
+// получение длины данных файла и его последнего блока
+int64_t CBundleFile::DataLengthGet(BundleFileDesc& desc, int64_t& lastBlock) {
+  int64_t length = 0;
+
+  // сохраненные значения верны, пока за последним блоком ничего нет. длина
+  // берется из размера блока, поэтому дописывание и обрезание внутри него
+  // (в том числе старыми версиями) заголовок не портит
+  if ((desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0) {
+    lastBlock = BundleInt48Get(desc.info.dataLastBlock);
+
+    if (lastBlock == 0) {
+      if (desc.info.attrsBlocks[BUNDLE_FILE_DATA] == 0) {
+        return 0;
+      }
+    } else {
+      BundleBlock bb;
+
+      if (BlockLoad(lastBlock, bb) && (bb.nextBlock == 0)) {
+        return BundleInt48Get(desc.info.dataLastStart) + bb.size;
+      }
+    }
   }
 
-  // лочимся
-#ifdef __GNUC__
-  pthread_mutex_lock(&m_locker);
-#else // ifdef __GNUC__
-  std::lock_guard<std::recursive_mutex> locker(m_locker);
-#endif // ifdef __GNUC__
+  // посчитаем по цепочке (заодно построим индекс блоков)
+  length    = ExtentsUpdate(desc);
+  lastBlock = desc.extents.empty() ? 0 : desc.extents.back().block;
+
+  // запомним (на диск попадет со следующей записью заголовка)
+  DataLengthSet(desc, length, lastBlock);
+
+  // вернем результат
+  return length;
+}
+
+// установка длины данных файла и его последнего блока (в заголовке - начало
+// последнего блока). возвращает true, если заголовок изменился
+bool CBundleFile::DataLengthSet(BundleFileDesc& desc, int64_t length, int64_t lastBlock) {
+  int64_t     start = 0;
+  BundleBlock bb;
+
+  if (lastBlock > 0) {
+    if (!BlockLoad(lastBlock, bb) || (bb.size > length)) {
+      // без блока сохранять нечего, длину придется пересчитать
+      bool changed = (desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0;
+      desc.info.extFlags &= ~BUNDLE_FILE_EXT_LENGTH;
+      return changed;
+    }
+    start = length - bb.size;
+  }
+
+  if (((desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0)
+      && (BundleInt48Get(desc.info.dataLastStart) == start)
+      && (BundleInt48Get(desc.info.dataLastBlock) == lastBlock)) {
+    return false;
+  }
+
+  // выставим значения
+  BundleInt48Set(desc.info.dataLastStart, start);
+  BundleInt48Set(desc.info.dataLastBlock, lastBlock);
+  desc.info.extFlags |= BUNDLE_FILE_EXT_LENGTH;
+
+  // вернем результат
+  return true;
+}
+
+// обрезание файла по заданному размеру
+void CBundleFile::FileTrunk(int idx, int64_t newSize) {
+  // проверки
+  if (!m_created || m_sealed) {
+    return;
+  }
+
+  if (newSize < 0) {
+    return;
+  }
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
 
   // обрежем
   if ((idx >= 0) && (idx < (int)m_filesDesc->size())
       && (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)) {
+    BundleFileDesc& desc = (*m_filesDesc)[idx];
+    int64_t lastBlock    = 0;
+
+    DataLengthGet(desc, lastBlock);
+
     // сместимся
     FileSeek(idx, newSize, BUNDLE_FILE_ORIG_SET);
 
     // обрежем
-    BlockTrunk((*m_filesDesc)[idx].curBlock, (*m_filesDesc)[idx].curBlockPos);
+    uint64_t stored = m_blocksStored;
+    BlockTrunk(desc.curBlock, desc.curBlockPos);
+
+    // обрежем и индекс блоков
+    if (m_blocksStored != stored) {
+      desc.chainGen++;
+      m_chainsGen++;
+    }
+
+    if (!desc.extents.empty()) {
+      size_t i = ExtentsFind(desc.extents, desc.curPos);
+
+      desc.extents.resize(i + 1);
+      desc.extents[i].size = desc.curBlockPos;
+    }
+
+    // запишем новую длину
+    if ((desc.curBlock > 0) && DataLengthSet(desc, desc.curPos, desc.curBlock)) {
+      InfoStore(desc.infoPos, desc.info, idx == 0);
+    }
+
+    // файл будет записан заново - повтор nonce повторил бы и гамму
+    if ((newSize == 0) && ((desc.info.flags & BUNDLE_FILE_FLAG_CTR) != 0)) {
+      NonceSet(idx, BundleCtrNonce());
+    }
+    AutoCompactCheck();
   }
 
-  // анлочим
-#ifdef __GNUC__
-  pthread_mutex_unlock(&m_locker);
-#endif // ifdef __GNUC__
 }
 
 // обрезание файла по заданному размеру
 void CBundleFile::BlockTrunk(int64_t blockPos, int64_t newSize) {
   // получим блок
-  BundleBlock *bb = BlockLoad(blockPos);
+  BundleBlock bb;
+
+  if (BlockLoad(blockPos, bb) && ((bb.size > newSize) || (bb.nextBlock > 0))) {
+    int64_t oldSize   = bb.size;
+    int64_t nextBlock = bb.nextBlock;
 
-  if ((bb != nullptr) && (bb->size > newSize)) {
     // обрежем
-    bb->size      = newSize;
-    bb->nextBlock = 0;
+    bb.size      = std::min(bb.size, newSize);
+    bb.nextBlock = 0;
 
-    // сохраним блок
-    BlockStore(blockPos, *bb);
+    // сохраним блок и освободим отрезанное
+    if (BlockStore(blockPos, bb)) {
+      SpaceRelease(blockPos + sizeof(BundleBlock) + bb.size, oldSize - bb.size);
+      SpaceReleaseChain(nextBlock);
+    }
   }
 }
 
@@ -873,12 +1718,18 @@ bool CBundleFile::ReadHeaders() {
     // добавим заголовки
     for (int64_t i = 0; i < countSize; i++) {
       desc.info     = tmpVect[(size_t)i];
-      desc.curBlock = desc.curBlockPos = 0;
+      desc.curBlock = desc.curBlockPos = desc.curPos = 0;
       desc.infoPos  = sizeof(BundleFileInfo) * i;
 
+      // бандлы 1й версии длину и хэш пути в заголовке не хранят
+      if (m_info.version < 2) {
+        desc.info.extFlags &= ~(BUNDLE_FILE_EXT_LENGTH | BUNDLE_FILE_EXT_NAMETAG);
+      }
+
       // добавим в вектор только значимые заголовки
       if ((desc.info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0) {
         m_filesDesc->push_back(desc);
+        m_infoNext = desc.infoPos + sizeof(BundleFileInfo);
       }
     }
   }
@@ -889,405 +1740,1909 @@ bool CBundleFile::ReadHeaders() {
 
 // расшифровка путей файлов
 bool CBundleFile::ReadPaths() {
-  int64_t totalSize = 0;
-  int64_t readSize  = 0;
-  std::string tmpStr(2048, '\0');
+  std::string path;
+
+  m_filesIdx->Reserve(m_filesDesc->size());
 
   // пройдем по списку заголовков
   for (size_t i = 1, j = m_filesDesc->size(); i < j; i++) {
-    // загрузим путь
-    totalSize = tmpStr.size() * sizeof(tmpStr[0]);
-    readSize  = BundleAttributeGet((int)i, BUNDLE_FILE_NAME, &tmpStr[0], &totalSize,
-                                   m_AesPathContext);
+    PathLoad(i, path);
+    PathStore(i, path);
+  }
+  m_pathsNext = m_filesDesc->size();
 
-    // занулим
-    if ((readSize >= 0) && (readSize <= totalSize)) {
-      tmpStr[(size_t)readSize / sizeof(tmpStr[0])] = '\0';
-    }
+  // все ок
+  return true;
+}
 
-    // добавим в индекс по пути
-    if (!tmpStr.empty()) {
-      (*m_filesIdx)[tmpStr.c_str()] = i;
-      (*m_filesDesc)[i].path        = tmpStr;
-    }
+// расшифровка пути заголовка. вызывается под блокировкой бандла, лок
+// состояния не нужен (имя меняется только под монопольной блокировкой)
+bool CBundleFile::PathLoad(size_t idx, std::string& path) {
+  char    tmp[2048];
+  int64_t blockPos    = (*m_filesDesc)[idx].info.attrsBlocks[BUNDLE_FILE_NAME];
+  int64_t blockOffset = 0;
+  int64_t totalSize   = sizeof(tmp);
+  int64_t readSize    = 0;
+
+  path.clear();
+
+  if (((*m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0) {
+    return false;
+  }
+
+  // загрузим путь (имя дополнено нулями до блока шифрования)
+  readSize = CryptoContentRead(blockPos, blockOffset, tmp, &totalSize, m_AesPathContext);
+
+  if ((readSize <= 0) || (readSize > totalSize)) {
+    return false;
   }
+  path.assign(tmp, strnlen(tmp, (size_t)readSize));
 
   // все ок
   return true;
 }
 
-// чтение данных с последующей расшифровкой
-int64_t CBundleFile::CryptoContentRead(int64_t& blockPos, int64_t& blockOffset,
-                                       void *dst, int64_t *dstLen, void *cryptoContext) {
-  // проверки
-  if ((cryptoContext == nullptr) || (dst == nullptr) || (dstLen == nullptr)
-      || (m_AesBuffer == nullptr)
-      || (m_AesBufferSize == 0)) {
-    return 0;
+// сохранение расшифрованного пути и добавление в индекс. вызывается под
+// локом состояния или монопольной блокировкой
+void CBundleFile::PathStore(size_t idx, std::string& path) {
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+  size_t found         = 0;
+
+  // путь уже расшифровали в другом потоке
+  if (desc.pathValid) {
+    return;
   }
+  desc.path.swap(path);
+  desc.pathValid = true;
+  m_pathsResolved++;
 
-  if ((*dstLen % AES_BLOCK_SIZE) != 0) {
-    return 0;
+  // при совпадении путей в индексе остается последний заголовок, как при
+  // расшифровке по порядку
+  if (((desc.info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)
+      && (!m_filesIdx->Find(desc.path.data(), desc.path.size(), found) || (found < idx))) {
+    m_filesIdx->Set(desc.path.data(), desc.path.size(), idx);
   }
+}
 
-  // читаем данные в буфер
-  int64_t remain    = *dstLen;
-  int64_t totalRead = 0;
+// путь заголовка, расшифровывается при первом обращении. вызывается под
+// блокировкой бандла
+const std::string& CBundleFile::PathGet(size_t idx) {
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+  std::string     path;
 
-  while (remain > 0) {
-    int64_t toRead = std::min(remain, (int64_t)m_AesBufferSize);
-    int64_t read   = ContentRead(blockPos, blockOffset, m_AesBuffer, &toRead);
+  {
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
 
-    // проверим, есть ли выровненные данные?
-    if (((read % AES_BLOCK_SIZE) != 0) || (read <= 0)) {
-      break;
+    if (desc.pathValid) {
+      return desc.path;
     }
+  }
 
-    // расшифруем
-    for (size_t pos = 0; pos < static_cast<size_t>(read); pos += AES_BLOCK_SIZE) {
-      mbedtls_aes_crypt_ecb(&((AesContext *)cryptoContext)->ctxDec, MBEDTLS_AES_DECRYPT,
-                            (unsigned char *)m_AesBuffer + pos, (unsigned char *)m_AesBuffer + pos);
+  // расшифруем вне лока состояния
+  PathLoad(idx, path);
+
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+  PathStore(idx, path);
+
+  // расшифрованный путь больше не меняется
+  return desc.path;
+}
+
+// nonce AES-CTR файла. читается из атрибута при первом обращении, вызывается
+// под блокировкой бандла
+bool CBundleFile::NonceGet(int idx, uint64_t& nonce) {
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+  unsigned char   buf[sizeof(uint64_t)];
+  int64_t blockPos    = desc.info.attrsBlocks[BUNDLE_FILE_NONCE];
+  int64_t blockOffset = 0;
+  int64_t len         = sizeof(buf);
+
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  if (!desc.nonceValid) {
+    if ((blockPos <= 0) || (ContentRead(blockPos, blockOffset, buf, &len) != sizeof(buf))) {
+      return false;
     }
 
-    // скопируем
-    memcpy((char *)dst + totalRead, m_AesBuffer, (rsize_t)read);
+    desc.nonce = 0;
 
-    // сдвинем счетчики
-    totalRead += read;
-    remain    -= read;
+    for (int i = sizeof(buf) - 1; i >= 0; i--) {
+      desc.nonce = (desc.nonce << 8) | buf[i];
+    }
+    desc.nonceValid = true;
   }
+  nonce = desc.nonce;
 
-  // вернем результат
-  return totalRead;
+  // все ок
+  return true;
 }
 
-// запись данных с шифрованием
-int64_t CBundleFile::CryptoContentWrite(int64_t   & blockPos,
-                                        int64_t   & blockOffset,
-                                        const void *src,
-                                        int64_t     srcLen,
+// сохранение nonce AES-CTR файла. вызывается под блокировкой на запись
+bool CBundleFile::NonceSet(int idx, uint64_t nonce) {
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+  unsigned char   buf[sizeof(uint64_t)];
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = (unsigned char)(nonce >> (8 * i));
+  }
+
+  desc.nonceValid = false;
+
+  if (BundleAttributeSet(idx, BUNDLE_FILE_NONCE, buf, sizeof(buf), nullptr) != sizeof(buf)) {
+    return false;
+  }
+  desc.nonce      = nonce;
+  desc.nonceValid = true;
+
+  // все ок
+  return true;
+}
+
+// поиск по пути. сначала расшифровываются заголовки с тем же ключевым хэшем
+// пути, затем по порядку заголовки без хэша (старые бандлы). вызывается под
+// блокировкой бандла
+bool CBundleFile::PathFind(uint64_t hash, const char *path, size_t len, size_t& idx) {
+  {
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+    if (m_filesIdx->Find(hash, path, len, idx) && (idx < m_filesDesc->size())) {
+      return true;
+    }
+  }
+
+  // кандидаты по хэшу (таблица не меняется до следующей инициализации)
+  if (!m_tagsItems->empty()) {
+    uint16_t tag = BundleNameTag(&m_AesPathContext->ctxEnc, path, len);
+
+    for (uint32_t k = (*m_tagsStart)[tag]; k < (*m_tagsStart)[tag + 1]; k++) {
+      if ((*m_tagsItems)[k] < m_filesDesc->size()) {
+        PathGet((*m_tagsItems)[k]);
+      }
+    }
+  }
+
+  for (;;) {
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+      if (m_filesIdx->Find(hash, path, len, idx) && (idx < m_filesDesc->size())) {
+        return true;
+      }
+    }
+
+    // расшифруем следующий
+    if (PathsResolve(m_pathsNext, 1, m_tagsItems->empty())) {
+      continue;
+    }
+
+    // все разобраны, дождемся расшифровываемых другими потоками
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+      if (m_pathsBusy == 0) {
+        return m_filesIdx->Find(hash, path, len, idx) && (idx < m_filesDesc->size());
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+
+// расшифровка следующих по порядку count путей с позиции cursor (all = false -
+// только заголовков без ключевого хэша). возвращает false, если таких
+// нерасшифрованных путей не осталось. вызывается под блокировкой бандла
+bool CBundleFile::PathsResolve(size_t& cursor, size_t count, bool all) {
+  std::string path;
+  uint16_t    tag = 0;
+
+  for (size_t n = 0; n < count; n++) {
+    size_t idx = 0;
+
+    // займем заголовок
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+      while ((cursor < m_filesDesc->size())
+             && ((*m_filesDesc)[cursor].pathValid
+                 || (!all && BundleNameTagGet((*m_filesDesc)[cursor].info, tag)))) {
+        cursor++;
+      }
+
+      if (cursor >= m_filesDesc->size()) {
+        return false;
+      }
+      idx = cursor++;
+      m_pathsBusy++;
+    }
+
+    // расшифруем вне лока состояния
+    PathLoad(idx, path);
+
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+    PathStore(idx, path);
+    m_pathsBusy--;
+  }
+
+  // вернем результат
+  return true;
+}
+
+// таблица заголовков по ключевому хэшу пути (подсчетом: число заголовков
+// на каждое значение хэша, затем индексы подряд)
+void CBundleFile::TagsBuild() {
+  uint16_t tag = 0;
+
+  m_tagsStart->assign(0x10000 + 1, 0);
+
+  for (size_t i = 1, j = m_filesDesc->size(); i < j; i++) {
+    if (BundleNameTagGet((*m_filesDesc)[i].info, tag)) {
+      (*m_tagsStart)[tag + 1]++;
+    }
+  }
+
+  for (size_t i = 1; i < m_tagsStart->size(); i++) {
+    (*m_tagsStart)[i] += (*m_tagsStart)[i - 1];
+  }
+
+  // хэшей нет - бандл старого формата
+  if (m_tagsStart->back() == 0) {
+    m_tagsStart->clear();
+    return;
+  }
+
+  CNameTags next(m_tagsStart->begin(), m_tagsStart->end() - 1);
+  m_tagsItems->resize(m_tagsStart->back());
+
+  for (size_t i = 1, j = m_filesDesc->size(); i < j; i++) {
+    if (BundleNameTagGet((*m_filesDesc)[i].info, tag)) {
+      (*m_tagsItems)[next[tag]++] = (uint32_t)i;
+    }
+  }
+}
+
+// фоновая расшифровка путей порциями. между порциями блокировка
+// освобождается, чтобы не задерживать запись
+void CBundleFile::PathsWorker() {
+  size_t next = 1;
+
+  // без хэшей путей поиск идет тем же курсором, иначе - своим
+  size_t& cursor = m_tagsItems->empty() ? m_pathsNext : next;
+
+  while (!m_pathsStop) {
+    CBundleReadLock locker(m_locker);
+
+    if (!m_initialized || !PathsResolve(cursor, BUNDLE_PATHS_BATCH, true)) {
+      break;
+    }
+  }
+}
+
+// остановка фоновой расшифровки путей
+void CBundleFile::PathsStop() {
+  if (m_pathsThread.joinable()) {
+    m_pathsStop = true;
+    m_pathsThread.join();
+  }
+  m_pathsStop = false;
+}
+
+// чтение каталога запечатанного бандла
+bool CBundleFile::ReadSealed() {
+  BundleSealInfo seal;
+  BundleFileDesc desc;
+  CBundleBuffer  dir;
+  int64_t size = m_bundle->Size();
+
+  m_sealed = false;
+  m_sealNames->clear();
+
+  // читаем окончание бандла
+  if ((size < (int64_t)(sizeof(BundleInfo) + sizeof(seal)))
+      || (m_bundle->ReadAt(size - sizeof(seal), &seal, sizeof(seal), false) != sizeof(seal))
+      || (memcmp(seal.sealSign, BUNDLE_SEAL_SIGNATURE, sizeof(BUNDLE_SEAL_SIGNATURE)) != 0)) {
+    return false;
+  }
+
+  // проверим каталог
+  if ((seal.filesCount <= 0) || (seal.dirPos < (int64_t)sizeof(BundleInfo))
+      || (seal.dirPos + seal.dirSize != size - (int64_t)sizeof(seal))
+      || (seal.dirSize < (int64_t)(seal.filesCount * sizeof(BundleFileInfo)))
+      || (((seal.dirSize - seal.filesCount * sizeof(BundleFileInfo)) % AES_BLOCK_SIZE) != 0)) {
+    return false;
+  }
+
+  // читаем весь каталог одним чтением
+  dir.resize((size_t)seal.dirSize);
+
+  if (m_bundle->ReadAt(seal.dirPos, &dir[0], dir.size(), true) != dir.size()) {
+    return false;
+  }
+
+  // добавим заголовки. каждый атрибут лежит одним блоком, индекс блоков
+  // данных строится по нему при первом обращении
+  for (int i = 0; i < seal.filesCount; i++) {
+    memcpy(&desc.info, &dir[i * sizeof(BundleFileInfo)], sizeof(BundleFileInfo));
+    desc.infoPos = sizeof(BundleFileInfo) * i;
+    desc.extents.clear();
+    desc.extentsValid = false;
+    desc.curBlock     = desc.info.attrsBlocks[BUNDLE_FILE_DATA];
+    m_filesDesc->push_back(desc);
+  }
+
+  // имена расшифруем при инициализации
+  m_sealNames->assign(dir.begin() + seal.filesCount * sizeof(BundleFileInfo), dir.end());
+  m_infoNext = seal.filesCount * sizeof(BundleFileInfo);
+  m_sealed   = true;
+
+  // все ок
+  return true;
+}
+
+// расшифровка имен из каталога запечатанного бандла
+bool CBundleFile::ReadSealedPaths() {
+  CBundleBuffer names(*m_sealNames);
+  size_t pos = 0;
+
+  // расшифруем разом
+  if (!names.empty()) {
+    BundleAesEcb(&m_AesPathContext->ctxDec, MBEDTLS_AES_DECRYPT, &names[0], names.size());
+  }
+
+  m_filesIdx->Reserve(m_filesDesc->size());
+
+  // разберем: длина (2 байта) и имя для каждого файла кроме нулевого
+  for (size_t i = 1, j = m_filesDesc->size(); i < j; i++) {
+    if (pos + 2 > names.size()) {
+      return false;
+    }
+    size_t len = names[pos] | (names[pos + 1] << 8);
+    pos += 2;
+
+    if (pos + len > names.size()) {
+      return false;
+    }
+    const char *path = (const char *)&names[pos];
+    pos += len;
+
+    // добавим в индекс по пути
+    m_filesIdx->Set(path, len, i);
+    (*m_filesDesc)[i].path.assign(path, len);
+    (*m_filesDesc)[i].pathValid = true;
+    m_pathsResolved++;
+  }
+
+  // все ок
+  return true;
+}
+
+// шифрование/расшифровка данных файла (большие объемы - в пуле потоков)
+void CBundleFile::CryptoProcess(AesContext *cryptoContext, int mode,
+                                const unsigned char *src, unsigned char *dst, size_t size) {
+  mbedtls_aes_context *ctx = mode == MBEDTLS_AES_ENCRYPT ? &cryptoContext->ctxEnc
+                             : &cryptoContext->ctxDec;
+
+  if (m_cryptoPool != nullptr) {
+    m_cryptoPool->Process(ctx, mode, src, dst, size);
+  } else {
+    BundleAesEcb(ctx, mode, src, dst, size);
+  }
+}
+
+// чтение данных с последующей расшифровкой
+int64_t CBundleFile::CryptoContentRead(int64_t& blockPos, int64_t& blockOffset,
+                                       void *dst, int64_t *dstLen, void *cryptoContext) {
+  // проверки
+  if ((cryptoContext == nullptr) || (dst == nullptr) || (dstLen == nullptr)
+      || (m_AesBufferSize == 0)) {
+    return 0;
+  }
+
+  if ((*dstLen % AES_BLOCK_SIZE) != 0) {
+    return 0;
+  }
+
+  // потоковое чтение: порция расшифровывается в фоне, пока читается
+  // следующая
+  if (m_cryptoStreaming && (m_cryptoPool != nullptr)
+      && (*dstLen > BUNDLE_CRYPTO_STREAM_CHUNK)) {
+    return CryptoContentStream(blockPos, blockOffset, dst, dstLen,
+                               (AesContext *)cryptoContext);
+  }
+
+  // читаем сразу в dst порциями и расшифровываем на месте, пока данные
+  // в кэше процессора
+  int64_t remain    = *dstLen;
+  int64_t totalRead = 0;
+
+  while (remain > 0) {
+    unsigned char *data = (unsigned char *)dst + totalRead;
+    int64_t toRead      = std::min(remain, (int64_t)m_AesBufferSize);
+    int64_t read        = ContentRead(blockPos, blockOffset, data, &toRead);
+
+    // проверим, есть ли выровненные данные?
+    if (((read % AES_BLOCK_SIZE) != 0) || (read <= 0)) {
+      break;
+    }
+
+    // расшифруем
+    CryptoProcess((AesContext *)cryptoContext, MBEDTLS_AES_DECRYPT, data, data,
+                  (size_t)read);
+
+    // сдвинем счетчики
+    totalRead += read;
+    remain    -= read;
+  }
+
+  // вернем результат
+  return totalRead;
+}
+
+// потоковое чтение с расшифровкой в фоне
+int64_t CBundleFile::CryptoContentStream(int64_t& blockPos, int64_t& blockOffset,
+                                         void *dst, int64_t *dstLen,
+                                         AesContext *cryptoContext) {
+  CBundleCryptoPool::Batch batch;
+  int64_t remain    = *dstLen;
+  int64_t totalRead = 0;
+
+  while (remain > 0) {
+    unsigned char *data = (unsigned char *)dst + totalRead;
+    int64_t toRead      = std::min(remain, (int64_t)BUNDLE_CRYPTO_STREAM_CHUNK);
+    int64_t read        = ContentRead(blockPos, blockOffset, data, &toRead);
+
+    // проверим, есть ли выровненные данные?
+    if (((read % AES_BLOCK_SIZE) != 0) || (read <= 0)) {
+      break;
+    }
+
+    // отдадим на расшифровку и читаем дальше
+    m_cryptoPool->Submit(batch, &cryptoContext->ctxDec, MBEDTLS_AES_DECRYPT, data, data,
+                         (size_t)read);
+
+    // сдвинем счетчики
+    totalRead += read;
+    remain    -= read;
+  }
+
+  // дождемся расшифровки (и поможем с ней)
+  m_cryptoPool->Wait(batch);
+
+  // вернем результат
+  return totalRead;
+}
+
+// чтение данных с расшифровкой AES-CTR. pos - логическое смещение данных
+// в файле, выравнивание не нужно
+int64_t CBundleFile::CtrContentRead(int64_t& blockPos, int64_t& blockOffset, int64_t pos,
+                                    void *dst, int64_t *dstLen, AesContext *cryptoContext,
+                                    uint64_t nonce) {
+  // проверки
+  if ((cryptoContext == nullptr) || (dst == nullptr) || (dstLen == nullptr)
+      || (m_AesBufferSize == 0)) {
+    return 0;
+  }
+
+  // читаем сразу в dst порциями и расшифровываем на месте
+  int64_t remain    = *dstLen;
+  int64_t totalRead = 0;
+
+  while (remain > 0) {
+    unsigned char *data = (unsigned char *)dst + totalRead;
+    int64_t toRead      = std::min(remain, (int64_t)m_AesBufferSize);
+    int64_t read        = ContentRead(blockPos, blockOffset, data, &toRead);
+
+    if (read <= 0) {
+      break;
+    }
+
+    // расшифруем
+    BundleAesCtr(&cryptoContext->ctxEnc, nonce, pos + totalRead, data, data, (size_t)read);
+
+    // сдвинем счетчики
+    totalRead += read;
+    remain    -= read;
+
+    // конец файла
+    if (read != toRead) {
+      break;
+    }
+  }
+
+  // вернем результат
+  return totalRead;
+}
+
+// запись данных с шифрованием AES-CTR. pos - логическое смещение данных
+// в файле, выравнивание и добивка не нужны
+int64_t CBundleFile::CtrContentWrite(int64_t& blockPos, int64_t& blockOffset, int64_t pos,
+                                     const void *src, int64_t srcLen, int64_t *firstBlock,
+                                     AesContext *cryptoContext, uint64_t nonce) {
+  // проверки
+  if ((cryptoContext == nullptr) || (src == nullptr) || (m_AesBufferSize == 0)) {
+    return 0;
+  }
+
+  // возьмем свободное окно
+  void *buffer = AesBufferAcquire();
+
+  if (buffer == nullptr) {
+    return 0;
+  }
+
+  // шифруем из src в окно и пишем окно на диск
+  int64_t remain     = srcLen;
+  int64_t totalWrote = 0;
+
+  while (remain > 0) {
+    int64_t toWrite = std::min(remain, (int64_t)m_AesWindowSize);
+
+    BundleAesCtr(&cryptoContext->ctxEnc, nonce, pos + totalWrote,
+                 (const unsigned char *)src + totalWrote, (unsigned char *)buffer,
+                 (size_t)toWrite);
+
+    // запишем на диск
+    int64_t wrote = ContentWrite(blockPos, blockOffset, buffer, toWrite, firstBlock);
+
+    if (wrote > 0) {
+      totalWrote += wrote;
+      remain     -= wrote;
+    }
+
+    // проверим
+    if (wrote != toWrite) {
+      break;
+    }
+  }
+
+  // вернем окно
+  AesBufferRelease(buffer);
+
+  // вернем результат
+  return totalWrote;
+}
+
+// запись данных с шифрованием
+int64_t CBundleFile::CryptoContentWrite(int64_t   & blockPos,
+                                        int64_t   & blockOffset,
+                                        const void *src,
+                                        int64_t     srcLen,
                                         int64_t    *firstBlock,
                                         void       *cryptoContext,
                                         bool        padding) {
   // проверки
-  if ((cryptoContext == nullptr) || (src == nullptr) || (m_AesBuffer == nullptr)
-      || (m_AesBufferSize == 0)) {
+  if ((cryptoContext == nullptr) || (src == nullptr) || (m_AesBufferSize == 0)) {
+    return 0;
+  }
+
+  if (((srcLen % AES_BLOCK_SIZE) != 0) && !padding) {
+    return 0;
+  }
+
+  // возьмем свободный буфер
+  void *buffer = AesBufferAcquire();
+
+  if (buffer == nullptr) {
     return 0;
   }
 
-  if (((srcLen % AES_BLOCK_SIZE) != 0) && !padding) {
-    return 0;
+  // шифруем из src в окно и пишем окно на диск
+  int64_t remain     = srcLen;
+  int64_t totalWrote = 0;
+
+  while (remain > 0) {
+    const unsigned char *data = (const unsigned char *)src + totalWrote;
+    int64_t toRead            = std::min(remain, (int64_t)m_AesWindowSize);
+
+    if (toRead <= 0) {
+      break;
+    }
+
+    // зашифруем целые блоки
+    int64_t whole = toRead - toRead % AES_BLOCK_SIZE;
+
+    CryptoProcess((AesContext *)cryptoContext, MBEDTLS_AES_ENCRYPT, data,
+                  (unsigned char *)buffer, (size_t)whole);
+
+    // неполный блок в конце добьем нулями
+    int64_t toWrite = whole;
+
+    if (toRead > whole) {
+      unsigned char *tail = (unsigned char *)buffer + whole;
+
+      memcpy(tail, data + whole, (size_t)(toRead - whole));
+      memset(tail + toRead - whole, 0, (size_t)(AES_BLOCK_SIZE - (toRead - whole)));
+      CryptoProcess((AesContext *)cryptoContext, MBEDTLS_AES_ENCRYPT, tail, tail,
+                    AES_BLOCK_SIZE);
+      toWrite += AES_BLOCK_SIZE;
+    }
+
+    // запишем на диск
+    int64_t wrote = ContentWrite(blockPos, blockOffset, buffer, toWrite,
+                                 firstBlock);
+
+    // проверим
+    if (wrote != toWrite) {
+      break;
+    }
+
+    // сдвинем счетчики
+    totalWrote += toRead;
+    remain     -= toRead;
+  }
+
+  // вернем буфер
+  AesBufferRelease(buffer);
+
+  // вернем результат
+  return totalWrote;
+}
+
+// чтение контента
+int64_t CBundleFile::ContentRead(int64_t& blockPos, int64_t& blockOffset,
+                                 void *dst, int64_t  *dstLen) {
+  int64_t res    = 0;
+  int64_t remain = 0;
+
+  // проверки
+  if (dstLen == nullptr) {
+    return 0;
+  }
+
+  // проверим на операцию запроса длины
+  if (dst == nullptr) {
+    // посчитаем размер
+    CalculateSize(blockPos, blockOffset, dstLen);
+    return 0;
+  }
+
+  // читаем данные
+  remain = *dstLen;
+
+  BundleBlock bb;
+
+  for (bool loaded = BlockLoad(blockPos, bb); loaded && remain > 0;) {
+    int64_t toRead = std::min(bb.size - blockOffset, remain);
+
+    if (toRead < 0) {
+      break;
+    }
+
+    if (toRead > 0) {
+      const void *src = m_bundle->Borrow(blockPos + blockOffset + sizeof(BundleBlock),
+                                         (size_t)toRead);
+      size_t read = (size_t)toRead;
+
+      // читаем из отображения или из файла
+      if (src != nullptr) {
+        memcpy((char *)dst + res, src, read);
+      } else {
+        read = m_bundle->ReadAt(blockPos + blockOffset + sizeof(BundleBlock),
+                                (char *)dst + res, (size_t)toRead, false);
+      }
+
+      // сместим счетчики
+      res         += read;
+      remain      -= read;
+      blockOffset += read;
+
+      // тут выход в случае ошибки
+      if (read != (size_t)toRead) {
+        return res;
+      }
+    }
+
+    // если нужно - смещаемся к следующему блоку
+    if ((remain > 0) && (bb.nextBlock > 0)) {
+      blockPos    = bb.nextBlock;
+      blockOffset = 0;
+      loaded      = BlockLoad(blockPos, bb);
+    } else {
+      loaded = false;
+    }
+  }
+
+  // вернем результат
+  return res;
+}
+
+// запись контента
+int64_t CBundleFile::ContentWrite(int64_t& blockPos, int64_t& blockOffset,
+                                  const void *src, int64_t srcLen, int64_t *firstBlock) {
+  int64_t res     = 0;
+  int64_t remain  = srcLen;
+  BundleBlock bb;
+  bool    loaded  = false;
+
+  // проверки
+  if (src == nullptr) {
+    return 0;
+  }
+
+  // пишем данные
+  for (loaded = BlockLoad(blockPos, bb); loaded && remain > 0;) {
+    int64_t toWrite = std::min(bb.size - blockOffset, remain);
+
+    if (toWrite < 0) {
+      break;
+    }
+
+    if (toWrite > 0) {
+      // пишем в файл
+      size_t wrote = m_bundle->WriteAt(blockPos + blockOffset + sizeof(BundleBlock),
+                                       (char *)src + res, (size_t)toWrite, false);
+
+      // сместим счетчики
+      res         += wrote;
+      remain      -= wrote;
+      blockOffset += wrote;
+
+      // тут выход в случае ошибки
+      if (wrote != (size_t)toWrite) {
+        return res;
+      }
+    }
+
+    // если нужно - смещаемся к следующему блоку
+    if (bb.nextBlock > 0) {
+      if (remain > 0) {
+        blockPos    = bb.nextBlock;
+        blockOffset = 0;
+        loaded      = BlockLoad(blockPos, bb);
+
+        // проверим на ошибку
+        if (!loaded) {
+          remain = 0;
+        }
+      }
+    } else {
+      break;
+    }
+  }
+
+  // проверим, хватило ли блоков?
+  while (remain > 0) {
+    // попробуем расширить последний блок за счет свободного места за ним
+    if (loaded) {
+      int64_t end   = blockPos + bb.size + sizeof(BundleBlock);
+      int64_t taken = SpaceTake(end, remain);
+      int64_t grow  = taken;
+
+      // блок в конце бандла можно расширять сколько угодно
+      if ((grow == 0) && (end == m_bundle->Size())) {
+        grow = remain;
+      }
+
+      if (grow > 0) {
+        // запишем данные
+        if (m_bundle->WriteAt(end, (char *)src + res, (size_t)grow, false) != (size_t)grow) {
+          SpaceRelease(end, taken);
+          break;
+        }
+
+        // установим новый размер блока
+        bb.size += grow;
+        BlockStore(blockPos, bb);
+
+        // сместим счетчики
+        res        += grow;
+        remain     -= grow;
+        blockOffset = bb.size;
+        continue;
+      }
+    }
+
+    // выясним, куда вставлять: в свободное место или в конец бандла
+    int64_t pos  = 0;
+    int64_t size = 0;
+
+    if (!SpaceAllocate(remain + sizeof(BundleBlock), pos, size)) {
+      pos  = m_bundle->Size();
+      size = remain + sizeof(BundleBlock);
+    }
+
+    BundleBlock bbn;
+    bbn.size = size - sizeof(BundleBlock);
+
+    // вставим новый блок
+    if (!BlockStore(pos, bbn) ||
+        (m_bundle->WriteAt(pos + sizeof(BundleBlock), (char *)src + res,
+                           (size_t)bbn.size, false) != (size_t)bbn.size)) {
+      SpaceRelease(pos, size);
+      break;
+    }
+
+    // вставим новый блок в список
+    if (loaded) {
+      bb.nextBlock = pos;
+      BlockStore(blockPos, bb);
+    } else {
+      // запомним позицию первого блока
+      if (firstBlock != nullptr) {
+        *firstBlock = pos;
+      }
+    }
+
+    // сместим счетчики
+    res        += bbn.size;
+    remain     -= bbn.size;
+    blockOffset = bbn.size;
+    blockPos    = pos;
+    bb          = bbn;
+    loaded      = true;
+  }
+
+  // вернем результат
+  return res;
+}
+
+// получение буфера для криптографии. параллельные чтения получают разные
+// буферы, новые выделяются по мере надобности и остаются до Initialize
+void * CBundleFile::AesBufferAcquire() {
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+  void *res = nullptr;
+
+  if (!m_AesBuffers->empty()) {
+    res = m_AesBuffers->back();
+    m_AesBuffers->pop_back();
+  } else {
+    res = malloc(m_AesWindowSize);
+  }
+
+  // вернем результат
+  return res;
+}
+
+// возврат буфера для криптографии
+void CBundleFile::AesBufferRelease(void *buffer) {
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  m_AesBuffers->push_back(buffer);
+}
+
+void CBundleFile::AesBuffersFree() {
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+  for (size_t i = 0; i < m_AesBuffers->size(); i++) {
+    free((*m_AesBuffers)[i]);
+  }
+  m_AesBuffers->clear();
+}
+
+// вычисление оставшегося размера
+void CBundleFile::CalculateSize(int64_t blockPos, int64_t blockOffset,
+                                int64_t *dstLen) {
+  int64_t res = 0;
+
+  // проверки
+  if ((blockPos < (int64_t)sizeof(m_info)) || (dstLen == nullptr)) {
+    return;
+  }
+
+  // считаем по размеру блоков
+  for (BundleBlock bl; BlockLoad(blockPos, bl); blockPos = bl.nextBlock) {
+    res += bl.size;
+  }
+
+  // отнимем смещение в первом блоке
+  res -= res > blockOffset ? blockOffset : res;
+
+  // выставим значение
+  *dstLen = res;
+}
+
+// загрузка блока. блоки отдаются копией: кэш ограничен по объему, и запись
+// может быть вытеснена параллельным чтением
+bool CBundleFile::BlockLoad(int64_t blockPos, BundleBlock& block) {
+  // проверки
+  if (blockPos < (int64_t)sizeof(m_info)) {
+    return false;
+  }
+
+  // проверим, есть ли блок в кэше
+  {
+    std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+
+    if (m_blocksCache->Find(blockPos, block)) {
+      return true;
+    }
+  }
+
+  // читаем без лока (параллельное чтение того же блока даст то же значение)
+  if (m_bundle->ReadAt(blockPos, &block, sizeof(block), false) != sizeof(block)) {
+    return false;
+  }
+
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+  m_blocksCache->Put(blockPos, block);
+
+  // вернем результат
+  return true;
+}
+
+// сохранение блока
+bool CBundleFile::BlockStore(int64_t blockPos, const BundleBlock& block) {
+  // проверки
+  if (blockPos < (int64_t)sizeof(m_info)) {
+    return false;
+  }
+
+  // сохраним
+  if (m_bundle->WriteAt(blockPos, (void *)&block, sizeof(block), true) != sizeof(block)) {
+    return false;
+  }
+
+  std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+  m_blocksCache->Put(blockPos, block);
+  m_blocksStored++;
+
+  // вернем результат
+  return true;
+}
+
+// построение карты свободного места по цепочкам живых файлов
+bool CBundleFile::SpaceRebuild() {
+  std::vector<std::pair<int64_t, int64_t> > used;
+  int64_t total = m_bundle->Size();
+  int64_t limit = total / sizeof(BundleBlock);
+
+  m_freeExtents->clear();
+  m_freeBySize->clear();
+  m_freeBytes = 0;
+
+  // соберем все занятые блоки
+  for (size_t i = 0, j = m_filesDesc->size(); i < j; i++) {
+    if (((*m_filesDesc)[i].info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0) {
+      continue;
+    }
+
+    for (int l = 0; l < BUNDLE_ATTRS_COUNT; l++) {
+      BundleBlock bb;
+
+      for (int64_t pos = (*m_filesDesc)[i].info.attrsBlocks[l];
+           pos > 0 && pos < total && limit > 0 && BlockLoad(pos, bb);
+           pos = bb.nextBlock, limit--) {
+        used.push_back(std::make_pair(pos, pos + bb.size + (int64_t)sizeof(BundleBlock)));
+      }
+    }
+  }
+
+  // защита от зацикленных цепочек. в этом случае переиспользуем только то,
+  // что будет освобождено в текущей сессии
+  if (limit <= 0) {
+    m_freeValid = true;
+    return false;
+  }
+
+  // свободно все, что лежит между занятыми блоками
+  int64_t cur = sizeof(BundleInfo);
+  std::sort(used.begin(), used.end());
+
+  for (size_t i = 0, j = used.size(); i < j; i++) {
+    if (used[i].first > cur) {
+      (*m_freeExtents)[cur] = used[i].first - cur;
+      m_freeBySize->insert(std::make_pair(used[i].first - cur, cur));
+      m_freeBytes += used[i].first - cur;
+    }
+    cur = std::max(cur, used[i].second);
+  }
+
+  if (total > cur) {
+    (*m_freeExtents)[cur] = total - cur;
+    m_freeBySize->insert(std::make_pair(total - cur, cur));
+    m_freeBytes += total - cur;
+  }
+
+  // все ок
+  m_freeValid = true;
+  return true;
+}
+
+// освобождение участка с объединением соседних
+void CBundleFile::SpaceRelease(int64_t pos, int64_t size) {
+  // проверки
+  if (!m_freeValid || (pos < (int64_t)sizeof(BundleInfo)) || (size <= 0)) {
+    return;
+  }
+  m_freeBytes += size;
+
+  // объединим с предыдущим участком
+  CFreeExtents::iterator it = m_freeExtents->lower_bound(pos);
+
+  if (it != m_freeExtents->begin()) {
+    CFreeExtents::iterator prev = it;
+    --prev;
+
+    if (prev->first + prev->second == pos) {
+      m_freeBySize->erase(std::make_pair(prev->second, prev->first));
+      pos  = prev->first;
+      size += prev->second;
+      m_freeExtents->erase(prev);
+    }
+  }
+
+  // объединим со следующим участком
+  if ((it != m_freeExtents->end()) && (it->first == pos + size)) {
+    m_freeBySize->erase(std::make_pair(it->second, it->first));
+    size += it->second;
+    m_freeExtents->erase(it);
+  }
+
+  // запомним
+  (*m_freeExtents)[pos] = size;
+  m_freeBySize->insert(std::make_pair(size, pos));
+}
+
+// освобождение цепочки блоков
+void CBundleFile::SpaceReleaseChain(int64_t blockPos) {
+  int64_t limit = m_freeValid ? m_bundle->Size() / sizeof(BundleBlock) : 0;
+
+  for (BundleBlock bb; blockPos > 0 && limit > 0 && BlockLoad(blockPos, bb); limit--) {
+    int64_t next = bb.nextBlock;
+
+    // освободим блок и уберем его из кэша
+    SpaceRelease(blockPos, bb.size + sizeof(BundleBlock));
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+      m_blocksCache->Erase(blockPos);
+    }
+
+    blockPos = next;
+  }
+}
+
+// выделение места под блок. выбирает наименьший подходящий участок, иначе -
+// наибольший из имеющихся (тогда размер может быть меньше запрошенного)
+bool CBundleFile::SpaceAllocate(int64_t need, int64_t& pos, int64_t& size) {
+  // проверки
+  if (!m_freeValid && !SpaceRebuild()) {
+    return false;
+  }
+
+  if (m_freeBySize->empty()) {
+    return false;
+  }
+
+  // ищем наименьший подходящий участок
+  CFreeBySize::iterator it = m_freeBySize->lower_bound(std::make_pair(need, (int64_t)0));
+
+  if (it == m_freeBySize->end()) {
+    --it;
+
+    // слишком маленькие участки не используем
+    if (it->first < BUNDLE_FREE_MIN_EXTENT) {
+      return false;
+    }
+  }
+
+  // заберем участок
+  pos  = it->second;
+  size = std::min(need, it->first);
+
+  int64_t rest = it->first - size;
+  m_freeExtents->erase(pos);
+  m_freeBySize->erase(it);
+  m_freeBytes -= size;
+
+  // остаток вернем обратно
+  if (rest > 0) {
+    (*m_freeExtents)[pos + size] = rest;
+    m_freeBySize->insert(std::make_pair(rest, pos + size));
+  }
+
+  // все ок
+  return true;
+}
+
+// забирает свободное место, начинающееся строго с заданной позиции.
+// возвращает размер полученного участка
+int64_t CBundleFile::SpaceTake(int64_t pos, int64_t maxSize) {
+  // проверки
+  if (!m_freeValid && !SpaceRebuild()) {
+    return 0;
+  }
+
+  CFreeExtents::iterator it = m_freeExtents->find(pos);
+
+  if (it == m_freeExtents->end()) {
+    return 0;
+  }
+
+  // заберем участок
+  int64_t size = std::min(maxSize, it->second);
+  int64_t rest = it->second - size;
+
+  m_freeBySize->erase(std::make_pair(it->second, it->first));
+  m_freeExtents->erase(it);
+  m_freeBytes -= size;
+
+  // остаток вернем обратно
+  if (rest > 0) {
+    (*m_freeExtents)[pos + size] = rest;
+    m_freeBySize->insert(std::make_pair(rest, pos + size));
+  }
+
+  // вернем результат
+  return size;
+}
+
+// выделение места под блок до смещения limit. берет наименьший участок не
+// меньше need, иначе - наибольший не меньше minSize целиком (тогда размер
+// меньше запрошенного). участки перебираются по размеру, начиная с
+// подходящих, до первого лежащего до limit
+bool CBundleFile::SpaceAllocateBelow(int64_t need, int64_t minSize, int64_t limit, int64_t& pos,
+                                     int64_t& size) {
+  // проверки
+  if (!m_freeValid && !SpaceRebuild()) {
+    return false;
+  }
+
+  // участки до limit целиком лежат перед ним (занятое место не пересекают)
+  for (CFreeBySize::iterator it = m_freeBySize->lower_bound(std::make_pair(need, (int64_t)0));
+       it != m_freeBySize->end(); ++it) {
+    if (it->second < limit) {
+      pos  = it->second;
+      size = SpaceTake(pos, need);
+      return size == need;
+    }
+  }
+
+  for (CFreeBySize::reverse_iterator it = m_freeBySize->rbegin();
+       (it != m_freeBySize->rend()) && (it->first >= minSize); ++it) {
+    if (it->second < limit) {
+      // заберем участок целиком
+      pos  = it->second;
+      size = SpaceTake(pos, it->first);
+      return size > 0;
+    }
+  }
+
+  // места нет
+  return false;
+}
+
+// отрезание свободного места в конце бандла. возвращает размер отрезанного
+int64_t CBundleFile::SpaceTrim() {
+  // проверки
+  if (!m_freeValid || m_freeExtents->empty() || !m_bundle->Flush()) {
+    return 0;
+  }
+
+  CFreeExtents::reverse_iterator it = m_freeExtents->rbegin();
+  int64_t pos  = it->first;
+  int64_t size = it->second;
+
+  if ((pos + size != m_bundle->Size()) || !m_bundle->Truncate(pos)) {
+    return 0;
+  }
+
+  // уберем участок из карты
+  m_freeBySize->erase(std::make_pair(size, pos));
+  m_freeExtents->erase(pos);
+  m_freeBytes -= size;
+
+  // вернем результат
+  return size;
+}
+
+// загрузка информации о файле
+BundleFileInfo * CBundleFile::InfoLoad(int64_t /*infoPos*/) {
+  return nullptr;
+}
+
+// сохранение информации о файле
+bool CBundleFile::InfoStore(int64_t& infoPos, BundleFileInfo& info,
+                            bool infoSystem) {
+  // установим позицию
+  if (!infoSystem) {
+    if (infoPos <= 0) {
+      // новый заголовок пишем после последнего использованного: заголовки
+      // удаленных файлов в m_filesDesc после переоткрытия не попадают
+      infoPos = std::max(m_infoNext, (int64_t)sizeof(BundleFileInfo));
+
+      // проверим, нужно ли добавлять заголовки
+      if (FileSize(0) <= infoPos) {
+        AddEmptyHeaders(m_emptyHeadersCount);
+      }
+    }
+    m_infoNext = std::max(m_infoNext, infoPos + (int64_t)sizeof(BundleFileInfo));
+    FileSeek(0, infoPos, BUNDLE_FILE_ORIG_SET);
+  } else {
+    FileSeek(0, 0, BUNDLE_FILE_ORIG_SET);
+  }
+
+  // сохраним
+  return BundleAttributeSet(0, BUNDLE_FILE_DATA, &info, sizeof(info),
+                            nullptr) == sizeof(info);
+}
+
+// цепочки блоков всех атрибутов файла добавляются в chains. limit - сколько
+// блоков еще можно обойти. false - цепочки зациклены
+bool CBundleFile::ChainsCollect(size_t idx, CBundleChains& chains, int64_t& limit) {
+  int64_t total = m_bundle->Size();
+
+  for (int l = 0; l < BUNDLE_ATTRS_COUNT; l++) {
+    BundleChain chain;
+    BundleBlock bb;
+
+    for (int64_t pos = (*m_filesDesc)[idx].info.attrsBlocks[l];
+         pos > 0 && pos < total && limit > 0 && BlockLoad(pos, bb);
+         pos = bb.nextBlock, limit--) {
+      chain.blocks.push_back(pos);
+      chain.size += bb.size;
+    }
+
+    if (!chain.blocks.empty()) {
+      chain.idx  = (int)idx;
+      chain.type = l;
+      chains.push_back(chain);
+    }
+  }
+
+  // вернем результат
+  return limit > 0;
+}
+
+// сверка цепочек уплотнения с бандлом. первый вызов обходит все живые
+// файлы, следующие - только изменившиеся с прошлой сверки (по chainGen) и
+// созданные после нее; цепочки удаленных и изменившихся файлов остаются в
+// векторе без блоков, чтобы номера остальных не сдвигались
+bool CBundleFile::CompactRefresh(BundleCompactState& state) {
+  std::vector<size_t> files;
+  int64_t limit = m_bundle->Size() / sizeof(BundleBlock);
+  size_t  count = m_filesDesc->size();
+
+  if (state.valid && (state.gen == m_chainsGen)) {
+    return true;
+  }
+
+  if (!state.valid) {
+    state = BundleCompactState();
+
+    for (size_t i = 0; i < count; i++) {
+      files.push_back(i);
+    }
+  } else {
+    // уберем устаревшие цепочки
+    for (size_t c = 0; c < state.chains.size(); c++) {
+      BundleChain   & chain = state.chains[c];
+      BundleFileDesc& desc  = (*m_filesDesc)[chain.idx];
+
+      if (chain.blocks.empty()
+          || (((desc.info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0)
+              && (desc.chainGen == state.gens[chain.idx]))) {
+        continue;
+      }
+
+      for (size_t k = 0; k < chain.blocks.size(); k++) {
+        state.blocks.erase(chain.blocks[k]);
+      }
+      chain.blocks.clear();
+    }
+
+    for (size_t i = 0; i < count; i++) {
+      if ((i >= state.gens.size()) || ((*m_filesDesc)[i].chainGen != state.gens[i])) {
+        files.push_back(i);
+      }
+    }
+  }
+
+  state.gens.resize(count);
+
+  // обойдем цепочки заново
+  for (size_t j = 0; j < files.size(); j++) {
+    size_t i     = files[j];
+    size_t first = state.chains.size();
+
+    state.gens[i] = (*m_filesDesc)[i].chainGen;
+
+    if (((*m_filesDesc)[i].info.flags & BUNDLE_FILE_FLAG_EMPTY) != 0) {
+      continue;
+    }
+
+    if (!ChainsCollect(i, state.chains, limit)) {
+      return false;
+    }
+
+    for (size_t c = first; c < state.chains.size(); c++) {
+      for (size_t k = 0; k < state.chains[c].blocks.size(); k++) {
+        state.blocks[state.chains[c].blocks[k]] = std::make_pair(c, k);
+      }
+
+      if ((i != 0) && (state.chains[c].blocks.size() > 1)) {
+        state.fragmented.push_back(c);
+      }
+    }
+  }
+
+  state.gen   = m_chainsGen;
+  state.valid = true;
+
+  // все ок
+  return true;
+}
+
+// учет перенесенной цепочки c в карте блоков уплотнения (before - ее блоки
+// до переноса)
+void CBundleFile::CompactUpdate(BundleCompactState& state, size_t c,
+                                const std::vector<int64_t>& before) {
+  BundleChain& chain = state.chains[c];
+
+  for (size_t k = 0; k < before.size(); k++) {
+    state.blocks.erase(before[k]);
+  }
+
+  for (size_t k = 0; k < chain.blocks.size(); k++) {
+    state.blocks[chain.blocks[k]] = std::make_pair(c, k);
+  }
+
+  // перенос меняет chainGen файла, цепочки которого уже учтены
+  state.gens[chain.idx] = (*m_filesDesc)[chain.idx].chainGen;
+}
+
+// запись заголовка файла при уплотнении. заголовок нулевого файла лежит в
+// начале его первого блока (он не переносится) и пишется напрямую: запись
+// через цепочку пересчитала бы длину посреди переноса
+bool CBundleFile::CompactInfoStore(int idx) {
+  BundleFileDesc& desc = (*m_filesDesc)[idx];
+
+  if (idx == 0) {
+    return m_bundle->WriteAt(sizeof(BundleInfo) + sizeof(BundleBlock), &desc.info,
+                             sizeof(desc.info), true) == sizeof(desc.info);
+  }
+  return InfoStore(desc.infoPos, desc.info, false);
+}
+
+// перенос блоков first..first+count-1 цепочки одним блоком в свободное место
+// до limit. сначала пишется копия, затем одной записью на нее переключается
+// ссылка (заголовок файла или предыдущий блок), и только после этого
+// освобождаются старые блоки: сбой на любом шаге оставляет цепочку целой.
+// возвращает перенесенный объем, 0 - нет места, -1 - ошибка
+int64_t CBundleFile::CompactMove(BundleChain& chain, size_t first, size_t count, int64_t limit) {
+  BundleFileDesc& desc = (*m_filesDesc)[chain.idx];
+  std::vector<BundleBlock> old(count);
+  CBundleBuffer data;
+  BundleBlock nb;
+  int64_t pos       = 0;
+  int64_t size      = 0;
+  int64_t length    = 0;
+  int64_t lastBlock = 0;
+  bool    last      = (chain.type == BUNDLE_FILE_DATA) && (first + count == chain.blocks.size());
+  bool    ok        = true;
+
+  // заголовки переносимых блоков
+  for (size_t i = 0; i < count; i++) {
+    if (!BlockLoad(chain.blocks[first + i], old[i])) {
+      return -1;
+    }
+    nb.size += old[i].size;
+  }
+  nb.nextBlock = old[count - 1].nextBlock;
+
+  if (!SpaceAllocateBelow(nb.size + sizeof(BundleBlock), nb.size + sizeof(BundleBlock), limit,
+                          pos, size)) {
+    return 0;
+  }
+
+  // копия данных
+  data.resize((size_t)nb.size);
+
+  for (size_t i = 0, offset = 0; (i < count) && ok; offset += (size_t)old[i].size, i++) {
+    ok = (old[i].size == 0)
+         || (m_bundle->ReadAt(chain.blocks[first + i] + sizeof(BundleBlock), &data[offset],
+                              (size_t)old[i].size, true) == (size_t)old[i].size);
+  }
+
+  ok = ok && BlockStore(pos, nb)
+       && ((nb.size == 0)
+           || (m_bundle->WriteAt(pos + sizeof(BundleBlock), &data[0], (size_t)nb.size,
+                                 true) == (size_t)nb.size))
+       && m_bundle->Flush();
+
+  if (!ok) {
+    SpaceRelease(pos, size);
+    return -1;
+  }
+
+  // последний блок записан в заголовке файла: до переключения ссылка в
+  // заголовке снимается, иначе сбой оставил бы ее на освобожденный блок
+  if (last) {
+    length = DataLengthGet(desc, lastBlock);
+
+    if ((first > 0) && ((desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0)) {
+      desc.info.extFlags &= ~BUNDLE_FILE_EXT_LENGTH;
+      ok = CompactInfoStore(chain.idx);
+    }
+  }
+
+  // переключим ссылку
+  if (ok && (first == 0)) {
+    desc.info.attrsBlocks[chain.type] = pos;
+  } else if (ok) {
+    BundleBlock prev;
+
+    ok = BlockLoad(chain.blocks[first - 1], prev);
+    prev.nextBlock = pos;
+    ok = ok && BlockStore(chain.blocks[first - 1], prev);
+  }
+
+  if (!ok) {
+    SpaceRelease(pos, size);
+    return -1;
+  }
+  desc.chainGen++;
+  m_chainsGen++;
+
+  // курсор файла переедет вместе с данными, индекс блоков построится заново
+  if (chain.type == BUNDLE_FILE_DATA) {
+    for (size_t i = 0, offset = 0; i < count; offset += (size_t)old[i].size, i++) {
+      if (desc.curBlock == chain.blocks[first + i]) {
+        desc.curBlock     = pos;
+        desc.curBlockPos += offset;
+        break;
+      }
+    }
+    desc.extents.clear();
+    desc.extentsValid = false;
+  }
+
+  // заголовок файла (для первого блока это и есть переключение)
+  if (last) {
+    DataLengthSet(desc, length, pos);
+  }
+
+  if (((first == 0) || last) && !CompactInfoStore(chain.idx)) {
+    return -1;
+  }
+
+  // освободим старые блоки
+  for (size_t i = 0; i < count; i++) {
+    SpaceRelease(chain.blocks[first + i], old[i].size + sizeof(BundleBlock));
+    {
+      std::lock_guard<std::recursive_mutex> state(m_stateLocker);
+      m_blocksCache->Erase(chain.blocks[first + i]);
+    }
+  }
+
+  chain.blocks.erase(chain.blocks.begin() + first, chain.blocks.begin() + first + count);
+  chain.blocks.insert(chain.blocks.begin() + first, pos);
+
+  // вернем результат
+  return nb.size;
+}
+
+// перенос конца блока i (не больше part байт) отдельным блоком в свободное
+// место до limit. копия пишется заранее, переключение - одна запись
+// заголовка блока (новый размер и ссылка на копию). возвращает перенесенный
+// объем, 0 - нет места, -1 - ошибка
+int64_t CBundleFile::CompactSplit(BundleChain& chain, size_t i, int64_t part, int64_t limit) {
+  BundleFileDesc& desc = (*m_filesDesc)[chain.idx];
+  int64_t block        = chain.blocks[i];
+  CBundleBuffer data;
+  BundleBlock bb;
+  BundleBlock nb;
+  int64_t pos       = 0;
+  int64_t size      = 0;
+  int64_t keep      = 0;
+  int64_t length    = 0;
+  int64_t lastBlock = 0;
+  bool    last      = (chain.type == BUNDLE_FILE_DATA) && (i + 1 == chain.blocks.size());
+  bool    ok        = true;
+
+  if (!BlockLoad(block, bb) || (part <= 0) || (part >= bb.size)) {
+    return -1;
+  }
+
+  // подойдет и участок меньше запрошенного
+  if (!SpaceAllocateBelow(part + sizeof(BundleBlock),
+                          BUNDLE_COMPACT_MIN_PART + sizeof(BundleBlock), limit, pos, size)) {
+    return 0;
+  }
+
+  // граница остается выровненной на блок шифрования
+  nb.size      = std::min(part, size - (int64_t)sizeof(BundleBlock)) / AES_BLOCK_SIZE *
+                 AES_BLOCK_SIZE;
+  nb.nextBlock = bb.nextBlock;
+  keep         = bb.size - nb.size;
+
+  if (nb.size <= 0) {
+    SpaceRelease(pos, size);
+    return 0;
+  }
+
+  // лишнее вернем
+  SpaceRelease(pos + nb.size + sizeof(BundleBlock), size - nb.size - sizeof(BundleBlock));
+  size = nb.size + sizeof(BundleBlock);
+
+  // копия конца блока
+  data.resize((size_t)nb.size);
+
+  ok = (m_bundle->ReadAt(block + sizeof(BundleBlock) + keep, &data[0], (size_t)nb.size,
+                         true) == (size_t)nb.size)
+       && BlockStore(pos, nb)
+       && (m_bundle->WriteAt(pos + sizeof(BundleBlock), &data[0], (size_t)nb.size,
+                             true) == (size_t)nb.size)
+       && m_bundle->Flush();
+
+  // ссылка на последний блок в заголовке снимается до переключения
+  if (ok && last) {
+    length = DataLengthGet(desc, lastBlock);
+
+    if ((desc.info.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0) {
+      desc.info.extFlags &= ~BUNDLE_FILE_EXT_LENGTH;
+      ok = CompactInfoStore(chain.idx);
+    }
+  }
+
+  // переключим: блок укорачивается и ссылается на копию
+  bb.size      = keep;
+  bb.nextBlock = pos;
+
+  if (!ok || !BlockStore(block, bb)) {
+    SpaceRelease(pos, size);
+    return -1;
+  }
+  desc.chainGen++;
+  m_chainsGen++;
+
+  // курсор за новой границей переходит в копию
+  if (chain.type == BUNDLE_FILE_DATA) {
+    if ((desc.curBlock == block) && (desc.curBlockPos > keep)) {
+      desc.curBlock     = pos;
+      desc.curBlockPos -= keep;
+    }
+    desc.extents.clear();
+    desc.extentsValid = false;
+  }
+
+  if (last) {
+    DataLengthSet(desc, length, pos);
+
+    if (!CompactInfoStore(chain.idx)) {
+      return -1;
+    }
+  }
+
+  // освободим перенесенное
+  SpaceRelease(block + sizeof(BundleBlock) + keep, nb.size);
+  chain.blocks.insert(chain.blocks.begin() + i + 1, pos);
+
+  // вернем результат
+  return nb.size;
+}
+
+// шаг уплотнения
+bool CBundleFile::CompactStep(int64_t budget, int64_t& moved, int64_t& trimmed) {
+  BundleCompactState state;
+
+  return CompactStep(state, budget, moved, trimmed);
+}
+
+// шаг уплотнения по собранным цепочкам (сверяются с бандлом под блокировкой)
+bool CBundleFile::CompactStep(BundleCompactState& state, int64_t budget, int64_t& moved,
+                              int64_t& trimmed) {
+  moved   = 0;
+  trimmed = 0;
+
+  // проверки
+  if (!m_created || m_sealed || !m_bundle->IsWritable()) {
+    return false;
+  }
+
+  if (budget <= 0) {
+    budget = BUNDLE_COMPACT_STEP;
+  }
+
+  // лочимся на запись
+  CBundleWriteLock locker(m_locker);
+
+  if ((!m_freeValid && !SpaceRebuild()) || !CompactRefresh(state)) {
+    return false;
   }
 
-  // читаем данные в буфер
-  int64_t remain     = srcLen;
-  int64_t totalWrote = 0;
+  trimmed += SpaceTrim();
 
-  while (remain > 0) {
-    int64_t toRead = std::min(remain, (int64_t)m_AesBufferSize);
+  // сначала хвост: самый дальний блок переносим ближе к началу (вместе со
+  // всей цепочкой, если она фрагментирована и помещается в шаг)
+  while ((moved < budget) && !state.blocks.empty()) {
+    int64_t      top   = state.blocks.rbegin()->first;
+    size_t       c     = state.blocks.rbegin()->second.first;
+    size_t       i     = state.blocks.rbegin()->second.second;
+    BundleChain& chain = state.chains[c];
+    std::vector<int64_t> before = chain.blocks;
+    int64_t left = budget - moved;
+    int64_t res  = 0;
+    BundleBlock bb;
 
-    if (toRead <= 0) {
+    // первый блок заголовков остается на месте
+    if (((chain.idx == 0) && (i == 0)) || !BlockLoad(top, bb)) {
       break;
     }
 
-    // скопируем исходные данные
-    memcpy(m_AesBuffer, (char *)src + totalWrote, (rsize_t)toRead);
-
-    // вычислим размер для шифрования
-    int64_t toWrite = (toRead % AES_BLOCK_SIZE) == 0 ? toRead : toRead +
-                      AES_BLOCK_SIZE - toRead % AES_BLOCK_SIZE;
+    if ((chain.idx != 0) && (chain.blocks.size() > 1) && (chain.size <= left)) {
+      res = CompactMove(chain, 0, chain.blocks.size(), top);
+    }
 
-    // добьем нулями
-    if (toWrite > toRead) {
-      memset((char *)m_AesBuffer + toRead, 0, (size_t)(toWrite - toRead));
+    if ((res == 0) && (bb.size <= left)) {
+      res = CompactMove(chain, i, 1, top);
     }
 
-    // зашифруем
-    for (size_t pos = 0; pos < static_cast<size_t>(toWrite); pos += AES_BLOCK_SIZE) {
-      mbedtls_aes_crypt_ecb(&((AesContext *)cryptoContext)->ctxEnc, MBEDTLS_AES_ENCRYPT,
-                            (unsigned char *)m_AesBuffer + pos, (unsigned char *)m_AesBuffer + pos);
+    // большой блок переносится по частям, но не мельче минимальной
+    if ((res == 0) && (bb.size > left)
+        && (left >= std::min(budget, (int64_t)BUNDLE_COMPACT_MIN_PART))) {
+      res = CompactSplit(chain, i, left, top);
     }
 
-    // запишем на диск
-    int64_t wrote = ContentWrite(blockPos, blockOffset, m_AesBuffer, toWrite,
-                                 firstBlock);
+    if (res < 0) {
+      return false;
+    }
 
-    // проверим
-    if (wrote != toWrite) {
+    // больше некуда
+    if (res == 0) {
       break;
     }
 
-    // сдвинем счетчики
-    totalWrote += toRead;
-    remain     -= toRead;
-  }
-
-  // вернем результат
-  return totalWrote;
-}
-
-// чтение контента
-int64_t CBundleFile::ContentRead(int64_t& blockPos, int64_t& blockOffset,
-                                 void *dst, int64_t  *dstLen) {
-  int64_t res    = 0;
-  int64_t remain = 0;
-
-  // проверки
-  if (dstLen == nullptr) {
-    return 0;
-  }
-
-  // проверим на операцию запроса длины
-  if (dst == nullptr) {
-    // посчитаем размер
-    CalculateSize(blockPos, blockOffset, dstLen);
-    return 0;
+    CompactUpdate(state, c, before);
+    moved   += res;
+    trimmed += SpaceTrim();
   }
 
-  // читаем данные
-  remain = *dstLen;
+  // затем фрагментированные цепочки, помещающиеся в шаг, собираются в один
+  // блок, если для него есть место до их последнего блока. каждая
+  // пробуется один раз за уплотнение, не поместившаяся в остаток шага ждет
+  // следующего
+  for (; (state.next < state.fragmented.size()) && (moved < budget); state.next++) {
+    size_t       c     = state.fragmented[state.next];
+    BundleChain& chain = state.chains[c];
+    std::vector<int64_t> before = chain.blocks;
+    int64_t res = 0;
 
-  for (BundleBlock *bb = BlockLoad(blockPos); bb != nullptr && remain > 0;) {
-    int64_t toRead = std::min(bb->size - blockOffset, remain);
+    if ((chain.blocks.size() < 2) || (chain.size > budget)) {
+      continue;
+    }
 
-    if (toRead < 0) {
+    if (chain.size > budget - moved) {
       break;
     }
 
-    if (toRead > 0) {
-      // читаем из файла
-      m_bundle->Seek(blockPos + blockOffset + sizeof(BundleBlock), SEEK_SET);
-      size_t read = m_bundle->Read((char *)dst + res, (size_t)toRead, false);
-
-      // сместим счетчики
-      res         += read;
-      remain      -= read;
-      blockOffset += read;
+    res = CompactMove(chain, 0, chain.blocks.size(),
+                      *std::max_element(chain.blocks.begin(), chain.blocks.end()));
 
-      // тут выход в случае ошибки
-      if (read != (size_t)toRead) {
-        return res + read;
-      }
+    if (res < 0) {
+      return false;
     }
 
-    // если нужно - смещаемся к следующему блоку
-    if ((remain > 0) && (bb->nextBlock > 0)) {
-      blockPos    = bb->nextBlock;
-      blockOffset = 0;
-      bb          = BlockLoad(blockPos);
-    } else {
-      bb = nullptr;
+    if (res > 0) {
+      CompactUpdate(state, c, before);
     }
+    moved += res;
   }
 
-  // вернем результат
-  return res;
+  trimmed += SpaceTrim();
+
+  // все изменения шага учтены в цепочках
+  state.gen = m_chainsGen;
+
+  // все ок
+  return true;
 }
 
-// запись контента
-int64_t CBundleFile::ContentWrite(int64_t& blockPos, int64_t& blockOffset,
-                                  const void *src, int64_t srcLen, int64_t *firstBlock) {
-  int64_t res     = 0;
-  int64_t remain  = srcLen;
-  BundleBlock *bb = nullptr;
+// уплотнение шагами с ограничением скорости. цепочки собираются один раз
+// под блокировкой на чтение, шаги только сверяют их с изменениями
+int64_t CBundleFile::Compact(int64_t stepSize, int64_t bytesPerSecond, int64_t maxBytes) {
+  auto    start    = std::chrono::steady_clock::now();
+  int64_t total    = 0;
+  int64_t reclaimed = 0;
+  BundleCompactState state;
 
-  // проверки
-  if (src == nullptr) {
-    return 0;
+  if (m_created) {
+    CBundleReadLock locker(m_locker);
+
+    if (!CompactRefresh(state)) {
+      return -1;
+    }
   }
 
-  // пишем данные
-  for (bb = BlockLoad(blockPos); bb != nullptr && remain > 0;) {
-    int64_t toWrite = std::min(bb->size - blockOffset, remain);
+  for (;;) {
+    int64_t budget  = stepSize > 0 ? stepSize : BUNDLE_COMPACT_STEP;
+    int64_t moved   = 0;
+    int64_t trimmed = 0;
 
-    if (toWrite < 0) {
-      break;
+    if (maxBytes > 0) {
+      budget = std::min(budget, maxBytes - total);
     }
 
-    if (toWrite > 0) {
-      // пишем в файл
-      m_bundle->Seek(blockPos + blockOffset + sizeof(BundleBlock), SEEK_SET);
-      size_t wrote = m_bundle->Write((char *)src + res, (size_t)toWrite, false);
-
-      // сместим счетчики
-      res         += wrote;
-      remain      -= wrote;
-      blockOffset += wrote;
+    if (budget <= 0) {
+      break;
+    }
 
-      // тут выход в случае ошибки
-      if (wrote != (size_t)toWrite) {
-        return res + wrote;
-      }
+    if (!CompactStep(state, budget, moved, trimmed)) {
+      return -1;
     }
+    reclaimed += trimmed;
 
-    // если нужно - смещаемся к следующему блоку
-    if (bb->nextBlock > 0) {
-      if (remain > 0) {
-        blockPos    = bb->nextBlock;
-        blockOffset = 0;
-        bb          = BlockLoad(blockPos);
+    if (moved == 0) {
+      break;
+    }
+    total += moved;
+
+    // между шагами бандл доступен остальным. выдержим скорость (ожидание
+    // прерывается остановкой фонового уплотнения)
+    std::unique_lock<std::mutex> lock(m_compactLocker);
+
+    if (bytesPerSecond > 0) {
+      m_compactWake.wait_until(lock, start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                 std::chrono::duration<double>((double)total / bytesPerSecond)),
+                               [this] {
+        return m_compactStop;
+      });
+    }
 
-        // проверим на ошибку
-        if (bb == nullptr) {
-          remain = 0;
-        }
-      }
-    } else {
+    if (m_compactStop) {
       break;
     }
   }
 
-  // проверим, хватило ли блоков?
-  if (remain > 0) {
-    BundleBlock bbn;
-    bbn.size = remain;
+  // вернем результат
+  return reclaimed;
+}
 
-    // выясним, куда вставлять
-    int64_t pos = m_bundle->Size();
+// учет места
+bool CBundleFile::SpaceStats(int64_t& size, int64_t& live, int64_t& dead, int64_t& tail) {
+  size = 0;
+  live = 0;
+  dead = 0;
+  tail = 0;
 
-    // проверим, можно ли расширить блок?
-    if ((bb != nullptr) && (pos == blockPos + bb->size + (int64_t)sizeof(BundleBlock))) {
-      // запишем данные
-      m_bundle->Seek(pos, SEEK_SET);
+  // проверки
+  if (!m_created) {
+    return false;
+  }
 
-      if (m_bundle->Write((char *)src + res, (size_t)remain, false) == (size_t)remain) {
-        // установим новый размер блока
-        bb->size += remain;
-        BlockStore(blockPos, *bb);
+  // лочимся на запись (карта может строиться)
+  CBundleWriteLock locker(m_locker);
 
-        // сместим счетчики
-        res        += remain;
-        blockOffset = bb->size;
-      }
-    } else
+  // запечатанный бандл записан плотно
+  if (m_sealed) {
+    size = live = m_bundle->Size();
+    return true;
+  }
 
-    // вставим новый блок
-    if (BlockStore(pos, bbn) != nullptr) {
-      // запишем данные
-      if (m_bundle->Seek(pos + sizeof(BundleBlock), SEEK_SET) &&
-          (m_bundle->Write((char *)src + res, (size_t)remain, false) == (size_t)remain)) {
-        // запомним первый блок
-        // вставим новый блок в список
-        if (bb != nullptr) {
-          bb->nextBlock = pos;
-          BlockStore(blockPos, *bb);
-        } else {
-          // запомним позицию первого блока
-          if (firstBlock != nullptr) {
-            *firstBlock = pos;
-          }
-        }
+  if (!m_bundle->Flush()) {
+    return false;
+  }
 
-        // сместим счетчики
-        res        += remain;
-        blockOffset = remain;
-        blockPos    = pos;
-      }
-    }
+  if (!m_freeValid) {
+    SpaceRebuild();
   }
 
-  // вернем результат
-  return res;
-}
+  size = m_bundle->Size();
+  dead = m_freeBytes;
+  live = size - dead;
 
-// вычисление оставшегося размера
-void CBundleFile::CalculateSize(int64_t blockPos, int64_t blockOffset,
-                                int64_t *dstLen) {
-  int64_t res = 0;
+  // свободный хвост
+  if (!m_freeExtents->empty()
+      && (m_freeExtents->rbegin()->first + m_freeExtents->rbegin()->second == size)) {
+    tail = m_freeExtents->rbegin()->second;
+  }
+
+  // все ок
+  return true;
+}
 
+// настройка автоматического уплотнения
+bool CBundleFile::AutoCompactSet(double deadRatio, int64_t minDeadBytes, int64_t stepSize,
+                                 int64_t bytesPerSecond, int64_t maxBytes) {
   // проверки
-  if ((blockPos < (int64_t)sizeof(m_info)) || (dstLen == nullptr)) {
-    return;
+  if (!m_created) {
+    return false;
   }
 
-  // считаем по размеру блоков
-  for (BundleBlock *bl = BlockLoad(blockPos); bl != nullptr;
-       bl = BlockLoad(bl->nextBlock)) {
-    res += bl->size;
-  }
+  // прежний поток больше не нужен
+  AutoCompactStop();
 
-  // отнимем смещение в первом блоке
-  res -= res > blockOffset ? blockOffset : res;
+  if (deadRatio <= 0) {
+    return true;
+  }
 
-  // выставим значение
-  *dstLen = res;
-}
+  if (m_sealed || !m_bundle->IsWritable()) {
+    return false;
+  }
 
-// загрузка блока
-BundleBlock * CBundleFile::BlockLoad(int64_t blockPos) {
-  BundleBlock *res = nullptr;
+  // запомним параметры
+  {
+    std::lock_guard<std::mutex> lock(m_compactLocker);
+    m_compactRatio   = deadRatio;
+    m_compactMinDead = minDeadBytes > 0 ? minDeadBytes : BUNDLE_AUTOCOMPACT_MIN_DEAD;
+    m_compactStep    = stepSize;
+    m_compactRate    = bytesPerSecond;
+    m_compactMax     = maxBytes;
+  }
 
-  // проверки
-  if (blockPos < (int64_t)sizeof(m_info)) {
-    return nullptr;
+  try {
+    m_compactThread = std::thread(&CBundleFile::AutoCompactWorker, this);
+  } catch (...) {
+    std::lock_guard<std::mutex> lock(m_compactLocker);
+    m_compactRatio = 0;
+    return false;
   }
 
-  // проверим, есть ли блок в кэше?
-  CBundleBlocks::iterator it = m_blocksCache->find(blockPos);
+  // построим карту свободного места и проверим порог сразу
+  CBundleWriteLock locker(m_locker);
 
-  if (it == m_blocksCache->end()) {
-    BundleBlock block;
-    m_bundle->Seek(blockPos, SEEK_SET);
+  m_compactBaseline = 0;
 
-    if (m_bundle->Read(&block, sizeof(block), false) == sizeof(block)) {
-      (*m_blocksCache)[blockPos] = block;
-      res                        = &(*m_blocksCache)[blockPos];
-    }
-  } else {
-    res = &it->second;
+  if (!m_freeValid) {
+    SpaceRebuild();
   }
+  AutoCompactCheck();
 
-  // вернем результат
-  return res;
+  // все ок
+  return true;
 }
 
-// сохранение блока
-BundleBlock * CBundleFile::BlockStore(int64_t blockPos, BundleBlock& block) {
-  BundleBlock *res = nullptr;
+// проверка порога автоматического уплотнения (под блокировкой на запись)
+void CBundleFile::AutoCompactCheck() {
+  std::lock_guard<std::mutex> lock(m_compactLocker);
 
-  // проверки
-  if (blockPos < (int64_t)sizeof(m_info)) {
-    return nullptr;
+  if ((m_compactRatio <= 0) || m_compactPending || !m_freeValid
+      || (m_freeBytes - m_compactBaseline < m_compactMinDead)) {
+    return;
   }
 
-  // сохраним
-  m_bundle->Seek(blockPos, SEEK_SET);
-
-  if (m_bundle->Write(&block, sizeof(block), true) == sizeof(block)) {
-    (*m_blocksCache)[blockPos] = block;
-    res                        = &(*m_blocksCache)[blockPos];
+  // доля свободного места
+  if ((double)m_freeBytes >= m_compactRatio * (double)m_bundle->Size()) {
+    m_compactPending = true;
+    m_compactWake.notify_all();
   }
-
-  // вернем результат
-  return res;
 }
 
-// загрузка информации о файле
-BundleFileInfo * CBundleFile::InfoLoad(int64_t /*infoPos*/) {
-  return nullptr;
-}
+// поток автоматического уплотнения
+void CBundleFile::AutoCompactWorker() {
+  std::unique_lock<std::mutex> lock(m_compactLocker);
 
-// сохранение информации о файле
-bool CBundleFile::InfoStore(int64_t& infoPos, BundleFileInfo& info,
-                            bool infoSystem) {
-  // установим позицию
-  if (!infoSystem) {
-    if (infoPos <= 0) {
-      infoPos = m_filesDesc->size() * sizeof(BundleFileInfo);
+  for (;;) {
+    m_compactWake.wait(lock, [this] {
+      return m_compactStop || m_compactPending;
+    });
 
-      // проверим, нужно ли добавлять заголовки
-      if (FileSize(0) == infoPos) {
-        AddEmptyHeaders();
-      }
+    if (m_compactStop) {
+      break;
     }
-    FileSeek(0, infoPos, BUNDLE_FILE_ORIG_SET);
-  } else {
-    FileSeek(0, 0, BUNDLE_FILE_ORIG_SET);
+
+    int64_t stepSize       = m_compactStep;
+    int64_t bytesPerSecond = m_compactRate;
+    int64_t maxBytes       = m_compactMax;
+
+    lock.unlock();
+    Compact(stepSize, bytesPerSecond, maxBytes);
+
+    // оставшееся свободное место перенести не удалось, следующий запуск -
+    // после прироста
+    {
+      CBundleWriteLock locker(m_locker);
+      m_compactBaseline = m_freeBytes;
+    }
+
+    lock.lock();
+    m_compactPending = false;
   }
+}
 
-  // сохраним
-  return BundleAttributeSet(0, BUNDLE_FILE_DATA, &info, sizeof(info),
-                            nullptr) == sizeof(info);
+// остановка автоматического уплотнения (дожидается текущего шага)
+void CBundleFile::AutoCompactStop() {
+  {
+    std::lock_guard<std::mutex> lock(m_compactLocker);
+    m_compactRatio = 0;
+    m_compactStop  = true;
+  }
+  m_compactWake.notify_all();
+
+  if (m_compactThread.joinable()) {
+    m_compactThread.join();
+  }
+
+  std::lock_guard<std::mutex> lock(m_compactLocker);
+  m_compactStop    = false;
+  m_compactPending = false;
 }
 
 // дефрагментация. жадная - создает новый временный файл для копии
@@ -1402,6 +3757,182 @@ bool CBundleFile::Defragmentation(std::shared_ptr<IBinaryStream>src,
   return ret;
 }
 
+// запечатывание: копия бандла, где каждый атрибут записан одним блоком, файлы
+// лежат подряд в порядке путей, а в конце добавлен каталог (заголовки и
+// зашифрованные имена) для открытия одним чтением
+bool CBundleFile::Seal(std::shared_ptr<IBinaryStream>src,
+                       std::shared_ptr<IBinaryStream>dst,
+                       const void                   *pathKey,
+                       int                           keyLen) {
+  // проверки
+  if ((src == nullptr) || (dst == nullptr) || !src->IsReadable() || !dst->IsWritable()
+      || (pathKey == nullptr)) {
+    return false;
+  }
+
+  CBundleFile srcBundle(src);
+  std::vector<size_t> order;
+  std::vector<BundleFileInfo> infos;
+  CBundleBuffer names;
+  BundleInfo     info;
+  BundleBlock    block;
+  BundleSealInfo seal;
+  bool    ret  = true;
+  int64_t pos  = 0;
+  void *buffer = nullptr;
+
+  // откроем исходный бандл
+  if ((srcBundle.Open(false) != 0)
+      || !srcBundle.Initialize(pathKey, keyLen, BUNDLE_CACHE_SIZE)) {
+    return false;
+  }
+
+  // живые файлы в порядке путей
+  for (size_t i = 1, j = srcBundle.m_filesDesc->size(); i < j; i++) {
+    if (((*srcBundle.m_filesDesc)[i].info.flags & BUNDLE_FILE_FLAG_EMPTY) == 0) {
+      order.push_back(i);
+    }
+  }
+  std::sort(order.begin(), order.end(), [&srcBundle](size_t a, size_t b) {
+    return (*srcBundle.m_filesDesc)[a].path < (*srcBundle.m_filesDesc)[b].path;
+  });
+  order.insert(order.begin(), 0);
+  infos.resize(order.size());
+
+  // место под заголовок бандла и блок заголовков файлов
+  pos = sizeof(BundleInfo) + sizeof(BundleBlock) + infos.size() * sizeof(BundleFileInfo);
+
+  if ((buffer = malloc(BUNDLE_CACHE_SIZE)) == nullptr) {
+    return false;
+  }
+
+  // сначала служебные атрибуты, затем данные файлов подряд
+  for (int pass = 0; pass < 2 && ret; pass++) {
+    for (size_t i = 0; i < order.size() && ret; i++) {
+      for (int l = 0; l < BUNDLE_ATTRS_COUNT && ret; l++) {
+        if (((l == BUNDLE_FILE_DATA) != (pass == 1)) || ((i == 0) && (l == BUNDLE_FILE_DATA))) {
+          continue;
+        }
+
+        ret = AttributeSeal(srcBundle, dst, (int)order[i], l, infos[i], pos, buffer,
+                            BUNDLE_CACHE_SIZE);
+      }
+    }
+  }
+  free(buffer);
+
+  // имена: длина и путь каждого файла, шифруются ключом путей
+  for (size_t i = 1; i < order.size(); i++) {
+    const std::string& path = (*srcBundle.m_filesDesc)[order[i]].path;
+    names.push_back((unsigned char)(path.size() & 0xFF));
+    names.push_back((unsigned char)((path.size() >> 8) & 0xFF));
+    names.insert(names.end(), path.begin(), path.end());
+  }
+  names.resize((names.size() + AES_BLOCK_SIZE - 1) / AES_BLOCK_SIZE * AES_BLOCK_SIZE, 0);
+
+  if (!names.empty()) {
+    BundleAesEcb(&srcBundle.m_AesPathContext->ctxEnc, MBEDTLS_AES_ENCRYPT, &names[0],
+                 names.size());
+  }
+
+  // нулевой файл - блок заголовков сразу за заголовком бандла
+  infos[0].flags                        = 0;
+  infos[0].attrsBlocks[BUNDLE_FILE_DATA] = sizeof(BundleInfo);
+  BundleInt48Set(infos[0].dataLastStart, 0);
+  BundleInt48Set(infos[0].dataLastBlock, sizeof(BundleInfo));
+  infos[0].extFlags |= BUNDLE_FILE_EXT_LENGTH | BUNDLE_FILE_EXT_SEALED;
+
+  // заголовок бандла и блок заголовков файлов
+  memset(&info, 0, sizeof(info));
+  memcpy(info.bundleSign, BUNDLE_SIGNATURE, strlen(BUNDLE_SIGNATURE));
+  info.version = BUNDLE_VERSION;
+  block.size   = infos.size() * sizeof(BundleFileInfo);
+
+  ret = ret && dst->Seek(0, SEEK_SET)
+        && (dst->Write(&info, sizeof(info), true) == sizeof(info))
+        && (dst->Write(&block, sizeof(block), true) == sizeof(block))
+        && (dst->Write(&infos[0], (size_t)block.size, true) == (size_t)block.size);
+
+  // каталог и окончание
+  memset(&seal, 0, sizeof(seal));
+  memcpy(seal.sealSign, BUNDLE_SEAL_SIGNATURE, sizeof(BUNDLE_SEAL_SIGNATURE));
+  seal.dirPos     = pos;
+  seal.dirSize    = block.size + names.size();
+  seal.filesCount = (int)infos.size();
+
+  ret = ret && dst->Seek(pos, SEEK_SET)
+        && (dst->Write(&infos[0], (size_t)block.size, true) == (size_t)block.size)
+        && (names.empty() || (dst->Write(&names[0], names.size(), true) == names.size()))
+        && (dst->Write(&seal, sizeof(seal), true) == sizeof(seal))
+        && dst->Flush();
+
+  // закроем бандл
+  srcBundle.Close();
+
+  // вернем результат
+  return ret;
+}
+
+// копирование атрибута одним блоком в запечатанный бандл. функция внутренняя и
+// служебная, никаких проверок!
+bool CBundleFile::AttributeSeal(CBundleFile& srcBundle, std::shared_ptr<IBinaryStream>dst,
+                                int idx, int type, BundleFileInfo& info, int64_t& pos,
+                                void *buffer, size_t bufferSize) {
+  BundleBlock block;
+  int64_t     blockPos    = (*srcBundle.m_filesDesc)[idx].info.attrsBlocks[type];
+  int64_t     blockOffset = 0;
+  int64_t     remain      = 0;
+  uint16_t    tag         = 0;
+
+  if (blockPos <= 0) {
+    return true;
+  }
+
+  // длина атрибута
+  srcBundle.CalculateSize(blockPos, blockOffset, &remain);
+
+  // заголовок блока
+  block.size = remain;
+
+  if (!dst->Seek(pos, SEEK_SET) || (dst->Write(&block, sizeof(block), true) != sizeof(block))) {
+    return false;
+  }
+
+  // содержимое копируем как есть (зашифрованное остается зашифрованным)
+  while (remain > 0) {
+    int64_t toRead = std::min(remain, (int64_t)bufferSize);
+
+    if ((srcBundle.ContentRead(blockPos, blockOffset, buffer, &toRead) != toRead)
+        || (dst->Write(buffer, (size_t)toRead, false) != (size_t)toRead)) {
+      return false;
+    }
+
+    // сместим счетчики
+    remain -= toRead;
+  }
+
+  // сохраним инфо
+  info.attrsBlocks[type] = pos;
+  info.flags            |= (*srcBundle.m_filesDesc)[idx].info.flags &
+                           (BUNDLE_FILE_FLAG_ENC_ATTR0 << type);
+
+  if (type == BUNDLE_FILE_DATA) {
+    info.flags |= (*srcBundle.m_filesDesc)[idx].info.flags & BUNDLE_FILE_FLAG_CTR;
+    BundleInt48Set(info.dataLastStart, 0);
+    BundleInt48Set(info.dataLastBlock, pos);
+    info.extFlags |= BUNDLE_FILE_EXT_LENGTH;
+  } else if ((type == BUNDLE_FILE_NAME)
+             && BundleNameTagGet((*srcBundle.m_filesDesc)[idx].info, tag)) {
+    BundleNameTagSet(info, tag);
+  }
+
+  // сместимся за блок
+  pos += sizeof(block) + block.size;
+
+  // все ок
+  return true;
+}
+
 // копирование атрибутов. функция внутренняя и служебная, никаких проверок!
 bool CBundleFile::AttributeCopy(CBundleFile& srcBundle, CBundleFile& dstBundle,
                                 int idxSrc, int idxDst, int type, void *buffer, size_t bufferSize) {
@@ -1411,6 +3942,7 @@ bool CBundleFile::AttributeCopy(CBundleFile& srcBundle, CBundleFile& dstBundle,
   int64_t blockPosWrite    = 0;
   int64_t blockOffsetWrite = 0;
   int64_t firstBlock       = 0;
+  uint16_t tag             = 0;
 
   srcBundle.CalculateSize(blockPosRead, blockOffsetRead, &remain);
 
@@ -1435,9 +3967,19 @@ bool CBundleFile::AttributeCopy(CBundleFile& srcBundle, CBundleFile& dstBundle,
   // сохраним инфо
   (*dstBundle.m_filesDesc)[idxDst].info.attrsBlocks[type] = firstBlock;
   (*dstBundle.m_filesDesc)[idxDst].info.flags            |=
-    (*srcBundle.m_filesDesc)[idxDst].info.flags & (BUNDLE_FILE_FLAG_ENC_ATTR0 <<
+    (*srcBundle.m_filesDesc)[idxSrc].info.flags & (BUNDLE_FILE_FLAG_ENC_ATTR0 <<
                                                    type);
 
+  // режим шифрования данных переносится вместе с данными, хэш пути - с
+  // именем
+  if (type == BUNDLE_FILE_DATA) {
+    (*dstBundle.m_filesDesc)[idxDst].info.flags |=
+      (*srcBundle.m_filesDesc)[idxSrc].info.flags & BUNDLE_FILE_FLAG_CTR;
+  } else if ((type == BUNDLE_FILE_NAME)
+             && BundleNameTagGet((*srcBundle.m_filesDesc)[idxSrc].info, tag)) {
+    BundleNameTagSet((*dstBundle.m_filesDesc)[idxDst].info, tag);
+  }
+
   // все ок
   return true;
 }
@@ -1,39 +1,89 @@
 #pragma once
-#ifdef __GNUC__
-# include <pthread.h>
-#else // ifdef __GNUC__
-# include <mutex>
-#endif // ifdef __GNUC__
+#include <atomic>
+#include <condition_variable>
 #include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
 #include "mbedtls/aes.h"
 #include "BundleFileHDRs.h"
+#include "BundleBlockCache.h"
+#include "BundlePathIndex.h"
+#include "BundleLock.h"
 #include "streams/IBinaryStream.h"
 
-// класс, работающий с бандлом
+class CBundleCryptoPool;
+
+// класс, работающий с бандлом. чтение (атрибуты, данные, размер, имена,
+// позиционирование) идет под общей блокировкой и выполняется параллельно,
+// изменения - под монопольной. изменяемое при чтении состояние (кэш блоков,
+// курсоры и индексы блоков файлов, окна шифрования) защищено отдельным
+// коротким локом
 class CBundleFile {
 private:
 
   std::shared_ptr<IBinaryStream> m_bundle; // поток бандла
   bool m_initialized;                      // флаг инициализации
   bool m_created;                          // флаг создания
-#ifdef __GNUC__
-  pthread_mutex_t m_locker;                // лок
-#else // ifdef __GNUC__
-  std::recursive_mutex m_locker;           // лок
-#endif // ifdef __GNUC__
+  CBundleLock m_locker;                    // лок читатель-писатель
+  std::recursive_mutex m_stateLocker;      // лок состояния, меняющегося
+                                           // при чтении
 
   // криптография
-  AesContext *m_AesPathContext;
-  void       *m_AesBuffer;      // буфер для криптографии
-  size_t      m_AesBufferSize;  // размер буфера
+  AesContext     *m_AesPathContext;
+  CCryptoBuffers *m_AesBuffers;   // свободные окна для шифрования при
+                                  // записи
+  size_t          m_AesBufferSize; // размер порции чтения/записи
+  size_t          m_AesWindowSize; // размер окна шифрования
+  CBundleCryptoPool *m_cryptoPool; // потоки для шифрования больших объемов
+                                   // (nullptr - в вызывающем потоке)
+  int     m_cryptoThreads;         // число потоков шифрования
+  int64_t m_cryptoThreshold;       // порог распараллеливания
+  bool    m_cryptoStreaming;       // флаг потокового чтения
+  size_t  m_cryptoBufferSize;      // порция чтения/записи для Initialize
   // информация о бандле
   BundleInfo  m_info;           // инфо бандла
   CFilesDesc *m_filesDesc;      // файлы бандла
-  CFilesIndex
+  CBundlePathIndex
   *m_filesIdx;                  // индекс для поиска по пути
-  CBundleBlocks *m_blocksCache; // кэш блоков
+  CBundleBlockCache *m_blocksCache; // кэш заголовков блоков
+  CFreeExtents  *m_freeExtents; // свободные участки по смещению
+  CFreeBySize   *m_freeBySize;  // свободные участки по размеру
+  bool m_freeValid;             // флаг актуальности карты свободного места
+  int64_t m_freeBytes;          // объем свободного места по карте
+  uint64_t m_chainsGen;         // счетчик изменений цепочек всех файлов
+  uint64_t m_blocksStored;      // счетчик записей заголовков блоков
   int
     m_emptyHeadersCount;        // число пустых заголовков для превыделения
+  int64_t m_infoNext;           // смещение следующего неиспользованного
+                                // заголовка
+  bool m_sealed;                // флаг запечатанного бандла (только чтение)
+  CBundleBuffer *m_sealNames;   // зашифрованные имена каталога
+  // отложенная расшифровка путей (под локом состояния)
+  int    m_pathsMode;           // режим расшифровки (BundlePathsMode)
+  size_t m_pathsNext;           // следующий заголовок для расшифровки по
+                                // порядку
+  size_t m_pathsBusy;           // число путей, расшифровываемых вне лока
+  int64_t m_pathsResolved;      // число расшифрованных путей (статистика)
+  std::thread m_pathsThread;    // фоновая расшифровка
+  std::atomic<bool> m_pathsStop; // флаг остановки фоновой расшифровки
+  // заголовки по ключевому хэшу пути (строятся при инициализации)
+  CNameTags *m_tagsStart;       // начало группы каждого значения хэша
+  CNameTags *m_tagsItems;       // индексы заголовков по группам
+  // автоматическое уплотнение (параметры и флаги под m_compactLocker)
+  double  m_compactRatio;       // доля свободного места для запуска (0 -
+                                // выключено)
+  int64_t m_compactMinDead;     // прирост свободного места для запуска
+  int64_t m_compactStep;        // параметры уплотнения (см. Compact)
+  int64_t m_compactRate;
+  int64_t m_compactMax;
+  int64_t m_compactBaseline;    // свободное место после прошлого уплотнения
+                                // (под m_locker)
+  bool    m_compactPending;     // уплотнение запрошено
+  bool    m_compactStop;        // флаг остановки уплотнения
+  std::thread m_compactThread;  // фоновое уплотнение
+  std::mutex  m_compactLocker;  // лок параметров и флагов
+  std::condition_variable m_compactWake; // запрос уплотнения или остановка
 
 public:
 
@@ -50,6 +100,37 @@ public:
                      int         keyLen,
                      size_t      cryptoBufferSize);
 
+  // параллельное шифрование данных файлов: threads дополнительных потоков,
+  // объемы меньше threshold шифруются в вызывающем потоке. threads = 0 -
+  // отключить
+  bool    CryptoThreadsSet(int     threads,
+                           int64_t threshold);
+
+  // потоковое чтение шифрованных данных: пока порция расшифровывается
+  // в фоне, читается следующая
+  bool    CryptoStreamingSet(bool enabled);
+
+  // настройки, задаваемые при открытии (BundleOpenEx): размер порции
+  // шифрования для Initialize, объем кэша заголовков блоков и режим
+  // блокировки (BundleLockMode, менять до начала работы с бандлом)
+  void    CryptoBufferSizeSet(size_t size);
+  size_t  CryptoBufferSize() const;
+  void    BlocksCacheSet(int64_t budget);
+
+  // статистика кэша заголовков блоков: попадания, промахи, занятая память
+  void    BlocksCacheStats(uint64_t& hits,
+                           uint64_t& misses,
+                           int64_t & memory);
+  void    LockModeSet(int mode);
+
+  // режим расшифровки путей (BundlePathsMode), действует при следующей
+  // инициализации. запечатанный бандл расшифровывает имена сразу
+  void    PathsModeSet(int mode);
+
+  // статистика: число расшифрованных путей и заголовков файлов
+  void    PathsStats(int64_t& resolved,
+                     int64_t& total);
+
   // получение информации (атрибуты, данные и т.д.)
   int64_t BundleAttributeGet(int      idx,
                              int      type,
@@ -64,7 +145,16 @@ public:
 
   // работа с файлами
   int     FileOpen(const char *filename,
-                   bool        openAlways);
+                   bool        openAlways,
+                   bool        rewind = true);
+
+  // создание файлов пачкой: заголовки занимают один участок, заголовки
+  // и имена пишутся несколькими большими записями. существующие файлы
+  // открываются. в indices - индексы файлов (-1 при ошибке), возвращает
+  // число файлов с индексом
+  int     FilesCreate(const char *const *filenames,
+                      int                count,
+                      int               *indices);
   int64_t FileSeek(int              idx,
                    int64_t          offset,
                    BundleFileOrigin origin);
@@ -75,24 +165,135 @@ public:
   int     FileName(int   idx,
                    char *filename,
                    int   len);
+  const void* FileBorrow(int      idx,
+                         int64_t *dstLen);
+
+  // режим шифрования данных файла (BundleFileCipher). менять можно только
+  // у файла без данных. для CTR выбирается новый nonce, nonce - заданный
+  // (для данных, зашифрованных вне бандла), nullptr - случайный
+  bool    FileCipherSet(int             idx,
+                        int             cipher,
+                        const uint64_t *nonce = nullptr);
+  int     FileCipherGet(int idx);
+
+  // флаг шифрования данных файла без данных: для данных, зашифрованных
+  // вне бандла и записываемых без криптоконтекста
+  bool    FileDataEncryptedSet(int  idx,
+                               bool encrypted);
+
+  // чтение/запись данных файла с заданной позиции. курсор файла не
+  // используется и не меняется, параллельные чтения не мешают друг другу
+  int64_t FileReadAt(int      idx,
+                     int64_t  pos,
+                     void    *dst,
+                     int64_t *dstLen,
+                     void    *cryptoContext);
+  int64_t FileWriteAt(int           idx,
+                      int64_t       pos,
+                      const void   *src,
+                      const int64_t srcLen,
+                      void         *cryptoContext);
+
+  // раскладка данных всех файлов (блоки в логическом порядке) и чтение
+  // данных бандла с заданного смещения без разбора блоков. данные блока
+  // лежат сразу за его заголовком (BundleBlock). gen - счетчик изменений
+  // цепочек на момент раскладки: RawRead читает, только пока он не
+  // изменился (иначе возвращает 0), LayoutChanged отмечает в changed файлы
+  // раскладки, цепочки которых с тех пор изменились или удалены, и
+  // обновляет gen. FileLayout - раскладка одного файла (false - файла нет)
+  bool    FilesLayout(CFilesLayout& files,
+                      uint64_t    & gen);
+  bool    FileLayout(int               idx,
+                     BundleFileLayout& file);
+  size_t  RawRead(int64_t  pos,
+                  void    *dst,
+                  size_t   size,
+                  uint64_t gen);
+  void    LayoutChanged(const CFilesLayout& files,
+                        std::vector<bool> & changed,
+                        uint64_t          & gen);
+
+  // уплотнение без закрытия бандла: блоки из конца бандла и
+  // фрагментированные цепочки переносятся в свободные места ближе к началу,
+  // свободный хвост отрезается. шаг переносит не больше budget байт под
+  // монопольной блокировкой, в moved - перенесено, в trimmed - отрезано.
+  // Compact повторяет шаги по stepSize байт, пока есть что переносить (но
+  // не больше maxBytes, 0 - без ограничения), не быстрее bytesPerSecond
+  // (0 - без ограничения). возвращает, на сколько уменьшился бандл, или -1
+  bool    CompactStep(int64_t  budget,
+                      int64_t& moved,
+                      int64_t& trimmed);
+  int64_t Compact(int64_t stepSize,
+                  int64_t bytesPerSecond,
+                  int64_t maxBytes);
+
+  // учет места: размер бандла, занятое живыми цепочками (вместе с
+  // заголовками блоков), свободное внутри бандла (удаленные и обрезанные
+  // данные, брошенные блоки заголовков) и из него - свободное в конце файла.
+  // первый запрос после открытия строит карту свободного места
+  bool    SpaceStats(int64_t& size,
+                     int64_t& live,
+                     int64_t& dead,
+                     int64_t& tail);
+
+  // автоматическое уплотнение в фоновом потоке: запускается после удаления
+  // или обрезания, когда свободное место занимает не меньше deadRatio
+  // бандла и выросло на minDeadBytes с прошлого уплотнения. остальные
+  // параметры - как у Compact. deadRatio <= 0 - выключить. действует до
+  // закрытия
+  bool    AutoCompactSet(double  deadRatio,
+                         int64_t minDeadBytes,
+                         int64_t stepSize,
+                         int64_t bytesPerSecond,
+                         int64_t maxBytes);
 
   // служебная функция
   static bool Defragmentation(std::shared_ptr<IBinaryStream>src,
                               std::shared_ptr<IBinaryStream>dst);
+  static bool Seal(std::shared_ptr<IBinaryStream>src,
+                   std::shared_ptr<IBinaryStream>dst,
+                   const void                   *pathKey,
+                   int                           keyLen);
 
 private:
 
   errno_t BundleOpen(int mode,
                      int emptyHeadersCount);
   errno_t CreateNewBundle();
-  bool    AddEmptyHeaders();
+  bool    AddEmptyHeaders(int count);
   bool    ReadHeaders();
   bool    ReadPaths();
+  bool    PathLoad(size_t       idx,
+                   std::string& path);
+  void    PathStore(size_t       idx,
+                    std::string& path);
+  const std::string& PathGet(size_t idx);
+  bool    NonceGet(int       idx,
+                   uint64_t& nonce);
+  bool    NonceSet(int      idx,
+                   uint64_t nonce);
+  bool    PathFind(uint64_t    hash,
+                   const char *path,
+                   size_t      len,
+                   size_t    & idx);
+  bool    PathsResolve(size_t& cursor,
+                       size_t  count,
+                       bool    all);
+  void    TagsBuild();
+  void    PathsWorker();
+  void    PathsStop();
+  bool    ReadSealed();
+  bool    ReadSealedPaths();
   int64_t CryptoContentRead(int64_t& blockPos,
                             int64_t& blockOffset,
                             void    *dst,
                             int64_t *dstLen,
                             void    *cryptoContext);
+  int64_t CryptoContentStream(int64_t   & blockPos,
+                              int64_t   & blockOffset,
+                              void       *dst,
+                              int64_t    *dstLen,
+                              AesContext *cryptoContext);
   int64_t CryptoContentWrite(int64_t   & blockPos,
                              int64_t   & blockOffset,
                              const void *src,
@@ -100,6 +301,21 @@ private:
                              int64_t    *firstBlock,
                              void       *cryptoContext,
                              bool        padding);
+  int64_t CtrContentRead(int64_t   & blockPos,
+                         int64_t   & blockOffset,
+                         int64_t     pos,
+                         void       *dst,
+                         int64_t    *dstLen,
+                         AesContext *cryptoContext,
+                         uint64_t    nonce);
+  int64_t CtrContentWrite(int64_t   & blockPos,
+                          int64_t   & blockOffset,
+                          int64_t     pos,
+                          const void *src,
+                          int64_t     srcLen,
+                          int64_t    *firstBlock,
+                          AesContext *cryptoContext,
+                          uint64_t    nonce);
   int64_t ContentRead(int64_t& blockPos,
                       int64_t& blockOffset,
                       void    *dst,
@@ -109,28 +325,83 @@ private:
                        const void *src,
                        int64_t     srcLen,
                        int64_t    *firstBlock = nullptr);
+  void            CryptoProcess(AesContext          *cryptoContext,
+                                int                  mode,
+                                const unsigned char *src,
+                                unsigned char       *dst,
+                                size_t               size);
+  void            AesBuffersFree();
+  bool            CryptoPoolRebuild();
+  void          * AesBufferAcquire();
+  void            AesBufferRelease(void *buffer);
   void            CalculateSize(int64_t  blockPos,
                                 int64_t  blockOffset,
                                 int64_t *dstLen);
-  BundleBlock   * BlockLoad(int64_t blockPos);
-  BundleBlock   * BlockStore(int64_t      blockPos,
-                             BundleBlock& block);
+  bool            BlockLoad(int64_t      blockPos,
+                            BundleBlock& block);
+  bool            BlockStore(int64_t            blockPos,
+                             const BundleBlock& block);
   void            BlockTrunk(int64_t blockPos,
                              int64_t newSize);
+
+  // работа со свободным местом
+  bool            SpaceRebuild();
+  void            SpaceRelease(int64_t pos,
+                               int64_t size);
+  void            SpaceReleaseChain(int64_t blockPos);
+  bool            SpaceAllocate(int64_t  need,
+                                int64_t& pos,
+                                int64_t& size);
+  int64_t         SpaceTake(int64_t pos,
+                            int64_t maxSize);
+  bool            SpaceAllocateBelow(int64_t  need,
+                                     int64_t  minSize,
+                                     int64_t  limit,
+                                     int64_t& pos,
+                                     int64_t& size);
+  int64_t         SpaceTrim();
+
+  // уплотнение
+  bool            ChainsCollect(size_t         idx,
+                                CBundleChains& chains,
+                                int64_t      & limit);
+  bool            CompactRefresh(BundleCompactState& state);
+  void            CompactUpdate(BundleCompactState        & state,
+                                size_t                      c,
+                                const std::vector<int64_t>& before);
+  bool            CompactStep(BundleCompactState& state,
+                              int64_t             budget,
+                              int64_t           & moved,
+                              int64_t           & trimmed);
+  bool            CompactInfoStore(int idx);
+  int64_t         CompactMove(BundleChain& chain,
+                              size_t       first,
+                              size_t       count,
+                              int64_t      limit);
+  int64_t         CompactSplit(BundleChain& chain,
+                               size_t       i,
+                               int64_t      part,
+                               int64_t      limit);
+  void            AutoCompactCheck();
+  void            AutoCompactWorker();
+  void            AutoCompactStop();
   BundleFileInfo* InfoLoad(int64_t infoPos);
   bool            InfoStore(int64_t       & infoPos,
                             BundleFileInfo& info,
                             bool            infoSystem);
-  int64_t         CollectBlocks(int64_t               start,
-                                int64_t               end,
-                                std::vector<int64_t>& dest);
-  int64_t         FileSeekForward(int64_t& curBlock,
-                                  int64_t& curBlockPos,
-                                  int64_t  offset);
-  int64_t         FileSeekBackward(int64_t             & curBlock,
-                                   int64_t             & curBlockPos,
-                                   int64_t               offset,
-                                   std::vector<int64_t>& blocks);
+
+  // индекс блоков содержимого файла
+  int64_t         ExtentsUpdate(BundleFileDesc& desc);
+  int64_t         ExtentsPosition(BundleFileDesc& desc);
+  static size_t   ExtentsFind(const CFileExtents& extents,
+                              int64_t             pos);
+
+  // длина данных и последний блок, хранимые в заголовке файла
+  int64_t         DataLengthGet(BundleFileDesc& desc,
+                                int64_t       & lastBlock);
+  bool            DataLengthSet(BundleFileDesc& desc,
+                                int64_t         length,
+                                int64_t         lastBlock);
 
   // служебная функция
   static bool AttributeCopy(CBundleFile& srcBundle,
@@ -140,4 +411,12 @@ private:
                             int          type,
                             void        *buffer,
                             size_t       bufferSize);
+  static bool AttributeSeal(CBundleFile                  & srcBundle,
+                            std::shared_ptr<IBinaryStream>dst,
+                            int                           idx,
+                            int                           type,
+                            BundleFileInfo              & info,
+                            int64_t                     & pos,
+                            void                         *buffer,
+                            size_t                        bufferSize);
 };
@@ -3,6 +3,9 @@
 #include <errno.h>
 #include <vector>
 #include <map>
+#include <mutex>
+#include <set>
+#include <string>
 #include <stdio.h>
 #include <string.h>
 //
@@ -21,11 +24,33 @@ typedef int errno_t;
 #endif // ifndef rsize_t
 
 // константы
-#define BUNDLE_VERSION 1
+// версия 2: в заголовке файла - последний блок данных и его логическое
+// начало (длина - начало плюс размер блока), ключевой хэш пути. библиотеки
+// версии 1 версию не проверяют и бандлы версии 2 менять ими нельзя:
+// дописывание и обрезание внутри последнего блока заголовок переживает, а
+// обрезание через границу блока оставляет ссылку на брошенный блок, и это
+// не обнаружить
+#define BUNDLE_VERSION 2
 #define BUNDLE_CACHE_SIZE (4 * 1024 * 1024)
+#define BUNDLE_CRYPTO_WINDOW (256 * 1024) // окно для шифрования при записи
+#define BUNDLE_CRYPTO_STREAM_CHUNK (1024 * 1024) // порция потокового чтения
+#define BUNDLE_PAGE_CACHE_SIZE (1024 * 1024)  // кэш страниц файла бандла
+#define BUNDLE_BLOCKS_CACHE_SIZE (4 * 1024 * 1024) // кэш заголовков блоков
+#define BUNDLE_PATHS_BATCH 256 // пути, расшифровываемые в фоне за один захват
 #define BUNDLE_SIGNATURE "AZBUKA"
+#define BUNDLE_SEAL_SIGNATURE "AZBSEAL"
 #define BUNDLE_ATTRS_COUNT 4
 #define BUNDLE_BLOCK_HDRS_CNT 128
+#define BUNDLE_FREE_MIN_EXTENT 64 // минимальный участок свободного места для
+                                  // переиспользования (с заголовком блока)
+#define BUNDLE_COMPACT_STEP (4 * 1024 * 1024) // объем переноса за шаг
+                                              // уплотнения по умолчанию
+#define BUNDLE_COMPACT_MIN_PART (64 * 1024)   // минимальная часть блока,
+                                              // переносимая отдельно
+#define BUNDLE_AUTOCOMPACT_MIN_DEAD (4 * 1024 * 1024) // прирост свободного
+                                                      // места для запуска
+                                                      // автоуплотнения по
+                                                      // умолчанию
 
 #pragma pack(push,1)
 
@@ -45,13 +70,26 @@ enum BundleFileFlags
   BUNDLE_FILE_FLAG_ENC_ATTR0 = 0x002, // зашифрованный атрибут 0
   BUNDLE_FILE_FLAG_ENC_ATTR1 = 0x004, // зашифрованный атрибут 1
   BUNDLE_FILE_FLAG_ENC_ATTR2 = 0x008, // зашифрованный атрибут 2
-  BUNDLE_FILE_FLAG_ENC_ATTR3 = 0x010  // зашифрованный атрибут 3
+  BUNDLE_FILE_FLAG_ENC_ATTR3 = 0x010, // зашифрованный атрибут 3
+  BUNDLE_FILE_FLAG_CTR       = 0x020  // данные файла шифруются AES-CTR от
+                                      // логического смещения (без
+                                      // выравнивания), иначе AES-ECB
+};
+enum BundleFileExtFlags
+{
+  BUNDLE_FILE_EXT_LENGTH  = 0x001, // последний блок данных и его начало
+                                   // актуальны (с версии 2)
+  BUNDLE_FILE_EXT_NAMETAG = 0x002, // в reserved - ключевой хэш пути
+                                   // (BundleNameTag)
+  BUNDLE_FILE_EXT_SEALED  = 0x004  // только у нулевого файла: бандл
+                                   // запечатан, каталог в конце файла
 };
 enum BundleFileAttribute
 {
   BUNDLE_FILE_DATA  = 0,
   BUNDLE_FILE_NAME  = 1,
-  BUNDLE_FILE_ATTRS = 2
+  BUNDLE_FILE_ATTRS = 2,
+  BUNDLE_FILE_NONCE = 3  // nonce AES-CTR данных файла (8 байт, little-endian)
 };
 
 // основная информация бандла
@@ -61,6 +99,15 @@ typedef struct
   int  version;       // версия бандла
 } BundleInfo;
 
+// окончание запечатанного бандла (последние байты файла)
+typedef struct
+{
+  int64_t dirPos;      // смещение каталога от начала бандла
+  int64_t dirSize;     // размер каталога (заголовки + зашифрованные имена)
+  int     filesCount;  // число заголовков в каталоге (с нулевым)
+  char    sealSign[8]; // "AZBSEAL"
+} BundleSealInfo;
+
 // блок информации
 typedef struct BundleBlock
 {
@@ -75,15 +122,117 @@ typedef struct BundleFileInfo
   unsigned char flags = 0;                 // флаги файла
                                            // (BundleFileFlags)
   int64_t attrsBlocks[BUNDLE_ATTRS_COUNT]; // смещения на блоки атрибутов файла
-  char    reserved[15];                    // зарезервировано для экстра-данных
+  unsigned char extFlags = 0;              // расширенные флаги
+                                           // (BundleFileExtFlags)
+  unsigned char dataLastStart[6];          // логическое начало последнего
+                                           // блока данных
+  unsigned char dataLastBlock[6];          // смещение последнего блока данных
+  char          reserved[2];               // зарезервировано для экстра-данных
   BundleFileInfo() {
-    memset(attrsBlocks, 0, sizeof(attrsBlocks));
-    memset(reserved,    0, sizeof(reserved));
+    memset(attrsBlocks,   0, sizeof(attrsBlocks));
+    memset(dataLastStart, 0, sizeof(dataLastStart));
+    memset(dataLastBlock, 0, sizeof(dataLastBlock));
+    memset(reserved,      0, sizeof(reserved));
   }
 } BundleFileInfo;
 #pragma pack(pop)
 
+// размер заголовка файла - часть формата, менять нельзя
+static_assert(sizeof(BundleFileInfo) == 48, "BundleFileInfo must be 48 bytes");
+
+// 48-битные значения в заголовке файла (little-endian)
+inline int64_t BundleInt48Get(const unsigned char *src) {
+  int64_t res = 0;
+
+  for (int i = 5; i >= 0; i--) {
+    res = (res << 8) | src[i];
+  }
+
+  // вернем результат
+  return res;
+}
+
+inline void BundleInt48Set(unsigned char *dst, int64_t value) {
+  for (int i = 0; i < 6; i++) {
+    dst[i] = (unsigned char)(value & 0xFF);
+    value >>= 8;
+  }
+}
+
+// ключевой хэш пути в заголовке файла
+inline bool BundleNameTagGet(const BundleFileInfo& info, uint16_t& tag) {
+  if ((info.extFlags & BUNDLE_FILE_EXT_NAMETAG) == 0) {
+    return false;
+  }
+  tag = (uint16_t)((unsigned char)info.reserved[0] | ((unsigned char)info.reserved[1] << 8));
+  return true;
+}
+
+inline void BundleNameTagSet(BundleFileInfo& info, uint16_t tag) {
+  info.reserved[0] = (char)(tag & 0xFF);
+  info.reserved[1] = (char)(tag >> 8);
+  info.extFlags   |= BUNDLE_FILE_EXT_NAMETAG;
+}
+
+// участок содержимого файла (один блок цепочки)
+typedef struct BundleExtent
+{
+  int64_t block  = 0; // смещение блока от начала бандла
+  int64_t offset = 0; // логическое смещение начала блока в файле
+  int64_t size   = 0; // размер данных в блоке
+} BundleExtent;
+typedef std::vector<BundleExtent> CFileExtents;
+
+// раскладка данных файла (для выгрузки в порядке расположения на диске)
+typedef struct BundleFileLayout
+{
+  int           idx    = 0;   // индекс файла
+  std::string   path   = "";  // путь к файлу
+  unsigned char flags  = 0;   // флаги файла (BundleFileFlags)
+  int64_t       length = 0;   // длина данных
+  uint64_t      nonce  = 0;   // nonce AES-CTR
+  uint64_t      gen    = 0;   // счетчик изменений цепочек файла (chainGen)
+  CFileExtents  extents;      // блоки данных
+} BundleFileLayout;
+typedef std::vector<BundleFileLayout> CFilesLayout;
+
+// цепочка блоков атрибута файла (для уплотнения)
+typedef struct BundleChain
+{
+  int     idx  = 0;             // индекс файла
+  int     type = 0;             // атрибут
+  int64_t size = 0;             // размер данных
+  std::vector<int64_t> blocks;  // блоки в порядке цепочки
+} BundleChain;
+typedef std::vector<BundleChain> CBundleChains;
+
+// состояние уплотнения между шагами одного вызова: цепочки собираются один
+// раз, на шаге заново обходятся только цепочки изменившихся файлов
+typedef struct BundleCompactState
+{
+  CBundleChains chains;                                 // цепочки (без блоков -
+                                                        // устарела)
+  std::map<int64_t, std::pair<size_t, size_t> > blocks; // блок -> (цепочка,
+                                                        // номер в ней)
+  std::vector<uint64_t> gens;                           // chainGen файлов при обходе
+  std::vector<size_t>   fragmented;                     // раздробленные цепочки
+  size_t   next  = 0;                                   // следующая из них для сборки
+  uint64_t gen   = 0;                                   // m_chainsGen при сверке
+  bool     valid = false;                               // цепочки собраны
+} BundleCompactState;
+
 // определим структуру для хранения
+// блокировка курсора файла. копия описателя получает свою блокировку
+struct BundleCursorLocker
+{
+  std::mutex locker;
+  BundleCursorLocker() {}
+  BundleCursorLocker(const BundleCursorLocker&) {}
+  BundleCursorLocker& operator=(const BundleCursorLocker&) {
+    return *this;
+  }
+};
+
 typedef struct BundleFileDesc
 {
   BundleFileInfo info;        // информация о файле
@@ -91,8 +240,21 @@ typedef struct BundleFileDesc
   // информация для содержимого файла
   int64_t curBlock    = 0;    // смещение текущего блока от начала бандла
   int64_t curBlockPos = 0;    // позиция в текущем блоке
+  int64_t curPos      = 0;    // логическая позиция в файле
+  BundleCursorLocker cursorLocker; // чтение и позиционирование по курсору
+                                   // под локом на чтение идут по очереди
+  // индекс блоков содержимого (строится при первом позиционировании и
+  // достраивается, только если цепочка менялась)
+  CFileExtents extents;
+  bool         extentsValid = false;
+  uint64_t     chainGen     = 0; // счетчик изменений цепочек файла
+  uint64_t     extentsGen   = 0; // значение счетчика при построении индекса
+  // nonce AES-CTR (читается из атрибута при первом обращении)
+  uint64_t nonce      = 0;
+  bool     nonceValid = false;
   // путь
-  std::string path = "";      // путь к файлу
+  std::string path      = "";    // путь к файлу
+  bool        pathValid = false; // флаг расшифрованного пути
 } BundleFileDesc;
 
 #ifndef AES_BLOCK_SIZE
@@ -104,5 +266,9 @@ typedef struct
   mbedtls_aes_context ctxEnc;
 } AesContext;
 typedef std::vector<BundleFileDesc>   CFilesDesc;
-typedef std::map<std::string, size_t> CFilesIndex;
-typedef std::map<int64_t, BundleBlock>CBundleBlocks;
+typedef std::vector<unsigned char>    CBundleBuffer;
+typedef std::vector<uint32_t>         CNameTags;
+typedef std::vector<void *>           CCryptoBuffers;
+typedef std::map<int64_t, int64_t>    CFreeExtents; // смещение -> размер
+typedef std::set<std::pair<int64_t, int64_t> >
+  CFreeBySize;                                      // (размер, смещение)
@@ -0,0 +1,63 @@
+#include <algorithm>
+#include "BundleFileHandle.h"
+#include "BundleFile.h"
+
+// конструктор
+CBundleFileHandle::CBundleFileHandle(CBundleFile& bundle, int idx)
+  : m_bundle(bundle), m_idx(idx), m_pos(0) {}
+
+// установка новой позиции
+int64_t CBundleFileHandle::Seek(int64_t offset, BundleFileOrigin origin) {
+  std::lock_guard<std::mutex> locker(m_locker);
+  int64_t size = m_bundle.FileSize(m_idx);
+
+  // вычислим позицию
+  if (origin == BUNDLE_FILE_ORIG_END) {
+    m_pos = size + offset;
+  } else if (origin == BUNDLE_FILE_ORIG_CUR) {
+    m_pos += offset;
+  } else {
+    m_pos = offset;
+  }
+
+  // не выходим за границы файла
+  m_pos = std::max((int64_t)0, std::min(m_pos, size));
+
+  // вернем результат
+  return m_pos;
+}
+
+// получение размера файла
+int64_t CBundleFileHandle::Size() {
+  return m_bundle.FileSize(m_idx);
+}
+
+// чтение с текущей позиции
+int64_t CBundleFileHandle::Read(void *dst, int64_t *dstLen, void *cryptoContext) {
+  std::lock_guard<std::mutex> locker(m_locker);
+  int64_t ret = m_bundle.FileReadAt(m_idx, m_pos, dst, dstLen, cryptoContext);
+
+  // сдвинем позицию
+  m_pos += ret;
+
+  // вернем результат
+  return ret;
+}
+
+// запись с текущей позиции
+int64_t CBundleFileHandle::Write(const void *src, const int64_t srcLen, void *cryptoContext) {
+  std::lock_guard<std::mutex> locker(m_locker);
+  int64_t ret = m_bundle.FileWriteAt(m_idx, m_pos, src, srcLen, cryptoContext);
+
+  // сдвинем позицию
+  m_pos += ret;
+
+  // вернем результат
+  return ret;
+}
+
+// чтение с заданной позиции
+int64_t CBundleFileHandle::ReadAt(int64_t pos, void *dst, int64_t *dstLen,
+                                  void *cryptoContext) {
+  return m_bundle.FileReadAt(m_idx, pos, dst, dstLen, cryptoContext);
+}
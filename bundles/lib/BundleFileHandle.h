@@ -0,0 +1,53 @@
+#pragma once
+#include <mutex>
+#include "mbedtls/aes.h"
+#include "BundleFileHDRs.h"
+
+class CBundleFile;
+
+// дескриптор открытого файла бандла со своим курсором. создается дешево
+// (без обращения к диску), курсор защищен своим локом. разные дескрипторы
+// одного файла не мешают друг другу, а чтение с заданной позиции (ReadAt)
+// можно вести из нескольких потоков через один дескриптор.
+// дескриптор должен быть закрыт до закрытия бандла
+class CBundleFileHandle {
+private:
+
+  CBundleFile& m_bundle; // бандл
+  int m_idx;             // индекс файла
+  int64_t m_pos;         // логическая позиция в файле
+  std::mutex m_locker;   // лок позиции
+
+public:
+
+  CBundleFileHandle(CBundleFile& bundle,
+                    int          idx);
+
+  CBundleFileHandle(const CBundleFileHandle&)            = delete;
+  CBundleFileHandle& operator=(const CBundleFileHandle&) = delete;
+
+  int Index() const {
+    return m_idx;
+  }
+
+  // позиционирование. возвращает новую позицию от начала файла
+  int64_t Seek(int64_t          offset,
+               BundleFileOrigin origin);
+  int64_t Size();
+
+  // чтение/запись с текущей позиции со сдвигом позиции. запись данных,
+  // шифрованных AES-ECB, возможна только с позиции, выровненной на 16 байт
+  int64_t Read(void    *dst,
+               int64_t *dstLen,
+               void    *cryptoContext);
+  int64_t Write(const void   *src,
+                const int64_t srcLen,
+                void         *cryptoContext);
+
+  // чтение с заданной позиции, позиция дескриптора не меняется. для данных,
+  // шифрованных AES-ECB, позиция должна быть выровнена на 16 байт
+  int64_t ReadAt(int64_t  pos,
+                 void    *dst,
+                 int64_t *dstLen,
+                 void    *cryptoContext);
+};
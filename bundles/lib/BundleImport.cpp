@@ -0,0 +1,306 @@
+#include <stdio.h>
+#include <algorithm>
+#include <thread>
+#ifdef _MSC_VER
+# include <io.h>
+#else // ifdef _MSC_VER
+# include <dirent.h>
+# include <sys/stat.h>
+#endif // ifdef _MSC_VER
+#include "BundlesLibrary.h"
+#include "BundleImport.h"
+#include "BundleFile.h"
+#include "BundleCrypto.h"
+
+#define BUNDLE_IMPORT_CHUNK_SIZE (4 * 1024 * 1024)  // порция чтения по
+                                                     // умолчанию
+#define BUNDLE_IMPORT_QUEUE_SIZE (64 * 1024 * 1024) // объем очереди по
+                                                     // умолчанию
+
+// конструктор
+CBundleImport::CBundleImport(CBundleFile& bundle, AesContext *cryptoCtx, int threads,
+                             int64_t chunkSize, int64_t queueSize)
+  : m_bundle(bundle), m_cryptoCtx(cryptoCtx), m_threads(threads),
+  m_chunkSize(chunkSize > 0 ? (size_t)chunkSize : BUNDLE_IMPORT_CHUNK_SIZE),
+  m_queueSize(queueSize > 0 ? (size_t)queueSize : BUNDLE_IMPORT_QUEUE_SIZE),
+  m_next(0), m_current(0), m_buffered(0), m_abort(false) {
+  if (m_threads <= 0) {
+    m_threads = std::max((int)std::thread::hardware_concurrency(), 1);
+  }
+}
+
+// импорт каталога
+int64_t CBundleImport::Run(const char *root, const char *prefix) {
+  std::vector<std::thread> readers;
+  std::vector<const char *> names;
+  std::vector<int> indices;
+  int64_t imported = 0;
+  bool    failed   = false;
+  bool    ok       = true;
+
+  if (root == nullptr) {
+    return -1;
+  }
+
+  // список файлов
+  if (!Scan(root, prefix != nullptr ? prefix : "")) {
+    return -1;
+  }
+
+  if (m_entries.empty()) {
+    return 0;
+  }
+
+  // создадим все файлы одним вызовом
+  names.resize(m_entries.size());
+  indices.resize(m_entries.size(), -1);
+
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    names[i] = m_entries[i].path.c_str();
+  }
+
+  if (m_bundle.FilesCreate(&names[0], (int)names.size(), &indices[0]) != (int)names.size()) {
+    return -1;
+  }
+
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    m_entries[i].idx   = indices[i];
+    m_entries[i].nonce = m_cryptoCtx != nullptr ? BundleCtrNonce() : 0;
+  }
+
+  // читатели
+  for (int i = 0; i < std::min(m_threads, (int)m_entries.size()); i++) {
+    readers.emplace_back(&CBundleImport::Reader, this);
+  }
+
+  // пишем по порядку
+  for (size_t i = 0; (i < m_entries.size()) && ok; i++) {
+    bool readFailed = false;
+
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+      m_current = i;
+    }
+    m_space.notify_all();
+
+    ok = Write(m_entries[i], readFailed);
+
+    if (ok && !readFailed) {
+      imported++;
+    }
+    failed = failed || readFailed;
+  }
+
+  // остановим читателей
+  {
+    std::lock_guard<std::mutex> lock(m_locker);
+    m_abort = true;
+  }
+  m_space.notify_all();
+
+  for (size_t i = 0; i < readers.size(); i++) {
+    readers[i].join();
+  }
+
+  return ok && !failed ? imported : -1;
+}
+
+// рекурсивный обход каталога dir, rel - путь каталога в бандле (с
+// разделителем в конце или пустой). порядок файлов - по имени
+bool CBundleImport::Scan(const std::string& dir, const std::string& rel) {
+  struct Item {
+    std::string name;
+    bool        dir;
+    int64_t     size;
+
+    bool operator<(const Item& other) const {
+      return name < other.name;
+    }
+  };
+  std::vector<Item> items;
+
+#ifdef _MSC_VER
+  struct __finddata64_t data;
+  intptr_t handle = _findfirst64((dir + "\\*").c_str(), &data);
+
+  if (handle == -1) {
+    return false;
+  }
+
+  do {
+    std::string name = data.name;
+
+    if ((name != ".") && (name != "..")) {
+      items.push_back({ name, (data.attrib & _A_SUBDIR) != 0, (int64_t)data.size });
+    }
+  } while (_findnext64(handle, &data) == 0);
+  _findclose(handle);
+#else // ifdef _MSC_VER
+  DIR *handle = opendir(dir.c_str());
+
+  if (handle == nullptr) {
+    return false;
+  }
+
+  for (struct dirent *ent = readdir(handle); ent != nullptr; ent = readdir(handle)) {
+    std::string name = ent->d_name;
+    struct stat st;
+
+    // ссылки разыменовываем, специальные файлы пропускаем
+    if ((name == ".") || (name == "..") || (stat((dir + "/" + name).c_str(), &st) != 0)) {
+      continue;
+    }
+
+    if (S_ISDIR(st.st_mode) || S_ISREG(st.st_mode)) {
+      items.push_back({ name, S_ISDIR(st.st_mode), (int64_t)st.st_size });
+    }
+  }
+  closedir(handle);
+#endif // ifdef _MSC_VER
+
+  std::sort(items.begin(), items.end());
+
+  for (size_t i = 0; i < items.size(); i++) {
+    std::string source = dir + "/" + items[i].name;
+
+    if (items[i].dir) {
+      if (!Scan(source, rel + items[i].name + "/")) {
+        return false;
+      }
+    } else {
+      m_entries.emplace_back();
+      m_entries.back().path   = rel + items[i].name;
+      m_entries.back().source = source;
+      m_entries.back().size   = items[i].size;
+    }
+  }
+  return true;
+}
+
+// читающий поток: берет следующий файл и читает его порциями. ждет, пока
+// очередь переполнена, кроме файла, который сейчас пишется (иначе писатель
+// и читатель ждали бы друг друга)
+void CBundleImport::Reader() {
+  for (;;) {
+    size_t i      = 0;
+    FILE  *file   = nullptr;
+    int64_t pos   = 0;
+
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+
+      if (m_abort || (m_next >= m_entries.size())) {
+        return;
+      }
+      i = m_next++;
+    }
+
+    Entry& entry = m_entries[i];
+    file = fopen(entry.source.c_str(), "rb");
+
+    for (bool eof = (file == nullptr); !eof;) {
+      std::vector<unsigned char> chunk;
+
+      // порция не больше остатка файла (с байтом сверх, чтобы сразу увидеть
+      // конец файла), если файл не вырос после обхода
+      size_t want = entry.size - pos >= (int64_t)m_chunkSize
+                    ? m_chunkSize : (size_t)std::max(entry.size - pos, (int64_t)0) + 1;
+
+      // место в очереди резервируется до чтения
+      {
+        std::unique_lock<std::mutex> lock(m_locker);
+        m_space.wait(lock, [&] {
+          return m_abort || (i == m_current) || (m_buffered < m_queueSize);
+        });
+
+        if (m_abort) {
+          break;
+        }
+        m_buffered += want;
+      }
+
+      chunk.resize(want);
+      size_t read = fread(chunk.data(), 1, chunk.size(), file);
+      chunk.resize(read);
+      eof = read < want;
+
+      if (m_cryptoCtx != nullptr) {
+        BundleAesCtr(&m_cryptoCtx->ctxEnc, entry.nonce, pos, chunk.data(), chunk.data(), read);
+      }
+      pos += read;
+
+      {
+        std::lock_guard<std::mutex> lock(m_locker);
+        m_buffered -= want - read;
+
+        if (read > 0) {
+          entry.chunks.push_back(std::move(chunk));
+        }
+      }
+      m_ready.notify_all();
+    }
+
+    // файл прочитан
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+      entry.failed = (file == nullptr) || (ferror(file) != 0);
+      entry.done   = true;
+    }
+    m_ready.notify_all();
+
+    if (file != nullptr) {
+      fclose(file);
+    }
+  }
+}
+
+// запись файла по мере поступления порций. false - ошибка записи в бандл,
+// в failed - ошибка чтения исходного файла
+bool CBundleImport::Write(Entry& entry, bool& failed) {
+  bool ok = true;
+
+  // перезаписываем с нуля. данные, зашифрованные читателями, пишутся как
+  // есть, поэтому файл помечается шифрованным заранее
+  m_bundle.FileTrunk(entry.idx, 0);
+
+  if (m_cryptoCtx != nullptr) {
+    ok = m_bundle.FileCipherSet(entry.idx, BUNDLE_CIPHER_CTR, &entry.nonce)
+         && m_bundle.FileDataEncryptedSet(entry.idx, true);
+  } else {
+    ok = m_bundle.FileCipherSet(entry.idx, BUNDLE_CIPHER_ECB)
+         && m_bundle.FileDataEncryptedSet(entry.idx, false);
+  }
+  m_bundle.FileSeek(entry.idx, 0, BUNDLE_FILE_ORIG_SET);
+
+  for (;;) {
+    std::vector<unsigned char> chunk;
+
+    {
+      std::unique_lock<std::mutex> lock(m_locker);
+      m_ready.wait(lock, [&] {
+        return !entry.chunks.empty() || entry.done;
+      });
+
+      if (entry.chunks.empty()) {
+        failed = entry.failed;
+        break;
+      }
+      chunk = std::move(entry.chunks.front());
+      entry.chunks.pop_front();
+    }
+
+    if (ok) {
+      ok = m_bundle.BundleAttributeSet(entry.idx, BUNDLE_FILE_DATA, chunk.data(),
+                                       (int64_t)chunk.size(), nullptr) == (int64_t)chunk.size();
+    }
+
+    // порция ушла из очереди
+    {
+      std::lock_guard<std::mutex> lock(m_locker);
+      m_buffered -= chunk.size();
+    }
+    m_space.notify_all();
+  }
+
+  return ok;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "mbedtls/aes.h"
+#include "BundleFileHDRs.h"
+
+class CBundleFile;
+
+// импорт каталога в бандл конвейером: файлы создаются одним вызовом
+// FilesCreate, несколько читающих потоков читают исходные файлы порциями
+// (и при необходимости шифруют их AES-CTR), а единственный пишущий поток
+// (вызывающий) записывает порции строго по порядку файлов. файлы ложатся в
+// бандл подряд, объем прочитанных, но не записанных данных ограничен
+class CBundleImport {
+private:
+
+  // исходный файл
+  struct Entry {
+    std::string path;   // путь в бандле
+    std::string source; // путь на диске
+    int64_t size = 0;   // размер при обходе каталога
+    int idx = -1;       // индекс файла в бандле
+    uint64_t nonce = 0; // nonce AES-CTR (выбирается до запуска читателей)
+    std::deque<std::vector<unsigned char> > chunks; // прочитанные порции
+    bool done   = false; // файл прочитан целиком (или с ошибкой)
+    bool failed = false; // ошибка чтения
+  };
+
+  CBundleFile& m_bundle;       // бандл
+  AesContext  *m_cryptoCtx;    // шифрование данных (nullptr - без него)
+  int          m_threads;      // число читающих потоков
+  size_t       m_chunkSize;    // порция чтения
+  size_t       m_queueSize;    // максимум непереданных писателю данных
+  std::vector<Entry> m_entries; // файлы в порядке записи
+  std::mutex m_locker;         // лок очереди
+  std::condition_variable m_ready; // появилась порция (для писателя)
+  std::condition_variable m_space; // освободилось место (для читателей)
+  size_t m_next;               // следующий файл для чтения
+  size_t m_current;            // файл, который пишется
+  size_t m_buffered;           // объем прочитанных порций в очереди
+  bool   m_abort;              // остановка читателей
+
+public:
+
+  CBundleImport(CBundleFile& bundle,
+                AesContext  *cryptoCtx,
+                int          threads,
+                int64_t      chunkSize,
+                int64_t      queueSize);
+
+  CBundleImport(const CBundleImport&)            = delete;
+  CBundleImport& operator=(const CBundleImport&) = delete;
+
+  // импорт файлов каталога root (рекурсивно) с путями prefix +
+  // относительный путь (разделитель '/'). существующие файлы
+  // перезаписываются. возвращает число импортированных файлов или -1 при
+  // ошибке (остальные файлы при ошибке чтения одного из них импортируются)
+  int64_t Run(const char *root,
+              const char *prefix);
+
+private:
+
+  bool    Scan(const std::string& dir,
+               const std::string& rel);
+  void    Reader();
+  bool    Write(Entry& entry,
+                bool & failed);
+};
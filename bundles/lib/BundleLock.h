@@ -0,0 +1,185 @@
+#pragma once
+#ifdef __GNUC__
+# include <pthread.h>
+#else // ifdef __GNUC__
+# include <shared_mutex>
+#endif // ifdef __GNUC__
+#include <atomic>
+#include <thread>
+#include <vector>
+
+// блокировка читатель-писатель для бандла. читатели работают параллельно,
+// писатель - монопольно. ожидающий писатель пропускается вперед новых
+// читателей, поэтому поток читателей его не задерживает. писатель может
+// повторно брать блокировку (и на чтение, и на запись) - служебные функции
+// записи вызывают публичные. читатель может повторно брать блокировку на
+// чтение (повторный захват учитывается счетчиком потока и не встает в
+// очередь за писателем), но не на запись. в монопольном режиме читатели тоже
+// захватывают блокировку на запись
+class CBundleLock {
+private:
+
+#ifdef __GNUC__
+  pthread_rwlock_t m_locker;                // лок
+#else // ifdef __GNUC__
+  std::shared_timed_mutex m_locker;         // лок
+#endif // ifdef __GNUC__
+  std::atomic<std::thread::id> m_writer;    // поток-писатель
+  int m_depth;                              // глубина захвата писателем
+  bool m_exclusive;                         // монопольный режим
+
+  // захваты на чтение текущим потоком (блокировка -> глубина)
+  static std::vector<std::pair<const CBundleLock *, int> >& Readers() {
+    static thread_local std::vector<std::pair<const CBundleLock *, int> > readers;
+    return readers;
+  }
+
+public:
+
+  CBundleLock() : m_writer(std::thread::id()), m_depth(0), m_exclusive(false) {
+#ifdef __GNUC__
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+# ifdef __GLIBC__
+    // по умолчанию glibc пропускает читателей вперед писателя
+    pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+# endif // ifdef __GLIBC__
+    pthread_rwlock_init(&m_locker, &attr);
+    pthread_rwlockattr_destroy(&attr);
+#endif // ifdef __GNUC__
+  }
+
+  ~CBundleLock() {
+#ifdef __GNUC__
+    pthread_rwlock_destroy(&m_locker);
+#endif // ifdef __GNUC__
+  }
+
+  CBundleLock(const CBundleLock&)            = delete;
+  CBundleLock& operator=(const CBundleLock&) = delete;
+
+  // монопольный режим. менять можно, только когда блокировка не захвачена
+  void ExclusiveSet(bool exclusive) {
+    m_exclusive = exclusive;
+  }
+
+  // захват на чтение
+  void LockRead() {
+    if (m_exclusive) {
+      LockWrite();
+      return;
+    }
+
+    if (m_writer.load() == std::this_thread::get_id()) {
+      m_depth++;
+      return;
+    }
+
+    // повторный захват читателем
+    std::vector<std::pair<const CBundleLock *, int> >& readers = Readers();
+
+    for (size_t i = 0; i < readers.size(); i++) {
+      if (readers[i].first == this) {
+        readers[i].second++;
+        return;
+      }
+    }
+#ifdef __GNUC__
+    pthread_rwlock_rdlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.lock_shared();
+#endif // ifdef __GNUC__
+    readers.push_back(std::make_pair(this, 1));
+  }
+
+  void UnlockRead() {
+    if (m_exclusive) {
+      UnlockWrite();
+      return;
+    }
+
+    if (m_writer.load() == std::this_thread::get_id()) {
+      m_depth--;
+      return;
+    }
+
+    // снимаем блокировку с последним захватом потока
+    std::vector<std::pair<const CBundleLock *, int> >& readers = Readers();
+
+    for (size_t i = 0; i < readers.size(); i++) {
+      if (readers[i].first == this) {
+        if (--readers[i].second > 0) {
+          return;
+        }
+        readers.erase(readers.begin() + i);
+        break;
+      }
+    }
+#ifdef __GNUC__
+    pthread_rwlock_unlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.unlock_shared();
+#endif // ifdef __GNUC__
+  }
+
+  // захват на запись
+  void LockWrite() {
+    if (m_writer.load() == std::this_thread::get_id()) {
+      m_depth++;
+      return;
+    }
+#ifdef __GNUC__
+    pthread_rwlock_wrlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.lock();
+#endif // ifdef __GNUC__
+    m_writer = std::this_thread::get_id();
+    m_depth  = 1;
+  }
+
+  void UnlockWrite() {
+    if (--m_depth > 0) {
+      return;
+    }
+    m_writer = std::thread::id();
+#ifdef __GNUC__
+    pthread_rwlock_unlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.unlock();
+#endif // ifdef __GNUC__
+  }
+};
+
+// захват блокировки бандла на чтение в пределах области видимости
+class CBundleReadLock {
+private:
+
+  CBundleLock& m_locker;
+
+public:
+
+  explicit CBundleReadLock(CBundleLock& locker) : m_locker(locker) {
+    m_locker.LockRead();
+  }
+
+  ~CBundleReadLock() {
+    m_locker.UnlockRead();
+  }
+};
+
+// захват блокировки бандла на запись в пределах области видимости
+class CBundleWriteLock {
+private:
+
+  CBundleLock& m_locker;
+
+public:
+
+  explicit CBundleWriteLock(CBundleLock& locker) : m_locker(locker) {
+    m_locker.LockWrite();
+  }
+
+  ~CBundleWriteLock() {
+    m_locker.UnlockWrite();
+  }
+};
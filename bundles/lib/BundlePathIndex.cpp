@@ -0,0 +1,192 @@
+#include <string.h>
+#include <algorithm>
+#include "BundlePathIndex.h"
+
+#define BUNDLE_PATH_MIN_SLOTS  64          // минимальный размер таблицы
+#define BUNDLE_PATH_CHUNK_SIZE (64 * 1024) // порция памяти ключей
+
+// конструктор
+CBundlePathIndex::CBundlePathIndex() : m_chunkUsed(0), m_chunkSize(0), m_count(0) {
+  m_entries.resize(BUNDLE_PATH_MIN_SLOTS);
+}
+
+// хэш пути (FNV-1a по 8 байт с перемешиванием, хвост побайтно)
+uint64_t CBundlePathIndex::Hash(const char *key, size_t len) {
+  uint64_t h = 0xcbf29ce484222325ULL ^ len;
+  size_t   i = 0;
+
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w;
+    memcpy(&w, key + i, 8);
+    h ^= w;
+    h *= 0x100000001b3ULL;
+    h ^= h >> 29;
+  }
+
+  for (; i < len; i++) {
+    h ^= (unsigned char)key[i];
+    h *= 0x100000001b3ULL;
+  }
+
+  // финальное перемешивание, чтобы младшие биты зависели от всех
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+
+  return h;
+}
+
+// поиск
+bool CBundlePathIndex::Find(const char *key, size_t len, size_t& value) const {
+  return Find(Hash(key, len), key, len, value);
+}
+
+bool CBundlePathIndex::Find(uint64_t hash, const char *key, size_t len,
+                            size_t& value) const {
+  size_t slot = 0;
+
+  if (!Lookup(hash, key, len, slot)) {
+    return false;
+  }
+
+  value = m_entries[slot].value;
+  return true;
+}
+
+// добавление или замена
+void CBundlePathIndex::Set(const char *key, size_t len, size_t value) {
+  uint64_t hash = Hash(key, len);
+  size_t   slot = 0;
+
+  // замена
+  if (Lookup(hash, key, len, slot)) {
+    m_entries[slot].value = value;
+    return;
+  }
+
+  // заполнение не больше 3/4
+  if ((m_count + 1) * 4 > m_entries.size() * 3) {
+    Resize(m_entries.size() * 2);
+  }
+
+  size_t mask = m_entries.size() - 1;
+
+  for (slot = (size_t)hash & mask; m_entries[slot].key != nullptr; slot = (slot + 1) & mask) {}
+
+  m_entries[slot].hash  = hash;
+  m_entries[slot].key   = Store(key, len);
+  m_entries[slot].len   = len;
+  m_entries[slot].value = value;
+  m_count++;
+}
+
+// удаление (память ключа освобождается при Clear)
+void CBundlePathIndex::Erase(const char *key, size_t len) {
+  size_t slot = 0;
+
+  if (Lookup(Hash(key, len), key, len, slot)) {
+    EraseSlot(slot);
+  }
+}
+
+// очистка
+void CBundlePathIndex::Clear() {
+  std::vector<Entry>(BUNDLE_PATH_MIN_SLOTS).swap(m_entries);
+  m_chunks.clear();
+  m_chunkUsed = 0;
+  m_chunkSize = 0;
+  m_count     = 0;
+}
+
+// подготовка к добавлению
+void CBundlePathIndex::Reserve(size_t count) {
+  size_t size = m_entries.size();
+
+  while ((m_count + count) * 4 > size * 3) {
+    size *= 2;
+  }
+
+  if (size != m_entries.size()) {
+    Resize(size);
+  }
+}
+
+// поиск ячейки
+bool CBundlePathIndex::Lookup(uint64_t hash, const char *key, size_t len,
+                              size_t& slot) const {
+  size_t mask = m_entries.size() - 1;
+
+  for (slot = (size_t)hash & mask; m_entries[slot].key != nullptr; slot = (slot + 1) & mask) {
+    const Entry& e = m_entries[slot];
+
+    if ((e.hash == hash) && (e.len == len) && (memcmp(e.key, key, len) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// копирование ключа в общую память (длинный ключ - в своей порции)
+const char * CBundlePathIndex::Store(const char *key, size_t len) {
+  if (m_chunks.empty() || (m_chunkUsed + len > m_chunkSize)) {
+    m_chunkSize = std::max(len, (size_t)BUNDLE_PATH_CHUNK_SIZE);
+    m_chunks.emplace_back(new char[m_chunkSize]);
+    m_chunkUsed = 0;
+  }
+
+  char *dst = m_chunks.back().get() + m_chunkUsed;
+  memcpy(dst, key, len);
+  m_chunkUsed += len;
+
+  return dst;
+}
+
+// перестроение таблицы (хэши не пересчитываются)
+void CBundlePathIndex::Resize(size_t size) {
+  std::vector<Entry> entries(size);
+  size_t mask = size - 1;
+
+  for (size_t i = 0; i < m_entries.size(); i++) {
+    if (m_entries[i].key == nullptr) {
+      continue;
+    }
+
+    size_t slot = (size_t)m_entries[i].hash & mask;
+
+    while (entries[slot].key != nullptr) {
+      slot = (slot + 1) & mask;
+    }
+    entries[slot] = m_entries[i];
+  }
+
+  m_entries.swap(entries);
+}
+
+// удаление записи со сдвигом следующих записей цепочки назад
+void CBundlePathIndex::EraseSlot(size_t slot) {
+  size_t mask = m_entries.size() - 1;
+  size_t i    = slot;
+  size_t j    = slot;
+
+  for (;;) {
+    j = (j + 1) & mask;
+
+    if (m_entries[j].key == nullptr) {
+      break;
+    }
+
+    // запись j можно перенести в i, только если ее начальная ячейка не
+    // лежит между i и j
+    size_t home = (size_t)m_entries[j].hash & mask;
+
+    if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) {
+      continue;
+    }
+
+    m_entries[i] = m_entries[j];
+    i            = j;
+  }
+
+  m_entries[i] = Entry();
+  m_count--;
+}
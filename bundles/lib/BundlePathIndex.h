@@ -0,0 +1,73 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+#include <memory>
+#include <vector>
+
+// индекс файлов бандла по пути: хэш-таблица с открытой адресацией
+// (линейное пробирование). хэш пути считается один раз и хранится в записи,
+// сравнение строк - только при совпадении хэша. ключи копируются в общую
+// память порциями, поиск идет по указателю и длине без выделения памяти.
+// поиск из нескольких потоков допустим, изменения - монопольно
+class CBundlePathIndex {
+private:
+
+  // запись таблицы (key = nullptr - свободна)
+  struct Entry {
+    uint64_t    hash  = 0;
+    const char *key   = nullptr;
+    size_t      len   = 0;
+    size_t      value = 0;
+  };
+
+  std::vector<Entry> m_entries;                   // таблица (размер -
+                                                  // степень двойки)
+  std::vector<std::unique_ptr<char[]> > m_chunks; // память ключей
+  size_t m_chunkUsed;                             // занято в последней порции
+  size_t m_chunkSize;                             // размер последней порции
+  size_t m_count;                                 // число записей
+
+public:
+
+  CBundlePathIndex();
+
+  CBundlePathIndex(const CBundlePathIndex&)            = delete;
+  CBundlePathIndex& operator=(const CBundlePathIndex&) = delete;
+
+  // хэш пути
+  static uint64_t Hash(const char *key,
+                       size_t      len);
+
+  // поиск, добавление/замена и удаление. ключ - len байт с key
+  bool   Find(const char *key,
+              size_t      len,
+              size_t    & value) const;
+  bool   Find(uint64_t    hash,
+              const char *key,
+              size_t      len,
+              size_t    & value) const;
+  void   Set(const char *key,
+             size_t      len,
+             size_t      value);
+  void   Erase(const char *key,
+               size_t      len);
+  void   Clear();
+
+  size_t Count() const {
+    return m_count;
+  }
+
+  // подготовка к добавлению count записей
+  void   Reserve(size_t count);
+
+private:
+
+  bool   Lookup(uint64_t    hash,
+                const char *key,
+                size_t      len,
+                size_t    & slot) const;
+  const char* Store(const char *key,
+                    size_t      len);
+  void   Resize(size_t size);
+  void   EraseSlot(size_t slot);
+};
@@ -1,27 +1,81 @@
 #include <string>
 #include <vector>
 #include <map>
+#include <thread>
+#include <algorithm>
 #include "BundlesLibrary.h"
 #include "BundleFile.h"
+#include "BundleFileHandle.h"
+#include "BundleImport.h"
+#include "BundleExtract.h"
 
 #include "streams/BinaryFile.h"
+#include "streams/MappedFile.h"
+#include "streams/PositionalFile.h"
 
 
+// параметры открытия по умолчанию
+void BundleOpenOptionsInit(BundleOpenOptions *options, int mode) {
+  if (options == nullptr) {
+    return;
+  }
+
+  options->mode             = mode;
+  options->lockMode         = BUNDLE_LOCK_SHARED;
+  options->pageCacheSize    = BUNDLE_PAGE_CACHE_SIZE;
+  options->headersCount     = BUNDLE_BLOCK_HDRS_CNT;
+  options->cryptoBufferSize = BUNDLE_CACHE_SIZE;
+  options->blockCacheSize   = BUNDLE_BLOCKS_CACHE_SIZE;
+  options->cryptoThreads    = 0;
+  options->cryptoThreshold  = 0;
+  options->cryptoStreaming  = 0;
+  options->pathsMode        = BUNDLE_PATHS_EAGER;
+}
+
 // открытие бандла
 BundlePtr BundleOpen(const char *filename, int mode) {
+  BundleOpenOptions options;
+
+  BundleOpenOptionsInit(&options, mode);
+
+  return BundleOpenEx(filename, &options);
+}
+
+// открытие бандла с параметрами
+BundlePtr BundleOpenEx(const char *filename, const BundleOpenOptions *options) {
   std::string  om     = "";
   CBundleFile *bundle = nullptr;
   std::shared_ptr<CBinaryFile> stream;
+  std::shared_ptr<CMappedFile> mapped;
+  std::shared_ptr<CPositionalFile> positional;
 
   // проверки параметров
-  if (filename == nullptr) {
+  if ((filename == nullptr) || (options == nullptr)
+      || (options->pageCacheSize < 0) || (options->headersCount <= 0)
+      || (options->cryptoBufferSize < AES_BLOCK_SIZE)) {
     return nullptr;
   }
 
+  int mode = options->mode;
+
+#ifdef _MSC_VER
+
+  // отображение в память и pread/pwrite не поддерживаются
+  mode &= ~(BMODE_MAPPED | BMODE_POSITIONAL);
+#endif // ifdef _MSC_VER
+
   // выделяем объекты
   try {
-    stream = std::make_shared<CBinaryFile>(0, 0);
-    bundle = new CBundleFile(stream);
+    if ((mode & BMODE_MAPPED) == BMODE_MAPPED) {
+      mapped = std::make_shared<CMappedFile>();
+      bundle = new CBundleFile(mapped, options->headersCount);
+    } else if ((mode & BMODE_POSITIONAL) == BMODE_POSITIONAL) {
+      positional = std::make_shared<CPositionalFile>();
+      bundle     = new CBundleFile(positional, options->headersCount);
+    } else {
+      stream = std::make_shared<CBinaryFile>(0, (size_t)options->pageCacheSize);
+      bundle = new CBundleFile(stream, options->headersCount);
+    }
   } catch (...) {
     if (bundle != nullptr) {
       delete bundle;
@@ -40,16 +94,36 @@ BundlePtr BundleOpen(const char *filename, int mode) {
   }
 
   // открываем поток
-  errno_t err = stream->Open(filename, om.data());
+  auto open = [&](const char *m) -> errno_t {
+                if (mapped) return mapped->Open(filename, m);
+                if (positional) return positional->Open(filename, m);
+                return stream->Open(filename, m);
+              };
+  errno_t err = open(om.data());
 
   if ((err == ENOENT) && ((mode & BMODE_OPEN_ALWAYS) == BMODE_OPEN_ALWAYS)) {
-    err = stream->Open(filename, "w+b");
+    err = open("w+b");
   }
 
   // инициализиуруем бандл
   if ((err != 0) || (bundle->Open((mode & BMODE_OPEN_ALWAYS) == BMODE_OPEN_ALWAYS) != 0)) {
     delete bundle;
-    bundle = nullptr;
+    return nullptr;
+  }
+
+  // настройки
+  bundle->LockModeSet(options->lockMode);
+  bundle->CryptoBufferSizeSet((size_t)options->cryptoBufferSize);
+  bundle->BlocksCacheSet(options->blockCacheSize);
+  bundle->PathsModeSet(options->pathsMode);
+
+  if (((options->cryptoThreads != 0)
+       && (BundleCryptoThreadsSet(bundle, options->cryptoThreads,
+                                  options->cryptoThreshold) == 0))
+      || ((options->cryptoStreaming != 0)
+          && (BundleCryptoStreamingSet(bundle, 1) == 0))) {
+    delete bundle;
+    return nullptr;
   }
 
   // вернем результат
@@ -100,7 +174,7 @@ int BundleInitialize(BundlePtr bundle, const void *pathKey,
   CBundleFile *bf = (CBundleFile *)bundle;
 
   return bf != nullptr
-         && bf->Initialize(pathKey, keyLen, BUNDLE_CACHE_SIZE) ? 1 : 0;
+         && bf->Initialize(pathKey, keyLen, bf->CryptoBufferSize()) ? 1 : 0;
 }
 
 // получение атрибутов бандла
@@ -170,6 +244,62 @@ void BundleDestroyCryptoContext(CryptoCtx cryptoCtx) {
   delete (AesContext *)cryptoCtx;
 }
 
+// параллельное шифрование
+int BundleCryptoThreadsSet(BundlePtr bundle, int threads, int64_t threshold) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  // по числу ядер (вызывающий поток тоже шифрует)
+  if (threads < 0) {
+    threads = std::max((int)std::thread::hardware_concurrency() - 1, 0);
+  }
+
+  return bf != nullptr && bf->CryptoThreadsSet(threads, threshold) ? 1 : 0;
+}
+
+// потоковое чтение
+int BundleCryptoStreamingSet(BundlePtr bundle, int enabled) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr && bf->CryptoStreamingSet(enabled != 0) ? 1 : 0;
+}
+
+// статистика кэша заголовков блоков
+int BundleBlocksCacheStats(BundlePtr bundle, uint64_t *hits, uint64_t *misses,
+                           int64_t *memory) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  uint64_t     h  = 0;
+  uint64_t     m  = 0;
+  int64_t      s  = 0;
+
+  if (bf == nullptr) {
+    return 0;
+  }
+  bf->BlocksCacheStats(h, m, s);
+
+  if (hits != nullptr) *hits = h;
+  if (misses != nullptr) *misses = m;
+  if (memory != nullptr) *memory = s;
+
+  return 1;
+}
+
+// статистика расшифровки путей
+int BundlePathsStats(BundlePtr bundle, int64_t *resolved, int64_t *total) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  int64_t      r  = 0;
+  int64_t      t  = 0;
+
+  if (bf == nullptr) {
+    return 0;
+  }
+  bf->PathsStats(r, t);
+
+  if (resolved != nullptr) *resolved = r;
+  if (total != nullptr) *total = t;
+
+  return 1;
+}
+
 // открытие файла
 int BundleFileOpen(BundlePtr bundle, const char *filename,
                    int openAlways) {
@@ -178,6 +308,149 @@ int BundleFileOpen(BundlePtr bundle, const char *filename,
   return bf != nullptr ? bf->FileOpen(filename, openAlways != 0) : -1;
 }
 
+// создание файлов пачкой
+int BundleFilesCreate(BundlePtr bundle, const char *const *filenames, int count,
+                      int *indices) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr ? bf->FilesCreate(filenames, count, indices) : 0;
+}
+
+// параметры импорта по умолчанию
+void BundleImportOptionsInit(BundleImportOptions *options) {
+  if (options == nullptr) {
+    return;
+  }
+
+  options->threads   = 0;
+  options->chunkSize = 0;
+  options->queueSize = 0;
+  options->cryptoCtx = nullptr;
+  options->prefix    = "";
+}
+
+// импорт каталога
+int64_t BundleImportDirectory(BundlePtr bundle, const char *rootPath,
+                              const BundleImportOptions *options) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  BundleImportOptions defaults;
+
+  if ((bf == nullptr) || (rootPath == nullptr)) {
+    return -1;
+  }
+
+  if (options == nullptr) {
+    BundleImportOptionsInit(&defaults);
+    options = &defaults;
+  }
+
+  CBundleImport import(*bf, (AesContext *)options->cryptoCtx, options->threads,
+                       options->chunkSize, options->queueSize);
+
+  return import.Run(rootPath, options->prefix);
+}
+
+// параметры выгрузки по умолчанию
+void BundleExtractOptionsInit(BundleExtractOptions *options) {
+  if (options == nullptr) {
+    return;
+  }
+
+  options->threads   = 0;
+  options->runSize   = 0;
+  options->queueSize = 0;
+  options->cryptoCtx = nullptr;
+}
+
+// выгрузка бандла
+int64_t BundleExtract(BundlePtr bundle, const char *destDir,
+                      const BundleExtractOptions *options) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  BundleExtractOptions defaults;
+
+  if ((bf == nullptr) || (destDir == nullptr)) {
+    return -1;
+  }
+
+  if (options == nullptr) {
+    BundleExtractOptionsInit(&defaults);
+    options = &defaults;
+  }
+
+  CBundleExtract extract(*bf, (AesContext *)options->cryptoCtx, options->threads,
+                         options->runSize, options->queueSize);
+
+  return extract.Run(destDir);
+}
+
+// параметры уплотнения по умолчанию
+void BundleCompactOptionsInit(BundleCompactOptions *options) {
+  if (options == nullptr) {
+    return;
+  }
+
+  options->stepSize       = 0;
+  options->bytesPerSecond = 0;
+  options->maxBytes       = 0;
+}
+
+// уплотнение бандла
+int64_t BundleCompact(BundlePtr bundle, const BundleCompactOptions *options) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  BundleCompactOptions defaults;
+
+  if (bf == nullptr) {
+    return -1;
+  }
+
+  if (options == nullptr) {
+    BundleCompactOptionsInit(&defaults);
+    options = &defaults;
+  }
+
+  return bf->Compact(options->stepSize, options->bytesPerSecond, options->maxBytes);
+}
+
+// учет места в бандле
+int BundleSpaceStats(BundlePtr bundle, int64_t *size, int64_t *liveBytes, int64_t *deadBytes,
+                     int64_t *tailBytes) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  int64_t      s  = 0;
+  int64_t      l  = 0;
+  int64_t      d  = 0;
+  int64_t      t  = 0;
+
+  if ((bf == nullptr) || !bf->SpaceStats(s, l, d, t)) {
+    return 0;
+  }
+
+  if (size != nullptr) *size = s;
+  if (liveBytes != nullptr) *liveBytes = l;
+  if (deadBytes != nullptr) *deadBytes = d;
+  if (tailBytes != nullptr) *tailBytes = t;
+
+  return 1;
+}
+
+// автоматическое уплотнение
+int BundleAutoCompactSet(BundlePtr bundle, double deadRatio, int64_t minDeadBytes,
+                         const BundleCompactOptions *options) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  BundleCompactOptions defaults;
+
+  if (bf == nullptr) {
+    return 0;
+  }
+
+  if (options == nullptr) {
+    BundleCompactOptionsInit(&defaults);
+    options = &defaults;
+  }
+
+  return bf->AutoCompactSet(deadRatio, minDeadBytes, options->stepSize,
+                            options->bytesPerSecond, options->maxBytes) ? 1 : 0;
+}
+
 // установка заданной позиции
 int64_t BundleFileSeek(BundlePtr bundle, int idx, int64_t offset,
                        BundleFileOrigin origin) {
@@ -221,6 +494,13 @@ int64_t BundleFileWrite(BundlePtr bundle, int idx, const void *src,
                                              srcLen, cryptoCtx) : 0;
 }
 
+// чтение без копирования
+const void * BundleFileBorrow(BundlePtr bundle, int idx, int64_t *dstLen) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr && idx > 0 ? bf->FileBorrow(idx, dstLen) : nullptr;
+}
+
 // удаление файла
 void BundleFileDelete(BundlePtr bundle, int idx) {
   CBundleFile *bf = (CBundleFile *)bundle;
@@ -230,6 +510,95 @@ void BundleFileDelete(BundlePtr bundle, int idx) {
   }
 }
 
+// режим шифрования данных файла
+int BundleFileCipherSet(BundlePtr bundle, int idx, BundleFileCipher cipher) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr && bf->FileCipherSet(idx, cipher) ? 1 : 0;
+}
+
+int BundleFileCipherGet(BundlePtr bundle, int idx) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr ? bf->FileCipherGet(idx) : -1;
+}
+
+// чтение с заданной позиции
+int64_t BundleFileReadAt(BundlePtr bundle, int idx, int64_t pos, void *dst,
+                         int64_t dstOffset, int64_t *dstLen, CryptoCtx cryptoCtx) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+
+  return bf != nullptr
+         && idx > 0 ? bf->FileReadAt(idx, pos, (char *)dst + dstOffset, dstLen, cryptoCtx) : 0;
+}
+
+// открытие дескриптора файла
+BundleFileHandle BundleFileHandleOpen(BundlePtr bundle, const char *filename, int openAlways) {
+  CBundleFile *bf = (CBundleFile *)bundle;
+  int idx         = bf != nullptr ? bf->FileOpen(filename, openAlways != 0, false) : -1;
+
+  if (idx <= 0) {
+    return nullptr;
+  }
+
+  try {
+    return new CBundleFileHandle(*bf, idx);
+  } catch (...) {
+    return nullptr;
+  }
+}
+
+// закрытие дескриптора файла
+void BundleFileHandleClose(BundleFileHandle handle) {
+  delete (CBundleFileHandle *)handle;
+}
+
+// индекс файла дескриптора
+int BundleFileHandleIndex(BundleFileHandle handle) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->Index() : -1;
+}
+
+// установка позиции дескриптора
+int64_t BundleFileHandleSeek(BundleFileHandle handle, int64_t offset,
+                             BundleFileOrigin origin) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->Seek(offset, origin) : 0;
+}
+
+// размер файла дескриптора
+int64_t BundleFileHandleLength(BundleFileHandle handle) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->Size() : 0;
+}
+
+// чтение с позиции дескриптора
+int64_t BundleFileHandleRead(BundleFileHandle handle, void *dst, int64_t dstOffset,
+                             int64_t *dstLen, CryptoCtx cryptoCtx) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->Read((char *)dst + dstOffset, dstLen, cryptoCtx) : 0;
+}
+
+// чтение с заданной позиции через дескриптор
+int64_t BundleFileHandleReadAt(BundleFileHandle handle, int64_t pos, void *dst,
+                               int64_t dstOffset, int64_t *dstLen, CryptoCtx cryptoCtx) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->ReadAt(pos, (char *)dst + dstOffset, dstLen, cryptoCtx) : 0;
+}
+
+// запись с позиции дескриптора
+int64_t BundleFileHandleWrite(BundleFileHandle handle, const void *src, int64_t srcOffset,
+                              const int64_t srcLen, CryptoCtx cryptoCtx) {
+  CBundleFileHandle *fh = (CBundleFileHandle *)handle;
+
+  return fh != nullptr ? fh->Write((char *)src + srcOffset, srcLen, cryptoCtx) : 0;
+}
+
 // дефрагментация
 void Defragmentation(const char *fileSrc, const char *fileTmp) {
   auto streamSrc = std::make_shared<CBinaryFile>(0, 1024 * 1024);
@@ -255,3 +624,27 @@ void Defragmentation(const char *fileSrc, const char *fileTmp) {
   streamSrc->Close();
   streamDst->Close();
 }
+
+// запечатывание бандла
+bool BundleSeal(const char *fileSrc, const char *fileDst, const void *pathKey, int keyLen) {
+  auto streamSrc = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+  auto streamDst = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+  bool ret       = false;
+
+  // проверки
+  if ((fileSrc == nullptr) || (fileDst == nullptr) || (pathKey == nullptr)) {
+    return false;
+  }
+
+  // откроем
+  if ((streamSrc->Open(fileSrc, "rb") == 0) && (streamDst->Open(fileDst, "w+b") == 0)) {
+    ret = CBundleFile::Seal(streamSrc, streamDst, pathKey, keyLen);
+  }
+
+  // закроем
+  streamSrc->Close();
+  streamDst->Close();
+
+  // вернем результат
+  return ret;
+}
@@ -6,7 +6,32 @@ enum BundleOpenMode {
   BMODE_READ        = 0x01,
   BMODE_WRITE       = 0x02,
   BMODE_READWRITE   = 0x03,
-  BMODE_OPEN_ALWAYS = 0x04
+  BMODE_OPEN_ALWAYS = 0x04,
+  BMODE_MAPPED      = 0x08, // отображение файла в память (под Windows
+                            // игнорируется)
+  BMODE_POSITIONAL  = 0x10  // pread/pwrite без общего курсора (под Windows
+                            // игнорируется, BMODE_MAPPED важнее)
+};
+
+// режим шифрования данных файла
+enum BundleFileCipher {
+  BUNDLE_CIPHER_ECB = 0, // AES-ECB, позиции и размеры кратны 16 байтам
+  BUNDLE_CIPHER_CTR = 1  // AES-CTR, любые позиции и размеры
+};
+
+// режим блокировки бандла
+enum BundleLockMode {
+  BUNDLE_LOCK_SHARED    = 0, // чтения идут параллельно, запись монопольно
+  BUNDLE_LOCK_EXCLUSIVE = 1  // все операции монопольно (без издержек
+                             // разделяемой блокировки при работе из одного
+                             // потока)
+};
+
+// расшифровка путей файлов при инициализации
+enum BundlePathsMode {
+  BUNDLE_PATHS_EAGER      = 0, // все пути сразу
+  BUNDLE_PATHS_LAZY       = 1, // по требованию (поиск по пути, имя файла)
+  BUNDLE_PATHS_BACKGROUND = 2  // по требованию и порциями в фоновом потоке
 };
 
 enum BundleAttribute {
@@ -24,10 +49,33 @@ enum BundleFileOrigin {
 #endif // ifndef _BUNDLES_ORIGIN_ENUM_
 typedef void *BundlePtr;
 typedef void *CryptoCtx;
+typedef void *BundleFileHandle;
+
+// параметры открытия бандла. заполняются значениями по умолчанию функцией
+// BundleOpenOptionsInit
+struct BundleOpenOptions {
+  int     mode;             // BundleOpenMode, в том числе способ доступа к
+                            // файлу (BMODE_MAPPED, BMODE_POSITIONAL)
+  int     lockMode;         // BundleLockMode
+  int64_t pageCacheSize;    // кэш страниц файла (без BMODE_MAPPED и
+                            // BMODE_POSITIONAL), 0 - без кэша
+  int     headersCount;     // число превыделяемых заголовков файлов
+  int64_t cryptoBufferSize; // порция чтения/записи шифрованных данных
+  int64_t blockCacheSize;   // объем кэша заголовков блоков, 0 - без
+                            // ограничения
+  int     cryptoThreads;    // см. BundleCryptoThreadsSet
+  int64_t cryptoThreshold;
+  int     cryptoStreaming;  // см. BundleCryptoStreamingSet
+  int     pathsMode;        // BundlePathsMode
+};
 
 // открытие и закрытие бандла
 BundlePtr BundleOpen(const char *filename,
                      int         mode);
+void      BundleOpenOptionsInit(BundleOpenOptions *options,
+                                int                mode);
+BundlePtr BundleOpenEx(const char              *filename,
+                       const BundleOpenOptions *options);
 BundlePtr BundleOpenFromStream(std::shared_ptr<IBinaryStream>stream,
                                int                           mode);
 void      BundleClose(BundlePtr bundle);
@@ -73,8 +121,37 @@ CryptoCtx BundleCreateCryptoContext(const void *key,
                                     int         keyLen);
 void      BundleDestroyCryptoContext(CryptoCtx cryptoCtx);
 
+// параллельное шифрование данных файлов бандла (по умолчанию выключено).
+// threads - число дополнительных потоков (0 - выключить, -1 - по числу
+// ядер), threshold - объем, меньше которого шифрование идет в вызывающем
+// потоке (0 - по умолчанию). в случае успеха возвращает 1
+int BundleCryptoThreadsSet(BundlePtr bundle,
+                           int       threads,
+                           int64_t   threshold);
+
+// потоковое чтение шифрованных данных (по умолчанию выключено): при больших
+// чтениях расшифровка порции идет в фоне, пока читается следующая. в случае
+// успеха возвращает 1
+int BundleCryptoStreamingSet(BundlePtr bundle,
+                             int       enabled);
+
+// статистика кэша заголовков блоков: попадания, промахи и занятая память.
+// в случае успеха возвращает 1
+int BundleBlocksCacheStats(BundlePtr bundle,
+                           uint64_t *hits,
+                           uint64_t *misses,
+                           int64_t  *memory);
+
+// статистика расшифровки путей: сколько путей расшифровано с момента
+// инициализации и сколько всего заголовков файлов. в случае успеха
+// возвращает 1
+int BundlePathsStats(BundlePtr bundle,
+                     int64_t  *resolved,
+                     int64_t  *total);
+
 // работа с файлами. Для всех операций чтения/записи с использованием
-// криптоконтекста, буфер должен быть выровнен на 16 байт (блок AES)
+// криптоконтекста, буфер должен быть выровнен на 16 байт (блок AES), кроме
+// файлов в режиме BUNDLE_CIPHER_CTR
 int     BundleFileOpen(BundlePtr   bundle,
                        const char *filename,
                        int         openAlways);
@@ -84,6 +161,9 @@ int64_t BundleFileSeek(BundlePtr        bundle,
                        BundleFileOrigin origin);
 int64_t BundleFileLength(BundlePtr bundle,
                          int       idx);
+void    BundleFileTrunk(BundlePtr bundle,
+                        int       idx,
+                        int64_t   newSize);
 int64_t BundleFileRead(BundlePtr bundle,
                        int       idx,
                        void     *dst,
@@ -99,5 +179,175 @@ int64_t BundleFileWrite(BundlePtr     bundle,
 void BundleFileDelete(BundlePtr bundle,
                       int       idx);
 
+// создание count файлов одним вызовом (существующие открываются). в indices
+// - индексы файлов или -1 при ошибке. возвращает число файлов с индексом
+int BundleFilesCreate(BundlePtr          bundle,
+                      const char *const *filenames,
+                      int                count,
+                      int               *indices);
+
+// параметры импорта каталога. заполняются значениями по умолчанию функцией
+// BundleImportOptionsInit
+struct BundleImportOptions {
+  int         threads;   // число читающих потоков (0 - по числу ядер)
+  int64_t     chunkSize; // порция чтения исходных файлов (0 - по умолчанию)
+  int64_t     queueSize; // максимум прочитанных, но не записанных данных
+                         // (0 - по умолчанию)
+  CryptoCtx   cryptoCtx; // шифрование данных (AES-CTR) в читающих
+                         // потоках, nullptr - без шифрования
+  const char *prefix;    // префикс путей в бандле, добавляется как есть
+};
+
+// импорт всех файлов каталога rootPath (рекурсивно) в бандл. пути в бандле -
+// prefix и путь относительно rootPath с разделителем '/', существующие файлы
+// перезаписываются. файлы читаются несколькими потоками и записываются
+// одним потоком подряд в порядке путей. возвращает число импортированных
+// файлов или -1 при ошибке (если не прочитался один из файлов, остальные
+// импортируются)
+void    BundleImportOptionsInit(BundleImportOptions *options);
+int64_t BundleImportDirectory(BundlePtr                  bundle,
+                              const char                *rootPath,
+                              const BundleImportOptions *options);
+
+// параметры выгрузки бандла. заполняются значениями по умолчанию функцией
+// BundleExtractOptionsInit
+struct BundleExtractOptions {
+  int       threads;   // число потоков расшифровки и записи (0 - по числу
+                       // ядер)
+  int64_t   runSize;   // максимальная порция чтения бандла (0 - по
+                       // умолчанию)
+  int64_t   queueSize; // максимум прочитанных, но не записанных данных
+                       // (0 - по умолчанию)
+  CryptoCtx cryptoCtx; // расшифровка данных, nullptr - данные выгружаются
+                       // как хранятся
+};
+
+// выгрузка всех файлов бандла в каталог destDir (создается при
+// необходимости) по их путям. данные читаются крупными порциями в порядке
+// расположения в бандле, расшифровываются и пишутся несколькими потоками.
+// файлы с путями вне каталога (абсолютные, с "..") не выгружаются. бандл не
+// должен меняться во время выгрузки. возвращает число выгруженных файлов
+// или -1 при ошибке (остальные файлы выгружаются)
+void    BundleExtractOptionsInit(BundleExtractOptions *options);
+int64_t BundleExtract(BundlePtr                   bundle,
+                      const char                 *destDir,
+                      const BundleExtractOptions *options);
+
+// параметры уплотнения бандла. заполняются значениями по умолчанию функцией
+// BundleCompactOptionsInit
+struct BundleCompactOptions {
+  int64_t stepSize;       // объем переноса за шаг под монопольной
+                          // блокировкой (0 - по умолчанию, 4МБ)
+  int64_t bytesPerSecond; // ограничение скорости переноса (0 - без
+                          // ограничения)
+  int64_t maxBytes;       // максимум переноса за вызов (0 - пока есть что
+                          // переносить)
+};
+
+// уплотнение открытого бандла без его закрытия (в отличие от
+// Defragmentation): блоки из конца бандла и фрагментированные цепочки
+// переносятся шагами в свободные места ближе к началу, свободный хвост
+// файла бандла отрезается. между шагами бандл доступен для чтения и записи.
+// ссылки на перенесенные данные переключаются одной записью после записи
+// копии, поэтому сбой не портит бандл. для бандлов, открытых с
+// BMODE_MAPPED, хвост не отрезается. возвращает, на сколько байт уменьшился
+// бандл, или -1 при ошибке
+void    BundleCompactOptionsInit(BundleCompactOptions *options);
+int64_t BundleCompact(BundlePtr                   bundle,
+                      const BundleCompactOptions *options);
+
+// учет места в бандле: размер файла бандла, занятое файлами (вместе с
+// заголовками блоков) и свободное внутри бандла (удаленные и обрезанные
+// данные, брошенные блоки), из него - свободное в конце файла. первый
+// запрос после открытия строит карту свободного места по цепочкам файлов,
+// дальше счетчики обновляются при записи, удалении и обрезании. в случае
+// успеха возвращает 1
+int BundleSpaceStats(BundlePtr bundle,
+                     int64_t  *size,
+                     int64_t  *liveBytes,
+                     int64_t  *deadBytes,
+                     int64_t  *tailBytes);
+
+// автоматическое уплотнение (см. BundleCompact) в фоновом потоке. запускается
+// после удаления или обрезания, когда свободное место занимает не меньше
+// deadRatio размера бандла и выросло не меньше чем на minDeadBytes (0 - по
+// умолчанию, 4МБ) с прошлого уплотнения. options - параметры уплотнения
+// (nullptr - по умолчанию), deadRatio <= 0 - выключить. действует до
+// закрытия бандла, закрытие дожидается текущего шага. в случае успеха
+// возвращает 1
+int BundleAutoCompactSet(BundlePtr                   bundle,
+                         double                      deadRatio,
+                         int64_t                     minDeadBytes,
+                         const BundleCompactOptions *options);
+
+// режим шифрования данных файла. менять можно только у файла без данных
+// (новый или обрезанный до нуля). для CTR каждый раз выбирается новый
+// случайный nonce (он же меняется при обрезании файла до нуля). в случае
+// успеха возвращает 1
+int BundleFileCipherSet(BundlePtr        bundle,
+                        int              idx,
+                        BundleFileCipher cipher);
+int BundleFileCipherGet(BundlePtr bundle,
+                        int       idx);
+
+// чтение с заданной позиции без курсора файла. параллельные вызовы (в том
+// числе для одного файла) не мешают друг другу. для данных, шифрованных
+// AES-ECB, позиция должна быть выровнена на 16 байт, иначе возвращается 0
+int64_t BundleFileReadAt(BundlePtr bundle,
+                         int       idx,
+                         int64_t   pos,
+                         void     *dst,
+                         int64_t   dstOffset,
+                         int64_t  *dstLen,
+                         CryptoCtx cryptoCtx);
+
+// дескрипторы файлов: у каждого свой курсор, поэтому один файл можно
+// одновременно читать с разных позиций. дескриптор нужно закрыть до
+// закрытия бандла. в случае ошибки открытия возвращается nullptr
+BundleFileHandle BundleFileHandleOpen(BundlePtr   bundle,
+                                      const char *filename,
+                                      int         openAlways);
+void             BundleFileHandleClose(BundleFileHandle handle);
+int              BundleFileHandleIndex(BundleFileHandle handle);
+int64_t          BundleFileHandleSeek(BundleFileHandle handle,
+                                      int64_t          offset,
+                                      BundleFileOrigin origin);
+int64_t          BundleFileHandleLength(BundleFileHandle handle);
+int64_t          BundleFileHandleRead(BundleFileHandle handle,
+                                      void            *dst,
+                                      int64_t          dstOffset,
+                                      int64_t         *dstLen,
+                                      CryptoCtx        cryptoCtx);
+// для данных, шифрованных AES-ECB, позиция чтения и записи должна быть
+// выровнена на 16 байт, иначе возвращается 0
+int64_t          BundleFileHandleReadAt(BundleFileHandle handle,
+                                        int64_t          pos,
+                                        void            *dst,
+                                        int64_t          dstOffset,
+                                        int64_t         *dstLen,
+                                        CryptoCtx        cryptoCtx);
+int64_t          BundleFileHandleWrite(BundleFileHandle handle,
+                                       const void      *src,
+                                       int64_t          srcOffset,
+                                       const int64_t    srcLen,
+                                       CryptoCtx        cryptoCtx);
+
+// чтение без копирования (для бандлов, открытых с BMODE_MAPPED). возвращает
+// указатель на данные с текущей позиции в пределах одного блока и сдвигает
+// позицию, в dstLen - сколько байт доступно. данные возвращаются как хранятся
+// (зашифрованные - зашифрованными). память по указателю доступна до закрытия
+// бандла, но данные в ней верны только до следующей записи, обрезания,
+// удаления или уплотнения: освобожденное место занимают другие блоки
+const void* BundleFileBorrow(BundlePtr bundle,
+                             int       idx,
+                             int64_t  *dstLen);
+
 void Defragmentation(const char *fileSrc,
                      const char *fileTmp);
+
+// запечатывание бандла: файлы записываются подряд, в конец добавляется каталог
+// для открытия одним чтением. запечатанный бандл доступен только для чтения
+bool BundleSeal(const char *fileSrc,
+                const char *fileDst,
+                const void *pathKey,
+                int         keyLen);
@@ -24,14 +24,32 @@ INCLUDEPATH += $$REPO_ROOT/mbedtls-2.4.0/include/
 
 SOURCES += BundlesLibrary.cpp \
     BundleFile.cpp \
+    BundleFileHandle.cpp \
+    BundleCrypto.cpp \
+    BundleBlockCache.cpp \
+    BundlePathIndex.cpp \
+    BundleImport.cpp \
+    BundleExtract.cpp \
     streams/BinaryFile.cpp \
+    streams/MappedFile.cpp \
+    streams/PositionalFile.cpp \
     ../mbedtls-2.4.0/library/aes.c \
+    ../mbedtls-2.4.0/library/aesni.c \
     ../mbedtls-2.4.0/library/padlock.c
 
 HEADERS += BundlesLibrary.h \
     BundleFile.h \
+    BundleFileHandle.h \
+    BundleCrypto.h \
+    BundleBlockCache.h \
+    BundlePathIndex.h \
+    BundleImport.h \
+    BundleExtract.h \
     BundleFileHDRs.h \
+    BundleLock.h \
     streams/BinaryFile.h \
+    streams/MappedFile.h \
+    streams/PositionalFile.h \
     streams/IBinaryStream.h
 
 unix {
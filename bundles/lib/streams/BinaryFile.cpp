@@ -1,7 +1,11 @@
 #include <cstring>
 #include <algorithm>
 #ifdef _MSC_VER
+# include <io.h>
 # include <share.h>
+#else // ifdef _MSC_VER
+# include <fcntl.h>
+# include <unistd.h>
 #endif // ifdef _MSC_VER
 #include <vector>
 #include "BinaryFile.h"
@@ -83,17 +87,32 @@ std::wstring utf8_to_utf16(const std::string& utf8)
 }
 
 // конструктор
-CBinaryFile::CBinaryFile(size_t cacheWriteSize, size_t cacheReadSize) {
+CBinaryFile::CBinaryFile(size_t cacheWriteSize, size_t cacheReadSize, size_t pageSize) {
   try
   {
     // создадим буферы
     if (cacheWriteSize > 0) m_writeCache = new char[cacheWriteSize];
 
-    if (cacheReadSize > 0)  m_readCache = new char[cacheReadSize];
+    // страницы кэша чтения (маленький кэш - одна страница)
+    m_pageSize = std::min(pageSize, cacheReadSize);
+
+    if (m_pageSize > 0)
+    {
+      size_t count = cacheReadSize / m_pageSize;
+
+      m_readCache = new char[count * m_pageSize];
+      m_pages.resize(count);
+
+      for (size_t i = 0; i < count; i++) m_pages[i].data = m_readCache + i * m_pageSize;
+
+      // большие чтения не вытесняют кэш
+      m_bypassSize = std::max(m_pageSize,
+                              std::min(count * m_pageSize / 4,
+                                       m_pageSize * BINARY_FILE_BYPASS_PAGES));
+    }
 
     // установим размеры
     m_writeCacheSize = cacheWriteSize;
-    m_readCacheSize  = cacheReadSize;
 #ifdef __GNUC__
     pthread_mutexattr_t attr;
     pthread_mutexattr_init(&attr);
@@ -106,10 +125,11 @@ CBinaryFile::CBinaryFile(size_t cacheWriteSize, size_t cacheReadSize) {
     // удалим буферы
     if (m_readCache != nullptr)
     {
-      delete[] (char *)m_readCache;
-      m_readCache     = nullptr;
-      m_readCacheSize = 0;
+      delete[] m_readCache;
+      m_readCache = nullptr;
     }
+    m_pages.clear();
+    m_pageSize = 0;
 
     if (m_writeCache != nullptr)
     {
@@ -129,11 +149,11 @@ CBinaryFile::~CBinaryFile(void)
   // удалим буферы
   if (m_readCache != nullptr)
   {
-    delete[] (char *)m_readCache;
-    m_readCache     = nullptr;
-    m_readPos       = 0;
-    m_readSize      = 0;
-    m_readCacheSize = 0;
+    PagesClear();
+    delete[] m_readCache;
+    m_readCache = nullptr;
+    m_pages.clear();
+    m_pageSize = 0;
   }
 
   if (m_writeCache != nullptr)
@@ -203,6 +223,12 @@ void CBinaryFile::Close()
     m_handle = 0;
   }
 
+  // кэш и потоки относились к закрытому файлу
+  PagesClear();
+
+  for (auto& stream : m_streams) stream = ReadStream();
+  m_sequential = false;
+
   // очистим путь
   m_path.clear();
 }
@@ -224,14 +250,10 @@ size_t CBinaryFile::Read(void  *buffer,
   char  *dst       = (char *)buffer;
 
   // проверки
-  if (m_handle == nullptr) return 0;
+  if ((m_handle == nullptr) || (buffer == nullptr)) return 0;
 
-  if (!ignoreCache &&
-      ((m_readCache == nullptr) || (m_readCacheSize == 0))) ignoreCache = true;
-
-  if ((buffer == nullptr) &&
-      (ignoreCache || (m_readCache == nullptr) ||
-       (m_readCacheSize == 0))) return 0;
+  // без кэша и большие чтения - напрямую
+  if (m_pages.empty() || (size >= m_bypassSize)) ignoreCache = true;
 
   // лочимся
 #ifdef __GNUC__
@@ -240,22 +262,27 @@ size_t CBinaryFile::Read(void  *buffer,
   m_locker.lock();
 #endif // ifdef __GNUC__
 
-  // флашим
-  if (!m_read) Flush();
+  // флашим (в том числе отложенную запись)
+  if (!m_read || (m_writeSize > 0)) Flush();
+
+  // последовательный доступ - подкачаем данные заранее
+  ReadAhead(m_curPos, size);
 
   // читаем и копируем
   while (size > 0)
   {
-    // проверим на кэш-попадание
-    if (!ignoreCache && (m_readCache != nullptr) && (m_readCacheSize > 0) &&
-        (m_readPos <= m_curPos) && ((int64_t)(m_readPos + m_readSize) > m_curPos))
+    if (!ignoreCache)
     {
+      // страница с текущей позицией
+      Page  *page   = PageGet(m_curPos / (int64_t)m_pageSize);
+      size_t offset = (size_t)(m_curPos % (int64_t)m_pageSize);
+
+      // конец файла
+      if ((page == nullptr) || (page->size <= offset)) break;
+
       // скопируем из кэша
-      readNeed =
-        std::min(size,
-                 static_cast<size_t>((int64_t)(m_readPos + m_readSize) -
-                                     m_curPos));
-      memcpy(dst, (char *)m_readCache + m_curPos - m_readPos, readNeed);
+      readNeed = std::min(size, page->size - offset);
+      memcpy(dst, page->data + offset, readNeed);
 
       // изменим счетчики
       size      -= readNeed;
@@ -263,39 +290,27 @@ size_t CBinaryFile::Read(void  *buffer,
       m_curPos  += readNeed;
       dst       += readNeed;
 
-      // проверим, нужно ли еще считывать?
-      if (size == 0) break;
+      // неполная страница - дальше файла нет
+      if (page->size < m_pageSize) break;
     }
+    else
+    {
+      // установим позицию в файле
+      if (_fseeki64(m_handle, m_curPos, SEEK_SET) != 0) break;
 
-    // флашим, если была запись
-    if (!m_read) _fflush_nolock(m_handle);
-
-    // установим позицию в файле
-    if (_fseeki64(m_handle, m_curPos, SEEK_SET) != 0) break;
-
-    // выясним, сколько нужно читать
-    readNeed = ignoreCache ? size : m_readCacheSize;
-
-    // читаем
-    read = _fread_nolock(ignoreCache ? dst : m_readCache, 1, readNeed, m_handle);
+      // читаем
+      read = _fread_nolock(dst, 1, size, m_handle);
 
-    // выставим флаг чтения
-    m_read = true;
+      // выставим флаг чтения
+      m_read = true;
 
-    if (read == 0) break;
+      if (read == 0) break;
 
-    // изменим счетчики
-    if (ignoreCache)
-    {
+      // изменим счетчики
       size      -= read;
       readTotal += read;
-      m_curPos  += readNeed;
-      dst       += readNeed;
-    }
-    else
-    {
-      m_readSize = read;
-      m_readPos  = m_curPos;
+      m_curPos  += read;
+      dst       += read;
     }
   }
 
@@ -381,14 +396,14 @@ size_t CBinaryFile::Write(void  *buffer,
 
       if (wrote == 0) break;
 
+      // обновим кэш чтения
+      PagesUpdate(m_curPos, dst, wrote);
+
       // сместим счетчики
       wroteTotal += wrote;
       dst        += wrote;
       m_curPos   += wrote;
       size       -= wrote;
-
-      // обнулим кэш чтения
-      if (wrote > 0) m_readSize = 0;
     }
   }
 
@@ -403,6 +418,63 @@ size_t CBinaryFile::Write(void  *buffer,
   return wroteTotal;
 }
 
+// чтение с заданной позиции. позиционирование и чтение выполняются под одним
+// локом
+size_t CBinaryFile::ReadAt(int64_t pos,
+                           void   *buffer,
+                           size_t  size,
+                           bool    ignoreCache)
+{
+  size_t read = 0;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  if (Seek(pos, SEEK_SET)) read = Read(buffer, size, ignoreCache);
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return read;
+}
+
+// запись с заданной позиции
+size_t CBinaryFile::WriteAt(int64_t pos,
+                            void   *buffer,
+                            size_t  size,
+                            bool    ignoreCache)
+{
+  size_t wrote = 0;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  if (Seek(pos, SEEK_SET)) wrote = Write(buffer, size, ignoreCache);
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return wrote;
+}
+
 // сброс данных на диск
 bool CBinaryFile::Flush()
 {
@@ -414,12 +486,9 @@ bool CBinaryFile::Flush()
       return false;
     }
 
-    // сбросим
+    // сбросим (кэш чтения обновлен при записи)
     m_writeSize = 0;
     m_writePos  = 0;
-
-    // обнулим кэш чтения
-    m_readSize = 0;
   }
 
   // флашим
@@ -429,12 +498,66 @@ bool CBinaryFile::Flush()
   return true;
 }
 
-// получение размера файла
+// получение размера файла. позиция файла сдвигается, поэтому под локом:
+// иначе параллельный ReadAt прочитал бы с конца файла
 int64_t CBinaryFile::Size()
 {
-  if (_fseeki64(m_handle, 0, SEEK_END) != 0) return 0;
+  int64_t size = 0;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  if (_fseeki64(m_handle, 0, SEEK_END) == 0) size = _ftelli64(m_handle);
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  return size;
+}
+
+// обрезание файла. кэш записи сбрасывается, кэш чтения очищается
+bool CBinaryFile::Truncate(int64_t size)
+{
+  bool res = false;
+
+  // проверки
+  if ((m_handle == nullptr) || !m_canWrite || (size < 0)) return false;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  if (Flush())
+  {
+#ifdef _MSC_VER
+    res = _chsize_s(_fileno(m_handle), size) == 0;
+#else // ifdef _MSC_VER
+    res = ftruncate(fileno(m_handle), (off_t)size) == 0;
+#endif // ifdef _MSC_VER
+    PagesClear();
+    Seek(0, SEEK_SET);
+  }
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
 
-  return _ftelli64(m_handle);
+  // вернем результат
+  return res;
 }
 
 // установка новой позиции
@@ -446,3 +569,233 @@ bool CBinaryFile::Seek(int64_t pos, int origin)
   }
   return false;
 }
+
+// статистика кэша чтения
+void CBinaryFile::CacheStats(uint64_t& hits, uint64_t& misses)
+{
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  hits   = m_cacheHits;
+  misses = m_cacheMisses;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+}
+
+// объем запрошенного упреждающего чтения
+uint64_t CBinaryFile::ReadAheadSize()
+{
+  uint64_t size;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  size = m_readAhead;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  return size;
+}
+
+// страница кэша с заданным номером (загружается при промахе). nullptr - за
+// концом файла или ошибка чтения. вызывается под локом
+CBinaryFile::Page * CBinaryFile::PageGet(int64_t index)
+{
+  auto it = m_pagesIdx.find(index);
+
+  // попадание
+  if (it != m_pagesIdx.end())
+  {
+    m_cacheHits++;
+    m_pages[it->second].referenced = true;
+    return &m_pages[it->second];
+  }
+  m_cacheMisses++;
+
+  // выберем жертву: пропускаем страницы с флагом обращения, сбрасывая его
+  size_t victim = m_clockHand;
+
+  while (m_pages[victim].referenced)
+  {
+    m_pages[victim].referenced = false;
+    victim                     = (victim + 1) % m_pages.size();
+  }
+  m_clockHand = (victim + 1) % m_pages.size();
+
+  Page& page = m_pages[victim];
+
+  if (page.index >= 0) m_pagesIdx.erase(page.index);
+  page.index = -1;
+  page.size  = 0;
+
+  // читаем страницу
+  if (_fseeki64(m_handle, index * (int64_t)m_pageSize, SEEK_SET) != 0) return nullptr;
+
+  size_t read = _fread_nolock(page.data, 1, m_pageSize, m_handle);
+  m_read = true;
+
+  if (read == 0) return nullptr;
+
+  // запомним
+  page.index       = index;
+  page.size        = read;
+  page.referenced  = true;
+  m_pagesIdx[index] = victim;
+
+  // вернем результат
+  return &page;
+}
+
+// обновление страниц кэша после записи. вызывается под локом
+void CBinaryFile::PagesUpdate(int64_t pos, const char *data, size_t size)
+{
+  if (m_pagesIdx.empty() || (size == 0)) return;
+
+  int64_t end = pos + (int64_t)size;
+
+  for (int64_t index = pos / (int64_t)m_pageSize;
+       index * (int64_t)m_pageSize < end; index++)
+  {
+    auto it = m_pagesIdx.find(index);
+
+    if (it == m_pagesIdx.end()) continue;
+
+    Page  & page  = m_pages[it->second];
+    int64_t start = index * (int64_t)m_pageSize;
+
+    // файл вырос за неполную страницу - перечитаем ее при обращении
+    if (std::min(end, start + (int64_t)m_pageSize) > start + (int64_t)page.size)
+    {
+      m_pagesIdx.erase(it);
+      page.index      = -1;
+      page.size       = 0;
+      page.referenced = false;
+      continue;
+    }
+
+    // перепишем измененную часть
+    int64_t from = std::max(pos, start);
+    memcpy(page.data + (from - start), data + (from - pos), (size_t)(end - from));
+  }
+}
+
+// очистка кэша чтения
+void CBinaryFile::PagesClear()
+{
+  for (size_t i = 0; i < m_pages.size(); i++)
+  {
+    m_pages[i].index      = -1;
+    m_pages[i].size       = 0;
+    m_pages[i].referenced = false;
+  }
+  m_pagesIdx.clear();
+  m_clockHand = 0;
+}
+
+// отслеживание последовательного чтения. чтение, продолжающее один из
+// потоков, запрашивает у системы асинхронную подкачку данных впереди с
+// растущим окном; прочие чтения начинают новый поток. вызывается под локом
+void CBinaryFile::ReadAhead(int64_t pos, size_t size)
+{
+  ReadStream *stream = nullptr;
+  ReadStream *oldest = &m_streams[0];
+
+  m_streamsClock++;
+
+  for (auto& s : m_streams)
+  {
+    // продолжение допускает пропуск в пределах страницы (заголовок блока
+    // прочитан из кэша)
+    if ((s.next >= 0) && (pos >= s.next) &&
+        (pos <= s.next + BINARY_FILE_PAGE_SIZE))
+    {
+      stream = &s;
+      break;
+    }
+
+    if (s.lastUsed < oldest->lastUsed) oldest = &s;
+  }
+
+  int64_t end = pos + (int64_t)size;
+
+  // новый поток
+  if (stream == nullptr)
+  {
+    *oldest          = ReadStream();
+    oldest->next     = end;
+    oldest->lastUsed = m_streamsClock;
+
+    // последовательных потоков не осталось
+    if (m_sequential &&
+        std::all_of(m_streams, m_streams + BINARY_FILE_READAHEAD_STREAMS,
+                    [](const ReadStream& s) { return s.window == 0; }))
+    {
+      Advise(0, 0, 0);
+      m_sequential = false;
+    }
+    return;
+  }
+
+  stream->next     = end;
+  stream->lastUsed = m_streamsClock;
+
+  if (++stream->streak < BINARY_FILE_READAHEAD_STREAK - 1) return;
+
+  // поток подтвержден
+  if (stream->window == 0)
+  {
+    stream->window  = BINARY_FILE_READAHEAD_MIN;
+    stream->advised = pos;
+
+    if (!m_sequential)
+    {
+      Advise(0, 0, 1);
+      m_sequential = true;
+    }
+  }
+
+  // запрашиваем следующее окно, когда прочитана половина предыдущего
+  if (end + (int64_t)stream->window / 2 < stream->advised) return;
+
+  int64_t from = std::max(stream->advised, end);
+
+  Advise(from, (int64_t)stream->window, 2);
+  m_readAhead += stream->window;
+
+  stream->advised = from + (int64_t)stream->window;
+  stream->window  = std::min(stream->window * 2, (size_t)BINARY_FILE_READAHEAD_MAX);
+}
+
+// рекомендации системе: 0 - обычный доступ, 1 - последовательный, 2 -
+// подкачать диапазон
+void CBinaryFile::Advise(int64_t pos, int64_t len, int advice)
+{
+#ifdef POSIX_FADV_WILLNEED
+  static const int advices[] =
+  { POSIX_FADV_NORMAL, POSIX_FADV_SEQUENTIAL, POSIX_FADV_WILLNEED };
+
+  posix_fadvise(fileno(m_handle), (off_t)pos, (off_t)len, advices[advice]);
+#else // ifdef POSIX_FADV_WILLNEED
+  (void)pos;
+  (void)len;
+  (void)advice;
+#endif // ifdef POSIX_FADV_WILLNEED
+}
@@ -9,11 +9,23 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdexcept>
+#include <unordered_map>
+#include <vector>
 #include "IBinaryStream.h"
 
 //
 #define _FILE_OFFSET_BITS 64
 
+#define BINARY_FILE_PAGE_SIZE   4096 // размер страницы кэша чтения
+#define BINARY_FILE_BYPASS_PAGES 16  // чтения от стольких страниц идут мимо
+                                     // кэша
+#define BINARY_FILE_READAHEAD_MIN (128 * 1024)      // начальное окно упреждения
+#define BINARY_FILE_READAHEAD_MAX (8 * 1024 * 1024) // максимальное окно
+#define BINARY_FILE_READAHEAD_STREAMS 4             // число отслеживаемых
+                                                    // последовательных потоков
+#define BINARY_FILE_READAHEAD_STREAK 3              // чтений подряд для
+                                                    // признания потока
+
 #ifndef _MSC_VER
 # ifndef _fflush_nolock
 #  define _fflush_nolock fflush
@@ -41,10 +53,30 @@
 #endif  // ifndef _MSC_VER
 
 // класс для работы с бинарным файлом с использованием кэша
-// Класс является потоково-безопасным
+// Класс является потоково-безопасным. Кэш чтения - страницы фиксированного
+// размера в пределах заданного объема, вытеснение по алгоритму CLOCK
+// (часто используемые страницы - заголовки, блоки, мелкие файлы - остаются
+// в памяти). Запись обновляет закэшированные страницы
 class CBinaryFile : public IBinaryStream {
 private:
 
+  // страница кэша чтения
+  struct Page {
+    int64_t index      = -1;    // номер страницы в файле (-1 - свободна)
+    size_t  size       = 0;     // размер прочитанных данных
+    bool    referenced = false; // флаг обращения (для CLOCK)
+    char   *data       = nullptr;
+  };
+
+  // последовательный поток чтения (упреждающее чтение)
+  struct ReadStream {
+    int64_t  next     = -1; // ожидаемая позиция следующего чтения
+    int64_t  advised  = 0;  // граница запрошенного упреждения
+    size_t   window   = 0;  // текущее окно упреждения (0 - не поток)
+    int      streak   = 0;  // число последовательных чтений подряд
+    uint64_t lastUsed = 0;  // для вытеснения
+  };
+
   FILE *m_handle = nullptr; // хэндл открытого файла
 
 #ifdef __GNUC__
@@ -59,11 +91,20 @@ private:
   bool m_canWrite  = false;       // флаг возможности записи
   int64_t m_curPos = 0;           // текущая позиция в файле
   // кэш чтения
-  void   *m_readCache = nullptr;  // буфер кэша чтения
-  int64_t m_readPos   = 0;        // позиция в файле, с которой прочитали
-                                  // данные
-  size_t m_readSize      = 0;     // размер прочитанных в кэш данных
-  size_t m_readCacheSize = 0;     // размер кэша
+  char *m_readCache = nullptr;    // память страниц
+  std::vector<Page> m_pages;      // страницы
+  std::unordered_map<int64_t, size_t>
+  m_pagesIdx;                     // номер страницы -> индекс в m_pages
+  size_t m_pageSize    = 0;       // размер страницы
+  size_t m_clockHand   = 0;       // стрелка CLOCK
+  size_t m_bypassSize  = 0;       // чтения от этого размера - мимо кэша
+  uint64_t m_cacheHits = 0;       // статистика кэша
+  uint64_t m_cacheMisses = 0;
+  // упреждающее чтение
+  ReadStream m_streams[BINARY_FILE_READAHEAD_STREAMS];
+  uint64_t   m_streamsClock = 0;
+  bool       m_sequential   = false; // выставлен POSIX_FADV_SEQUENTIAL
+  uint64_t   m_readAhead    = 0;     // всего запрошено упреждения
   // кэш записи
   void   *m_writeCache = nullptr; // буфер кэша записи
   int64_t m_writePos   = 0;       // позиция в файле, с которой начали
@@ -73,8 +114,10 @@ private:
 
 public:
 
+  // cacheReadSize - объем кэша чтения (0 - без кэша)
   CBinaryFile(size_t cacheWriteSize,
-              size_t cacheReadSize);
+              size_t cacheReadSize,
+              size_t pageSize = BINARY_FILE_PAGE_SIZE);
   ~CBinaryFile(void);
 
   void Path(std::string& path);
@@ -102,12 +145,41 @@ public:
   size_t  Write(void  *buffer,
                 size_t size,
                 bool   ignoreCache);
+  size_t  ReadAt(int64_t pos,
+                 void   *buffer,
+                 size_t  size,
+                 bool    ignoreCache);
+  size_t  WriteAt(int64_t pos,
+                  void   *buffer,
+                  size_t  size,
+                  bool    ignoreCache);
 
   // флаш данных на диск
   bool    Flush();
 
   // работа с позицией и размером
   int64_t Size();
+  bool    Truncate(int64_t size);
   bool    Seek(int64_t pos,
                int     origin);
+
+  // статистика кэша чтения
+  void    CacheStats(uint64_t& hits,
+                     uint64_t& misses);
+
+  // объем запрошенного упреждающего чтения
+  uint64_t ReadAheadSize();
+
+private:
+
+  Page  * PageGet(int64_t index);
+  void    PagesUpdate(int64_t     pos,
+                      const char *data,
+                      size_t      size);
+  void    PagesClear();
+  void    ReadAhead(int64_t pos,
+                    size_t  size);
+  void    Advise(int64_t pos,
+                 int64_t len,
+                 int     advice);
 };
@@ -1,6 +1,7 @@
 #pragma once
 #include <stdint.h>
 #include <cstddef>
+#include <stdio.h>
 
 // интерфейс, работающий с бинарным потоком
 class IBinaryStream {
@@ -22,4 +23,35 @@ public:
   virtual bool    Seek(int64_t pos,
                        int     origin) = 0;
   virtual void    Close()              = 0;
+
+  // чтение/запись с заданной позиции. позиция потока после вызова не
+  // определена. реализации, которые умеют делать это без общего курсора
+  // (pread/pwrite), не мешают параллельным вызовам друг друга
+  virtual size_t ReadAt(int64_t pos,
+                        void   *buffer,
+                        size_t  size,
+                        bool    ignoreCache) {
+    return Seek(pos, SEEK_SET) ? Read(buffer, size, ignoreCache) : 0;
+  }
+
+  virtual size_t WriteAt(int64_t pos,
+                         void   *buffer,
+                         size_t  size,
+                         bool    ignoreCache) {
+    return Seek(pos, SEEK_SET) ? Write(buffer, size, ignoreCache) : 0;
+  }
+
+  // обрезание потока до size байт. возвращает false, если поток этого не
+  // поддерживает
+  virtual bool Truncate(int64_t /*size*/) {
+    return false;
+  }
+
+  // прямой доступ к size байтам с позиции pos без копирования. возвращает
+  // nullptr, если поток этого не поддерживает или данные недоступны.
+  // указатель действителен до закрытия потока
+  virtual const void* Borrow(int64_t /*pos*/,
+                             size_t  /*size*/) {
+    return nullptr;
+  }
 };
@@ -0,0 +1,414 @@
+#include <cstring>
+#include <algorithm>
+#ifndef _MSC_VER
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# include <sys/stat.h>
+#endif // ifndef _MSC_VER
+#include "MappedFile.h"
+
+// размер начала и конца файла, которые стоит подгрузить заранее (там лежат
+// заголовки бандла и каталог запечатанного бандла)
+#define MAPPED_FILE_PREFETCH_SIZE (64 * 1024)
+
+// конструктор
+CMappedFile::CMappedFile()
+{
+#ifdef __GNUC__
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&m_locker, &attr);
+#endif // ifdef __GNUC__
+}
+
+// деструктор
+CMappedFile::~CMappedFile(void)
+{
+  // закроем файл
+  Close();
+#ifdef __GNUC__
+  pthread_mutex_destroy(&m_locker);
+#endif // ifdef __GNUC__
+}
+
+// открытие файла
+errno_t CMappedFile::Open(const char *filename, const char *mode)
+{
+  // закроем предыдущий файл
+  Close();
+
+  // проверки параметров
+  if ((filename == nullptr) || (mode == nullptr)) return EINVAL;
+
+#ifndef _MSC_VER
+  bool plus  = strchr(mode, '+') != nullptr;
+  int  flags = 0;
+
+  // выберем режим открытия
+  if (mode[0] == 'r') flags = plus ? O_RDWR : O_RDONLY;
+  else if (mode[0] == 'w') flags = O_RDWR | O_CREAT | O_TRUNC;
+  else return EINVAL;
+
+  // откроем файл
+  m_handle = open(filename, flags | O_CLOEXEC, 0666);
+
+  if (m_handle < 0) return errno;
+
+  // узнаем размер
+  struct stat st;
+
+  if (fstat(m_handle, &st) != 0)
+  {
+    errno_t err = errno;
+    Close();
+    return err;
+  }
+
+  // запомним путь и режим
+  m_path     = filename;
+  m_size     = st.st_size;
+  m_curPos   = 0;
+  m_canWrite = (strstr(mode, "r+") != nullptr || strstr(mode, "w")  != nullptr);
+  m_canRead  = (strstr(mode, "r")  != nullptr || strstr(mode, "w+") != nullptr);
+
+  // отобразим
+  if (!Remap())
+  {
+    errno_t err = errno;
+    Close();
+    return err;
+  }
+
+  // подскажем ядру, что начало и конец файла понадобятся сразу
+  char   *map     = m_map;
+  int64_t mapSize = m_mapSize;
+
+  if (map != nullptr)
+  {
+    int64_t tail = std::max((int64_t)0, mapSize - MAPPED_FILE_PREFETCH_SIZE);
+    tail -= tail % sysconf(_SC_PAGESIZE);
+
+    madvise(map, (size_t)std::min(mapSize, (int64_t)MAPPED_FILE_PREFETCH_SIZE),
+            MADV_WILLNEED);
+    madvise(map + tail, (size_t)(mapSize - tail), MADV_WILLNEED);
+  }
+
+  // все ок
+  return 0;
+#else // ifndef _MSC_VER
+  return ENOSYS;
+#endif // ifndef _MSC_VER
+}
+
+// закрытие
+void CMappedFile::Close()
+{
+#ifndef _MSC_VER
+
+  // снимем отображения
+  if (m_map != nullptr)
+  {
+    munmap(m_map, (size_t)m_mapSize);
+    m_mapSize = 0;
+    m_map     = nullptr;
+  }
+
+  for (size_t i = 0; i < m_retired.size(); i++)
+  {
+    munmap(m_retired[i].first, (size_t)m_retired[i].second);
+  }
+  m_retired.clear();
+
+  // закроем файл
+  if (m_handle >= 0)
+  {
+    close(m_handle);
+    m_handle = -1;
+  }
+#endif // ifndef _MSC_VER
+
+  // очистим данные
+  m_path.clear();
+  m_size   = 0;
+  m_curPos = 0;
+}
+
+// получение пути к файлу
+void CMappedFile::Path(std::string& path)
+{
+  path = m_path;
+}
+
+// проверка на конец файла
+bool CMappedFile::EndOfFile()
+{
+  return m_curPos >= m_size;
+}
+
+// расширение отображения до текущего размера файла. вызывается под локером.
+// отображение растет минимум вдвое с запасом за концом файла (обращения
+// ограничены размером файла), поэтому при дописывании оно пересоздается
+// O(log размера) раз. старое отображение не освобождается до закрытия
+// файла: читатели без блокировки могут еще копировать из него
+bool CMappedFile::Remap()
+{
+#ifndef _MSC_VER
+  int64_t size = m_size;
+
+  if ((size <= m_mapSize) || (m_handle < 0)) return true;
+
+  // отобразим файл с запасом
+  size = std::max(size, 2 * m_mapSize.load());
+
+  void *map = mmap(nullptr, (size_t)size,
+                   PROT_READ | (m_canWrite ? PROT_WRITE : 0), MAP_SHARED, m_handle, 0);
+
+  if (map == MAP_FAILED) return false;
+
+  // старое отображение отложим
+  if (m_map != nullptr) m_retired.push_back(std::make_pair(m_map.load(), m_mapSize.load()));
+
+  // сначала адрес, затем размер
+  m_map.store((char *)map, std::memory_order_release);
+  m_mapSize.store(size, std::memory_order_release);
+
+  // все ок
+  return true;
+#else // ifndef _MSC_VER
+  return false;
+#endif // ifndef _MSC_VER
+}
+
+// чтение из файла. возвращает число прочитанных байт
+size_t CMappedFile::Read(void  *buffer,
+                         size_t size,
+                         bool   ignoreCache)
+{
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  size_t read = ReadAt(m_curPos, buffer, size, ignoreCache);
+  m_curPos += read;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return read;
+}
+
+// запись в файл. возвращает число записанных байт
+size_t CMappedFile::Write(void  *buffer,
+                          size_t size,
+                          bool   ignoreCache)
+{
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  size_t wrote = WriteAt(m_curPos, buffer, size, ignoreCache);
+  m_curPos += wrote;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return wrote;
+}
+
+// чтение с заданной позиции. возвращает число прочитанных байт
+size_t CMappedFile::ReadAt(int64_t pos,
+                           void   *buffer,
+                           size_t  size,
+                           bool /*ignoreCache*/)
+{
+  size_t read = 0;
+
+  // проверки
+  if ((m_handle < 0) || (buffer == nullptr) || (pos < 0)) return 0;
+
+  // отображение расширяем под локером, только если данных в нем не хватает.
+  // за концом файла отображение не читается
+  int64_t fileSize = m_size;
+  int64_t mapSize  = m_mapSize.load(std::memory_order_acquire);
+
+  if ((pos + (int64_t)size > mapSize) && (mapSize < fileSize))
+  {
+    // лочимся
+#ifdef __GNUC__
+    pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.lock();
+#endif // ifdef __GNUC__
+
+    Remap();
+    mapSize = m_mapSize.load(std::memory_order_acquire);
+
+    // анлочимся
+#ifdef __GNUC__
+    pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.unlock();
+#endif // ifdef __GNUC__
+  }
+  mapSize = std::min(mapSize, fileSize);
+
+  // скопируем
+  if (pos < mapSize)
+  {
+    read = (size_t)std::min((int64_t)size, mapSize - pos);
+    memcpy(buffer, m_map.load(std::memory_order_acquire) + pos, read);
+  }
+
+  // вернем результат
+  return read;
+}
+
+// запись с заданной позиции. возвращает число записанных байт
+size_t CMappedFile::WriteAt(int64_t pos,
+                            void   *buffer,
+                            size_t  size,
+                            bool /*ignoreCache*/)
+{
+  size_t wroteTotal = 0;
+  char  *src        = (char *)buffer;
+
+  // проверки
+  if ((m_handle < 0) || (buffer == nullptr) || !m_canWrite || (pos < 0)) return 0;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  // внутри файла и отображения пишем в память (запас отображения за концом
+  // файла не записывается - обращение к нему дает SIGBUS)
+  int64_t mapSize = std::min(m_mapSize.load(), m_size.load());
+
+  if (pos < mapSize)
+  {
+    size_t toWrite = (size_t)std::min((int64_t)size, mapSize - pos);
+    memcpy(m_map.load() + pos, src, toWrite);
+
+    // сместим счетчики
+    wroteTotal += toWrite;
+    src        += toWrite;
+    pos        += toWrite;
+    size       -= toWrite;
+  }
+
+#ifndef _MSC_VER
+
+  // остальное пишем в файл
+  while (size > 0)
+  {
+    ssize_t wrote = pwrite(m_handle, src, size, pos);
+
+    if (wrote <= 0) break;
+
+    // сместим счетчики
+    wroteTotal += wrote;
+    src        += wrote;
+    pos        += wrote;
+    size       -= wrote;
+  }
+#endif // ifndef _MSC_VER
+
+  // запомним новый размер
+  if (pos > m_size) m_size = pos;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return wroteTotal;
+}
+
+// прямой доступ к данным отображения
+const void * CMappedFile::Borrow(int64_t pos, size_t size)
+{
+  const void *res = nullptr;
+
+  // проверки
+  if ((m_handle < 0) || (pos < 0)) return nullptr;
+
+  // отображение расширяем под локером, только если данных в нем не хватает
+  int64_t fileSize = m_size;
+  int64_t mapSize  = m_mapSize.load(std::memory_order_acquire);
+
+  if ((pos + (int64_t)size > mapSize) && (mapSize < fileSize))
+  {
+    // лочимся
+#ifdef __GNUC__
+    pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.lock();
+#endif // ifdef __GNUC__
+
+    Remap();
+    mapSize = m_mapSize.load(std::memory_order_acquire);
+
+    // анлочимся
+#ifdef __GNUC__
+    pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+    m_locker.unlock();
+#endif // ifdef __GNUC__
+  }
+
+  if (pos + (int64_t)size <= std::min(mapSize, fileSize))
+    res = m_map.load(std::memory_order_acquire) + pos;
+
+  // вернем результат
+  return res;
+}
+
+// сброс данных на диск. записи в отображение уже видны ядру, как и после
+// fflush у CBinaryFile
+bool CMappedFile::Flush()
+{
+  return m_handle >= 0;
+}
+
+// получение размера файла
+int64_t CMappedFile::Size()
+{
+  return m_size;
+}
+
+// установка новой позиции
+bool CMappedFile::Seek(int64_t pos, int origin)
+{
+  // вычислим позицию
+  if (origin == SEEK_CUR) pos += m_curPos;
+  else if (origin == SEEK_END) pos += m_size;
+  else if (origin != SEEK_SET) return false;
+
+  if ((m_handle < 0) || (pos < 0)) return false;
+
+  m_curPos = pos;
+  return true;
+}
@@ -0,0 +1,106 @@
+#pragma once
+#ifdef __GNUC__
+# include <pthread.h>
+#else // ifdef __GNUC__
+# include <mutex>
+#endif // ifdef __GNUC__
+#include <errno.h>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <stdio.h>
+#include "IBinaryStream.h"
+
+#ifndef _MSC_VER
+# ifndef errno_t
+#  define errno_t int
+# endif // ifndef errno_t
+#endif  // ifndef _MSC_VER
+
+// класс для работы с файлом, отображенным в память (mmap). чтение идет
+// напрямую из отображения, данные можно получать без копирования (Borrow).
+// запись внутри отображения - в память, за его пределами - pwrite, после
+// чего отображение расширяется при первом обращении к новым данным.
+// Класс является потоково-безопасным: чтение внутри отображения идет без
+// блокировки, локер берется только для расширения отображения и записи. Под
+// Windows не поддерживается (Open возвращает ENOSYS)
+class CMappedFile : public IBinaryStream {
+private:
+
+  int m_handle = -1;                  // дескриптор открытого файла
+
+#ifdef __GNUC__
+  pthread_mutex_t m_locker;
+#else // ifdef __GNUC__
+  std::recursive_mutex m_locker;      // локер
+#endif // ifdef __GNUC__
+  std::string m_path;                 // путь к файлу
+  bool m_canRead   = false;           // флаг возможности чтения
+  bool m_canWrite  = false;           // флаг возможности записи
+  int64_t m_curPos = 0;               // текущая позиция в файле
+  std::atomic<int64_t> m_size{0};    // размер файла
+  // отображение. адрес публикуется раньше размера, поэтому читатель, увидевший
+  // размер, видит и отображение не меньше его
+  std::atomic<char *>  m_map{nullptr}; // адрес отображения
+  std::atomic<int64_t> m_mapSize{0};   // размер отображения (может быть
+                                       // больше файла)
+  std::vector<std::pair<char *, int64_t> >
+  m_retired;                          // старые отображения (освобождаются
+                                      // при закрытии, чтобы не испортить
+                                      // выданные Borrow указатели)
+
+public:
+
+  CMappedFile();
+  ~CMappedFile(void);
+
+  void Path(std::string& path);
+  bool IsReadable() {
+    return m_canRead;
+  }
+
+  bool IsWritable() {
+    return m_canWrite;
+  }
+
+  bool EndOfFile();
+
+  // открытие/закрытие. режимы как у fopen
+  errno_t Open(const char *filename,
+               const char *mode);
+  void    Close();
+
+  // чтение/запись. возвращают число прочитанных/записанных байт
+  size_t  Read(void  *buffer,
+               size_t size,
+               bool   ignoreCache);
+  size_t  Write(void  *buffer,
+                size_t size,
+                bool   ignoreCache);
+  size_t  ReadAt(int64_t pos,
+                 void   *buffer,
+                 size_t  size,
+                 bool    ignoreCache);
+  size_t  WriteAt(int64_t pos,
+                  void   *buffer,
+                  size_t  size,
+                  bool    ignoreCache);
+
+  // прямой доступ к данным отображения
+  const void* Borrow(int64_t pos,
+                     size_t  size);
+
+  // флаш данных на диск
+  bool    Flush();
+
+  // работа с позицией и размером. обрезание не поддерживается: выданные
+  // Borrow указатели на отрезанную часть вызвали бы SIGBUS
+  int64_t Size();
+  bool    Seek(int64_t pos,
+               int     origin);
+
+private:
+
+  bool Remap();
+};
@@ -0,0 +1,305 @@
+#include <cstring>
+#include <algorithm>
+#ifndef _MSC_VER
+# include <fcntl.h>
+# include <unistd.h>
+# include <sys/stat.h>
+#endif // ifndef _MSC_VER
+#include "PositionalFile.h"
+
+// конструктор
+CPositionalFile::CPositionalFile() : m_size(0)
+{
+#ifdef __GNUC__
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&m_locker, &attr);
+#endif // ifdef __GNUC__
+}
+
+// деструктор
+CPositionalFile::~CPositionalFile(void)
+{
+  // закроем файл
+  Close();
+#ifdef __GNUC__
+  pthread_mutex_destroy(&m_locker);
+#endif // ifdef __GNUC__
+}
+
+// открытие файла
+errno_t CPositionalFile::Open(const char *filename, const char *mode)
+{
+  // закроем предыдущий файл
+  Close();
+
+  // проверки параметров
+  if ((filename == nullptr) || (mode == nullptr)) return EINVAL;
+
+#ifndef _MSC_VER
+  bool plus  = strchr(mode, '+') != nullptr;
+  int  flags = 0;
+
+  // выберем режим открытия
+  if (mode[0] == 'r') flags = plus ? O_RDWR : O_RDONLY;
+  else if (mode[0] == 'w') flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT | O_TRUNC;
+  else if (mode[0] == 'a') flags = (plus ? O_RDWR : O_WRONLY) | O_CREAT;
+  else return EINVAL;
+
+  // откроем файл
+  m_handle = open(filename, flags | O_CLOEXEC, 0666);
+
+  if (m_handle < 0) return errno;
+
+  // узнаем размер
+  struct stat st;
+
+  if (fstat(m_handle, &st) != 0)
+  {
+    errno_t err = errno;
+    Close();
+    return err;
+  }
+
+  // запомним путь и режим
+  m_path     = filename;
+  m_size     = st.st_size;
+  m_curPos   = 0;
+  m_canWrite = (flags & (O_RDWR | O_WRONLY)) != 0;
+  m_canRead  = (flags & O_WRONLY) == 0;
+
+  // все ок
+  return 0;
+#else // ifndef _MSC_VER
+  return ENOSYS;
+#endif // ifndef _MSC_VER
+}
+
+// закрытие
+void CPositionalFile::Close()
+{
+#ifndef _MSC_VER
+
+  // закроем файл
+  if (m_handle >= 0)
+  {
+    close(m_handle);
+    m_handle = -1;
+  }
+#endif // ifndef _MSC_VER
+
+  // очистим данные
+  m_path.clear();
+  m_size   = 0;
+  m_curPos = 0;
+}
+
+// получение пути к файлу
+void CPositionalFile::Path(std::string& path)
+{
+  path = m_path;
+}
+
+// проверка на конец файла
+bool CPositionalFile::EndOfFile()
+{
+  return m_curPos >= m_size;
+}
+
+// чтение из файла. возвращает число прочитанных байт
+size_t CPositionalFile::Read(void  *buffer,
+                             size_t size,
+                             bool   ignoreCache)
+{
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  size_t read = ReadAt(m_curPos, buffer, size, ignoreCache);
+  m_curPos += read;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return read;
+}
+
+// запись в файл. возвращает число записанных байт
+size_t CPositionalFile::Write(void  *buffer,
+                              size_t size,
+                              bool   ignoreCache)
+{
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  size_t wrote = WriteAt(m_curPos, buffer, size, ignoreCache);
+  m_curPos += wrote;
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return wrote;
+}
+
+// чтение с заданной позиции. курсор не используется, блокировок нет
+size_t CPositionalFile::ReadAt(int64_t pos,
+                               void   *buffer,
+                               size_t  size,
+                               bool /*ignoreCache*/)
+{
+  size_t readTotal = 0;
+
+  // проверки
+  if ((m_handle < 0) || (buffer == nullptr) || !m_canRead || (pos < 0)) return 0;
+
+#ifndef _MSC_VER
+  char *dst = (char *)buffer;
+
+  // читаем, пока не получим все или не упремся в конец файла
+  while (size > 0)
+  {
+    ssize_t read = pread(m_handle, dst, size, pos);
+
+    if (read < 0)
+    {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (read == 0) break;
+
+    // сместим счетчики
+    readTotal += read;
+    dst       += read;
+    pos       += read;
+    size      -= read;
+  }
+#endif // ifndef _MSC_VER
+
+  // вернем результат
+  return readTotal;
+}
+
+// запись с заданной позиции. курсор не используется, блокировок нет
+size_t CPositionalFile::WriteAt(int64_t pos,
+                                void   *buffer,
+                                size_t  size,
+                                bool /*ignoreCache*/)
+{
+  size_t wroteTotal = 0;
+
+  // проверки
+  if ((m_handle < 0) || (buffer == nullptr) || !m_canWrite || (pos < 0)) return 0;
+
+#ifndef _MSC_VER
+  char *src = (char *)buffer;
+
+  // пишем, пока не запишем все
+  while (size > 0)
+  {
+    ssize_t wrote = pwrite(m_handle, src, size, pos);
+
+    if (wrote < 0)
+    {
+      if (errno == EINTR) continue;
+      break;
+    }
+
+    if (wrote == 0) break;
+
+    // сместим счетчики
+    wroteTotal += wrote;
+    src        += wrote;
+    pos        += wrote;
+    size       -= wrote;
+  }
+
+  // запомним новый размер (параллельные записи могут его уже увеличить)
+  int64_t size0 = m_size.load();
+
+  while ((pos > size0) && !m_size.compare_exchange_weak(size0, pos)) {}
+#endif // ifndef _MSC_VER
+
+  // вернем результат
+  return wroteTotal;
+}
+
+// сброс данных на диск. своего кэша нет, данные уже отданы ядру
+bool CPositionalFile::Flush()
+{
+  return m_handle >= 0;
+}
+
+// получение размера файла
+int64_t CPositionalFile::Size()
+{
+  return m_size;
+}
+
+// обрезание файла
+bool CPositionalFile::Truncate(int64_t size)
+{
+  // проверки
+  if ((m_handle < 0) || !m_canWrite || (size < 0)) return false;
+
+#ifndef _MSC_VER
+  if (ftruncate(m_handle, (off_t)size) != 0) return false;
+
+  m_size = size;
+  return true;
+#else // ifndef _MSC_VER
+  return false;
+#endif // ifndef _MSC_VER
+}
+
+// установка новой позиции
+bool CPositionalFile::Seek(int64_t pos, int origin)
+{
+  bool res = false;
+
+  // лочимся
+#ifdef __GNUC__
+  pthread_mutex_lock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.lock();
+#endif // ifdef __GNUC__
+
+  // вычислим позицию
+  if (origin == SEEK_CUR) pos += m_curPos;
+  else if (origin == SEEK_END) pos += m_size;
+  else if (origin != SEEK_SET) pos = -1;
+
+  if ((m_handle >= 0) && (pos >= 0))
+  {
+    m_curPos = pos;
+    res      = true;
+  }
+
+  // анлочимся
+#ifdef __GNUC__
+  pthread_mutex_unlock(&m_locker);
+#else // ifdef __GNUC__
+  m_locker.unlock();
+#endif // ifdef __GNUC__
+
+  // вернем результат
+  return res;
+}
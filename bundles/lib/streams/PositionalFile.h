@@ -0,0 +1,87 @@
+#pragma once
+#ifdef __GNUC__
+# include <pthread.h>
+#else // ifdef __GNUC__
+# include <mutex>
+#endif // ifdef __GNUC__
+#include <errno.h>
+#include <atomic>
+#include <string>
+#include <stdlib.h>
+#include <stdio.h>
+#include "IBinaryStream.h"
+
+#ifndef _MSC_VER
+# ifndef errno_t
+#  define errno_t int
+# endif // ifndef errno_t
+#endif  // ifndef _MSC_VER
+
+// класс для работы с файлом через дескриптор и pread/pwrite. ReadAt/WriteAt
+// не используют общий курсор и выполняются без блокировок, поэтому
+// параллельные чтения одного файла не мешают друг другу. Read/Write/Seek
+// работают с курсором под локером. Кэша нет - на каждое обращение один
+// системный вызов. Класс является потоково-безопасным. Под Windows не
+// поддерживается (Open возвращает ENOSYS)
+class CPositionalFile : public IBinaryStream {
+private:
+
+  int m_handle = -1;                // дескриптор открытого файла
+
+#ifdef __GNUC__
+  pthread_mutex_t m_locker;
+#else // ifdef __GNUC__
+  std::recursive_mutex m_locker;    // локер курсора
+#endif // ifdef __GNUC__
+  std::string m_path;               // путь к файлу
+  bool m_canRead   = false;         // флаг возможности чтения
+  bool m_canWrite  = false;         // флаг возможности записи
+  int64_t m_curPos = 0;             // текущая позиция в файле
+  std::atomic<int64_t> m_size;      // размер файла
+
+public:
+
+  CPositionalFile();
+  ~CPositionalFile(void);
+
+  void Path(std::string& path);
+  bool IsReadable() {
+    return m_canRead;
+  }
+
+  bool IsWritable() {
+    return m_canWrite;
+  }
+
+  bool EndOfFile();
+
+  // открытие/закрытие. режимы как у fopen
+  errno_t Open(const char *filename,
+               const char *mode);
+  void    Close();
+
+  // чтение/запись. возвращают число прочитанных/записанных байт
+  size_t  Read(void  *buffer,
+               size_t size,
+               bool   ignoreCache);
+  size_t  Write(void  *buffer,
+                size_t size,
+                bool   ignoreCache);
+  size_t  ReadAt(int64_t pos,
+                 void   *buffer,
+                 size_t  size,
+                 bool    ignoreCache);
+  size_t  WriteAt(int64_t pos,
+                  void   *buffer,
+                  size_t  size,
+                  bool    ignoreCache);
+
+  // флаш данных на диск
+  bool    Flush();
+
+  // работа с позицией и размером
+  int64_t Size();
+  bool    Truncate(int64_t size);
+  bool    Seek(int64_t pos,
+               int     origin);
+};
@@ -1,8 +1,21 @@
 #include "BundleTests.h"
 #include <QDir>
+#include <QFileInfo>
 #include <time.h>
+#include <vector>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <set>
 #include "../lib/streams/BinaryFile.h"
+#include "../lib/streams/MappedFile.h"
+#include "../lib/streams/PositionalFile.h"
 #include "../lib/BundlesLibrary.h"
+#include "../lib/BundleFile.h"
+#include "../lib/BundleCrypto.h"
+#include "../lib/BundleBlockCache.h"
+#include "../lib/BundlePathIndex.h"
 #include <QDebug>
 
 #define TEST_BUFFER_SIZE 16 * 1024 * 1024LL
@@ -90,6 +103,95 @@ void BundleTests::BinaryFileTest() {
   delete[] bufferWrite;
 }
 
+void BundleTests::BinaryFilePageCacheTest() {
+  // кэш из 4 страниц по 4 КБ
+  CBinaryFile file(0, 4 * 4096, 4096);
+
+  std::vector<char> data(64 * 1024);
+  std::vector<char> read(64 * 1024);
+
+  for (size_t i = 0; i < data.size(); i++) data[i] = rand() % 256;
+
+  auto str = QDir::tempPath().toStdString();
+  str += "/page_cache.test";
+
+  QVERIFY2(file.Open(str.c_str(), "w+b") == 0, "Failed to create file");
+
+  // неполная последняя страница: дописывание за ней видно при чтении
+  QVERIFY2(file.WriteAt(0, data.data(), 6000, false) == 6000, "Failed to write data");
+  QVERIFY2(file.ReadAt(0, read.data(), 100, false) == 100, "Failed to read data");
+  QVERIFY2(file.WriteAt(6000, data.data() + 6000, data.size() - 6000, true) ==
+           data.size() - 6000, "Failed to write data");
+
+  for (size_t pos = 0; pos < data.size(); pos += 1000) {
+    size_t len = std::min<size_t>(1000, data.size() - pos);
+    QVERIFY2(file.ReadAt(pos, read.data() + pos, len, false) == len, "Failed to read data");
+  }
+  QVERIFY2(memcmp(data.data(), read.data(), data.size()) == 0, "Read data is invalid");
+
+  // запись поверх закэшированных страниц
+  for (size_t i = 4000; i < 12000; i++) data[i] = ~data[i];
+  QVERIFY2(file.WriteAt(4000, data.data() + 4000, 8000, true) == 8000, "Failed to write data");
+  QVERIFY2(file.ReadAt(3000, read.data(), 10000, false) == 10000, "Failed to read data");
+  QVERIFY2(memcmp(data.data() + 3000, read.data(), 10000) == 0, "Read data is invalid");
+
+  // часто читаемая страница (заголовок) не вытесняется сканированием
+  uint64_t hits, misses, hitsBefore, missesBefore;
+
+  for (size_t pos = 0; pos < data.size(); pos += 4096) {
+    file.ReadAt(0, read.data(), 64, false);
+    file.ReadAt(pos, read.data(), 64, false);
+  }
+  file.CacheStats(hitsBefore, missesBefore);
+  QVERIFY2(file.ReadAt(0, read.data(), 64, false) == 64, "Failed to read data");
+  file.CacheStats(hits, misses);
+  QVERIFY2(hits == hitsBefore + 1 && misses == missesBefore, "Header page was evicted");
+
+  // чтение за концом файла
+  QVERIFY2(file.ReadAt(data.size() + 10, read.data(), 10, false) == 0, "Read past EOF");
+
+  file.Close();
+  remove(str.c_str());
+}
+
+void BundleTests::BinaryFileReadAheadTest() {
+  CBinaryFile file(0, 64 * 1024);
+
+  std::vector<char> data(4 * 1024 * 1024);
+  std::vector<char> read(data.size());
+
+  for (size_t i = 0; i < data.size(); i++) data[i] = rand() % 256;
+
+  auto str = QDir::tempPath().toStdString();
+  str += "/read_ahead.test";
+
+  QVERIFY2(file.Open(str.c_str(), "w+b") == 0, "Failed to create file");
+  QVERIFY2(file.Write(data.data(), data.size(), true) == data.size(), "Failed to write data");
+
+  // случайные чтения упреждение не вызывают
+  for (int i = 0; i < 64; i++) {
+    int64_t pos = (rand() % 1000) * 4096;
+    QVERIFY2(file.ReadAt(pos, read.data(), 100, false) == 100, "Failed to read data");
+  }
+  QVERIFY2(file.ReadAheadSize() == 0, "Read ahead on random access");
+
+  // последовательное чтение порциями, чередующееся с чтением заголовка
+  for (size_t pos = 0; pos < data.size(); pos += 32 * 1024) {
+    QVERIFY2(file.ReadAt(0, read.data(), 64, false) == 64, "Failed to read data");
+    QVERIFY2(file.ReadAt(pos, read.data() + pos, 32 * 1024, false) == 32 * 1024,
+             "Failed to read data");
+  }
+  QVERIFY2(memcmp(data.data(), read.data(), data.size()) == 0, "Read data is invalid");
+
+  // упреждение покрыло файл, окно ограничено сверху
+  uint64_t ahead = file.ReadAheadSize();
+  QVERIFY2(ahead >= data.size() && ahead <= data.size() + 2 * BINARY_FILE_READAHEAD_MAX,
+           "Invalid read ahead size");
+
+  file.Close();
+  remove(str.c_str());
+}
+
 void BundleTests::BundleFileTest() {
   void *bundle;
 
@@ -480,3 +582,2459 @@ void BundleTests::BundleFileTest() {
 
   if (error) throw std::exception();
 }
+
+void BundleTests::BundleSpaceReuseTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int filesCount = 20;
+  const int64_t dataSize = 64 * 1024;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  char name[64] = { 0 };
+
+  auto str = QDir::tempPath().toStdString() + "/space.bundle";
+  remove(str.c_str());
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // создадим бандл с файлами
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < filesCount; i++) {
+    sprintf(name, "space/file%d.dat", i);
+    int idx = BundleFileOpen(bundle, name, true);
+    QVERIFY2(idx > 0, "Failed to create file");
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, nullptr) == dataSize,
+             "Failed to write data");
+  }
+  BundleClose(bundle);
+
+  auto sizeBefore = QFileInfo(QString::fromStdString(str)).size();
+
+  // удалим половину файлов, часть оставшихся обрежем
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < filesCount; i++) {
+    sprintf(name, "space/file%d.dat", i);
+    int idx = BundleFileOpen(bundle, name, false);
+    QVERIFY2(idx > 0, "File not found");
+
+    if (i % 2 == 0) {
+      BundleFileDelete(bundle, idx);
+    } else if (i % 4 == 1) {
+      BundleFileTrunk(bundle, idx, dataSize / 4);
+    }
+  }
+
+  // новые файлы и дописывание должны занять освободившееся место
+  for (int i = 0; i < filesCount; i++) {
+    sprintf(name, "space/file%d.dat", i);
+    int idx = BundleFileOpen(bundle, name, i % 2 == 0);
+    QVERIFY2(idx > 0, "Failed to open file");
+
+    if (i % 2 == 0) {
+      QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, nullptr) == dataSize,
+               "Failed to write data");
+    } else if (i % 4 == 1) {
+      BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_END);
+      QVERIFY2(BundleFileWrite(bundle, idx, &data[dataSize / 4], 0, dataSize - dataSize / 4,
+                               nullptr) == dataSize - dataSize / 4, "Failed to write data");
+    }
+  }
+  BundleClose(bundle);
+
+  auto sizeAfter = QFileInfo(QString::fromStdString(str)).size();
+  QVERIFY2(sizeAfter <= sizeBefore + 4096, "Bundle grew instead of reusing free space");
+
+  // проверим содержимое
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < filesCount; i++) {
+    sprintf(name, "space/file%d.dat", i);
+    int idx = BundleFileOpen(bundle, name, false);
+    int64_t len = dataSize;
+    QVERIFY2(idx > 0, "File not found");
+    QVERIFY2(BundleFileLength(bundle, idx) == dataSize, "Invalid file size");
+    QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == dataSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+  }
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleFileSeekTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int chunksCount = 300;
+  const int64_t chunkSize = 1000;
+  const int64_t dataSize = chunksCount * chunkSize;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(chunkSize);
+
+  auto str = QDir::tempPath().toStdString() + "/seek.bundle";
+  remove(str.c_str());
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // запишем два файла вперемешку, чтобы цепочки блоков были фрагментированы
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  int idx1 = BundleFileOpen(bundle, "seek/file1.dat", true);
+  int idx2 = BundleFileOpen(bundle, "seek/file2.dat", true);
+  QVERIFY2(idx1 > 0 && idx2 > 0, "Failed to create file");
+
+  for (int i = 0; i < chunksCount; i++) {
+    QVERIFY2(BundleFileWrite(bundle, idx1, &data[0], i * chunkSize, chunkSize,
+                             nullptr) == chunkSize, "Failed to write data");
+    QVERIFY2(BundleFileWrite(bundle, idx2, &data[0], i * chunkSize, chunkSize,
+                             nullptr) == chunkSize, "Failed to write data");
+  }
+
+  // произвольное позиционирование от начала
+  for (int i = 0; i < 100; i++) {
+    int64_t pos = rand() % (dataSize - chunkSize);
+    int64_t len = chunkSize;
+    QVERIFY2(BundleFileSeek(bundle, idx1, pos, BUNDLE_FILE_ORIG_SET) == pos, "Invalid position");
+    QVERIFY2(BundleFileRead(bundle, idx1, &read[0], 0, &len, nullptr) == chunkSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[pos], chunkSize) == 0, "Read data is invalid");
+
+    // назад от текущей позиции
+    int64_t back = rand() % (pos + chunkSize);
+    QVERIFY2(BundleFileSeek(bundle, idx1, -back, BUNDLE_FILE_ORIG_CUR) == pos + chunkSize - back,
+             "Invalid position");
+
+    // от конца
+    len = chunkSize;
+    QVERIFY2(BundleFileSeek(bundle, idx1, -(pos + chunkSize),
+                            BUNDLE_FILE_ORIG_END) == dataSize - pos - chunkSize,
+             "Invalid position");
+    QVERIFY2(BundleFileRead(bundle, idx1, &read[0], 0, &len, nullptr) == chunkSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[dataSize - pos - chunkSize], chunkSize) == 0,
+             "Read data is invalid");
+  }
+
+  // позиционирование за пределы файла ограничивается его размером
+  QVERIFY2(BundleFileSeek(bundle, idx1, dataSize * 2, BUNDLE_FILE_ORIG_SET) == dataSize,
+           "Invalid position");
+  QVERIFY2(BundleFileSeek(bundle, idx1, -dataSize * 2, BUNDLE_FILE_ORIG_CUR) == 0,
+           "Invalid position");
+
+  // дописывание после позиционирования на конец от начала
+  QVERIFY2(BundleFileSeek(bundle, idx2, dataSize, BUNDLE_FILE_ORIG_SET) == dataSize,
+           "Invalid position");
+  QVERIFY2(BundleFileWrite(bundle, idx2, &data[0], 0, chunkSize, nullptr) == chunkSize,
+           "Failed to write data");
+  QVERIFY2(BundleFileLength(bundle, idx2) == dataSize + chunkSize, "Invalid file size");
+
+  // обрезание и дописывание
+  BundleFileTrunk(bundle, idx2, dataSize / 2);
+  QVERIFY2(BundleFileSeek(bundle, idx2, 0, BUNDLE_FILE_ORIG_END) == dataSize / 2,
+           "Invalid position");
+  QVERIFY2(BundleFileWrite(bundle, idx2, &data[dataSize / 2], 0, dataSize / 2,
+                           nullptr) == dataSize / 2, "Failed to write data");
+  QVERIFY2(BundleFileSeek(bundle, idx2, 0, BUNDLE_FILE_ORIG_END) == dataSize,
+           "Invalid position");
+
+  for (int i = 0; i < chunksCount; i++) {
+    int64_t len = chunkSize;
+    QVERIFY2(BundleFileSeek(bundle, idx2, i * chunkSize, BUNDLE_FILE_ORIG_SET) == i * chunkSize,
+             "Invalid position");
+    QVERIFY2(BundleFileRead(bundle, idx2, &read[0], 0, &len, nullptr) == chunkSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[i * chunkSize], chunkSize) == 0, "Read data is invalid");
+  }
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleFileLengthTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t chunkSize = 1000;
+  std::vector<char> data(chunkSize * 4);
+  BundleInfo     info;
+  BundleFileInfo fileInfo;
+
+  // заголовок первого файла лежит в первом блоке заголовков
+  const long infoPos = sizeof(BundleInfo) + sizeof(BundleBlock) + sizeof(BundleFileInfo);
+
+  auto str = QDir::tempPath().toStdString() + "/length.bundle";
+  remove(str.c_str());
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // создадим файл дописыванием в конец
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  int idx = BundleFileOpen(bundle, "length/file.dat", true);
+  QVERIFY2(idx > 0, "Failed to create file");
+
+  for (int i = 0; i < 3; i++) {
+    QVERIFY2(BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_END) == i * chunkSize,
+             "Invalid position");
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], i * chunkSize, chunkSize,
+                             nullptr) == chunkSize, "Failed to write data");
+  }
+  BundleClose(bundle);
+
+  // длина должна сохраниться в заголовке
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "length/file.dat", false);
+  QVERIFY2(idx > 0, "File not found");
+  QVERIFY2(BundleFileLength(bundle, idx) == 3 * chunkSize, "Invalid file size");
+  QVERIFY2(BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_END) == 3 * chunkSize,
+           "Invalid position");
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 3 * chunkSize, chunkSize,
+                           nullptr) == chunkSize, "Failed to write data");
+  BundleClose(bundle);
+
+  FILE *f = fopen(str.c_str(), "r+b");
+  QVERIFY2(f != nullptr, "Failed to open bundle file");
+  QVERIFY2(fread(&info, sizeof(info), 1, f) == 1, "Failed to read bundle info");
+  QVERIFY2(info.version == BUNDLE_VERSION, "Invalid bundle version");
+  fseek(f, infoPos, SEEK_SET);
+  QVERIFY2(fread(&fileInfo, sizeof(fileInfo), 1, f) == 1, "Failed to read file info");
+  QVERIFY2((fileInfo.extFlags & BUNDLE_FILE_EXT_LENGTH) != 0, "Length is not stored");
+  int64_t lastPos = BundleInt48Get(fileInfo.dataLastBlock);
+  BundleBlock lastBlock;
+  fseek(f, lastPos, SEEK_SET);
+  QVERIFY2(fread(&lastBlock, sizeof(lastBlock), 1, f) == 1, "Failed to read last block");
+  QVERIFY2(BundleInt48Get(fileInfo.dataLastStart) + lastBlock.size == 4 * chunkSize,
+           "Invalid stored start");
+
+  // обрезание внутри последнего блока (как его делает 1я версия) длину
+  // не портит
+  int64_t cut = std::min<int64_t>(lastBlock.size, 100);
+  lastBlock.size -= cut;
+  fseek(f, lastPos, SEEK_SET);
+  fwrite(&lastBlock, sizeof(lastBlock), 1, f);
+  fflush(f);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "length/file.dat", false);
+  QVERIFY2(idx > 0, "File not found");
+  QVERIFY2(BundleFileLength(bundle, idx) == 4 * chunkSize - cut, "Invalid truncated size");
+  BundleClose(bundle);
+
+  lastBlock.size += cut;
+  fseek(f, lastPos, SEEK_SET);
+  fwrite(&lastBlock, sizeof(lastBlock), 1, f);
+
+  // бандл 1й версии: значения в заголовке игнорируются
+  info.version = 1;
+  BundleInt48Set(fileInfo.dataLastStart, chunkSize);
+  fseek(f, 0, SEEK_SET);
+  fwrite(&info, sizeof(info), 1, f);
+  fseek(f, infoPos, SEEK_SET);
+  fwrite(&fileInfo, sizeof(fileInfo), 1, f);
+  fclose(f);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "length/file.dat", false);
+  QVERIFY2(idx > 0, "File not found");
+  QVERIFY2(BundleFileLength(bundle, idx) == 4 * chunkSize, "Invalid file size");
+
+  std::vector<char> read(data.size());
+  int64_t len = read.size();
+  QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == 4 * chunkSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], data.size()) == 0, "Read data is invalid");
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleSealTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int filesCount = 30;
+  const int64_t dataSize = 4096;
+  const char *info = "bundle info";
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  char name[64] = { 0 };
+
+  auto str = QDir::tempPath().toStdString() + "/unsealed.bundle";
+  auto strSealed = QDir::tempPath().toStdString() + "/sealed.bundle";
+  remove(str.c_str());
+  remove(strSealed.c_str());
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // создадим бандл: файлы пишутся вперемешку, часть зашифрована, часть удалена
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+  QVERIFY2(ctx != nullptr, "Failed to create crypto context");
+  QVERIFY2(BundleAttributeSet(bundle, BUNDLE_EXTRA_PUBLIC, info, 0, strlen(info)) ==
+           (int64_t)strlen(info), "Failed to set bundle attribute");
+
+  for (int part = 0; part < 2; part++) {
+    for (int i = filesCount - 1; i >= 0; i--) {
+      sprintf(name, "seal/file%02d.dat", i);
+      int idx = BundleFileOpen(bundle, name, true);
+      QVERIFY2(idx > 0, "Failed to open file");
+      BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_END);
+      QVERIFY2(BundleFileWrite(bundle, idx, &data[0], part * dataSize / 2, dataSize / 2,
+                               i % 3 == 0 ? ctx : nullptr) == dataSize / 2,
+               "Failed to write data");
+    }
+  }
+  sprintf(name, "seal/file%02d.dat", 7);
+  BundleFileDelete(bundle, BundleFileOpen(bundle, name, false));
+  BundleClose(bundle);
+
+  // запечатаем
+  QVERIFY2(BundleSeal(str.c_str(), strSealed.c_str(), key, sizeof(key)), "Failed to seal bundle");
+
+  bundle = BundleOpen(strSealed.c_str(), BMODE_READWRITE);
+  QVERIFY2(bundle != nullptr, "Failed to open sealed bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  // имена идут по порядку
+  int count = 0;
+  std::string prev;
+
+  for (int idx = BundleFileName(bundle, 0, name, sizeof(name)); idx > 0;
+       idx = BundleFileName(bundle, idx, name, sizeof(name))) {
+    QVERIFY2(prev < name, "Directory is not sorted");
+    prev = name;
+    count++;
+  }
+  QVERIFY2(count == filesCount - 1, "Invalid files count");
+
+  // содержимое
+  for (int i = 0; i < filesCount; i++) {
+    sprintf(name, "seal/file%02d.dat", i);
+    int idx = BundleFileOpen(bundle, name, false);
+
+    if (i == 7) {
+      QVERIFY2(idx < 0, "Deleted file found");
+      continue;
+    }
+    int64_t len = dataSize;
+    QVERIFY2(idx > 0, "File not found");
+    QVERIFY2(BundleFileLength(bundle, idx) == dataSize, "Invalid file size");
+    QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len,
+                            i % 3 == 0 ? ctx : nullptr) == dataSize, "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+
+    // позиционирование
+    len = 16;
+    QVERIFY2(BundleFileSeek(bundle, idx, -32, BUNDLE_FILE_ORIG_END) == dataSize - 32,
+             "Invalid position");
+    QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == 16,
+             "Failed to read data");
+  }
+
+  int64_t len = read.size();
+  QVERIFY2(BundleAttributeGet(bundle, BUNDLE_EXTRA_PUBLIC, &read[0], 0, &len) ==
+           (int64_t)strlen(info), "Failed to get bundle attribute");
+  QVERIFY2(memcmp(&read[0], info, strlen(info)) == 0, "Invalid bundle attribute");
+
+  // изменения запрещены
+  QVERIFY2(BundleFileOpen(bundle, "seal/new.dat", true) < 0, "File created in sealed bundle");
+  int idx = BundleFileOpen(bundle, "seal/file01.dat", false);
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, nullptr) == 0,
+           "Sealed bundle was modified");
+  BundleFileTrunk(bundle, idx, 0);
+  QVERIFY2(BundleFileLength(bundle, idx) == dataSize, "Sealed bundle was modified");
+  BundleClose(bundle);
+
+  // обычный бандл, окончание которого похоже на каталог, запечатанным не
+  // считается
+  remove(str.c_str());
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "seal/fake.dat", true);
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, nullptr) == dataSize,
+           "Failed to write data");
+  BundleClose(bundle);
+
+  BundleSealInfo seal;
+  int64_t fileSize = QFileInfo(QString::fromStdString(str)).size();
+  int64_t padding  = (AES_BLOCK_SIZE - (fileSize - sizeof(BundleInfo) -
+                                        sizeof(BundleFileInfo)) % AES_BLOCK_SIZE) %
+                     AES_BLOCK_SIZE;
+  std::vector<char> tail((size_t)padding, 0);
+  memset(&seal, 0, sizeof(seal));
+  memcpy(seal.sealSign, BUNDLE_SEAL_SIGNATURE, sizeof(BUNDLE_SEAL_SIGNATURE));
+  seal.dirPos     = sizeof(BundleInfo);
+  seal.dirSize    = fileSize + padding - sizeof(BundleInfo);
+  seal.filesCount = 1;
+  tail.insert(tail.end(), (char *)&seal, (char *)&seal + sizeof(seal));
+
+  FILE *f = fopen(str.c_str(), "ab");
+  QVERIFY2(f != nullptr, "Failed to open bundle file");
+  QVERIFY2(fwrite(&tail[0], 1, tail.size(), f) == tail.size(), "Failed to write tail");
+  fclose(f);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "seal/fake.dat", false);
+  QVERIFY2(idx > 0, "Bundle with a seal-like tail was opened as sealed");
+  len = dataSize;
+  QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+  BundleClose(bundle);
+
+  BundleDestroyCryptoContext(ctx);
+  remove(str.c_str());
+  remove(strSealed.c_str());
+}
+
+void BundleTests::MappedFileTest() {
+#ifndef _MSC_VER
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t dataSize = 256 * 1024;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  CMappedFile file;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // запись с ростом файла и чтение
+  auto str = QDir::tempPath().toStdString() + "/mapped.test";
+  QVERIFY2(file.Open(str.c_str(), "w+b") == 0, "Failed to open file");
+
+  for (int i = 0; i < 4; i++) {
+    QVERIFY2(file.Write(&data[i * dataSize / 4], dataSize / 4, false) == dataSize / 4,
+             "Failed to write data");
+    QVERIFY2(file.Borrow(0, (size_t)((i + 1) * dataSize / 4)) != nullptr,
+             "Failed to borrow data");
+  }
+  QVERIFY2(file.Size() == dataSize, "Invalid file size");
+  QVERIFY2(file.Borrow(dataSize - 1, 2) == nullptr, "Borrowed data past the end");
+
+  // перезапись внутри отображения
+  file.Seek(100, SEEK_SET);
+  QVERIFY2(file.Write(&data[0], 100, false) == 100, "Failed to write data");
+  memcpy(&data[100], &data[0], 100);
+
+  file.Seek(0, SEEK_SET);
+  QVERIFY2(file.Read(&read[0], dataSize, false) == dataSize, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+  QVERIFY2(memcmp(file.Borrow(0, dataSize), &data[0], dataSize) == 0, "Borrowed data is invalid");
+
+  // чтение параллельно с дописыванием: отображение расширяется на ходу
+  std::atomic<int64_t> written(dataSize);
+  std::atomic<int>     errors(0);
+  std::vector<std::thread> readers;
+
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&file, &data, &written, &errors, dataSize, t]() {
+      std::vector<char> chunk(4096);
+
+      for (int i = 0; i < 2000; i++) {
+        int64_t end = written;
+        int64_t pos = (int64_t)((i * 7919 + t * 131) % (end / chunk.size())) * chunk.size();
+
+        if ((file.ReadAt(pos, &chunk[0], chunk.size(), false) != chunk.size())
+            || (memcmp(&chunk[0], &data[pos % dataSize], chunk.size()) != 0)) {
+          errors++;
+        }
+      }
+    });
+  }
+
+  for (int i = 1; i < 8; i++) {
+    QVERIFY2(file.WriteAt(i * dataSize, &data[0], dataSize, false) == dataSize,
+             "Failed to write data");
+    written = (i + 1) * dataSize;
+  }
+
+  for (auto& th : readers) {
+    th.join();
+  }
+  QVERIFY2(errors == 0, "Concurrent read data is invalid");
+
+  // мелкие дописывания вперемешку с чтением: отображение растет вдвое, а не
+  // пересоздается на каждое дописывание
+  int64_t end = file.Size();
+
+  for (int i = 0; i < 2000; i++, end += 16) {
+    QVERIFY2(file.WriteAt(end, &data[i], 16, false) == 16, "Failed to write data");
+    QVERIFY2(file.ReadAt(end, &read[0], 16, false) == 16
+             && memcmp(&read[0], &data[i], 16) == 0, "Read data is invalid");
+  }
+  QVERIFY2(file.ReadAt(end - 8, &read[0], 16, false) == 8, "Read data past the end");
+  QVERIFY2(file.Borrow(end - 8, 16) == nullptr, "Borrowed data past the end");
+
+  FILE *maps = fopen("/proc/self/maps", "r");
+
+  if (maps != nullptr) {
+    char line[4096];
+    int  count = 0;
+
+    while (fgets(line, sizeof(line), maps) != nullptr) {
+      count += strstr(line, "mapped.test") != nullptr;
+    }
+    fclose(maps);
+    QVERIFY2(count <= 8, "Too many mappings after appends");
+  }
+  file.Close();
+  remove(str.c_str());
+
+  // бандл через отображение
+  str = QDir::tempPath().toStdString() + "/mapped.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS | BMODE_MAPPED);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  int idx1 = BundleFileOpen(bundle, "mapped/file1.dat", true);
+  int idx2 = BundleFileOpen(bundle, "mapped/file2.dat", true);
+  QVERIFY2(idx1 > 0 && idx2 > 0, "Failed to create file");
+
+  for (int i = 0; i < 4; i++) {
+    QVERIFY2(BundleFileWrite(bundle, idx1, &data[0], i * dataSize / 4, dataSize / 4,
+                             nullptr) == dataSize / 4, "Failed to write data");
+    QVERIFY2(BundleFileWrite(bundle, idx2, &data[0], i * dataSize / 4, dataSize / 4,
+                             nullptr) == dataSize / 4, "Failed to write data");
+  }
+  BundleClose(bundle);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ | BMODE_MAPPED);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx1 = BundleFileOpen(bundle, "mapped/file1.dat", false);
+  idx2 = BundleFileOpen(bundle, "mapped/file2.dat", false);
+  QVERIFY2(idx1 > 0 && idx2 > 0, "File not found");
+
+  // обычное чтение
+  int64_t len = dataSize;
+  QVERIFY2(BundleFileRead(bundle, idx1, &read[0], 0, &len, nullptr) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+
+  // чтение без копирования, по блокам
+  int64_t pos = 0;
+
+  while (pos < dataSize) {
+    len = dataSize;
+    const void *ptr = BundleFileBorrow(bundle, idx2, &len);
+    QVERIFY2(ptr != nullptr && len > 0, "Failed to borrow data");
+    QVERIFY2(memcmp(ptr, &data[pos], (size_t)len) == 0, "Borrowed data is invalid");
+    pos += len;
+  }
+  len = dataSize;
+  QVERIFY2(BundleFileBorrow(bundle, idx2, &len) == nullptr && len == 0,
+           "Borrowed data past the end");
+  BundleClose(bundle);
+  remove(str.c_str());
+#endif // ifndef _MSC_VER
+}
+
+void BundleTests::PositionalFileTest() {
+#ifndef _MSC_VER
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t dataSize = 256 * 1024;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  CPositionalFile file;
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // последовательная запись и чтение через курсор
+  auto str = QDir::tempPath().toStdString() + "/positional.test";
+  QVERIFY2(file.Open(str.c_str(), "w+b") == 0, "Failed to open file");
+  QVERIFY2(file.Write(&data[0], dataSize / 2, false) == dataSize / 2, "Failed to write data");
+  QVERIFY2(file.Size() == dataSize / 2, "Invalid file size");
+
+  // запись с позиции не трогает курсор
+  QVERIFY2(file.WriteAt(dataSize / 2, &data[dataSize / 2], dataSize / 2,
+                        false) == dataSize / 2, "Failed to write data");
+  QVERIFY2(file.Size() == dataSize, "Invalid file size");
+  QVERIFY2(file.Write(&data[dataSize / 2], 100, false) == 100, "Failed to write data");
+  QVERIFY2(file.Size() == dataSize, "Invalid file size");
+
+  file.Seek(0, SEEK_SET);
+  QVERIFY2(file.Read(&read[0], dataSize, false) == dataSize, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+  QVERIFY2(file.EndOfFile(), "End of file expected");
+
+  // чтение с позиции, в том числе за концом файла
+  QVERIFY2(file.ReadAt(1000, &read[0], 1000, false) == 1000, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[1000], 1000) == 0, "Read data is invalid");
+  QVERIFY2(file.ReadAt(dataSize - 10, &read[0], 100, false) == 10, "Invalid read size");
+  QVERIFY2(file.EndOfFile(), "Cursor moved by ReadAt");
+  file.Close();
+
+  // открытие на чтение
+  QVERIFY2(file.Open(str.c_str(), "rb") == 0, "Failed to open file");
+  QVERIFY2(file.Size() == dataSize, "Invalid file size");
+  QVERIFY2(!file.IsWritable() && file.WriteAt(0, &data[0], 10, false) == 0,
+           "Wrote to read-only file");
+  file.Close();
+  remove(str.c_str());
+
+  // бандл через pread/pwrite
+  str = QDir::tempPath().toStdString() + "/positional.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS | BMODE_POSITIONAL);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  int idx1 = BundleFileOpen(bundle, "positional/file1.dat", true);
+  int idx2 = BundleFileOpen(bundle, "positional/file2.dat", true);
+  QVERIFY2(idx1 > 0 && idx2 > 0, "Failed to create file");
+
+  for (int i = 0; i < 4; i++) {
+    QVERIFY2(BundleFileWrite(bundle, idx1, &data[0], i * dataSize / 4, dataSize / 4,
+                             nullptr) == dataSize / 4, "Failed to write data");
+    QVERIFY2(BundleFileWrite(bundle, idx2, &data[0], i * dataSize / 4, dataSize / 4,
+                             nullptr) == dataSize / 4, "Failed to write data");
+  }
+  BundleClose(bundle);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ | BMODE_POSITIONAL);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx1 = BundleFileOpen(bundle, "positional/file1.dat", false);
+  idx2 = BundleFileOpen(bundle, "positional/file2.dat", false);
+  QVERIFY2(idx1 > 0 && idx2 > 0, "File not found");
+
+  for (int idx : { idx1, idx2 }) {
+    int64_t len = dataSize;
+    QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == dataSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Read data is invalid");
+  }
+  BundleClose(bundle);
+  remove(str.c_str());
+#endif // ifndef _MSC_VER
+}
+
+void BundleTests::BundleConcurrentReadTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int     filesCount = 8;
+  const int64_t dataSize   = 64 * 1024;
+  std::vector<std::vector<char> > data(filesCount, std::vector<char>(dataSize));
+  std::atomic<int> errors(0);
+
+  for (int i = 0; i < filesCount; i++) {
+    for (size_t j = 0; j < data[i].size(); j++) {
+      data[i][j] = rand() % 256;
+    }
+  }
+
+  // создадим бандл: четные файлы шифрованные, нечетные - нет
+  auto str = QDir::tempPath().toStdString() + "/concurrent.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS | BMODE_POSITIONAL);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+  std::vector<int> idx(filesCount);
+
+  for (int i = 0; i < filesCount; i++) {
+    idx[i] = BundleFileOpen(bundle, ("concurrent/" + std::to_string(i)).c_str(), true);
+    QVERIFY2(idx[i] > 0, "Failed to create file");
+
+    // пишем кусками, чтобы получить цепочку блоков
+    for (int64_t pos = 0; pos < dataSize; pos += dataSize / 8) {
+      QVERIFY2(BundleFileWrite(bundle, idx[i], &data[i][0], pos, dataSize / 8,
+                               (i % 2) == 0 ? ctx : nullptr) == dataSize / 8,
+               "Failed to write data");
+    }
+  }
+
+  // каждый поток читает свой файл, один поток параллельно создает новые
+  std::vector<std::thread> threads;
+
+  for (int i = 0; i < filesCount; i++) {
+    threads.push_back(std::thread([&, i]() {
+      std::vector<char> read(dataSize);
+
+      for (int pass = 0; pass < 20; pass++) {
+        int64_t len = dataSize;
+
+        if ((BundleFileOpen(bundle, ("concurrent/" + std::to_string(i)).c_str(),
+                            false) != idx[i])
+            || (BundleFileLength(bundle, idx[i]) != dataSize)
+            || (BundleFileRead(bundle, idx[i], &read[0], 0, &len,
+                               (i % 2) == 0 ? ctx : nullptr) != dataSize)
+            || (memcmp(&read[0], &data[i][0], dataSize) != 0)
+            || (BundleFileSeek(bundle, idx[i], 0, BUNDLE_FILE_ORIG_CUR) != dataSize)) {
+          errors++;
+        }
+      }
+    }));
+  }
+  threads.push_back(std::thread([&]() {
+    for (int i = 0; i < 20; i++) {
+      int id = BundleFileOpen(bundle, ("concurrent/new" + std::to_string(i)).c_str(), true);
+
+      if ((id <= 0)
+          || (BundleFileWrite(bundle, id, &data[0][0], 0, 1024, nullptr) != 1024)) {
+        errors++;
+      }
+    }
+  }));
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  QVERIFY2(errors == 0, "Concurrent read failed");
+
+  // несколько потоков читают один файл по общему курсору: каждый байт
+  // должен быть прочитан ровно один раз
+  std::atomic<int64_t> total(0);
+  threads.clear();
+  BundleFileSeek(bundle, idx[1], 0, BUNDLE_FILE_ORIG_SET);
+
+  for (int i = 0; i < 4; i++) {
+    threads.push_back(std::thread([&]() {
+      std::vector<char> read(100);
+      int64_t len = 0;
+
+      do {
+        len = read.size();
+        len = BundleFileRead(bundle, idx[1], &read[0], 0, &len, nullptr);
+        total += std::max(len, (int64_t)0);
+      } while (len > 0);
+    }));
+  }
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  QVERIFY2(total == dataSize, "Shared cursor lost or repeated a read");
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+
+  // ожидающий писатель идет раньше новых читателей, повторный захват на
+  // чтение за ним не встает
+  CBundleLock lock;
+  std::atomic<int> order(0);
+  std::atomic<int> writerAt(0);
+  std::atomic<int> readerAt(0);
+
+  lock.LockRead();
+  std::thread writer([&]() {
+    lock.LockWrite();
+    writerAt = ++order;
+    lock.UnlockWrite();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  std::thread reader([&]() {
+    lock.LockRead();
+    readerAt = ++order;
+    lock.UnlockRead();
+  });
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  lock.LockRead();
+  lock.UnlockRead();
+  bool overtaken = (order != 0);
+  lock.UnlockRead();
+  writer.join();
+  reader.join();
+  QVERIFY2(!overtaken && writerAt == 1 && readerAt == 2,
+           "Waiting writer was overtaken by a reader");
+}
+
+void BundleTests::BundleFileHandleTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t dataSize = 128 * 1024;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  std::atomic<int>  errors(0);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  auto str = QDir::tempPath().toStdString() + "/handle.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // запись через дескриптор кусками (цепочка блоков)
+  BundleFileHandle h1 = BundleFileHandleOpen(bundle, "handle/plain.dat", true);
+  BundleFileHandle h2 = BundleFileHandleOpen(bundle, "handle/crypt.dat", true);
+  QVERIFY2(h1 != nullptr && h2 != nullptr, "Failed to create file");
+  QVERIFY2(BundleFileHandleOpen(bundle, "handle/none.dat", false) == nullptr,
+           "Opened missing file");
+
+  for (int64_t pos = 0; pos < dataSize; pos += dataSize / 8) {
+    QVERIFY2(BundleFileHandleWrite(h1, &data[0], pos, dataSize / 8,
+                                   nullptr) == dataSize / 8, "Failed to write data");
+    QVERIFY2(BundleFileHandleWrite(h2, &data[0], pos, dataSize / 8,
+                                   ctx) == dataSize / 8, "Failed to write data");
+  }
+  QVERIFY2(BundleFileHandleLength(h1) == dataSize, "Invalid file size");
+  QVERIFY2(BundleFileHandleLength(h2) == dataSize, "Invalid file size");
+  std::vector<char> crypt(data);
+
+  // курсор файла по индексу от дескрипторов не зависит
+  int idx     = BundleFileOpen(bundle, "handle/plain.dat", false);
+  int64_t len = 100;
+  QVERIFY2(idx == BundleFileHandleIndex(h1), "Invalid file index");
+  QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == 100,
+           "Failed to read data");
+
+  // два дескриптора одного файла с разными позициями
+  BundleFileHandle h3 = BundleFileHandleOpen(bundle, "handle/plain.dat", false);
+  QVERIFY2(h3 != nullptr, "Failed to open file");
+  QVERIFY2(BundleFileHandleSeek(h1, 1000, BUNDLE_FILE_ORIG_SET) == 1000, "Failed to seek");
+  QVERIFY2(BundleFileHandleSeek(h3, -500, BUNDLE_FILE_ORIG_END) == dataSize - 500,
+           "Failed to seek");
+
+  len = 300;
+  QVERIFY2(BundleFileHandleRead(h1, &read[0], 0, &len, nullptr) == 300, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[1000], 300) == 0, "Read data is invalid");
+  len = 1000;
+  QVERIFY2(BundleFileHandleRead(h3, &read[0], 0, &len, nullptr) == 500, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[dataSize - 500], 500) == 0, "Read data is invalid");
+  QVERIFY2(BundleFileHandleSeek(h1, 0, BUNDLE_FILE_ORIG_CUR) == 1300, "Invalid position");
+
+  len = 100;
+  QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, nullptr) == 100,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[100], 100) == 0, "File cursor was moved by handle");
+
+  // перезапись в середине и дописывание в конец
+  BundleFileHandleSeek(h3, 2000, BUNDLE_FILE_ORIG_SET);
+  QVERIFY2(BundleFileHandleWrite(h3, &data[0], 0, 100, nullptr) == 100, "Failed to write data");
+  memcpy(&data[2000], &data[0], 100);
+  BundleFileHandleSeek(h3, 0, BUNDLE_FILE_ORIG_END);
+  QVERIFY2(BundleFileHandleWrite(h3, &data[0], 0, 100, nullptr) == 100, "Failed to write data");
+  QVERIFY2(BundleFileHandleLength(h1) == dataSize + 100, "Invalid file size");
+
+  len = dataSize + 100;
+  read.resize(dataSize + 100);
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, nullptr) == dataSize + 100,
+           "Failed to read data");
+  QVERIFY2((memcmp(&read[0], &data[0], dataSize) == 0)
+           && (memcmp(&read[dataSize], &data[0], 100) == 0), "Read data is invalid");
+  len = 100;
+  QVERIFY2(BundleFileReadAt(bundle, idx, dataSize + 100, &read[0], 0, &len, nullptr) == 0
+           && len == 0, "Read past the end");
+
+  // параллельное чтение диапазонов через один дескриптор
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 4; t++) {
+    threads.push_back(std::thread([&, t]() {
+      std::vector<char> buf(4096);
+
+      for (int i = 0; i < 50; i++) {
+        int64_t pos = ((t * 50 + i) * 4096) % (dataSize - 4096);
+        int64_t l   = 4096;
+
+        if ((BundleFileHandleReadAt(h2, pos, &buf[0], 0, &l, ctx) != 4096)
+            || (memcmp(&buf[0], &crypt[pos], 4096) != 0)) {
+          errors++;
+        }
+      }
+    }));
+  }
+
+  for (size_t i = 0; i < threads.size(); i++) {
+    threads[i].join();
+  }
+  QVERIFY2(errors == 0, "Parallel read failed");
+
+  // AES-ECB с невыровненной позиции не читается
+  len = 96;
+  QVERIFY2(BundleFileHandleReadAt(h2, 5, &read[0], 0, &len, ctx) == 0 && len == 0,
+           "Unaligned encrypted read succeeded");
+  len = 96;
+  QVERIFY2(BundleFileReadAt(bundle, BundleFileHandleIndex(h2), 40, &read[0], 0, &len,
+                            ctx) == 0 && len == 0, "Unaligned encrypted read succeeded");
+  len = 96;
+  QVERIFY2(BundleFileReadAt(bundle, BundleFileHandleIndex(h2), 48, &read[0], 0, &len,
+                            ctx) == 96, "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &crypt[48], 96) == 0, "Read data is invalid");
+
+  // и не пишется: блоки легли бы мимо сетки AES
+  BundleFileHandleSeek(h2, 5, BUNDLE_FILE_ORIG_SET);
+  QVERIFY2(BundleFileHandleWrite(h2, &data[0], 0, 32, ctx) == 0,
+           "Unaligned encrypted write succeeded");
+  len = 96;
+  QVERIFY2(BundleFileHandleReadAt(h2, 0, &read[0], 0, &len, ctx) == 96
+           && memcmp(&read[0], &crypt[0], 96) == 0, "Read data is invalid");
+
+  BundleFileHandleClose(h1);
+  BundleFileHandleClose(h2);
+  BundleFileHandleClose(h3);
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleAesEcbTest() {
+  unsigned char key[32];
+
+  for (size_t i = 0; i < sizeof(key); i++) {
+    key[i] = rand() % 256;
+  }
+
+  // размеры: меньше прохода, ровно проход, с остатком
+  const size_t sizes[] = { 16, 7 * 16, 8 * 16, 9 * 16, 64 * 1024 + 5 * 16 };
+
+  // ключи 128, 192 и 256 бит
+  for (unsigned int bits = 128; bits <= 256; bits += 64) {
+    AesContext ctx;
+    mbedtls_aes_init(&ctx.ctxEnc);
+    mbedtls_aes_init(&ctx.ctxDec);
+    QVERIFY2(mbedtls_aes_setkey_enc(&ctx.ctxEnc, key, bits) == 0, "Failed to set key");
+    QVERIFY2(mbedtls_aes_setkey_dec(&ctx.ctxDec, key, bits) == 0, "Failed to set key");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+      std::vector<unsigned char> data(sizes[s]);
+
+      for (size_t i = 0; i < data.size(); i++) {
+        data[i] = rand() % 256;
+      }
+      std::vector<unsigned char> bulk(data);
+      std::vector<unsigned char> single(data);
+
+      // шифрование совпадает с поблочным
+      BundleAesEcb(&ctx.ctxEnc, MBEDTLS_AES_ENCRYPT, &bulk[0], bulk.size());
+      BundleAesEcbPerBlock(&ctx.ctxEnc, MBEDTLS_AES_ENCRYPT, &single[0], single.size());
+      QVERIFY2(bulk == single, "Encrypted data mismatch");
+      QVERIFY2(bulk != data, "Data not encrypted");
+
+      // расшифровка возвращает исходные данные
+      BundleAesEcb(&ctx.ctxDec, MBEDTLS_AES_DECRYPT, &bulk[0], bulk.size());
+      QVERIFY2(bulk == data, "Decrypted data mismatch");
+    }
+
+    mbedtls_aes_free(&ctx.ctxEnc);
+    mbedtls_aes_free(&ctx.ctxDec);
+  }
+}
+
+void BundleTests::BundleCryptoThreadsTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t dataSize = 3 * 1024 * 1024 + 5 * 16;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+  std::atomic<int>  errors(0);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  // пул дает тот же результат, что и один поток, в том числе при
+  // одновременных вызовах
+  AesContext *ctx = (AesContext *)BundleCreateCryptoContext(key, sizeof(key));
+  QVERIFY2(ctx != nullptr, "Failed to create crypto context");
+  {
+    CBundleCryptoPool pool(3, 256 * 1024);
+    std::vector<unsigned char> single(data.begin(), data.end());
+    std::vector<std::thread>   threads;
+
+    BundleAesEcb(&ctx->ctxEnc, MBEDTLS_AES_ENCRYPT, &single[0], single.size());
+
+    for (int t = 0; t < 4; t++) {
+      threads.push_back(std::thread([&]() {
+        std::vector<unsigned char> bulk(data.begin(), data.end());
+
+        pool.Process(&ctx->ctxEnc, MBEDTLS_AES_ENCRYPT, &bulk[0], bulk.size());
+
+        if (bulk != single) {
+          errors++;
+        }
+        pool.Process(&ctx->ctxDec, MBEDTLS_AES_DECRYPT, &bulk[0], bulk.size());
+
+        if (memcmp(&bulk[0], &data[0], bulk.size()) != 0) {
+          errors++;
+        }
+      }));
+    }
+
+    for (size_t i = 0; i < threads.size(); i++) {
+      threads[i].join();
+    }
+    QVERIFY2(errors == 0, "Pool data mismatch");
+  }
+
+  // бандл с потоками шифрования
+  auto str = QDir::tempPath().toStdString() + "/crypto_threads.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(BundleCryptoThreadsSet(bundle, 3, 128 * 1024), "Failed to set crypto threads");
+
+  int idx = BundleFileOpen(bundle, "crypto/large.dat", true);
+  QVERIFY2(idx > 0, "Failed to create file");
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, ctx) == dataSize,
+           "Failed to write data");
+
+  // чтение с потоками и без совпадает с исходными данными
+  for (int threads = 3; threads >= 0; threads -= 3) {
+    int64_t len = dataSize;
+
+    QVERIFY2(BundleCryptoThreadsSet(bundle, threads, 0), "Failed to set crypto threads");
+    memset(&read[0], 0, read.size());
+    QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == dataSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Invalid data");
+  }
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleCryptoInPlaceTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  // больше окна шифрования и не кратно ему
+  const int64_t dataSize = 2 * BUNDLE_CRYPTO_WINDOW + 3 * 16;
+  std::vector<char> data(dataSize + 1);
+  std::vector<char> read(dataSize + 1);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  auto str = QDir::tempPath().toStdString() + "/crypto_inplace.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // запись из невыровненного источника, исходные данные не меняются
+  std::vector<char> copy(data);
+  int idx = BundleFileOpen(bundle, "crypto/inplace.dat", true);
+  QVERIFY2(idx > 0, "Failed to create file");
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 1, dataSize, ctx) == dataSize,
+           "Failed to write data");
+  QVERIFY2(data == copy, "Source data changed");
+
+  // на диске шифротекст, совпадающий с поблочным шифрованием
+  AesContext *aes = (AesContext *)ctx;
+  std::vector<unsigned char> cipher(data.begin() + 1, data.end());
+  BundleAesEcbPerBlock(&aes->ctxEnc, MBEDTLS_AES_ENCRYPT, &cipher[0], cipher.size());
+
+  int64_t len = dataSize;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, nullptr) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &cipher[0], dataSize) == 0, "Invalid cipher text");
+
+  // чтение в невыровненный приемник расшифровывает на месте
+  len = dataSize - 16;
+  memset(&read[0], 0, read.size());
+  QVERIFY2(BundleFileReadAt(bundle, idx, 16, &read[0], 1, &len, ctx) == dataSize - 16,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[1], &data[17], dataSize - 16) == 0, "Invalid data");
+  QVERIFY2(read[0] == 0, "Data written before destination");
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleCryptoStreamingTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  // несколько порций потокового чтения и неполная последняя
+  const int64_t dataSize = 5 * BUNDLE_CRYPTO_STREAM_CHUNK + 7 * 16;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  auto str = QDir::tempPath().toStdString() + "/crypto_stream.bundle";
+  remove(str.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // файл из нескольких блоков
+  int idx = BundleFileOpen(bundle, "crypto/stream.dat", true);
+  QVERIFY2(idx > 0, "Failed to create file");
+
+  for (int64_t pos = 0; pos < dataSize; pos += dataSize / 3) {
+    int64_t len = std::min(dataSize / 3, dataSize - pos);
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], pos, len, ctx) == len,
+             "Failed to write data");
+  }
+
+  // потоковое чтение с фоновым потоком и с пулом потоков
+  QVERIFY2(BundleCryptoStreamingSet(bundle, 1), "Failed to enable streaming");
+
+  for (int threads = 0; threads <= 2; threads += 2) {
+    QVERIFY2(BundleCryptoThreadsSet(bundle, threads, 0), "Failed to set crypto threads");
+
+    int64_t len = dataSize;
+    memset(&read[0], 0, read.size());
+    BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+    QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, ctx) == dataSize,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Invalid data");
+
+    // чтение с позиции
+    len = dataSize - 1024;
+    QVERIFY2(BundleFileReadAt(bundle, idx, 1024, &read[0], 0, &len, ctx) == dataSize - 1024,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[1024], dataSize - 1024) == 0, "Invalid data");
+  }
+
+  // выключение возвращает обычное чтение
+  QVERIFY2(BundleCryptoStreamingSet(bundle, 0), "Failed to disable streaming");
+  int64_t len = dataSize;
+  memset(&read[0], 0, read.size());
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Invalid data");
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleCipherCtrTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  const int64_t dataSize = 300 * 1024 + 13;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  auto str    = QDir::tempPath().toStdString() + "/ctr.bundle";
+  auto sealed = QDir::tempPath().toStdString() + "/ctr_sealed.bundle";
+  remove(str.c_str());
+  remove(sealed.c_str());
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // режим выставляется у пустого файла
+  int idx = BundleFileOpen(bundle, "ctr/data.dat", true);
+  int ecb = BundleFileOpen(bundle, "ctr/ecb.dat", true);
+  QVERIFY2(idx > 0 && ecb > 0, "Failed to create file");
+  QVERIFY2(BundleFileCipherGet(bundle, idx) == BUNDLE_CIPHER_ECB, "Invalid default cipher");
+  QVERIFY2(BundleFileCipherSet(bundle, idx, BUNDLE_CIPHER_CTR), "Failed to set cipher");
+  QVERIFY2(BundleFileCipherGet(bundle, idx) == BUNDLE_CIPHER_CTR, "Invalid cipher");
+
+  // запись невыровненными кусками
+  for (int64_t pos = 0, step = 1; pos < dataSize; pos += step, step = step * 3 + 7) {
+    int64_t len = std::min(step, dataSize - pos);
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], pos, len, ctx) == len,
+             "Failed to write data");
+  }
+  QVERIFY2(BundleFileLength(bundle, idx) == dataSize, "Invalid file size");
+  QVERIFY2(!BundleFileCipherSet(bundle, idx, BUNDLE_CIPHER_ECB),
+           "Cipher changed for file with data");
+
+  // данные на диске зашифрованы
+  int64_t len = dataSize;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, nullptr) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) != 0, "Data not encrypted");
+
+  // чтение произвольных участков
+  for (int i = 0; i < 100; i++) {
+    int64_t pos = rand() % dataSize;
+    len = rand() % 5000;
+    int64_t expected = std::min(len, dataSize - pos);
+    QVERIFY2(BundleFileReadAt(bundle, idx, pos, &read[0], 1, &len, ctx) == expected,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[1], &data[pos], expected) == 0, "Invalid data");
+  }
+
+  // перезапись в середине без выравнивания
+  for (int64_t i = 1001; i < 1001 + 777; i++) {
+    data[i] = rand() % 256;
+  }
+  QVERIFY2(BundleFileSeek(bundle, idx, 1001, BUNDLE_FILE_ORIG_SET) == 1001, "Failed to seek");
+  QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 1001, 777, ctx) == 777,
+           "Failed to write data");
+  len = dataSize;
+  BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+  QVERIFY2(BundleFileRead(bundle, idx, &read[0], 0, &len, ctx) == dataSize,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], dataSize) == 0, "Invalid data");
+
+  // файл ECB по-прежнему требует выравнивания и читается
+  QVERIFY2(BundleFileWrite(bundle, ecb, &data[0], 0, 4096, ctx) == 4096,
+           "Failed to write data");
+  len = 4096;
+  QVERIFY2(BundleFileReadAt(bundle, ecb, 0, &read[0], 0, &len, ctx) == 4096,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], 4096) == 0, "Invalid data");
+
+  BundleClose(bundle);
+
+  // режим сохраняется при запечатывании
+  QVERIFY2(BundleSeal(str.c_str(), sealed.c_str(), key, sizeof(key)), "Failed to seal bundle");
+  bundle = BundleOpen(sealed.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "ctr/data.dat", false);
+  QVERIFY2(BundleFileCipherGet(bundle, idx) == BUNDLE_CIPHER_CTR, "Cipher lost on seal");
+  len = dataSize - 5;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 5, &read[0], 0, &len, ctx) == dataSize - 5,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[5], dataSize - 5) == 0, "Invalid data");
+  BundleClose(bundle);
+
+  // nonce случайный: те же данные по тому же пути после пересоздания и после
+  // обрезания до нуля шифруются иначе
+  std::vector<std::vector<char> > raw(3, std::vector<char>(4096));
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < 3; i++) {
+    if (i == 1) {
+      BundleFileDelete(bundle, BundleFileOpen(bundle, "ctr/same.dat", false));
+    }
+    idx = BundleFileOpen(bundle, "ctr/same.dat", true);
+    QVERIFY2(idx > 0, "Failed to create file");
+
+    if (i == 2) {
+      BundleFileTrunk(bundle, idx, 0);
+    } else {
+      QVERIFY2(BundleFileCipherSet(bundle, idx, BUNDLE_CIPHER_CTR), "Failed to set cipher");
+    }
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, 4096, ctx) == 4096,
+             "Failed to write data");
+    len = 4096;
+    QVERIFY2(BundleFileReadAt(bundle, idx, 0, &raw[i][0], 0, &len, nullptr) == 4096,
+             "Failed to read data");
+    len = 4096;
+    QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == 4096,
+             "Failed to read data");
+    QVERIFY2(memcmp(&read[0], &data[0], 4096) == 0, "Invalid data");
+  }
+  QVERIFY2((raw[0] != raw[1]) && (raw[1] != raw[2]) && (raw[0] != raw[2]),
+           "Keystream reused for the same path");
+
+  // nonce переносится вместе с данными при уплотнении и дефрагментации
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "ctr/data.dat", false));
+  QVERIFY2(BundleCompact(bundle, nullptr) > 0, "Failed to compact bundle");
+  idx = BundleFileOpen(bundle, "ctr/same.dat", false);
+  len = 4096;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == 4096,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], 4096) == 0, "Nonce lost on compaction");
+  BundleClose(bundle);
+
+  auto defrag = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+  auto source = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+  remove(sealed.c_str());
+  QVERIFY2(source->Open(str.c_str(), "rb") == 0 && defrag->Open(sealed.c_str(), "w+b") == 0,
+           "Failed to open bundle");
+  QVERIFY2(CBundleFile::Defragmentation(source, defrag), "Failed to defragment bundle");
+  source->Close();
+  defrag->Close();
+
+  bundle = BundleOpen(sealed.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  idx = BundleFileOpen(bundle, "ctr/same.dat", false);
+  len = 4096;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == 4096,
+           "Failed to read data");
+  QVERIFY2(memcmp(&read[0], &data[0], 4096) == 0, "Nonce lost on defragmentation");
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+  remove(sealed.c_str());
+}
+
+void BundleTests::BundleOpenExTest() {
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  const int64_t dataSize = 300 * 1024;
+  std::vector<char> data(dataSize);
+  std::vector<char> read(dataSize);
+
+  for (size_t i = 0; i < data.size(); i++) {
+    data[i] = rand() % 256;
+  }
+
+  auto str = QDir::tempPath().toStdString() + "/open_ex.bundle";
+  remove(str.c_str());
+
+  // неверные параметры
+  BundleOpenOptions options;
+  BundleOpenOptionsInit(&options, BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  options.cryptoBufferSize = 8;
+  QVERIFY2(BundleOpenEx(str.c_str(), &options) == nullptr, "Invalid options accepted");
+  QVERIFY2(BundleOpenEx(str.c_str(), nullptr) == nullptr, "Null options accepted");
+
+  // без кэша страниц, монопольная блокировка, маленькая порция шифрования
+  BundleOpenOptionsInit(&options, BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  options.lockMode         = BUNDLE_LOCK_EXCLUSIVE;
+  options.pageCacheSize    = 0;
+  options.headersCount     = 4;
+  options.cryptoBufferSize = 64 * 1024 + 5;
+  options.cryptoThreads    = 1;
+  options.cryptoThreshold  = 64 * 1024;
+  options.cryptoStreaming  = 1;
+
+  void *bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // заголовков больше, чем превыделено
+  for (int i = 0; i < 10; i++) {
+    std::string name = "open_ex/" + std::to_string(i);
+    int idx = BundleFileOpen(bundle, name.c_str(), true);
+    QVERIFY2(idx > 0, "Failed to create file");
+    QVERIFY2(BundleFileWrite(bundle, idx, &data[0], 0, dataSize, ctx) == dataSize,
+             "Failed to write data");
+  }
+
+  // чтения из нескольких потоков под монопольной блокировкой
+  std::atomic<int> errors(0);
+  std::vector<std::thread> threads;
+
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&, t]() {
+      std::vector<char> buf(dataSize);
+      std::string name = "open_ex/" + std::to_string(t);
+      int idx = BundleFileOpen(bundle, name.c_str(), false);
+      int64_t len = dataSize;
+
+      if ((idx <= 0) || (BundleFileReadAt(bundle, idx, 0, &buf[0], 0, &len, ctx) != dataSize)
+          || (buf != data)) {
+        errors++;
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  QVERIFY2(errors == 0, "Concurrent read failed");
+  BundleClose(bundle);
+
+  // открытие с параметрами по умолчанию
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  int idx = BundleFileOpen(bundle, "open_ex/9", false);
+  int64_t len = dataSize;
+  QVERIFY2(BundleFileReadAt(bundle, idx, 0, &read[0], 0, &len, ctx) == dataSize,
+           "Failed to read data");
+  QVERIFY2(read == data, "Invalid data");
+
+  BundleDestroyCryptoContext(ctx);
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleBlockCacheTest() {
+  // таблица против эталона при вставках, заменах и удалениях
+  CBundleBlockCache cache;
+  std::map<int64_t, BundleBlock> check;
+
+  for (int i = 0; i < 20000; i++) {
+    int64_t pos = 64 + (rand() % 5000) * 24;
+    BundleBlock bb;
+    bb.size      = rand();
+    bb.nextBlock = pos + 1;
+
+    if (rand() % 4 == 0) {
+      cache.Erase(pos);
+      check.erase(pos);
+    } else {
+      cache.Put(pos, bb);
+      check[pos] = bb;
+    }
+  }
+  QVERIFY2(cache.Count() == check.size(), "Invalid count");
+
+  for (auto& it : check) {
+    BundleBlock bb;
+    QVERIFY2(cache.Find(it.first, bb) && bb.size == it.second.size
+             && bb.nextBlock == it.second.nextBlock, "Block not found");
+  }
+
+  // ограниченный объем: память не растет, часто читаемый блок не вытесняется
+  cache.BudgetSet(16 * 1024);
+  size_t memory = cache.Memory();
+  BundleBlock hot;
+  hot.size = 777;
+  cache.Put(64, hot);
+
+  for (int64_t pos = 1024; pos < 1024 + 100000 * 24; pos += 24) {
+    BundleBlock bb;
+    bb.size = pos;
+    cache.Put(pos, bb);
+    QVERIFY2(cache.Find(64, bb) && bb.size == 777, "Hot block evicted");
+  }
+  QVERIFY2(cache.Memory() == memory && cache.Memory() <= 16 * 1024, "Budget exceeded");
+
+  // через бандл: длинная цепочка блоков при маленьком кэше
+  auto str = QDir::tempPath().toStdString() + "/block_cache.bundle";
+  remove(str.c_str());
+
+  BundleOpenOptions options;
+  BundleOpenOptionsInit(&options, BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  options.blockCacheSize = 1024;
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  void *bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  // файлы пишутся вперемешку, чтобы у каждого была цепочка из многих блоков
+  std::vector<char> data(100);
+  int idx[2] = { BundleFileOpen(bundle, "a", true), BundleFileOpen(bundle, "b", true) };
+
+  for (int i = 0; i < 500; i++) {
+    for (int f = 0; f < 2; f++) {
+      memset(&data[0], i + f, data.size());
+      QVERIFY2(BundleFileWrite(bundle, idx[f], &data[0], 0, data.size(), nullptr)
+               == (int64_t)data.size(), "Failed to write data");
+    }
+  }
+
+  std::vector<char> read(500 * 100);
+  int64_t len = read.size();
+  QVERIFY2(BundleFileReadAt(bundle, idx[1], 0, &read[0], 0, &len, nullptr)
+           == (int64_t)read.size(), "Failed to read data");
+
+  for (int i = 0; i < 500; i++) {
+    QVERIFY2(read[i * 100] == (char)(i + 1) && read[i * 100 + 99] == (char)(i + 1),
+             "Invalid data");
+  }
+
+  uint64_t hits = 0, misses = 0;
+  int64_t  cacheMemory = 0;
+  QVERIFY2(BundleBlocksCacheStats(bundle, &hits, &misses, &cacheMemory), "No stats");
+  QVERIFY2(misses > 0 && cacheMemory <= 1024, "Invalid stats");
+
+  BundleClose(bundle);
+  remove(str.c_str());
+}
+
+void BundleTests::BundlePathIndexTest() {
+  CBundlePathIndex index;
+  std::map<std::string, size_t> check;
+
+  // вставки, замены и удаления против эталона (с общими префиксами)
+  for (int i = 0; i < 50000; i++) {
+    std::string path = "dir/sub/" + std::to_string(rand() % 10000) + ".dat";
+
+    if (rand() % 3 == 0) {
+      index.Erase(path.data(), path.size());
+      check.erase(path);
+    } else {
+      index.Set(path.data(), path.size(), i);
+      check[path] = i;
+    }
+  }
+  QVERIFY2(index.Count() == check.size(), "Invalid count");
+
+  for (auto& it : check) {
+    size_t value = 0;
+    QVERIFY2(index.Find(it.first.data(), it.first.size(), value) && value == it.second,
+             "Path not found");
+  }
+
+  // ключ - ровно len байт (префикс и длинный ключ)
+  size_t value = 0;
+  QVERIFY2(!index.Find("dir/sub/", 8, value), "Prefix found");
+
+  std::string longPath(100000, 'x');
+  index.Set(longPath.data(), longPath.size(), 7);
+  index.Set("a", 1, 8);
+  QVERIFY2(index.Find(longPath.data(), longPath.size(), value) && value == 7, "Long path lost");
+  QVERIFY2(index.Find("ab", 1, value) && value == 8, "Short path lost");
+
+  index.Clear();
+  QVERIFY2(index.Count() == 0 && !index.Find("a", 1, value), "Index not cleared");
+}
+
+void BundleTests::BundleLazyPathsTest() {
+  auto str = QDir::tempPath().toStdString() + "/lazy_paths.bundle";
+  remove(str.c_str());
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  CryptoCtx ctx   = BundleCreateCryptoContext(key, sizeof(key));
+  const int count = 300;
+
+  // бандл с файлами, в одном из которых данные в режиме CTR (nonce - от пути)
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < count; i++) {
+    std::string name = "lazy/" + std::to_string(i);
+    int idx          = BundleFileOpen(bundle, name.c_str(), true);
+    QVERIFY2(idx > 0, "Failed to create file");
+
+    if (i == 150) {
+      QVERIFY2(BundleFileCipherSet(bundle, idx, BUNDLE_CIPHER_CTR), "Failed to set cipher");
+    }
+    QVERIFY2(BundleFileWrite(bundle, idx, name.data(), 0, name.size(), i == 150 ? ctx : nullptr)
+             == (int64_t)name.size(), "Failed to write data");
+  }
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "lazy/7", false));
+  BundleClose(bundle);
+
+  for (int mode : { BUNDLE_PATHS_LAZY, BUNDLE_PATHS_BACKGROUND }) {
+    BundleOpenOptions options;
+    BundleOpenOptionsInit(&options, BMODE_READWRITE);
+    options.pathsMode = mode;
+
+    bundle = BundleOpenEx(str.c_str(), &options);
+    QVERIFY2(bundle != nullptr, "Failed to open bundle");
+    QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+    // поиск и чтение CTR-файла до расшифровки остальных путей
+    char read[64] = { 0 };
+    int  idx      = BundleFileOpen(bundle, "lazy/150", false);
+    int64_t len   = 8;
+    QVERIFY2(idx > 0, "File not found");
+    QVERIFY2(BundleFileReadAt(bundle, idx, 0, read, 0, &len, ctx) == 8
+             && memcmp(read, "lazy/150", 8) == 0, "Invalid data");
+
+    // поиск из нескольких потоков
+    std::atomic<int> errors(0);
+    std::vector<std::thread> threads;
+
+    for (int t = 0; t < 4; t++) {
+      threads.emplace_back([&, t]() {
+        for (int i = count - 1 - t; i >= 0; i -= 4) {
+          std::string name = "lazy/" + std::to_string(i);
+
+          if ((BundleFileOpen(bundle, name.c_str(), false) > 0) != (i != 7)) {
+            errors++;
+          }
+        }
+      });
+    }
+
+    for (auto& thread : threads) {
+      thread.join();
+    }
+    QVERIFY2(errors == 0, "Concurrent lookup failed");
+
+    // перечисление имен
+    std::set<std::string> names;
+    char name[256];
+
+    for (idx = BundleFileName(bundle, 0, name, sizeof(name)); idx > 0;
+         idx = BundleFileName(bundle, idx, name, sizeof(name))) {
+      names.insert(name);
+    }
+    QVERIFY2(names.size() == count - 1 && names.count("lazy/7") == 0, "Invalid names");
+
+    // создание и удаление
+    QVERIFY2(BundleFileOpen(bundle, "lazy/missing", false) < 0, "Missing file found");
+    idx = BundleFileOpen(bundle, "lazy/new", true);
+    QVERIFY2(idx > 0 && BundleFileOpen(bundle, "lazy/new", false) == idx,
+             "Failed to create file");
+    BundleFileDelete(bundle, idx);
+    QVERIFY2(BundleFileOpen(bundle, "lazy/new", false) < 0, "Deleted file found");
+
+    BundleClose(bundle);
+  }
+
+  // закрытие до окончания фоновой расшифровки
+  BundleOpenOptions options;
+  BundleOpenOptionsInit(&options, BMODE_READ);
+  options.pathsMode = BUNDLE_PATHS_BACKGROUND;
+
+  bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  BundleClose(bundle);
+
+  BundleDestroyCryptoContext(ctx);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleNameTagTest() {
+  auto str = QDir::tempPath().toStdString() + "/name_tag.bundle";
+  remove(str.c_str());
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  unsigned char otherKey[sizeof(key)] = { 0 };
+  mbedtls_aes_context ctx, otherCtx;
+
+  // хэш зависит от ключа, пути и его длины
+  mbedtls_aes_init(&ctx);
+  mbedtls_aes_init(&otherCtx);
+  mbedtls_aes_setkey_enc(&ctx, key, sizeof(key) * 8);
+  mbedtls_aes_setkey_enc(&otherCtx, otherKey, sizeof(otherKey) * 8);
+
+  int sameKey = 0, sameLen = 0;
+
+  for (int i = 0; i < 1000; i++) {
+    std::string name = "dir/file_" + std::to_string(i) + ".dat";
+    QVERIFY2(BundleNameTag(&ctx, name.data(), name.size())
+             == BundleNameTag(&ctx, name.data(), name.size()), "Tag not stable");
+    sameKey += BundleNameTag(&ctx, name.data(), name.size())
+               == BundleNameTag(&otherCtx, name.data(), name.size());
+    sameLen += BundleNameTag(&ctx, name.data(), name.size())
+               == BundleNameTag(&ctx, name.data(), name.size() + 1);
+  }
+  QVERIFY2(sameKey < 10 && sameLen < 10, "Tag does not depend on key or length");
+  mbedtls_aes_free(&ctx);
+  mbedtls_aes_free(&otherCtx);
+
+  // бандл с большим числом файлов
+  const int count = 5000;
+  void *bundle    = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < count; i++) {
+    std::string name = "tag/" + std::to_string(i);
+    QVERIFY2(BundleFileOpen(bundle, name.c_str(), true) > 0, "Failed to create file");
+  }
+  BundleClose(bundle);
+
+  // поиск расшифровывает только пути с тем же хэшем
+  BundleOpenOptions options;
+  BundleOpenOptionsInit(&options, BMODE_READWRITE);
+  options.pathsMode = BUNDLE_PATHS_LAZY;
+
+  bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  int64_t resolved = 0, total = 0;
+  QVERIFY2(BundlePathsStats(bundle, &resolved, &total) && resolved == 0 && total == count,
+           "Invalid stats");
+
+  for (int i = count - 10; i < count; i++) {
+    std::string name = "tag/" + std::to_string(i);
+    QVERIFY2(BundleFileOpen(bundle, name.c_str(), false) > 0, "File not found");
+  }
+  QVERIFY2(BundleFileOpen(bundle, "tag/missing", false) < 0, "Missing file found");
+  QVERIFY2(BundlePathsStats(bundle, &resolved, &total) && resolved >= 10 && resolved < 20,
+           "Too many paths decrypted");
+
+  // новый файл находится после переоткрытия, удаленный - нет
+  QVERIFY2(BundleFileOpen(bundle, "tag/new", true) > 0, "Failed to create file");
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "tag/0", false));
+  BundleClose(bundle);
+
+  bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(BundleFileOpen(bundle, "tag/new", false) > 0, "New file not found");
+  QVERIFY2(BundleFileOpen(bundle, "tag/0", false) < 0, "Deleted file found");
+  BundleClose(bundle);
+
+  // хэши переносятся дефрагментацией
+  auto defrag = str + ".defrag";
+  remove(defrag.c_str());
+  {
+    auto src = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+    auto dst = std::make_shared<CBinaryFile>(0, 1024 * 1024);
+    QVERIFY2(src->Open(str.c_str(), "rb") == 0 && dst->Open(defrag.c_str(), "w+b") == 0,
+             "Failed to open streams");
+    QVERIFY2(CBundleFile::Defragmentation(src, dst), "Failed to defragment");
+    src->Close();
+    dst->Close();
+  }
+
+  bundle = BundleOpenEx(defrag.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(BundleFileOpen(bundle, "tag/4321", false) > 0, "File not found");
+  QVERIFY2(BundlePathsStats(bundle, &resolved, &total) && resolved < 10,
+           "Too many paths decrypted");
+  BundleClose(bundle);
+
+  remove(defrag.c_str());
+  remove(str.c_str());
+}
+
+void BundleTests::BundleFilesCreateTest() {
+  auto str = QDir::tempPath().toStdString() + "/files_create.bundle";
+  remove(str.c_str());
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  // мало превыделяемых заголовков, чтобы пачке не хватило свободных
+  BundleOpenOptions options;
+  BundleOpenOptionsInit(&options, BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  options.headersCount = 16;
+
+  void *bundle = BundleOpenEx(str.c_str(), &options);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  int first = BundleFileOpen(bundle, "batch/existing", true);
+  QVERIFY2(first > 0, "Failed to create file");
+
+  // пачка с существующим файлом, повтором и путями длиной кратной блоку AES
+  std::vector<std::string> paths;
+
+  for (int i = 0; i < 1000; i++) {
+    paths.push_back("batch/" + std::to_string(i));
+  }
+  paths.push_back("batch/existing");
+  paths.push_back("batch/7");
+  paths.push_back(std::string(32, 'x'));
+  paths.push_back("");
+
+  std::vector<const char *> names;
+  std::vector<int> indices(paths.size());
+
+  for (auto& path : paths) {
+    names.push_back(path.c_str());
+  }
+  QVERIFY2(BundleFilesCreate(bundle, &names[0], (int)names.size(), &indices[0])
+           == (int)names.size() - 1, "Failed to create files");
+  QVERIFY2(indices[1000] == first && indices[1001] == indices[7] && indices[1003] == -1,
+           "Invalid indices");
+
+  std::set<int> unique(indices.begin(), indices.begin() + 1000);
+  QVERIFY2(unique.size() == 1000 && *unique.begin() > first, "Duplicate indices");
+
+  // созданные файлы пишутся и находятся как обычные
+  for (int i = 0; i < 1000; i += 100) {
+    QVERIFY2(BundleFileOpen(bundle, names[i], false) == indices[i], "File not found");
+    QVERIFY2(BundleFileWrite(bundle, indices[i], names[i], 0, paths[i].size(), nullptr)
+             == (int64_t)paths[i].size(), "Failed to write data");
+  }
+  int last = BundleFileOpen(bundle, "batch/after", true);
+  QVERIFY2(last > indices[1002], "Failed to create file after batch");
+  BundleClose(bundle);
+
+  // после переоткрытия: имена, данные и поиск
+  for (int mode : { BUNDLE_PATHS_EAGER, BUNDLE_PATHS_LAZY }) {
+    options.pathsMode = mode;
+    bundle            = BundleOpenEx(str.c_str(), &options);
+    QVERIFY2(bundle != nullptr, "Failed to open bundle");
+    QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+    std::set<std::string> found;
+    char name[256];
+
+    for (int idx = BundleFileName(bundle, 0, name, sizeof(name)); idx > 0;
+         idx = BundleFileName(bundle, idx, name, sizeof(name))) {
+      found.insert(name);
+    }
+    QVERIFY2(found.size() == 1003 && found.count(paths[1002]) == 1
+             && found.count("batch/after") == 1, "Invalid names");
+
+    for (int i = 0; i < 1000; i += 100) {
+      char    data[64] = { 0 };
+      int64_t len      = sizeof(data);
+      int     idx      = BundleFileOpen(bundle, names[i], false);
+
+      QVERIFY2(idx > 0, "File not found");
+      QVERIFY2(BundleFileReadAt(bundle, idx, 0, data, 0, &len, nullptr)
+               == (int64_t)paths[i].size() && paths[i] == data, "Invalid data");
+    }
+    BundleClose(bundle);
+  }
+
+  remove(str.c_str());
+}
+
+void BundleTests::BundleImportDirectoryTest() {
+  auto str  = QDir::tempPath().toStdString() + "/import.bundle";
+  auto root = QDir::tempPath().toStdString() + "/import_src";
+  remove(str.c_str());
+  QDir(QString::fromStdString(root)).removeRecursively();
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  // исходный каталог: файлы разного размера, вложенные каталоги, пустой файл
+  std::map<std::string, std::vector<char> > sources;
+  sources["a.txt"]        = std::vector<char>(100);
+  sources["sub/b.bin"]    = std::vector<char>(3 * 1024 * 1024 + 5);
+  sources["sub/deep/c"]   = std::vector<char>();
+  sources["z"]            = std::vector<char>(100 * 1024);
+  QVERIFY2(QDir().mkpath(QString::fromStdString(root + "/sub/deep")), "Failed to create dir");
+
+  for (auto& source : sources) {
+    for (auto& c : source.second) {
+      c = (char)rand();
+    }
+
+    FILE *file = fopen((root + "/" + source.first).c_str(), "wb");
+    QVERIFY2(file != nullptr, "Failed to create source file");
+    fwrite(source.second.data(), 1, source.second.size(), file);
+    fclose(file);
+  }
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  // существующий файл перезаписывается
+  int existing = BundleFileOpen(bundle, "plain/a.txt", true);
+  QVERIFY2(BundleFileWrite(bundle, existing, key, 0, sizeof(key), nullptr) == sizeof(key),
+           "Failed to write data");
+
+  // маленькие порции и очередь, чтобы читатели ждали писателя
+  BundleImportOptions options;
+  BundleImportOptionsInit(&options);
+  options.threads   = 3;
+  options.chunkSize = 64 * 1024;
+  options.queueSize = 256 * 1024;
+  options.prefix    = "plain/";
+  QVERIFY2(BundleImportDirectory(bundle, root.c_str(), &options) == (int64_t)sources.size(),
+           "Failed to import directory");
+  QVERIFY2(BundleImportDirectory(bundle, (root + "/missing").c_str(), &options) == -1,
+           "Missing directory imported");
+
+  // с шифрованием в читающих потоках
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+  options.cryptoCtx = ctx;
+  options.prefix    = "enc/";
+  QVERIFY2(BundleImportDirectory(bundle, root.c_str(), &options) == (int64_t)sources.size(),
+           "Failed to import encrypted directory");
+  BundleClose(bundle);
+
+  // после переоткрытия данные совпадают с исходными
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(bundle != nullptr, "Failed to open bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (auto& source : sources) {
+    for (auto prefix : { "plain/", "enc/" }) {
+      bool encrypted = std::string(prefix) == "enc/";
+      int  idx       = BundleFileOpen(bundle, (prefix + source.first).c_str(), false);
+      QVERIFY2(idx > 0, "File not found");
+      QVERIFY2(BundleFileLength(bundle, idx) == (int64_t)source.second.size(),
+               "Invalid file length");
+      QVERIFY2(BundleFileCipherGet(bundle, idx)
+               == (encrypted ? BUNDLE_CIPHER_CTR : BUNDLE_CIPHER_ECB), "Invalid cipher");
+
+      std::vector<char> data(source.second.size() + 1);
+      int64_t len = (int64_t)data.size();
+      QVERIFY2(BundleFileRead(bundle, idx, data.data(), 0, &len, encrypted ? ctx : nullptr)
+               == (int64_t)source.second.size()
+               && std::equal(source.second.begin(), source.second.end(), data.begin()),
+               "Invalid data");
+
+      // без ключа шифрованные данные не читаются
+      if (encrypted && !source.second.empty()) {
+        len = (int64_t)data.size();
+        BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_SET);
+        BundleFileRead(bundle, idx, data.data(), 0, &len, nullptr);
+        QVERIFY2(!std::equal(source.second.begin(), source.second.end(), data.begin()),
+                 "Data not encrypted");
+      }
+    }
+  }
+  BundleClose(bundle);
+  BundleDestroyCryptoContext(ctx);
+
+  QDir(QString::fromStdString(root)).removeRecursively();
+  remove(str.c_str());
+}
+
+void BundleTests::BundleExtractTest() {
+  auto str  = QDir::tempPath().toStdString() + "/extract.bundle";
+  auto dest = QDir::tempPath().toStdString() + "/extract_dst";
+  remove(str.c_str());
+  QDir(QString::fromStdString(dest)).removeRecursively();
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // содержимое: открытое, AES-ECB, AES-CTR, пустое
+  std::map<std::string, std::vector<char> > files;
+  files["plain.dat"]          = std::vector<char>(300000);
+  files["dir/ecb.dat"]        = std::vector<char>(64 * 1024);
+  files["dir/sub/ctr.dat"]    = std::vector<char>(200001);
+  files["dir/sub/empty.dat"]  = std::vector<char>();
+  files["a/interleaved1.dat"] = std::vector<char>(50 * 1000);
+  files["a/interleaved2.dat"] = std::vector<char>(50 * 1000);
+  files["unaligned.dat"]      = std::vector<char>(4096);
+
+  for (auto& file : files) {
+    for (auto& c : file.second) {
+      c = (char)rand();
+    }
+  }
+
+  auto write = [&](const std::string& name, size_t from, size_t size, CryptoCtx crypto) {
+    int idx = BundleFileOpen(bundle, name.c_str(), true);
+    BundleFileSeek(bundle, idx, from, BUNDLE_FILE_ORIG_SET);
+    return size == 0 || BundleFileWrite(bundle, idx, files[name].data() + from, 0, size, crypto)
+           == (int64_t)size;
+  };
+
+  int hole = BundleFileOpen(bundle, "hole.dat", true);
+  QVERIFY2(BundleFileWrite(bundle, hole, files["plain.dat"].data(), 0, 1000, nullptr) == 1000,
+           "Failed to write data");
+  QVERIFY2(write("plain.dat", 0, files["plain.dat"].size(), nullptr), "Failed to write data");
+  QVERIFY2(write("dir/ecb.dat", 0, files["dir/ecb.dat"].size(), ctx), "Failed to write data");
+  QVERIFY2(BundleFileCipherSet(bundle, BundleFileOpen(bundle, "dir/sub/ctr.dat", true),
+                               BUNDLE_CIPHER_CTR), "Failed to set cipher");
+  QVERIFY2(write("dir/sub/ctr.dat", 0, files["dir/sub/ctr.dat"].size(), ctx),
+           "Failed to write data");
+  QVERIFY2(write("dir/sub/empty.dat", 0, 0, nullptr), "Failed to create file");
+
+  // блоки двух файлов вперемешку
+  for (size_t pos = 0; pos < 50 * 1000; pos += 1000) {
+    QVERIFY2(write("a/interleaved1.dat", pos, 1000, nullptr)
+             && write("a/interleaved2.dat", pos, 1000, nullptr), "Failed to write data");
+  }
+
+  // AES-ECB в дыре некратного размера: блоки файла не выровнены
+  BundleFileDelete(bundle, hole);
+  QVERIFY2(write("unaligned.dat", 0, files["unaligned.dat"].size(), ctx), "Failed to write data");
+
+  auto verify = [&](const std::string& root) -> bool {
+    for (auto& file : files) {
+      FILE *src = fopen((root + "/" + file.first).c_str(), "rb");
+
+      if (src == nullptr) {
+        return false;
+      }
+
+      std::vector<char> data(file.second.size() + 1);
+      size_t read = fread(data.data(), 1, data.size(), src);
+      fclose(src);
+
+      if ((read != file.second.size())
+          || !std::equal(file.second.begin(), file.second.end(), data.begin())) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // маленькие порции, чтобы чтение ждало записи
+  BundleExtractOptions options;
+  BundleExtractOptionsInit(&options);
+  options.threads   = 3;
+  options.runSize   = 16 * 1024;
+  options.queueSize = 64 * 1024;
+  options.cryptoCtx = ctx;
+  QVERIFY2(BundleExtract(bundle, dest.c_str(), &options) == (int64_t)files.size(),
+           "Failed to extract bundle");
+  QVERIFY2(verify(dest), "Invalid extracted data");
+
+  // без ключа шифрованные данные выгружаются как хранятся
+  options.cryptoCtx = nullptr;
+  QVERIFY2(BundleExtract(bundle, (dest + "/raw").c_str(), &options) == (int64_t)files.size(),
+           "Failed to extract bundle");
+  QVERIFY2(!verify(dest + "/raw"), "Encrypted data decrypted without key");
+
+  // обрезание и уплотнение во время выгрузки: порции читаются только из
+  // блоков раскладки, изменившийся файл выгружается заново
+  std::vector<char> plain = files["plain.dat"];
+  options.cryptoCtx = ctx;
+  std::thread changer([&] {
+    BundleCompactOptions compact;
+    BundleCompactOptionsInit(&compact);
+    compact.stepSize = 4096;
+    BundleFileTrunk(bundle, BundleFileOpen(bundle, "plain.dat", false), 100000);
+    BundleCompact(bundle, &compact);
+  });
+  int64_t changed = BundleExtract(bundle, (dest + "/changed").c_str(), &options);
+  changer.join();
+  QVERIFY2(changed == (int64_t)files.size(), "Failed to extract bundle");
+
+  files.erase("plain.dat");
+  QVERIFY2(verify(dest + "/changed"), "Invalid extracted data");
+  files["plain.dat"] = plain;
+
+  FILE *changedFile = fopen((dest + "/changed/plain.dat").c_str(), "rb");
+  QVERIFY2(changedFile != nullptr, "Changed file not extracted");
+  std::vector<char> changedData(plain.size() + 1);
+  changedData.resize(fread(changedData.data(), 1, changedData.size(), changedFile));
+  fclose(changedFile);
+  QVERIFY2((changedData == plain)
+           || (changedData == std::vector<char>(plain.begin(), plain.begin() + 100000)),
+           "Changed file extracted inconsistently");
+  files["plain.dat"].resize(100000);
+
+  // путь за пределы каталога не выгружается, остальные файлы - да
+  QVERIFY2(write("../escaped.dat", 0, 0, nullptr), "Failed to create file");
+  QVERIFY2(BundleExtract(bundle, (dest + "/safe").c_str(), &options) == -1,
+           "Unsafe path extracted");
+  QVERIFY2(!QFileInfo(QString::fromStdString(dest + "/escaped.dat")).exists(),
+           "File written outside destination");
+  QVERIFY2(QFileInfo(QString::fromStdString(dest + "/safe/plain.dat")).exists(),
+           "Safe file not extracted");
+
+  BundleClose(bundle);
+  BundleDestroyCryptoContext(ctx);
+
+  QDir(QString::fromStdString(dest)).removeRecursively();
+  remove(str.c_str());
+}
+
+void BundleTests::BundleCompactTest() {
+  auto str = QDir::tempPath().toStdString() + "/compact.bundle";
+  remove(str.c_str());
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  CryptoCtx ctx = BundleCreateCryptoContext(key, sizeof(key));
+
+  // файлы: открытые (мелкие вперемешку и большой), AES-ECB, AES-CTR
+  std::map<std::string, std::vector<char> > files;
+  std::map<std::string, CryptoCtx> crypto;
+
+  for (int i = 0; i < 20; i++) {
+    files["small" + std::to_string(i)] = std::vector<char>(3000 + i * 100);
+    crypto["small" + std::to_string(i)] = nullptr;
+  }
+  files["big"]  = std::vector<char>(1024 * 1024);
+  files["ecb"]  = std::vector<char>(160 * 1024);
+  files["ctr"]  = std::vector<char>(100001);
+  crypto["big"] = nullptr;
+  crypto["ecb"] = ctx;
+  crypto["ctr"] = ctx;
+
+  for (auto& file : files) {
+    for (auto& c : file.second) {
+      c = (char)rand();
+    }
+  }
+
+  auto write = [&](const std::string& name, size_t from, size_t size) {
+    int idx = BundleFileOpen(bundle, name.c_str(), true);
+    BundleFileSeek(bundle, idx, from, BUNDLE_FILE_ORIG_SET);
+    return BundleFileWrite(bundle, idx, files[name].data() + from, 0, size, crypto[name])
+           == (int64_t)size;
+  };
+
+  auto verify = [&]() -> bool {
+    for (auto& file : files) {
+      int idx = BundleFileOpen(bundle, file.first.c_str(), false);
+      std::vector<char> data(file.second.size());
+      int64_t len = data.size();
+
+      if ((idx <= 0) || (BundleFileLength(bundle, idx) != (int64_t)data.size())
+          || (BundleFileRead(bundle, idx, data.data(), 0, &len, crypto[file.first])
+              != (int64_t)data.size()) || (data != file.second)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // мусор, который потом удаляется: дыры в начале бандла
+  for (int i = 0; i < 10; i++) {
+    int idx = BundleFileOpen(bundle, ("garbage" + std::to_string(i)).c_str(), true);
+    QVERIFY2(BundleFileWrite(bundle, idx, files["big"].data(), 0, 40 * 1024, nullptr)
+             == 40 * 1024, "Failed to write data");
+  }
+
+  // мелкие файлы порциями вперемешку, остальные - целиком
+  for (size_t pos = 0; pos < 3000; pos += 1000) {
+    for (int i = 0; i < 20; i++) {
+      QVERIFY2(write("small" + std::to_string(i), pos, 1000), "Failed to write data");
+    }
+  }
+
+  for (int i = 0; i < 20; i++) {
+    QVERIFY2(write("small" + std::to_string(i), 3000, i * 100), "Failed to write data");
+  }
+  QVERIFY2(BundleFileCipherSet(bundle, BundleFileOpen(bundle, "ctr", true), BUNDLE_CIPHER_CTR),
+           "Failed to set cipher");
+  QVERIFY2(write("ecb", 0, files["ecb"].size()) && write("ctr", 0, files["ctr"].size())
+           && write("big", 0, files["big"].size()), "Failed to write data");
+
+  // атрибут файла тоже переносится
+  const char attrs[] = "{\"title\":\"compact\"}";
+  QVERIFY2(BundleFileAttributeSet(bundle, BundleFileOpen(bundle, "ctr", false), attrs, 0,
+                                  sizeof(attrs), ctx) > 0, "Failed to set attributes");
+
+  for (int i = 0; i < 10; i++) {
+    BundleFileDelete(bundle, BundleFileOpen(bundle, ("garbage" + std::to_string(i)).c_str(),
+                                            false));
+  }
+
+  // свободный хвост: последний файл обрезан
+  files["big"].resize(512 * 1024);
+  BundleFileTrunk(bundle, BundleFileOpen(bundle, "big", false), files["big"].size());
+  BundleClose(bundle);
+
+  auto size = [&]() -> int64_t {
+    return QFileInfo(QString::fromStdString(str)).size();
+  };
+  int64_t before = size();
+
+  // уплотнение мелкими шагами, параллельно с чтением
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  std::atomic<bool> done(false);
+  std::atomic<bool> readOk(true);
+  std::thread reader([&] {
+    int idx = BundleFileOpen(bundle, "small7", false);
+    BundleFileHandle handle = BundleFileHandleOpen(bundle, "ecb", 0);
+
+    while (!done) {
+      std::vector<char> data(files["small7"].size());
+      std::vector<char> ecb(files["ecb"].size());
+      int64_t len = data.size();
+      int64_t ecbLen = ecb.size();
+
+      readOk = readOk && (BundleFileReadAt(bundle, idx, 0, data.data(), 0, &len, nullptr)
+                          == (int64_t)data.size()) && (data == files["small7"])
+               && (BundleFileHandleReadAt(handle, 0, ecb.data(), 0, &ecbLen, ctx)
+                   == (int64_t)ecb.size()) && (ecb == files["ecb"]);
+    }
+    BundleFileHandleClose(handle);
+  });
+
+  BundleCompactOptions options;
+  BundleCompactOptionsInit(&options);
+  options.stepSize = 64 * 1024;
+  int64_t reclaimed = BundleCompact(bundle, &options);
+  done = true;
+  reader.join();
+
+  QVERIFY2(reclaimed > 0, "Nothing reclaimed");
+  QVERIFY2(readOk, "Invalid data read during compaction");
+  QVERIFY2(verify(), "Invalid data after compaction");
+
+  // повторное уплотнение ничего не дает
+  QVERIFY2(BundleCompact(bundle, &options) == 0, "Second compaction reclaimed space");
+
+  // после уплотнения файлы дописываются
+  std::vector<char> tail(70000, 'z');
+  files["ctr"].insert(files["ctr"].end(), tail.begin(), tail.end());
+  QVERIFY2(write("ctr", files["ctr"].size() - tail.size(), tail.size()), "Failed to append data");
+  BundleClose(bundle);
+
+  QVERIFY2(size() <= before - reclaimed + (int64_t)tail.size() + 1024, "Bundle did not shrink");
+
+  // после переоткрытия все на месте
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(verify(), "Invalid data after reopen");
+
+  // шифрованный атрибут читается блоками AES
+  char    attrsRead[64] = { 0 };
+  int64_t attrsLen      = sizeof(attrsRead);
+  BundleFileAttributeGet(bundle, BundleFileOpen(bundle, "ctr", false), attrsRead, 0, &attrsLen,
+                         ctx);
+  QVERIFY2(memcmp(attrs, attrsRead, sizeof(attrs)) == 0, "Invalid attributes after compaction");
+  BundleClose(bundle);
+
+  // ограничение скорости: после первого шага в 64КБ при 256КБ/с - пауза
+  // до 0.25 с (заодно через pread/pwrite)
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_POSITIONAL);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (int i = 0; i < 20; i += 2) {
+    BundleFileDelete(bundle, BundleFileOpen(bundle, ("small" + std::to_string(i)).c_str(),
+                                            false));
+    files.erase("small" + std::to_string(i));
+  }
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "ecb", false));
+  files.erase("ecb");
+
+  options.bytesPerSecond = 256 * 1024;
+  options.maxBytes       = 128 * 1024;
+  auto start = std::chrono::steady_clock::now();
+  QVERIFY2(BundleCompact(bundle, &options) > 0, "Failed to compact bundle");
+  QVERIFY2(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(200),
+           "Compaction not throttled");
+  QVERIFY2(verify(), "Invalid data after throttled compaction");
+
+  // запись, создание и удаление файлов между шагами: шаг сверяет собранные
+  // цепочки с изменениями
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "small1", false));
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "small3", false));
+  files.erase("small1");
+  files.erase("small3");
+
+  options.bytesPerSecond = 64 * 1024;
+  options.maxBytes       = 64 * 1024;
+  options.stepSize       = 16 * 1024;
+  int64_t concurrent = -1;
+  std::thread compactor([&] {
+    concurrent = BundleCompact(bundle, &options);
+  });
+
+  // после первого шага (следующий - через 0.25 с) меняются все файлы
+  std::this_thread::sleep_for(std::chrono::milliseconds(100));
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "small9", false));
+  files.erase("small9");
+
+  for (auto& file : files) {
+    file.second.resize(file.second.size() / 2);
+    BundleFileTrunk(bundle, BundleFileOpen(bundle, file.first.c_str(), false),
+                    file.second.size());
+  }
+  files["small5"].insert(files["small5"].end(), 20000, 'a');
+  QVERIFY2(write("small5", files["small5"].size() - 20000, 20000), "Failed to append data");
+  files["fresh"]  = std::vector<char>(50000, 'f');
+  crypto["fresh"] = nullptr;
+  QVERIFY2(write("fresh", 0, files["fresh"].size()), "Failed to write data");
+  compactor.join();
+
+  QVERIFY2(concurrent >= 0, "Failed to compact bundle");
+  QVERIFY2(verify(), "Invalid data after compaction with writes");
+  BundleClose(bundle);
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(verify(), "Invalid data after reopen");
+  BundleClose(bundle);
+
+  BundleDestroyCryptoContext(ctx);
+  remove(str.c_str());
+}
+
+void BundleTests::BundleSpaceStatsTest() {
+  auto str = QDir::tempPath().toStdString() + "/stats.bundle";
+  remove(str.c_str());
+
+  unsigned char key[] =
+  { 0x4a, 0x12, 0x45, 0x6a, 0x2a, 0x4d, 0x27, 0xb8, 0xa5, 0x31, 0xd5, 0xb6, 0xfb, 0x68, 0x8a,
+    0x11 };
+  std::map<std::string, std::vector<char> > files;
+
+  files["a"] = std::vector<char>(300 * 1024);
+  files["b"] = std::vector<char>(5000);
+  files["c"] = std::vector<char>(300 * 1024);
+
+  for (auto& file : files) {
+    for (auto& c : file.second) {
+      c = (char)rand();
+    }
+  }
+
+  void *bundle = BundleOpen(str.c_str(), BMODE_READWRITE | BMODE_OPEN_ALWAYS);
+  QVERIFY2(bundle != nullptr, "Failed to create bundle");
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  for (auto& file : files) {
+    int idx = BundleFileOpen(bundle, file.first.c_str(), true);
+    QVERIFY2(BundleFileWrite(bundle, idx, file.second.data(), 0, file.second.size(), nullptr)
+             == (int64_t)file.second.size(), "Failed to write data");
+  }
+
+  struct Stats {
+    int64_t size = 0;
+    int64_t live = 0;
+    int64_t dead = 0;
+    int64_t tail = 0;
+  };
+  auto stats = [&]() -> Stats {
+    Stats st;
+    BundleSpaceStats(bundle, &st.size, &st.live, &st.dead, &st.tail);
+    return st;
+  };
+  auto verify = [&]() -> bool {
+    for (auto& file : files) {
+      int idx = BundleFileOpen(bundle, file.first.c_str(), false);
+      std::vector<char> data(file.second.size());
+      int64_t len = data.size();
+
+      if ((idx <= 0) || (BundleFileRead(bundle, idx, data.data(), 0, &len, nullptr)
+                         != (int64_t)data.size()) || (data != file.second)) {
+        return false;
+      }
+    }
+    return true;
+  };
+
+  // записанный подряд бандл плотный
+  Stats st = stats();
+  QVERIFY2((st.size > 600 * 1024) && (st.live == st.size) && (st.dead == 0) && (st.tail == 0),
+           "Invalid stats of a new bundle");
+
+  // удаление и обрезание последнего файла
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "a", false));
+  files.erase("a");
+  Stats deleted = stats();
+  QVERIFY2((deleted.size == st.size) && (deleted.dead >= 300 * 1024)
+           && (deleted.live + deleted.dead == deleted.size) && (deleted.tail == 0),
+           "Invalid stats after delete");
+
+  files["c"].resize(100 * 1024);
+  BundleFileTrunk(bundle, BundleFileOpen(bundle, "c", false), files["c"].size());
+  Stats trunked = stats();
+  QVERIFY2((trunked.dead >= deleted.dead + 200 * 1024) && (trunked.tail >= 200 * 1024)
+           && (trunked.live + trunked.dead == trunked.size), "Invalid stats after truncate");
+
+  // запись в свободное место уменьшает свободное
+  std::vector<char> more(50 * 1024, 'x');
+  int idx = BundleFileOpen(bundle, "d", true);
+  QVERIFY2(BundleFileWrite(bundle, idx, more.data(), 0, more.size(), nullptr)
+           == (int64_t)more.size(), "Failed to write data");
+  files["d"] = more;
+  Stats written = stats();
+  QVERIFY2((written.dead <= trunked.dead - (int64_t)more.size())
+           && (written.live + written.dead == written.size), "Invalid stats after write");
+  BundleClose(bundle);
+
+  // после переоткрытия счетчики строятся заново по цепочкам
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  Stats reopened = stats();
+  QVERIFY2((reopened.size == written.size) && (reopened.dead == written.dead)
+           && (reopened.tail == written.tail), "Invalid stats after reopen");
+  QVERIFY2(BundleAutoCompactSet(bundle, 0.1, 0, nullptr) == 0,
+           "Auto compaction of a read-only bundle");
+  BundleClose(bundle);
+
+  // автоматическое уплотнение: порог уже превышен
+  bundle = BundleOpen(str.c_str(), BMODE_READWRITE);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+
+  BundleCompactOptions options;
+  BundleCompactOptionsInit(&options);
+  options.stepSize = 64 * 1024;
+  QVERIFY2(BundleAutoCompactSet(bundle, 0.2, 64 * 1024, &options), "Failed to set policy");
+
+  auto settled = [&](int64_t size) -> bool {
+    for (int i = 0; i < 500; i++) {
+      if (stats().size < size) {
+        return true;
+      }
+      std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+  };
+  QVERIFY2(settled(reopened.size), "Bundle was not compacted");
+  QVERIFY2(verify(), "Invalid data after auto compaction");
+
+  // следующий запуск - после удаления
+  Stats compacted = stats();
+  std::vector<char> big(400 * 1024, 'y');
+  idx = BundleFileOpen(bundle, "e", true);
+  QVERIFY2(BundleFileWrite(bundle, idx, big.data(), 0, big.size(), nullptr)
+           == (int64_t)big.size(), "Failed to write data");
+  files["e"] = big;
+  idx = BundleFileOpen(bundle, "b", false);
+  BundleFileSeek(bundle, idx, 0, BUNDLE_FILE_ORIG_END);
+  QVERIFY2(BundleFileWrite(bundle, idx, big.data(), 0, 1000, nullptr) == 1000,
+           "Failed to write data");
+  files["b"].insert(files["b"].end(), big.begin(), big.begin() + 1000);
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "e", false));
+  files.erase("e");
+  QVERIFY2(settled(compacted.size + (int64_t)big.size()), "Bundle was not compacted again");
+  QVERIFY2(verify(), "Invalid data after auto compaction");
+
+  // закрытие не ждет медленного уплотнения целиком
+  options.stepSize       = 16 * 1024;
+  options.bytesPerSecond = 16 * 1024;
+  files["f"] = std::vector<char>(200 * 1024, 'f');
+  files["g"] = std::vector<char>(300 * 1024, 'g');
+
+  for (auto name : { "f", "g" }) {
+    idx = BundleFileOpen(bundle, name, true);
+    QVERIFY2(BundleFileWrite(bundle, idx, files[name].data(), 0, files[name].size(), nullptr)
+             == (int64_t)files[name].size(), "Failed to write data");
+  }
+  Stats full = stats();
+  QVERIFY2(BundleAutoCompactSet(bundle, 0.01, 16 * 1024, &options), "Failed to set policy");
+  BundleFileDelete(bundle, BundleFileOpen(bundle, "f", false));
+  files.erase("f");
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  auto start = std::chrono::steady_clock::now();
+  BundleClose(bundle);
+  QVERIFY2(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(500),
+           "Close waited for compaction");
+
+  bundle = BundleOpen(str.c_str(), BMODE_READ);
+  QVERIFY2(BundleInitialize(bundle, key, sizeof(key)), "Failed to initialize bundle");
+  QVERIFY2(verify(), "Invalid data after interrupted compaction");
+  st = stats();
+  QVERIFY2((st.size < full.size) && (st.size > full.size - 200 * 1024)
+           && (st.live + st.dead == st.size), "Invalid stats after interrupted compaction");
+  BundleClose(bundle);
+
+  remove(str.c_str());
+}
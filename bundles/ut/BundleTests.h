@@ -8,7 +8,32 @@ class BundleTests : public QObject {
 private Q_SLOTS:
 
   void BinaryFileTest();
+  void BinaryFilePageCacheTest();
+  void BinaryFileReadAheadTest();
+  void MappedFileTest();
+  void PositionalFileTest();
   void BundleFileTest();
+  void BundleSpaceReuseTest();
+  void BundleFileSeekTest();
+  void BundleFileLengthTest();
+  void BundleSealTest();
+  void BundleConcurrentReadTest();
+  void BundleFileHandleTest();
+  void BundleAesEcbTest();
+  void BundleCryptoThreadsTest();
+  void BundleCryptoInPlaceTest();
+  void BundleCryptoStreamingTest();
+  void BundleCipherCtrTest();
+  void BundleOpenExTest();
+  void BundleBlockCacheTest();
+  void BundlePathIndexTest();
+  void BundleLazyPathsTest();
+  void BundleNameTagTest();
+  void BundleFilesCreateTest();
+  void BundleImportDirectoryTest();
+  void BundleExtractTest();
+  void BundleCompactTest();
+  void BundleSpaceStatsTest();
 };
 
 #endif // NONINTERACTIVETEST_H
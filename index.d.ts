@@ -11,6 +11,48 @@ declare enum BundleAttributeType {
 declare interface Options {
 	path: string;
 	readonly?: boolean;
+	stream?: 'File' | 'Mapped' | 'Positional';
+	lockMode?: 'Shared' | 'Exclusive';
+	pageCacheSize?: number;
+	headersCount?: number;
+	cryptoBufferSize?: number;
+	blockCacheSize?: number;
+	cryptoThreads?: number;
+	cryptoThreshold?: number;
+	cryptoStreaming?: boolean;
+	pathsMode?: 'Eager' | 'Lazy' | 'Background';
+}
+
+declare interface ImportOptions {
+	prefix?: string;
+	threads?: number;
+	chunkSize?: number;
+	queueSize?: number;
+}
+
+declare interface ExtractOptions {
+	threads?: number;
+	runSize?: number;
+	queueSize?: number;
+}
+
+declare interface CompactOptions {
+	stepSize?: number;
+	bytesPerSecond?: number;
+	maxBytes?: number;
+}
+
+declare interface AutoCompactOptions extends CompactOptions {
+	deadRatio: number;
+	minDeadBytes?: number;
+}
+
+declare interface BundleStats {
+	size: number;
+	liveBytes: number;
+	deadBytes: number;
+	tailBytes: number;
+	deadRatio: number;
 }
 
 /**
@@ -70,6 +112,60 @@ declare interface AggregionBundle {
 	 */
 	createFile(path : string): number;
 
+	/**
+	 * Creates many files at once, existing files are opened
+	 * @param {string[]} paths Paths to the files in the bundle
+	 * @return {Promise.<number[]>} File descriptors in the order of paths
+	 * @param paths
+	 * @return
+	 */
+	createFiles(paths : string[]): Promise<number[]>;
+
+	/**
+	 * Imports all files of a directory tree into the bundle
+	 * @param {string} rootPath Directory to import
+	 * @param {object} [options] prefix, reader threads, read portion and queue limit
+	 * @return {Promise.<number>} Number of imported files
+	 * @param rootPath
+	 * @param options
+	 * @return
+	 */
+	importDirectory(rootPath : string, options? : ImportOptions): Promise<number>;
+
+	/**
+	 * Extracts all files of the bundle into a directory
+	 * @param {string} destDir Destination directory, created if missing
+	 * @param {object} [options] writer threads, read portion and queue limit
+	 * @return {Promise.<number>} Number of extracted files
+	 * @param destDir
+	 * @param options
+	 * @return
+	 */
+	extract(destDir : string, options? : ExtractOptions): Promise<number>;
+
+	/**
+	 * Compacts the bundle without closing it
+	 * @param {object} [options] step size, speed and total limits in bytes
+	 * @return {Promise.<number>} Number of bytes the bundle shrank by
+	 * @param options
+	 * @return
+	 */
+	compact(options? : CompactOptions): Promise<number>;
+
+	/**
+	 * Returns space accounting of the bundle
+	 * @return {object} size, live, dead and dead-at-the-end bytes and the dead share
+	 * @return
+	 */
+	getStats(): BundleStats;
+
+	/**
+	 * Enables compaction in a background thread once dead space reaches the given share of the bundle
+	 * @param {object} options threshold and compaction limits
+	 * @param options
+	 */
+	setAutoCompact(options : AutoCompactOptions): void;
+
 	/**
 	 * Opens an existent file
 	 * @param {string} path Path to the file in the bundle
@@ -114,6 +210,19 @@ declare interface AggregionBundle {
 	 */
 	readFileBlock(fd : number, size : number): void;
 
+	/**
+	 * Reads a block of data from the given position of the file. Does not move the file position
+	 * The buffer is shorter than size near the end of file and empty past it
+	 * @param {number} fd File descriptor
+	 * @param {number} position Position in file to read from
+	 * @param {number} size Size of block to read
+	 * @return {Promise.<Buffer>} Block data
+	 * @param fd
+	 * @param position
+	 * @param size
+	 */
+	readFileRange(fd : number, position : number, size : number): void;
+
 	/**
 	 * Reads attributes data from file
 	 * @param {number} fd File descriptor
@@ -20,6 +20,17 @@ class AggregionBundle {
      * @param {object} options
      * @param {string} options.path Path to file
      * @param {boolean} [options.readonly] Open for read-only
+     * @param {string} [options.stream] File access: 'File' (default), 'Mapped' or 'Positional'
+     * @param {string} [options.lockMode] 'Shared' (default) or 'Exclusive'
+     * @param {number} [options.pageCacheSize] Page cache size in bytes for 'File' access, 0 disables
+     * @param {number} [options.headersCount] Number of file headers to preallocate
+     * @param {number} [options.cryptoBufferSize] Encrypted read/write portion in bytes
+     * @param {number} [options.blockCacheSize] Block header cache budget in bytes, 0 is unlimited
+     * @param {number} [options.cryptoThreads] Extra crypto threads, -1 for one per core
+     * @param {number} [options.cryptoThreshold] Size below which crypto runs in the calling thread
+     * @param {boolean} [options.cryptoStreaming] Overlap reading and decryption of large reads
+     * @param {string} [options.pathsMode] File path decryption on open: 'Eager' (default), 'Lazy'
+     *     (on lookup) or 'Background' (on lookup and in a background thread)
      */
     constructor(options) {
         check.assert.assigned(options, '"options" is required argument');
@@ -28,7 +39,21 @@ class AggregionBundle {
         this._closed = false;
         let {path} = options;
         let mode = options.readonly ? ['Read'] : ['Read', 'Write', 'OpenAlways'];
-        this._bundle = new Addon.Bundle(path, mode);
+        if (options.stream !== undefined) {
+            check.assert(['File', 'Mapped', 'Positional'].indexOf(options.stream) >= 0,
+                '"options.stream" should be one of "File", "Mapped", "Positional"');
+            if (options.stream !== 'File') {
+                mode.push(options.stream);
+            }
+        }
+        let tuning = {};
+        for (let key of ['lockMode', 'pageCacheSize', 'headersCount', 'cryptoBufferSize',
+            'blockCacheSize', 'cryptoThreads', 'cryptoThreshold', 'cryptoStreaming', 'pathsMode']) {
+            if (options[key] !== undefined) {
+                tuning[key] = options[key];
+            }
+        }
+        this._bundle = new Addon.Bundle(path, mode, tuning);
     }
 
     /**
@@ -94,6 +119,165 @@ class AggregionBundle {
         return Promise.resolve(this._openFile(path, true));
     }
 
+    /**
+     * Creates many files at once, existing files are opened
+     * @param {string[]} paths Paths to the files in the bundle
+     * @return {Promise.<number[]>} File descriptors in the order of paths
+     */
+    createFiles(paths) {
+        this._checkNotClosed();
+        check.assert.array.of.nonEmptyString(paths, '"paths" should be an array of non-empty strings');
+        let {_bundle: bundle} = this;
+        let fds = bundle.FilesCreate(paths);
+        let failed = fds.indexOf(-1);
+        if (failed >= 0) {
+            return Promise.reject(new Error(`Failed to create file "${paths[failed]}"`));
+        }
+        return Promise.resolve(fds);
+    }
+
+    /**
+     * Imports all files of a directory tree into the bundle. Files are read by a pool of
+     * native threads and written one after another, existing files are overwritten
+     * @param {string} rootPath Directory to import
+     * @param {object} [options]
+     * @param {string} [options.prefix] Prepended as is to the relative paths ('/' separated)
+     * @param {number} [options.threads] Reader threads, 0 (default) for one per core
+     * @param {number} [options.chunkSize] Read portion in bytes
+     * @param {number} [options.queueSize] Limit of read but not yet written data in bytes
+     * @return {Promise.<number>} Number of imported files
+     */
+    importDirectory(rootPath, options) {
+        this._checkNotClosed();
+        check.assert.nonEmptyString(rootPath, '"rootPath" should be non-empty string');
+        let native = {};
+        if (options !== undefined) {
+            check.assert.object(options, '"options" should be an object');
+            if (options.prefix !== undefined) {
+                check.assert.string(options.prefix, '"options.prefix" should be a string');
+            }
+            for (let key of ['prefix', 'threads', 'chunkSize', 'queueSize']) {
+                if (options[key] !== undefined) {
+                    native[key] = options[key];
+                }
+            }
+        }
+        let {_bundle: bundle} = this;
+        let def = Q.defer();
+        bundle.ImportDirectory(rootPath, native, (err, count) => {
+            if (err) {
+                def.reject(new Error(err));
+            } else {
+                def.resolve(count);
+            }
+        });
+        return def.promise;
+    }
+
+    /**
+     * Extracts all files of the bundle into a directory. Data is read in the order it lies in
+     * the bundle with large sequential reads and written by a pool of native threads
+     * @param {string} destDir Destination directory, created if missing
+     * @param {object} [options]
+     * @param {number} [options.threads] Writer threads, 0 (default) for one per core
+     * @param {number} [options.runSize] Largest sequential read in bytes
+     * @param {number} [options.queueSize] Limit of read but not yet written data in bytes
+     * @return {Promise.<number>} Number of extracted files
+     */
+    extract(destDir, options) {
+        this._checkNotClosed();
+        check.assert.nonEmptyString(destDir, '"destDir" should be non-empty string');
+        let native = {};
+        if (options !== undefined) {
+            check.assert.object(options, '"options" should be an object');
+            for (let key of ['threads', 'runSize', 'queueSize']) {
+                if (options[key] !== undefined) {
+                    native[key] = options[key];
+                }
+            }
+        }
+        let {_bundle: bundle} = this;
+        let def = Q.defer();
+        bundle.Extract(destDir, native, (err, count) => {
+            if (err) {
+                def.reject(new Error(err));
+            } else {
+                def.resolve(count);
+            }
+        });
+        return def.promise;
+    }
+
+    /**
+     * Compacts the bundle without closing it. Blocks from the end of the bundle and fragmented files
+     * are moved into free space closer to the start a few megabytes at a time and the free tail is
+     * cut off. Reads and writes go on between the steps
+     * @param {object} [options]
+     * @param {number} [options.stepSize] Bytes moved per step under the bundle lock
+     * @param {number} [options.bytesPerSecond] Limit of moved bytes per second, 0 (default) for none
+     * @param {number} [options.maxBytes] Limit of moved bytes per call, 0 (default) for none
+     * @return {Promise.<number>} Number of bytes the bundle shrank by
+     */
+    compact(options) {
+        this._checkNotClosed();
+        let native = {};
+        if (options !== undefined) {
+            check.assert.object(options, '"options" should be an object');
+            for (let key of ['stepSize', 'bytesPerSecond', 'maxBytes']) {
+                if (options[key] !== undefined) {
+                    native[key] = options[key];
+                }
+            }
+        }
+        let {_bundle: bundle} = this;
+        let def = Q.defer();
+        bundle.Compact(native, (err, reclaimed) => {
+            if (err) {
+                def.reject(new Error(err));
+            } else {
+                def.resolve(reclaimed);
+            }
+        });
+        return def.promise;
+    }
+
+    /**
+     * Returns space accounting of the bundle. Dead bytes are free space inside the bundle left by deleted
+     * and truncated files, tail bytes are the part of it at the end of the bundle file
+     * @return {{size: number, liveBytes: number, deadBytes: number, tailBytes: number, deadRatio: number}}
+     */
+    getStats() {
+        this._checkNotClosed();
+        let {_bundle: bundle} = this;
+        let stats = bundle.SpaceStats();
+        stats.deadRatio = stats.size > 0 ? stats.deadBytes / stats.size : 0;
+        return stats;
+    }
+
+    /**
+     * Enables compaction in a background thread once dead space reaches the given share of the bundle.
+     * Works until the bundle is closed, close waits for the current compaction step only
+     * @param {object} options
+     * @param {number} options.deadRatio Share of dead space to start at (0..1), 0 disables
+     * @param {number} [options.minDeadBytes] Growth of dead space since the last run, 4 MB by default
+     * @param {number} [options.stepSize] See compact()
+     * @param {number} [options.bytesPerSecond] See compact()
+     * @param {number} [options.maxBytes] See compact()
+     */
+    setAutoCompact(options) {
+        this._checkNotClosed();
+        check.assert.object(options, '"options" should be an object');
+        check.assert.number(options.deadRatio, '"deadRatio" should be a number');
+        let native = {};
+        for (let key of ['stepSize', 'bytesPerSecond', 'maxBytes']) {
+            if (options[key] !== undefined) {
+                native[key] = options[key];
+            }
+        }
+        let {_bundle: bundle} = this;
+        bundle.AutoCompactSet(options.deadRatio, options.minDeadBytes || 0, native);
+    }
+
     /**
      * Opens an existent file
      * @param {string} path Path to the file in the bundle
@@ -172,6 +356,35 @@ class AggregionBundle {
         return def.promise;
     }
 
+    /**
+     * Reads a block of data from the given position of the file. Does not move the file position
+     * The buffer is shorter than size near the end of file and empty past it
+     * @param {number} fd File descriptor
+     * @param {number} position Position in file to read from
+     * @param {number} size Size of block to read
+     * @return {Promise.<Buffer>} Block data
+     */
+    readFileRange(fd, position, size) {
+        this._checkNotClosed();
+        check.assert.assigned(fd, '"fd" is required argument');
+        check.assert.assigned(position, '"position" is required argument');
+        check.assert.integer(position, '"position" should be integer');
+        check.assert.greaterOrEqual(position, 0, '"position" should be greater or equal to 0');
+        check.assert.assigned(size, '"size" is required argument');
+        check.assert.integer(size, '"size" should be integer');
+        check.assert.greaterOrEqual(size, 0, '"size" should be greater or equal to 0');
+        let {_bundle: bundle} = this;
+        let def = Q.defer();
+        bundle.FileReadAt(fd, position, size, (err, data) => {
+            if (err) {
+                def.reject(new Error(err));
+            } else {
+                def.resolve(data);
+            }
+        });
+        return def.promise;
+    }
+
     /**
      * Reads attributes data from file
      * @param {number} fd File descriptor
@@ -404,6 +404,203 @@ describe('AggregionBundle', () => {
         });
     });
 
+    describe('#readFileRange', () => {
+        it('should read file block from position without moving file position', (done) => {
+            let tempPath = temp.path() + '.agb';
+            let bundle = new AggregionBundle({
+                path: tempPath
+            });
+            const filePath = 'dir1/dir2/file.dat';
+            const data = new Buffer('1234567890', 'ascii');
+            const expectedData = new Buffer('678', 'ascii');
+            let fd2;
+            bundle
+                .createFile(filePath)
+                .then((fd) => {
+                    return bundle.writeFileBlock(fd, data);
+                })
+                .then(() => {
+                    fd2 = bundle.openFile(filePath);
+                    return bundle.readFileRange(fd2, 5, expectedData.length);
+                })
+                .then((readData) => {
+                    expectedData.compare(readData).should.equal(0);
+                    return bundle.readFileBlock(fd2, data.length);
+                })
+                .then((readData) => {
+                    data.compare(readData).should.equal(0);
+                    return bundle.readFileRange(fd2, 8, 4);
+                })
+                .then((readData) => {
+                    readData.length.should.equal(2);
+                    return bundle.readFileRange(fd2, 20, 4);
+                })
+                .then((readData) => {
+                    readData.length.should.equal(0);
+                    bundle.close();
+                })
+                .catch(done)
+                .then(() => {
+                    fs.unlinkSync(tempPath);
+                    done();
+                });
+        });
+    });
+
+    describe('#importDirectory', () => {
+        it('should import all files of the directory tree', (done) => {
+            let tempPath = temp.path() + '.agb';
+            let rootPath = temp.path();
+            const files = {
+                'a.dat': crypto.randomBytes(100),
+                'dir1/b.dat': crypto.randomBytes(70000),
+                'dir1/dir2/c.dat': new Buffer(0)
+            };
+            Object.keys(files).forEach((name) => {
+                fsExtra.outputFileSync(path.join(rootPath, name), files[name]);
+            });
+            let bundle = new AggregionBundle({
+                path: tempPath
+            });
+            bundle
+                .importDirectory(rootPath, {prefix: 'root/', threads: 2})
+                .then((count) => {
+                    count.should.equal(3);
+                    return bundle.getFiles();
+                })
+                .then((names) => {
+                    names.sort().should.deep.equal(Object.keys(files).map((name) => 'root/' + name).sort());
+                    let fd = bundle.openFile('root/dir1/b.dat');
+                    return bundle.readFileBlock(fd, files['dir1/b.dat'].length);
+                })
+                .then((readData) => {
+                    files['dir1/b.dat'].compare(readData).should.equal(0);
+                    bundle.close();
+                })
+                .catch(done)
+                .then(() => {
+                    fs.unlinkSync(tempPath);
+                    fsExtra.removeSync(rootPath);
+                    done();
+                });
+        });
+    });
+
+    describe('#extract', () => {
+        it('should extract all files of the bundle into a directory', (done) => {
+            let tempPath = temp.path() + '.agb';
+            let rootPath = temp.path();
+            let destPath = temp.path();
+            const files = {
+                'a.dat': crypto.randomBytes(100),
+                'dir1/b.dat': crypto.randomBytes(70000),
+                'dir1/dir2/c.dat': new Buffer(0)
+            };
+            Object.keys(files).forEach((name) => {
+                fsExtra.outputFileSync(path.join(rootPath, name), files[name]);
+            });
+            let bundle = new AggregionBundle({
+                path: tempPath
+            });
+            bundle
+                .importDirectory(rootPath, {threads: 2})
+                .then(() => bundle.extract(destPath, {threads: 2}))
+                .then((count) => {
+                    count.should.equal(3);
+                    Object.keys(files).forEach((name) => {
+                        files[name].compare(fs.readFileSync(path.join(destPath, name))).should.equal(0);
+                    });
+                    bundle.close();
+                })
+                .catch(done)
+                .then(() => {
+                    fs.unlinkSync(tempPath);
+                    fsExtra.removeSync(rootPath);
+                    fsExtra.removeSync(destPath);
+                    done();
+                });
+        });
+    });
+
+    describe('#compact', () => {
+        it('should shrink the bundle after files are deleted', (done) => {
+            let tempPath = temp.path() + '.agb';
+            let rootPath = temp.path();
+            const files = {
+                'a.dat': crypto.randomBytes(300000),
+                'b.dat': crypto.randomBytes(1000),
+                'c.dat': crypto.randomBytes(300000)
+            };
+            Object.keys(files).forEach((name) => {
+                fsExtra.outputFileSync(path.join(rootPath, name), files[name]);
+            });
+            let bundle = new AggregionBundle({
+                path: tempPath
+            });
+            let sizeBefore = 0;
+            bundle
+                .importDirectory(rootPath)
+                .then(() => {
+                    bundle.deleteFile('a.dat');
+                    sizeBefore = fs.statSync(tempPath).size;
+                    return bundle.compact({stepSize: 65536});
+                })
+                .then((reclaimed) => {
+                    reclaimed.should.be.above(0);
+                    fs.statSync(tempPath).size.should.equal(sizeBefore - reclaimed);
+                    let fd = bundle.openFile('c.dat');
+                    return bundle.readFileBlock(fd, files['c.dat'].length);
+                })
+                .then((data) => {
+                    files['c.dat'].compare(data).should.equal(0);
+                    bundle.close();
+                })
+                .catch(done)
+                .then(() => {
+                    fs.unlinkSync(tempPath);
+                    fsExtra.removeSync(rootPath);
+                    done();
+                });
+        });
+    });
+
+    describe('#getStats', () => {
+        it('should count dead space of deleted files', (done) => {
+            let tempPath = temp.path() + '.agb';
+            let rootPath = temp.path();
+            const files = {
+                'a.dat': crypto.randomBytes(200000),
+                'b.dat': crypto.randomBytes(1000)
+            };
+            Object.keys(files).forEach((name) => {
+                fsExtra.outputFileSync(path.join(rootPath, name), files[name]);
+            });
+            let bundle = new AggregionBundle({
+                path: tempPath
+            });
+            bundle
+                .importDirectory(rootPath)
+                .then(() => {
+                    let before = bundle.getStats();
+                    before.deadBytes.should.equal(0);
+                    before.liveBytes.should.equal(before.size);
+                    bundle.deleteFile('a.dat');
+                    let after = bundle.getStats();
+                    after.deadBytes.should.not.be.below(200000);
+                    (after.liveBytes + after.deadBytes).should.equal(after.size);
+                    after.deadRatio.should.be.above(0.9);
+                    bundle.setAutoCompact({deadRatio: 0});
+                    bundle.close();
+                })
+                .catch(done)
+                .then(() => {
+                    fs.unlinkSync(tempPath);
+                    fsExtra.removeSync(rootPath);
+                    done();
+                });
+        });
+    });
+
     describe('#readFilePropertiesData', () => {
         it('should read file properties', (done) => {
             let bundle = createBundle();
@@ -5,14 +5,17 @@ const check = require('check-types');
 const Bundle = require('../index');
 
 cli.parse({
-    path: ['p', 'Relative path to the file in the bundle', 'string']
-}, ['props', 'info', 'fileprops', 'file']);
+    path: ['p', 'Relative path to the file in the bundle (path prefix for import)', 'string'],
+    dir: ['d', 'Directory to import from or extract to (import, extract commands)', 'path'],
+    threads: ['t', 'Worker threads for import and extract, 0 for one per core', 'int', 0],
+    rate: ['r', 'Compaction speed limit in bytes per second, 0 for none', 'int', 0]
+}, ['props', 'info', 'fileprops', 'file', 'import', 'extract', 'compact', 'stats']);
 
 cli.main((args, options) => {
     try {
         check.assert.hasLength(args, 1, 'You must specify one input file');
-        let bundle = new Bundle({path: args[0], readonly: true});
         let command = cli.command;
+        let bundle = new Bundle({path: args[0], readonly: command !== 'import' && command !== 'compact'});
         let promise;
         switch (command) {
             case 'props':
@@ -32,12 +35,44 @@ cli.main((args, options) => {
                 let size = bundle.getFileSize(options.path);
                 promise = bundle.readFileBlock(bundle.openFile(options.path), size);
                 break;
+            case 'import':
+                check.assert.assigned(options.dir, 'You must specify directory to import (-d option)');
+                check.assert.nonEmptyString(options.dir, 'Directory should be non-empty string');
+                promise = bundle.importDirectory(options.dir, {
+                    prefix: options.path || '',
+                    threads: options.threads
+                }).then((count) => {
+                    bundle.close();
+                    return `${count} files imported`;
+                });
+                break;
+            case 'extract':
+                check.assert.assigned(options.dir, 'You must specify destination directory (-d option)');
+                check.assert.nonEmptyString(options.dir, 'Directory should be non-empty string');
+                promise = bundle.extract(options.dir, {
+                    threads: options.threads
+                }).then((count) => {
+                    bundle.close();
+                    return `${count} files extracted`;
+                });
+                break;
+            case 'stats':
+                promise = Promise.resolve(JSON.stringify(bundle.getStats()));
+                break;
+            case 'compact':
+                promise = bundle.compact({
+                    bytesPerSecond: options.rate
+                }).then((reclaimed) => {
+                    bundle.close();
+                    return `${reclaimed} bytes reclaimed`;
+                });
+                break;
             default:
                 throw new Error('Unknown command');
         }
         promise
-            .then((buffer) => {
-                console.log(buffer.toString('hex'));
+            .then((result) => {
+                console.log(typeof result === 'string' ? result : result.toString('hex'));
             })
             .catch(cli.fatal);
     } catch (e) {